@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+
+//Stores a value where the compiler can't prove it is unused, so that the benchmarked code isn't optimized away.
+template<class T>
+inline void doNotOptimize(const T& value) {
+    static volatile T sink;
+    sink = value;
+    (void)sink;
+}
+
+//Median, minimum and median absolute deviation of a set of timings.
+struct BenchStats {
+    double median = 0;
+    double min = 0;
+    double mad = 0;
+};
+
+inline BenchStats benchStats(std::vector<double> samples) {
+    BenchStats stats;
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    stats.min = samples.front();
+    size_t mid = samples.size()/2;
+    stats.median = (samples.size() % 2) ? samples[mid] : (samples[mid - 1] + samples[mid])/2;
+    std::vector<double> deviations;
+    for (double sample : samples) {
+        deviations.push_back(std::fabs(sample - stats.median));
+    }
+    std::sort(deviations.begin(), deviations.end());
+    stats.mad = (deviations.size() % 2) ? deviations[mid] : (deviations[mid - 1] + deviations[mid])/2;
+    return stats;
+}
+
+struct BenchResult {
+    std::string name;
+    std::vector<std::pair<std::string, double> > params;
+    size_t ops; //Operations per repetition
+    size_t repetitions;
+    BenchStats ns_per_op;
+
+    //name/param=value/... identifies the same benchmark across runs
+    std::string id() const {
+        std::stringstream ss;
+        ss << name;
+        for (const std::pair<std::string, double>& param : params) {
+            ss << '/' << param.first << '=' << param.second;
+        }
+        return ss.str();
+    }
+};
+
+/*Times fn, which performs ops operations per call, once to warm up and then repetitions times. The statistics are over the
+  repetitions, in nanoseconds per operation.*/
+template<class Functor>
+BenchResult runBenchmark(const std::string& name, const std::vector<std::pair<std::string, double> >& params, size_t ops,
+ size_t repetitions, Functor fn) {
+    BenchResult result;
+    result.name = name;
+    result.params = params;
+    result.ops = ops;
+    result.repetitions = repetitions;
+    fn();
+    std::vector<double> samples;
+    for (size_t rep = 0; rep < repetitions; rep++) {
+        std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+        fn();
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(elapsed/ops);
+    }
+    result.ns_per_op = benchStats(samples);
+    return result;
+}
+
+//Collects the results of a run, prints them as they come in and writes them as JSON.
+class BenchReport {
+    public:
+        std::vector<BenchResult> results;
+
+        void add(const BenchResult& result) {
+            results.push_back(result);
+            std::cout << result.id() << ": " << result.ns_per_op.median << " ns/op (min " << result.ns_per_op.min << ", mad "
+            << result.ns_per_op.mad << ")" << std::endl;
+        }
+
+        void writeJSON(std::ostream& out) const {
+            out << "{\n  \"timestamp\": " << time(0) << ",\n  \"benchmarks\": [";
+            for (size_t i = 0; i < results.size(); i++) {
+                const BenchResult& result = results[i];
+                out << (i ? ",\n" : "\n") << "    {\"id\": \"" << result.id() << "\", \"name\": \"" << result.name << "\", \"params\": {";
+                for (size_t j = 0; j < result.params.size(); j++) {
+                    out << (j ? ", " : "") << '"' << result.params[j].first << "\": " << result.params[j].second;
+                }
+                out << "}, \"ops\": " << result.ops << ", \"repetitions\": " << result.repetitions
+                << ", \"ns_per_op\": {\"median\": " << result.ns_per_op.median << ", \"min\": " << result.ns_per_op.min
+                << ", \"mad\": " << result.ns_per_op.mad << "}}";
+            }
+            out << "\n  ]\n}\n";
+        }
+
+        void writeJSON(const std::string& path) const {
+            std::ofstream out(path);
+            if (out.fail()) {
+                std::cerr << "Failed to open file " << path << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            writeJSON(out);
+        }
+};
@@ -0,0 +1,76 @@
+#include "synthetic_arpa_impl.hh"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+//Writes a synthetic backoff language model in ARPA format and optionally a query workload of sentences drawn from it.
+
+int main(int argc, char* argv[]) {
+    SyntheticArpaOptions options;
+    std::string workload_path;
+    size_t num_sentences = 10000;
+    double mean_length = 25;
+    double hit_rate = 0.8;
+    int arg = 1;
+    while (arg + 1 < argc && std::string(argv[arg]).compare(0, 2, "--") == 0) {
+        std::string option = argv[arg];
+        std::string value = argv[arg + 1];
+        if (option == "--order") {
+            options.max_order = atoi(value.c_str());
+        } else if (option == "--vocab") {
+            options.vocab_size = std::stoul(value);
+        } else if (option == "--counts") {
+            //Comma separated, one per order from bigrams up
+            options.counts.clear();
+            std::stringstream ss(value);
+            std::string count;
+            while (std::getline(ss, count, ',')) {
+                options.counts.push_back(std::stoull(count));
+            }
+        } else if (option == "--zipf") {
+            options.zipf = atof(value.c_str());
+        } else if (option == "--seed") {
+            options.seed = std::stoull(value);
+        } else if (option == "--workload") {
+            workload_path = value;
+        } else if (option == "--sentences") {
+            num_sentences = std::stoull(value);
+        } else if (option == "--length") {
+            mean_length = atof(value.c_str());
+        } else if (option == "--hit-rate") {
+            hit_rate = atof(value.c_str());
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        arg += 2;
+    }
+    if (arg + 1 != argc || options.max_order < 1 || options.max_order > 9 || options.vocab_size == 0) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " [--order 5] [--vocab 10000] [--counts 100000,200000,200000,200000] [--zipf 1.0] [--seed 1]"
+        << " [--workload path_to_sentences [--sentences 10000] [--length 25] [--hit-rate 0.8]] output_arpa_file" << std::endl;
+        std::cerr << "--counts gives the number of ngrams of every order from bigrams up. The order is at most 9, which is all the ARPA reader takes." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    SyntheticArpa arpa(options);
+    std::ofstream out(argv[arg]);
+    if (out.fail()) {
+        std::cerr << "Failed to open file " << argv[arg] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    arpa.write(out);
+    out.close();
+    for (unsigned short n = 1; n <= options.max_order; n++) {
+        std::cerr << n << "-grams: " << arpa.count(n) << std::endl;
+    }
+
+    if (!workload_path.empty()) {
+        std::ofstream workload(workload_path);
+        if (workload.fail()) {
+            std::cerr << "Failed to open file " << workload_path << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        arpa.sampleSentences(num_sentences, mean_length, hit_rate, workload);
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+//#define ARPA_TESTFILEPATH is defined by cmake
+#include "micro_benchmarks.hh"
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    config.arpa = ARPA_TESTFILEPATH;
+    std::string json_path;
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--repetitions" && i + 1 < argc) {
+            config.repetitions = std::max(atoi(argv[++i]), 1);
+        } else if (arg == "--arpa" && i + 1 < argc) {
+            config.arpa = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--quick") {
+            config.node_sizes = {7, 31, 63};
+            config.tree_sizes = {100, 100000};
+            config.lookups = 1 << 16;
+        } else {
+            std::cerr << "Usage:" << std::endl << argv[0] << " [--json output_file] [--repetitions 5] [--arpa path_to_arpa_file] [--filter benchmark_name] [--quick]" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    BenchReport report;
+    runMicroBenchmarks(config, report, filter);
+    if (!json_path.empty()) {
+        report.writeJSON(json_path);
+    }
+    return 0;
+}
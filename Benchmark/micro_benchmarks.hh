@@ -0,0 +1,198 @@
+#pragma once
+#include "bench_common.hh"
+#include "trie_v2_impl.hh"
+#include "lm_impl.hh"
+#include <random>
+#include <set>
+
+/*Microbenchmarks of the Btree v2 and trie primitives: linearSearch, searchNode, searchBtree, array2balancedBtree, searchTrie and
+  ArpaReader::readline, over node sizes, tree sizes, payload kinds (lastNgram) and hit ratios. Btrees hold the even vocabIDs 2..2n,
+  so hits are even keys and misses the odd keys between them.*/
+
+//Inner nodes of more than about 120 entries overflow their unsigned short child offsets, so that's as far as node sizes go.
+struct BenchConfig {
+    std::vector<unsigned short> node_sizes = {7, 15, 31, 63};
+    std::vector<unsigned int> tree_sizes = {100, 10000, 1000000};
+    std::vector<double> hit_ratios = {1, 0.5, 0};
+    size_t lookups = 1 << 20; //Per repetition
+    size_t repetitions = 5;
+    std::string arpa;
+};
+
+inline std::vector<Entry_v2> evenEntries(unsigned int num_entries) {
+    std::vector<Entry_v2> entries(num_entries);
+    for (unsigned int i = 0; i < num_entries; i++) {
+        entries[i].vocabID = 2*i + 2;
+        entries[i].prob = -1.0f*i;
+        entries[i].backoff = -0.5f*i;
+    }
+    return entries;
+}
+
+inline std::vector<unsigned int> lookupKeys(unsigned int num_entries, double hit_ratio, size_t num_keys, std::mt19937& rng) {
+    std::uniform_int_distribution<unsigned int> entry(0, num_entries - 1);
+    std::bernoulli_distribution hit(hit_ratio);
+    std::vector<unsigned int> keys(num_keys);
+    for (unsigned int& key : keys) {
+        key = 2*entry(rng) + (hit(rng) ? 2 : 1);
+    }
+    return keys;
+}
+
+inline void benchLinearSearch(const BenchConfig& config, BenchReport& report, std::mt19937& rng) {
+    for (unsigned short node_size : config.node_sizes) {
+        std::vector<Entry_v2> entries = evenEntries(node_size);
+        std::vector<unsigned int> vocabIDs;
+        for (Entry_v2& entry : entries) {
+            vocabIDs.push_back(entry.vocabID);
+        }
+        for (double hit_ratio : config.hit_ratios) {
+            std::vector<unsigned int> keys = lookupKeys(node_size, hit_ratio, config.lookups, rng);
+            report.add(runBenchmark("linearSearch", {{"node_size", node_size}, {"hit_ratio", hit_ratio}}, keys.size(), config.repetitions, [&]() {
+                unsigned int positions = 0;
+                for (unsigned int key : keys) {
+                    positions += linearSearch(vocabIDs.data(), node_size, key).first;
+                }
+                doNotOptimize(positions);
+            }));
+        }
+    }
+}
+
+inline void benchBtree(const BenchConfig& config, BenchReport& report, std::mt19937& rng) {
+    for (unsigned short node_size : config.node_sizes) {
+        for (unsigned int tree_size : config.tree_sizes) {
+            for (int lastNgram = 0; lastNgram < 2; lastNgram++) {
+                std::vector<std::pair<std::string, double> > params = {{"node_size", node_size}, {"tree_size", tree_size}, {"last_ngram", lastNgram}};
+
+                //Construction, per entry
+                std::vector<unsigned char> byte_arr;
+                std::vector<Entry_v2> entries = evenEntries(tree_size);
+                report.add(runBenchmark("array2balancedBtree", params, tree_size, config.repetitions, [&]() {
+                    std::vector<Entry_v2> array = entries;
+                    byte_arr.clear();
+                    array2balancedBtree(byte_arr, array, node_size, lastNgram);
+                    doNotOptimize(byte_arr.size());
+                }));
+
+                unsigned short payload_size = lastNgram ? 4 : 12;
+                unsigned int root_size;
+                std::memcpy(&root_size, &byte_arr[0], sizeof(root_size));
+                for (double hit_ratio : config.hit_ratios) {
+                    std::vector<std::pair<std::string, double> > lookup_params = params;
+                    lookup_params.push_back(std::make_pair("hit_ratio", hit_ratio));
+                    std::vector<unsigned int> keys = lookupKeys(tree_size, hit_ratio, config.lookups, rng);
+                    //The root node only
+                    report.add(runBenchmark("searchNode", lookup_params, keys.size(), config.repetitions, [&]() {
+                        unsigned int found = 0;
+                        for (unsigned int key : keys) {
+                            found += searchNode(byte_arr, 4, root_size, key, payload_size, node_size).found_idx;
+                        }
+                        doNotOptimize(found);
+                    }));
+                    report.add(runBenchmark("searchBtree", lookup_params, keys.size(), config.repetitions, [&]() {
+                        float probs = 0;
+                        for (unsigned int key : keys) {
+                            probs += searchBtree(byte_arr, 0, node_size, key, lastNgram).prob;
+                        }
+                        doNotOptimize(probs);
+                    }));
+                }
+            }
+        }
+    }
+}
+
+/*Every ngram of the model for hits. Misses are ngrams of two or more words whose second word is replaced so that the first two
+  make an unseen bigram, so the walk stops at the first Btree instead of descending to the last word.*/
+inline void benchTrie(const BenchConfig& config, BenchReport& report, std::mt19937& rng) {
+    std::vector<std::vector<unsigned int> > hits;
+    std::vector<bool> hit_is_last;
+    std::vector<size_t> longer; //Hits of two or more words
+    std::set<std::pair<unsigned int, unsigned int> > bigrams;
+    ArpaReader infile(config.arpa);
+    processed_line text = infile.readline();
+    while (!text.filefinished) {
+        if (text.ngrams.size() > 1) {
+            longer.push_back(hits.size());
+            bigrams.insert(std::make_pair(text.ngrams[0], text.ngrams[1]));
+        }
+        hits.push_back(text.ngrams);
+        hit_is_last.push_back(text.ngram_size == infile.max_ngrams);
+        text = infile.readline();
+    }
+    unsigned int vocab_size = infile.encode_map.size();
+
+    for (unsigned short node_size : config.node_sizes) {
+        LM lm;
+        createTrie(config.arpa, lm, node_size);
+        for (double hit_ratio : config.hit_ratios) {
+            std::bernoulli_distribution hit(hit_ratio);
+            std::uniform_int_distribution<size_t> line(0, hits.size() - 1);
+            std::uniform_int_distribution<size_t> longer_line(0, longer.size() - 1);
+            std::uniform_int_distribution<unsigned int> word(1, vocab_size);
+            size_t num_queries = std::min(config.lookups, (size_t)1 << 18);
+            std::vector<std::vector<unsigned int> > queries;
+            std::vector<bool> is_last;
+            for (size_t i = 0; i < num_queries; i++) {
+                if (hit(rng) || longer.empty()) {
+                    size_t picked = line(rng);
+                    queries.push_back(hits[picked]);
+                    is_last.push_back(hit_is_last[picked]);
+                    continue;
+                }
+                size_t picked = longer[longer_line(rng)];
+                queries.push_back(hits[picked]);
+                is_last.push_back(hit_is_last[picked]);
+                std::vector<unsigned int>& query = queries.back();
+                for (int attempt = 0; attempt < 64 && bigrams.count(std::make_pair(query[0], query[1])); attempt++) {
+                    query[1] = word(rng);
+                }
+            }
+            report.add(runBenchmark("searchTrie", {{"node_size", node_size}, {"hit_ratio", hit_ratio}}, queries.size(), config.repetitions, [&]() {
+                float probs = 0;
+                for (size_t i = 0; i < queries.size(); i++) {
+                    probs += searchTrie(lm.trieByteArray, lm.first_lvl, queries[i], node_size, is_last[i]).prob;
+                }
+                doNotOptimize(probs);
+            }));
+        }
+    }
+}
+
+inline void benchArpaReader(const BenchConfig& config, BenchReport& report) {
+    size_t num_lines = 0;
+    {
+        ArpaReader infile(config.arpa);
+        while (!infile.readline().filefinished) {
+            num_lines++;
+        }
+    }
+    report.add(runBenchmark("ArpaReader::readline", {}, num_lines, config.repetitions, [&]() {
+        ArpaReader infile(config.arpa);
+        size_t words = 0;
+        processed_line text = infile.readline();
+        while (!text.filefinished) {
+            words += text.ngram_size;
+            text = infile.readline();
+        }
+        doNotOptimize(words);
+    }));
+}
+
+//All the benchmarks, or only those of the named one (and of the ones benchmarked along with it).
+inline void runMicroBenchmarks(const BenchConfig& config, BenchReport& report, const std::string& filter = "") {
+    std::mt19937 rng(1234);
+    if (filter.empty() || filter == "linearSearch") {
+        benchLinearSearch(config, report, rng);
+    }
+    if (filter.empty() || filter == "searchNode" || filter == "searchBtree" || filter == "array2balancedBtree") {
+        benchBtree(config, report, rng);
+    }
+    if (filter.empty() || filter == "searchTrie") {
+        benchTrie(config, report, rng);
+    }
+    if (filter.empty() || filter == "ArpaReader::readline") {
+        benchArpaReader(config, report);
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "bench_common.hh"
+#include <map>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+/*Comparison of a benchmark run against a baseline, both in the JSON format of BenchReport. A benchmark regressed when its median
+  is slower than the baseline median by more than the relative tolerance and also by more than mad_factor times the noise, the
+  larger of the two MADs scaled by 1.4826 to estimate a standard deviation. Either test alone flags noisy or tiny differences.*/
+struct PerfThresholds {
+    double tolerance = 0.15;
+    double mad_factor = 3;
+};
+
+enum class PerfVerdict {Unchanged, Regression, Improvement, Missing};
+
+struct PerfComparison {
+    std::string id;
+    BenchStats baseline;
+    BenchStats current;
+    PerfVerdict verdict;
+
+    double ratio() const {
+        return baseline.median > 0 ? current.median/baseline.median : 0;
+    }
+};
+
+/*Combines repeated runs of the same benchmarks, in the same order, into one result per benchmark whose statistics are over the
+  medians of the runs. Within a run repetitions are back to back and their MAD misses slower drift (frequency scaling, other load),
+  which shows up across runs.*/
+inline BenchReport combineRuns(const std::vector<BenchReport>& runs) {
+    BenchReport combined;
+    for (size_t i = 0; i < runs.front().results.size(); i++) {
+        BenchResult result = runs.front().results[i];
+        std::vector<double> medians;
+        double min = result.ns_per_op.min;
+        for (const BenchReport& run : runs) {
+            medians.push_back(run.results[i].ns_per_op.median);
+            min = std::min(min, run.results[i].ns_per_op.min);
+        }
+        result.repetitions *= runs.size();
+        result.ns_per_op = benchStats(medians);
+        result.ns_per_op.min = min;
+        combined.results.push_back(result);
+    }
+    return combined;
+}
+
+//The ns_per_op statistics of every benchmark of a BenchReport JSON file, by id.
+inline std::map<std::string, BenchStats> readBenchJSON(const std::string& path) {
+    boost::property_tree::ptree tree;
+    boost::property_tree::read_json(path, tree);
+    std::map<std::string, BenchStats> results;
+    for (const boost::property_tree::ptree::value_type& benchmark : tree.get_child("benchmarks")) {
+        BenchStats stats;
+        stats.median = benchmark.second.get<double>("ns_per_op.median");
+        stats.min = benchmark.second.get<double>("ns_per_op.min");
+        stats.mad = benchmark.second.get<double>("ns_per_op.mad");
+        results[benchmark.second.get<std::string>("id")] = stats;
+    }
+    return results;
+}
+
+inline PerfVerdict perfVerdict(const BenchStats& baseline, const BenchStats& current, const PerfThresholds& thresholds) {
+    double difference = current.median - baseline.median;
+    double noise = thresholds.mad_factor*1.4826*std::max(baseline.mad, current.mad);
+    if (std::fabs(difference) <= noise || std::fabs(difference) <= thresholds.tolerance*baseline.median) {
+        return PerfVerdict::Unchanged;
+    }
+    return difference > 0 ? PerfVerdict::Regression : PerfVerdict::Improvement;
+}
+
+//Benchmarks of the run that the baseline lacks are Missing, benchmarks of the baseline that the run lacks are left out.
+inline std::vector<PerfComparison> compareToBaseline(const std::vector<BenchResult>& results,
+ const std::map<std::string, BenchStats>& baseline, const PerfThresholds& thresholds) {
+    std::vector<PerfComparison> comparisons;
+    for (const BenchResult& result : results) {
+        PerfComparison comparison;
+        comparison.id = result.id();
+        comparison.current = result.ns_per_op;
+        std::map<std::string, BenchStats>::const_iterator base = baseline.find(comparison.id);
+        if (base == baseline.end()) {
+            comparison.verdict = PerfVerdict::Missing;
+        } else {
+            comparison.baseline = base->second;
+            comparison.verdict = perfVerdict(base->second, result.ns_per_op, thresholds);
+        }
+        comparisons.push_back(comparison);
+    }
+    return comparisons;
+}
+
+//Prints every comparison that isn't Unchanged, then a one line summary. Returns the number of regressions.
+inline size_t printComparisons(std::ostream& out, const std::vector<PerfComparison>& comparisons) {
+    size_t counts[4] = {0, 0, 0, 0};
+    for (const PerfComparison& comparison : comparisons) {
+        counts[(int)comparison.verdict]++;
+        if (comparison.verdict == PerfVerdict::Missing) {
+            out << "NEW         " << comparison.id << ": " << comparison.current.median << " ns/op, not in the baseline" << std::endl;
+        } else if (comparison.verdict != PerfVerdict::Unchanged) {
+            out << (comparison.verdict == PerfVerdict::Regression ? "REGRESSION  " : "IMPROVEMENT ") << comparison.id << ": "
+            << comparison.baseline.median << " -> " << comparison.current.median << " ns/op (x" << comparison.ratio() << ", mad "
+            << comparison.baseline.mad << " -> " << comparison.current.mad << ")" << std::endl;
+        }
+    }
+    out << comparisons.size() << " benchmarks: " << counts[(int)PerfVerdict::Regression] << " regressions, "
+    << counts[(int)PerfVerdict::Improvement] << " improvements, " << counts[(int)PerfVerdict::Unchanged] << " unchanged, "
+    << counts[(int)PerfVerdict::Missing] << " not in the baseline" << std::endl;
+    return counts[(int)PerfVerdict::Regression];
+}
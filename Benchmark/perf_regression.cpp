@@ -0,0 +1,165 @@
+//#define ARPA_TESTFILEPATH is defined by cmake
+#include "micro_benchmarks.hh"
+#include "perf_baseline.hh"
+#include "synthetic_arpa_impl.hh"
+#include "cpu_search_impl.hh"
+
+/*Performance regression check: a reduced set of the microbenchmarks, then building, query preparation and CPU scoring of a
+  sentence workload on a synthetic model, for both trie layouts, all of it repeated over a few runs. The results are compared against a baseline written by an earlier
+  run on the same machine (make perf_baseline), and the exit status is nonzero if anything regressed (make perf_check). Timings
+  from another machine mean nothing here, so baselines stay local and only the benchmark set and the thresholds below are shared.*/
+
+struct EndToEndConfig {
+    SyntheticArpaOptions model;
+    size_t num_sentences = 2000;
+    double mean_length = 25;
+    double hit_rate = 0.8;
+    unsigned short node_size = 31;
+    size_t repetitions = 5;
+    size_t build_repetitions = 2; //Building is slow and steady enough for fewer
+};
+
+inline void benchEndToEnd(const EndToEndConfig& config, BenchReport& report) {
+    SyntheticArpa arpa(config.model);
+    std::string path = boost::filesystem::unique_path(boost::filesystem::temp_directory_path() / "perf_check_%%%%%%.arpa").string();
+    std::ofstream out(path);
+    if (out.fail()) {
+        std::cerr << "Failed to open file " << path << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    arpa.write(out);
+    out.close();
+    size_t num_ngrams = 0;
+    for (unsigned short n = 1; n <= config.model.max_order; n++) {
+        num_ngrams += arpa.count(n);
+    }
+
+    std::stringstream workload;
+    arpa.sampleSentences(config.num_sentences, config.mean_length, config.hit_rate, workload);
+    std::vector<std::string> sentences;
+    std::string sentence;
+    while (std::getline(workload, sentence)) {
+        if (sentence != "") {
+            sentences.push_back(sentence);
+        }
+    }
+
+    for (int reversed = 0; reversed < 2; reversed++) {
+        std::vector<std::pair<std::string, double> > params = {{"node_size", config.node_size}, {"reversed", reversed}};
+        auto build = [&](LM& lm) {
+            if (reversed) {
+                createReversedTrie(path, lm, config.node_size);
+            } else {
+                createTrie(path, lm, config.node_size);
+            }
+        };
+        report.add(runBenchmark("e2e/buildTrie", params, num_ngrams, config.build_repetitions, [&]() {
+            LM lm;
+            build(lm);
+            doNotOptimize(lm.trieByteArray.size());
+        }));
+
+        LM lm;
+        build(lm);
+        VocabTable vocab(lm.encode_map);
+        CompactQueries batch;
+        sentences2CompactQueries(sentences, batch, vocab, true);
+        if (!reversed) {
+            report.add(runBenchmark("e2e/sentences2CompactQueries", {}, batch.vocabIDs.size(), config.repetitions, [&]() {
+                CompactQueries prepared;
+                sentences2CompactQueries(sentences, prepared, vocab, true);
+                doNotOptimize(prepared.vocabIDs.size());
+            }));
+        }
+        CPUSearcher searcher(lm);
+        report.add(runBenchmark("e2e/searchCompact", params, batch.numQueries(), config.repetitions, [&]() {
+            std::vector<float> results = searcher.searchCompact(batch);
+            float score = 0;
+            for (float result : results) {
+                score += result;
+            }
+            doNotOptimize(score);
+        }));
+    }
+    boost::filesystem::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig micro;
+    micro.node_sizes = {7, 31, 63};
+    micro.tree_sizes = {100, 100000};
+    micro.hit_ratios = {1, 0};
+    micro.lookups = 1 << 16;
+    micro.repetitions = 5;
+    micro.arpa = ARPA_TESTFILEPATH;
+    EndToEndConfig end_to_end;
+    end_to_end.model.vocab_size = 10000;
+    end_to_end.model.counts = {30000, 50000, 50000, 40000};
+    PerfThresholds thresholds;
+    std::string baseline_path;
+    std::string json_path;
+    bool write_baseline = false;
+    size_t num_runs = 3;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (arg == "--write-baseline") {
+            write_baseline = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--runs" && i + 1 < argc) {
+            num_runs = std::max(atoi(argv[++i]), 1);
+        } else if (arg == "--repetitions" && i + 1 < argc) {
+            micro.repetitions = std::max(atoi(argv[++i]), 1);
+            end_to_end.repetitions = micro.repetitions;
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            thresholds.tolerance = atof(argv[++i]);
+        } else if (arg == "--mad-factor" && i + 1 < argc) {
+            thresholds.mad_factor = atof(argv[++i]);
+        } else {
+            std::cerr << "Usage:" << std::endl << argv[0] << " --baseline baseline_json [--write-baseline] [--json output_file]"
+            << " [--runs 3] [--repetitions 5] [--tolerance 0.15] [--mad-factor 3]" << std::endl;
+            std::cerr << "Compares against the baseline and exits with 1 on a regression, or with --write-baseline replaces it with this run."
+            << " A regression is a median slower than the baseline's by more than the tolerance (relative) and by more than mad-factor"
+            << " scaled median absolute deviations, over the medians of the runs." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    if (baseline_path.empty()) {
+        std::cerr << "No baseline given, see " << argv[0] << " --help" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::map<std::string, BenchStats> baseline;
+    if (!write_baseline) {
+        if (!boost::filesystem::exists(baseline_path)) {
+            std::cerr << "No baseline at " << baseline_path << ". Baselines are per machine and not committed:"
+            << " run make perf_baseline (or " << argv[0] << " --write-baseline) first." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        baseline = readBenchJSON(baseline_path);
+    }
+
+    std::vector<BenchReport> runs(num_runs);
+    for (size_t run = 0; run < num_runs; run++) {
+        std::cout << "Run " << run + 1 << " out of " << num_runs << std::endl;
+        runMicroBenchmarks(micro, runs[run], "linearSearch");
+        runMicroBenchmarks(micro, runs[run], "searchBtree");
+        runMicroBenchmarks(micro, runs[run], "searchTrie");
+        benchEndToEnd(end_to_end, runs[run]);
+    }
+    BenchReport report = combineRuns(runs);
+    if (!json_path.empty()) {
+        report.writeJSON(json_path);
+    }
+
+    if (write_baseline) {
+        report.writeJSON(baseline_path);
+        std::cout << "Wrote the baseline to " << baseline_path << std::endl;
+        return 0;
+    }
+    std::cout << std::endl << "Against the baseline " << baseline_path << ":" << std::endl;
+    size_t regressions = printComparisons(std::cout, compareToBaseline(report.results, baseline, thresholds));
+    return regressions ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <random>
+#include <iostream>
+
+struct SyntheticArpaOptions {
+    unsigned short max_order = 5;
+    unsigned int vocab_size = 10000; //Not counting <unk>, <s> and </s>
+    std::vector<size_t> counts = {100000, 200000, 200000, 200000}; //Ngrams of order 2, 3, ... max_order
+    double zipf = 1.0; //Exponent of the unigram distribution
+    unsigned long long seed = 1;
+};
+
+/*A random backoff language model, the same for the same options and seed. Unigrams follow a Zipf distribution. Every ngram of order
+  n is a lower order ngram extended one word into the past, with the left word picked among those that precede its prefix, so that
+  both the prefix and the suffix of every ngram exist at the order below, as in models estimated by KenLM.
+  Probabilities are interpolated, p(w|h) = a(h) p(w|h') + (1 - a(h)) q(w|h), with q proportional to the unigram probabilities of the
+  children of h, which makes the model normalized with backoff(h) = a(h). Word IDs: 0 is <unk>, 1 <s>, 2 </s> and i + 2 the word "w<i>".
+  Ngrams are kept in flat arrays of n words per ngram of order n, so generating takes about 4*(order + 2) bytes per ngram.*/
+class SyntheticArpa {
+    private:
+        std::mt19937_64 rng;
+        std::vector<double> unigram_cdf; //Over the IDs, for sampling
+        std::vector<double> history_cdf; //Unigrams with <s> in place of </s>
+
+        double uniform();
+        unsigned int sample(const std::vector<double>& cdf);
+        size_t lowerBound(unsigned short order, const unsigned int * key, unsigned short key_size) const;
+        void sortUnique(unsigned short order, std::vector<unsigned int>& words);
+        void generateOrder(unsigned short order, size_t num_ngrams);
+
+    public:
+        SyntheticArpaOptions options;
+        std::vector<std::vector<unsigned int> > ngrams; //ngrams[n - 1] holds n words per ngram, sorted
+        std::vector<std::vector<float> > probs; //log10
+        std::vector<std::vector<float> > backoffs; //log10, 0 at the max order
+
+        explicit SyntheticArpa(const SyntheticArpaOptions& options);
+        size_t count(unsigned short order) const {
+            return ngrams[order - 1].size()/order;
+        }
+        std::string word(unsigned int id) const;
+        void write(std::ostream& out) const;
+        //Sentences (without markers) that follow an ngram of the model with probability hit_rate and a random word otherwise.
+        void sampleSentences(size_t num_sentences, double mean_length, double hit_rate, std::ostream& out);
+};
@@ -0,0 +1,241 @@
+#pragma once
+#include "synthetic_arpa.hh"
+#include <algorithm>
+#include <cmath>
+
+inline SyntheticArpa::SyntheticArpa(const SyntheticArpaOptions& options_) : rng(options_.seed), options(options_) {
+    unsigned int num_words = options.vocab_size + 3;
+    ngrams.resize(options.max_order);
+    probs.resize(options.max_order);
+    backoffs.resize(options.max_order);
+
+    //Unigrams: a little mass for <unk>, a fixed sentence end rate and a Zipf distribution over the rest. <s> is never predicted.
+    std::vector<double> unigram(num_words, 0);
+    double harmonic = 0;
+    for (unsigned int rank = 1; rank <= options.vocab_size; rank++) {
+        harmonic += std::pow(rank, -options.zipf);
+    }
+    unigram[0] = 0.001;
+    unigram[2] = 0.04;
+    for (unsigned int rank = 1; rank <= options.vocab_size; rank++) {
+        unigram[rank + 2] = (1 - unigram[0] - unigram[2])*std::pow(rank, -options.zipf)/harmonic;
+    }
+    unigram_cdf.resize(num_words);
+    history_cdf.resize(num_words);
+    double predicted = 0;
+    double history = 0;
+    for (unsigned int id = 0; id < num_words; id++) {
+        predicted += (id >= 2) ? unigram[id] : 0;
+        history += (id >= 3) ? unigram[id] : ((id == 1) ? unigram[2] : 0);
+        unigram_cdf[id] = predicted;
+        history_cdf[id] = history;
+    }
+    for (unsigned int id = 0; id < num_words; id++) {
+        ngrams[0].push_back(id);
+        probs[0].push_back(id == 1 ? -99 : std::log10(unigram[id]));
+    }
+    backoffs[0].assign(num_words, 0);
+
+    for (unsigned short n = 2; n <= options.max_order; n++) {
+        generateOrder(n, n - 2 < (int)options.counts.size() ? options.counts[n - 2] : 0);
+        backoffs[n - 1].assign(count(n), 0);
+
+        //Children of the same context are next to each other. The backoff of the context is its interpolation weight.
+        size_t num_ngrams = count(n);
+        probs[n - 1].resize(num_ngrams);
+        size_t group_start = 0;
+        while (group_start < num_ngrams) {
+            const unsigned int * context = &ngrams[n - 1][group_start*n];
+            size_t group_end = group_start;
+            double children_mass = 0;
+            while (group_end < num_ngrams && std::equal(context, context + n - 1, &ngrams[n - 1][group_end*n])) {
+                children_mass += unigram[ngrams[n - 1][group_end*n + n - 1]];
+                group_end++;
+            }
+            double weight = 0.3 + 0.4*uniform();
+            backoffs[n - 2][lowerBound(n - 1, context, n - 1)] = std::log10(weight);
+            for (size_t i = group_start; i < group_end; i++) {
+                const unsigned int * ngram = &ngrams[n - 1][i*n];
+                double lower = std::pow(10.0, (double)probs[n - 2][lowerBound(n - 1, ngram + 1, n - 1)]);
+                double prob = weight*lower + (1 - weight)*unigram[ngram[n - 1]]/children_mass;
+                probs[n - 1][i] = std::log10(prob);
+            }
+            group_start = group_end;
+        }
+    }
+}
+
+//Uniform in [0, 1) from the 53 high bits, so that the model doesn't depend on how the standard library implements distributions.
+inline double SyntheticArpa::uniform() {
+    return (rng() >> 11)*(1.0/9007199254740992.0);
+}
+
+inline unsigned int SyntheticArpa::sample(const std::vector<double>& cdf) {
+    double target = uniform()*cdf.back();
+    return std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin();
+}
+
+//The first ngram of the order whose first key_size words are not less than key, or count(order).
+inline size_t SyntheticArpa::lowerBound(unsigned short order, const unsigned int * key, unsigned short key_size) const {
+    const std::vector<unsigned int>& words = ngrams[order - 1];
+    size_t low = 0;
+    size_t high = count(order);
+    while (low < high) {
+        size_t mid = (low + high)/2;
+        if (std::lexicographical_compare(&words[mid*order], &words[mid*order] + key_size, key, key + key_size)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+//Sorts the flat ngrams of the order and removes duplicates
+inline void SyntheticArpa::sortUnique(unsigned short order, std::vector<unsigned int>& words) {
+    size_t num_ngrams = words.size()/order;
+    std::vector<unsigned int> permutation(num_ngrams);
+    for (size_t i = 0; i < num_ngrams; i++) {
+        permutation[i] = i;
+    }
+    std::sort(permutation.begin(), permutation.end(), [&words, order](unsigned int a, unsigned int b) {
+        return std::lexicographical_compare(&words[(size_t)a*order], &words[(size_t)a*order] + order, &words[(size_t)b*order], &words[(size_t)b*order] + order);
+    });
+    std::vector<unsigned int> sorted;
+    sorted.reserve(words.size());
+    for (size_t i = 0; i < num_ngrams; i++) {
+        const unsigned int * ngram = &words[(size_t)permutation[i]*order];
+        if (i == 0 || !std::equal(ngram, ngram + order, &sorted[sorted.size() - order])) {
+            sorted.insert(sorted.end(), ngram, ngram + order);
+        }
+    }
+    words.swap(sorted);
+}
+
+/*Candidates are drawn until there are enough distinct ones. A bigram is a history word and a predicted word. A longer ngram is an
+  ngram s of the order below (its suffix) extended with a word a such that (a, s without its last word) is also an ngram of the
+  order below, found through an index of that order sorted by everything but the first word.*/
+inline void SyntheticArpa::generateOrder(unsigned short order, size_t num_ngrams) {
+    const std::vector<unsigned int>& lower = ngrams[order - 2];
+    unsigned short lower_order = order - 1;
+    size_t lower_count = count(lower_order);
+    std::vector<unsigned int> by_suffix;
+    auto suffixLess = [&lower, lower_order](unsigned int a, unsigned int b) {
+        const unsigned int * left = &lower[(size_t)a*lower_order];
+        const unsigned int * right = &lower[(size_t)b*lower_order];
+        if (!std::equal(left + 1, left + lower_order, right + 1)) {
+            return std::lexicographical_compare(left + 1, left + lower_order, right + 1, right + lower_order);
+        }
+        return left[0] < right[0];
+    };
+    if (order > 2) {
+        by_suffix.resize(lower_count);
+        for (size_t i = 0; i < lower_count; i++) {
+            by_suffix[i] = i;
+        }
+        std::sort(by_suffix.begin(), by_suffix.end(), suffixLess);
+    }
+
+    std::vector<unsigned int> words;
+    for (int round = 0; round < 20 && words.size()/order < num_ngrams; round++) {
+        size_t missing = num_ngrams - words.size()/order;
+        for (size_t attempt = 0; attempt < missing; attempt++) {
+            if (order == 2) {
+                words.push_back(sample(history_cdf));
+                words.push_back(sample(unigram_cdf));
+                continue;
+            }
+            size_t suffix = std::min((size_t)(uniform()*lower_count), lower_count - 1);
+            const unsigned int * s = &lower[suffix*lower_order];
+            if (s[0] == 1) {
+                continue; //Nothing goes before <s>
+            }
+            //The ngrams of the order below that end in the prefix of s
+            std::vector<unsigned int>::iterator first = std::lower_bound(by_suffix.begin(), by_suffix.end(), s, [&lower, lower_order](unsigned int index, const unsigned int * key) {
+                return std::lexicographical_compare(&lower[(size_t)index*lower_order] + 1, &lower[(size_t)index*lower_order] + lower_order, key, key + lower_order - 1);
+            });
+            std::vector<unsigned int>::iterator last = first;
+            while (last != by_suffix.end() && std::equal(&lower[(size_t)*last*lower_order] + 1, &lower[(size_t)*last*lower_order] + lower_order, s)) {
+                last++;
+            }
+            if (first == last) {
+                continue;
+            }
+            size_t picked = std::min((size_t)(uniform()*(last - first)), (size_t)(last - first - 1));
+            words.push_back(lower[(size_t)first[picked]*lower_order]);
+            words.insert(words.end(), s, s + lower_order);
+        }
+        sortUnique(order, words);
+    }
+    if (words.size()/order < num_ngrams) {
+        std::cerr << "Only " << words.size()/order << " distinct " << order << "-grams out of the " << num_ngrams << " asked for." << std::endl;
+    }
+    ngrams[order - 1].swap(words);
+}
+
+inline std::string SyntheticArpa::word(unsigned int id) const {
+    switch (id) {
+        case 0: return "<unk>";
+        case 1: return "<s>";
+        case 2: return "</s>";
+        default: return "w" + std::to_string(id - 2);
+    }
+}
+
+inline void SyntheticArpa::write(std::ostream& out) const {
+    out << "\\data\\\n";
+    for (unsigned short n = 1; n <= options.max_order; n++) {
+        out << "ngram " << n << "=" << count(n) << '\n';
+    }
+    std::vector<std::string> words(options.vocab_size + 3);
+    for (unsigned int id = 0; id < words.size(); id++) {
+        words[id] = word(id);
+    }
+    out.precision(7);
+    for (unsigned short n = 1; n <= options.max_order; n++) {
+        out << "\n\\" << n << "-grams:\n";
+        for (size_t i = 0; i < count(n); i++) {
+            out << probs[n - 1][i] << '\t';
+            for (unsigned short j = 0; j < n; j++) {
+                out << (j ? " " : "") << words[ngrams[n - 1][i*n + j]];
+            }
+            if (n < options.max_order) {
+                out << '\t' << backoffs[n - 1][i];
+            }
+            out << '\n';
+        }
+    }
+    out << "\n\\end\\\n";
+}
+
+inline void SyntheticArpa::sampleSentences(size_t num_sentences, double mean_length, double hit_rate, std::ostream& out) {
+    std::vector<unsigned int> history;
+    for (size_t sentence = 0; sentence < num_sentences; sentence++) {
+        history.assign(1, 1); //<s>
+        do {
+            unsigned int next = 2;
+            if (uniform() < hit_rate) {
+                //A continuation of the longest context that has any
+                for (unsigned short context = std::min<size_t>(history.size(), options.max_order - 1); context > 0 && next == 2; context--) {
+                    const unsigned int * key = &history[history.size() - context];
+                    size_t first = lowerBound(context + 1, key, context);
+                    size_t last = first;
+                    while (last < count(context + 1) && std::equal(key, key + context, &ngrams[context][last*(context + 1)])) {
+                        last++;
+                    }
+                    if (first != last) {
+                        next = ngrams[context][(first + std::min((size_t)(uniform()*(last - first)), last - first - 1))*(context + 1) + context];
+                    }
+                }
+            }
+            while (next == 2) {
+                next = sample(unigram_cdf);
+            }
+            history.push_back(next);
+        } while (uniform() > 1/std::max(mean_length, 1.0));
+        for (size_t i = 1; i < history.size(); i++) {
+            out << (i > 1 ? " " : "") << word(history[i]);
+        }
+        out << '\n';
+    }
+}
@@ -17,11 +17,27 @@ struct Entry_with_offset {
     unsigned int currentBtreeStart;
 };
 
+//Node counter for searchBtree that counts nothing and compiles away.
+struct NoNodeCounting {
+    void node() {}
+};
+
 void array2balancedBtree(std::vector<unsigned char> &byte_arr, std::vector<Entry_v2> &array, unsigned short BtreeNodeSize, bool lastNgram);
 unsigned int futureSizeCalculator(unsigned int size, unsigned short BtreeNodeSize, int payload_size);
 void entry_v2_to_node(std::vector<unsigned char> &byte_arr, std::vector<Entry_v2> &entries, std::vector<unsigned int> offsets, unsigned int payload_size);
 std::vector<unsigned int> createEvenSplits(unsigned int array_size, unsigned short BtreeNodeSize);
 Entry_with_offset searchBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, unsigned int vocabID, bool lastNgram);
+//The same, calling count.node() for every node searched on the way down.
+template<class NodeCounter>
+Entry_with_offset searchBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, unsigned int vocabID,
+ bool lastNgram, NodeCounter& count);
 std::pair<unsigned int, bool> linearSearch(unsigned int * arr_to_search, unsigned int size, unsigned int vocabID);
 Entry_with_offset searchNode(std::vector<unsigned char> &byte_arr, size_t StartPosition, unsigned int node_size, unsigned int vocabID,
  unsigned short payload_size, unsigned short BtreeNodeSize);
+template<class Functor>
+void traverseBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, bool lastNgram, Functor &fn);
+template<class Functor>
+void traverseNode(std::vector<unsigned char> &byte_arr, size_t StartPosition, unsigned int node_size,
+ unsigned short payload_size, unsigned short BtreeNodeSize, Functor &fn);
+template<class Functor>
+void traverseBtreeNodes(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, bool lastNgram, Functor &fn);
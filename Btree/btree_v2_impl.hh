@@ -224,6 +224,13 @@ inline std::vector<unsigned int> createEvenSplits(unsigned int array_size, unsig
 }
 
 inline Entry_with_offset searchBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, unsigned int vocabID, bool lastNgram) {
+    NoNodeCounting no_counting;
+    return searchBtree(byte_arr, BtreeStartPosition, BtreeNodeSize, vocabID, lastNgram, no_counting);
+}
+
+template<class NodeCounter>
+inline Entry_with_offset searchBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, unsigned int vocabID,
+ bool lastNgram, NodeCounter& count) {
     unsigned short payload_size;
     if (lastNgram) {
         payload_size = 4;
@@ -240,6 +247,7 @@ inline Entry_with_offset searchBtree(std::vector<unsigned char> &byte_arr, size_
 
     while (true) {
         result = searchNode(byte_arr, current_start_pos, node_size, vocabID, payload_size, BtreeNodeSize);
+        count.node();
         current_start_pos = result.next_child_offset;
         node_size = result.next_child_size;
         if (result.found) {
@@ -366,6 +374,154 @@ inline std::pair<unsigned int, bool> linearSearch(unsigned int * arr_to_search,
     return ret;
 }
 
+/*Visits every entry of the Btree in ascending vocabID order. The functor is called as fn(vocabID, payload) where payload points to
+  the entry's payload inside the byte array: |next_level|prob|backoff| for inner trie levels and just |prob| for the last one.*/
+template<class Functor>
+void traverseBtree(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, bool lastNgram, Functor &fn) {
+    unsigned short payload_size;
+    if (lastNgram) {
+        payload_size = 4;
+    } else {
+        payload_size = 12;
+    }
+
+    unsigned int node_size;
+    std::memcpy(&node_size, &byte_arr[BtreeStartPosition], sizeof(node_size));
+    if (node_size != 0) {
+        traverseNode(byte_arr, BtreeStartPosition + 4, node_size, payload_size, BtreeNodeSize, fn);
+    }
+}
+
+template<class Functor>
+void traverseNode(std::vector<unsigned char> &byte_arr, size_t StartPosition, unsigned int node_size,
+ unsigned short payload_size, unsigned short BtreeNodeSize, Functor &fn) {
+    //Same leaf/internal node detection as in searchNode
+    unsigned int entry_size = 4 + payload_size;
+    unsigned int cur_node_entries = (node_size - sizeof(unsigned int) - sizeof(unsigned short))/(entry_size + sizeof(unsigned short));
+    bool is_leaf = !(BtreeNodeSize == cur_node_entries);
+
+    unsigned int * vocabIDs = reinterpret_cast<unsigned int *>(&byte_arr[StartPosition]);
+    unsigned int payload_words = payload_size/4;
+
+    if (is_leaf) {
+        assert(node_size % entry_size == 0); //Sanity check
+        cur_node_entries = node_size/entry_size;
+        unsigned int * payloads = reinterpret_cast<unsigned int *>(&byte_arr[StartPosition + cur_node_entries*sizeof(unsigned int)]);
+        for (unsigned int i = 0; i < cur_node_entries; i++) {
+            fn(vocabIDs[i], &payloads[i*payload_words]);
+        }
+    } else {
+        cur_node_entries = BtreeNodeSize;
+        unsigned int * first_child_offset = reinterpret_cast<unsigned int *>(&byte_arr[StartPosition + cur_node_entries*sizeof(unsigned int)]);
+        unsigned short * next_children_offsets = reinterpret_cast<unsigned short *>(&byte_arr[StartPosition + cur_node_entries*sizeof(unsigned int) + sizeof(unsigned int)]);
+        unsigned int payload_extra_offset =
+            cur_node_entries*sizeof(unsigned int) + cur_node_entries*sizeof(unsigned short) + sizeof(unsigned short) + sizeof(unsigned int);
+        unsigned int * payloads = reinterpret_cast<unsigned int *>(&byte_arr[StartPosition + payload_extra_offset]);
+        size_t first_child_full_offset = StartPosition + *first_child_offset*4;
+
+        //In order: child 0, entry 0, child 1, entry 1 ... child BtreeNodeSize. Children can be empty.
+        for (unsigned int i = 0; i <= cur_node_entries; i++) {
+            unsigned int child_start = (i == 0) ? 0 : next_children_offsets[i - 1]*4;
+            unsigned int child_size = next_children_offsets[i]*4 - child_start;
+            if (child_size != 0) {
+                traverseNode(byte_arr, first_child_full_offset + child_start, child_size, payload_size, BtreeNodeSize, fn);
+            }
+            if (i < cur_node_entries) {
+                fn(vocabIDs[i], &payloads[i*payload_words]);
+            }
+        }
+    }
+}
+
+/*Visits every node of the Btree, parents before their children. The functor is called as fn(depth, entries, is_leaf), with depth 1
+  for the root.*/
+template<class Functor>
+void traverseBtreeNodes(std::vector<unsigned char> &byte_arr, size_t BtreeStartPosition, unsigned short BtreeNodeSize, bool lastNgram, Functor &fn) {
+    unsigned int entry_size = lastNgram ? 8 : 16;
+    unsigned int root_size;
+    std::memcpy(&root_size, &byte_arr[BtreeStartPosition], sizeof(root_size));
+    if (root_size == 0) {
+        return;
+    }
+    std::vector<std::pair<size_t, unsigned int> > level(1, std::make_pair(BtreeStartPosition + 4, root_size)); //Start and size
+    std::vector<std::pair<size_t, unsigned int> > next_level;
+    for (unsigned int depth = 1; !level.empty(); depth++) {
+        for (std::pair<size_t, unsigned int>& node : level) {
+            //Same leaf/internal node detection as in searchNode
+            unsigned int cur_node_entries = (node.second - sizeof(unsigned int) - sizeof(unsigned short))/(entry_size + sizeof(unsigned short));
+            if (BtreeNodeSize != cur_node_entries) {
+                fn(depth, node.second/entry_size, true);
+                continue;
+            }
+            fn(depth, cur_node_entries, false);
+            unsigned int first_child_offset;
+            std::memcpy(&first_child_offset, &byte_arr[node.first + BtreeNodeSize*sizeof(unsigned int)], sizeof(first_child_offset));
+            unsigned short * next_children_offsets = reinterpret_cast<unsigned short *>(&byte_arr[node.first + BtreeNodeSize*sizeof(unsigned int) + sizeof(unsigned int)]);
+            for (unsigned int i = 0; i <= BtreeNodeSize; i++) {
+                unsigned int child_start = (i == 0) ? 0 : next_children_offsets[i - 1]*4;
+                unsigned int child_size = next_children_offsets[i]*4 - child_start;
+                if (child_size != 0) {
+                    next_level.push_back(std::make_pair(node.first + first_child_offset*4 + child_start, child_size));
+                }
+            }
+        }
+        level.swap(next_level);
+        next_level.clear();
+    }
+}
+
+inline std::pair<bool, std::string> test_btree_v2_traversal(unsigned int num_elements, unsigned short BtreeNodeSize, bool lastNgram) {
+    std::stringstream error;
+    bool passes = true;
+
+    std::set<unsigned int> prev_nums;
+    std::vector<Entry_v2> array;
+    while (prev_nums.size() < num_elements) {
+        unsigned int new_entry = 1 + (rand() % (num_elements*10));
+        if (prev_nums.count(new_entry) == 0){
+            Entry_v2 new_entry_actual = {new_entry, prev_nums.size() + 0.0f, prev_nums.size() + 0.5f};
+            array.push_back(new_entry_actual);
+            prev_nums.insert(new_entry);
+        }
+    }
+
+    std::sort(array.begin(), array.end());
+    std::vector<Entry_v2> expected = array; //array2balancedBtree clears its input
+
+    std::vector<unsigned char> btree_byte_arr;
+    array2balancedBtree(btree_byte_arr, array, BtreeNodeSize, lastNgram);
+
+    std::vector<Entry_v2> visited;
+    auto collect = [&visited, lastNgram](unsigned int vocabID, unsigned int * payload) {
+        Entry_v2 entry = {vocabID, 0.0f, 0.0f};
+        if (lastNgram) {
+            std::memcpy(&entry.prob, &payload[0], sizeof(entry.prob));
+        } else {
+            std::memcpy(&entry.prob, &payload[1], sizeof(entry.prob));
+            std::memcpy(&entry.backoff, &payload[2], sizeof(entry.backoff));
+        }
+        visited.push_back(entry);
+    };
+    traverseBtree(btree_byte_arr, 0, BtreeNodeSize, lastNgram, collect);
+
+    if (visited.size() != expected.size()) {
+        error << "Expected to visit " << expected.size() << " entries, visited " << visited.size() << std::endl;
+        return std::pair<bool, std::string>(false, error.str());
+    }
+
+    for (unsigned int i = 0; i < expected.size(); i++) {
+        if (expected[i].vocabID != visited[i].vocabID || expected[i].prob != visited[i].prob ||
+            (!lastNgram && expected[i].backoff != visited[i].backoff)) {
+            error << "Expected vocabID: " << expected[i].vocabID << " prob: " << expected[i].prob << " at position " << i
+            << ", got: " << visited[i].vocabID << " " << visited[i].prob << std::endl;
+            passes = false;
+            break;
+        }
+    }
+
+    return std::pair<bool, std::string>(passes, error.str());
+}
+
 inline std::pair<bool, std::string> test_btree_v2(unsigned int num_elements, unsigned short BtreeNodeSize, bool lastNgram) {
     std::stringstream error;
     bool passes = true;
@@ -20,12 +20,13 @@ struct LM_metadata {
     unsigned short max_ngram_order;
     float api_version;
     unsigned short btree_node_size;
+    bool reversed_contexts = false; //Trie built over reversed contexts, see createReversedTrie. Only the CPU search supports it.
 };
 
 inline bool operator== (const LM_metadata &left, const LM_metadata &right) {
     return left.byteArraySize == right.byteArraySize && left.max_ngram_order == right.max_ngram_order &&
            left.api_version == right.api_version && left.btree_node_size == right.btree_node_size &&
-           left.intArraySize == right.intArraySize;
+           left.intArraySize == right.intArraySize && left.reversed_contexts == right.reversed_contexts;
 };
 
 inline std::ostream& operator<< (std::ostream &out, LM_metadata &metadata) {
@@ -34,10 +35,13 @@ inline std::ostream& operator<< (std::ostream &out, LM_metadata &metadata) {
     << "First_level size: " << metadata.intArraySize << std::endl
     << "Size of the datasctructure in memory is: " << metadata.byteArraySize/(1024*1024) << " MB."<< std::endl
     << "Btree node size is: " << metadata.btree_node_size << std::endl
-    << "Max ngram order: " << metadata.max_ngram_order << std::endl;
+    << "Max ngram order: " << metadata.max_ngram_order << std::endl
+    << "Reversed contexts: " << metadata.reversed_contexts << std::endl;
     return out;
 };
 
+struct MemoryReport; //See memory_report.hh
+
 //A struct that contains all possible and necessary information for an LM
 class LM {
     private:
@@ -67,7 +71,7 @@ class LM {
                 //To maintain compatibility with the old format for now, check if intArraySize is more than 0
                 //before attempting to execute memory map
                 if (metadata.intArraySize) {
-                    munmap(reinterpret_cast<void *>(mmapedByteArray), metadata.intArraySize);
+                    munmap(reinterpret_cast<void *>(mmapedFirst_lvl), metadata.intArraySize*sizeof(unsigned int));
                 }
             }
         }
@@ -75,6 +79,9 @@ class LM {
         //Write to disk:
         template<class StringType> 
         void writeBinary(const StringType path);
+
+        //Byte accounting of everything the model holds, defined in memory_report_impl.hh
+        MemoryReport memoryReport() const;
 };
 
 
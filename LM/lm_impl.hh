@@ -3,6 +3,7 @@
     #include "lm.hh"
 #endif 
 
+#include "../misc/trace.hh"
 #include <type_traits>
 #include <boost/tokenizer.hpp>
 #include <boost/filesystem.hpp>
@@ -72,6 +73,7 @@ void LM::storeConfigFile(const StringType path) {
     configfile << metadata.max_ngram_order << '\n';
     configfile << metadata.api_version << '\n';
     configfile << metadata.btree_node_size << '\n';
+    configfile << metadata.reversed_contexts << '\n';
     //Also store in the config file the size of the datastructures. Useful to know if we can fit our model
     //on the available GPU memory, but we don't actually need to ever read it back. It is for the user's benefit.
     configfile << "First trie level memory size: " << (metadata.intArraySize/(1024*1024/4)) << " MB\n";
@@ -116,6 +118,9 @@ void LM::readConfigFile(const StringType path) {
     getline(configfile, line);
     metadata.btree_node_size = atoi(line.c_str());
 
+    //Get the trie layout. Older config files have the human readable memory sizes here, which read as 0, the forward layout.
+    getline(configfile, line);
+    metadata.reversed_contexts = atoi(line.c_str());
 }
 
 template<class StringType>
@@ -136,6 +141,7 @@ void createDirIfnotPresent(const StringType path) {
 //Given a path and an LM binarizes the LM there
 template<class StringType>
 void LM::writeBinary(const StringType path) {
+    GLM_TRACE_SPAN("LM::writeBinary");
     createDirIfnotPresent(path);
     std::string basepath(path);
     storeConfigFile(basepath + "/config");
@@ -156,12 +162,17 @@ void LM::writeBinary(const StringType path) {
 //Reads the model into the given (presumably empty byte_arr)
 template<class StringType>
 LM::LM(const StringType path) {
+    GLM_TRACE_SPAN("LM::LM");
     diskIO = true; //Indicate that we have performed diskIO and we need to call munmap in the destructor
 
     std::string basepath(path);
     this->readConfigFile(basepath + "/config");
-    readDatastructure(this->encode_map, basepath + "/encode.map");
-    readDatastructure(this->decode_map, basepath + "/decode.map");
+    {
+        GLM_TRACE_SPAN("read vocabulary");
+        readDatastructure(this->encode_map, basepath + "/encode.map");
+        readDatastructure(this->decode_map, basepath + "/decode.map");
+    }
+    GLM_TRACE_SPAN("read trie");
 
     //@TODO we should really make that step optional
     //We don't need the copy to vector since we're only going to copy it to GPU memory
@@ -0,0 +1,193 @@
+#pragma once
+#include "lm.hh"
+#include "vocab_table_impl.hh"
+#include "../misc/trace.hh"
+#include <boost/tokenizer.hpp>
+#include <cstring>
+#include <cstdlib>
+
+//Host side helpers for turning text into queries. They don't depend on CUDA so that the CPU tools can use them.
+
+/*Converts a tokenized sentence into vocabIDs through the encode_map. The query builders go through a VocabTable instead, which
+  resolves the special tokens once; this is the reference the tests compare them against.*/
+inline std::vector<unsigned int> sent2vocabIDs(LM &lm, const std::vector<std::string>& input, bool addBeginEndMarkers) {
+    std::vector<unsigned int> ret;
+    if (addBeginEndMarkers) {
+        ret.reserve(input.size() + 2);
+    } else {
+        ret.reserve(input.size());
+    }
+    std::unordered_map<std::string, unsigned int>::iterator unk = lm.encode_map.find(std::string("<unk>"));
+    std::unordered_map<std::string, unsigned int>::iterator begin = lm.encode_map.find(std::string("<s>"));
+    std::unordered_map<std::string, unsigned int>::iterator end = lm.encode_map.find(std::string("</s>"));
+    if (unk == lm.encode_map.end() || begin == lm.encode_map.end() || end == lm.encode_map.end()) {
+        throw std::invalid_argument("The model has no <unk>, <s> or </s>");
+    }
+    unsigned int unktoken = unk->second;
+    unsigned int beginsent = begin->second;
+    unsigned int endsent = end->second;
+
+    if (addBeginEndMarkers) {
+        ret.push_back(beginsent);
+    }
+    for (auto& item : input) {
+        std::unordered_map<std::string, unsigned int>::iterator it = lm.encode_map.find(item);
+        if (it != lm.encode_map.end()) {
+            ret.push_back(it->second);
+        } else {
+            ret.push_back(unktoken);
+        }
+    }
+    if (addBeginEndMarkers) {
+        ret.push_back(endsent);
+    }
+
+    return ret;
+}
+
+/*Appends one scoring query per word of the sentence to all_queries: the word preceded by as much history as the model order
+  allows, oldest word first and padded with zeroes. The begin of sentence marker is context only and doesn't get a query.
+  Returns the number of queries added.*/
+inline unsigned int vocabIDsent2scoringQueries(std::vector<unsigned int>& vocabIDs, std::vector<unsigned int>& all_queries, unsigned short ngram_order, bool addBeginEndMarkers) {
+    size_t first = addBeginEndMarkers ? 1 : 0;
+    if (vocabIDs.size() <= first) {
+        return 0;
+    }
+    unsigned int num_queries = vocabIDs.size() - first;
+    size_t offset = all_queries.size();
+    all_queries.resize(offset + num_queries*ngram_order, 0);
+
+    for (size_t i = first; i < vocabIDs.size(); i++) {
+        size_t history_start = (i + 1 >= ngram_order) ? i + 1 - ngram_order : 0;
+        std::memcpy(&all_queries[offset], &vocabIDs[history_start], (i + 1 - history_start)*sizeof(unsigned int));
+        offset += ngram_order;
+    }
+    return num_queries;
+}
+
+//Tokenizes in place and looks the words up in a VocabTable, which is a lot faster than boost::tokenizer and encode_map.
+inline unsigned int sent2ScoringQueries(boost::string_view sentence, std::vector<unsigned int>& all_queries, const VocabTable& vocab,
+ unsigned short ngram_order, bool addBeginEndMarkers) {
+    std::vector<unsigned int> vocabIDs;
+    vocab.sentence2vocabIDs(sentence, vocabIDs, addBeginEndMarkers);
+    return vocabIDsent2scoringQueries(vocabIDs, all_queries, ngram_order, addBeginEndMarkers);
+}
+
+//Reads a file with one sentence per line and converts it to scoring queries. sent_lengths holds the number of queries per sentence.
+template<class StringType>
+void sentencesToScoringQueries(std::vector<unsigned int>& queries, std::vector<unsigned int>& sent_lengths, LM& lm, StringType sentsFile, bool addBeginEndMarkers = true) {
+    std::ifstream queryFile;
+    queryFile.open(sentsFile);
+
+    if (queryFile.fail()) {
+        std::cerr << "Failed to open file " << sentsFile << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    VocabTable vocab(lm.encode_map);
+    std::string curr_sent;
+    while (std::getline(queryFile, curr_sent)) {
+        if (curr_sent == "") {
+            continue; //Skip empty lines
+        }
+        sent_lengths.push_back(sent2ScoringQueries(curr_sent, queries, vocab, lm.metadata.max_ngram_order, addBeginEndMarkers));
+    }
+}
+
+/*Compact form of a batch of sentences: their vocabIDs back to back, plus where each sentence starts. The query of every position is
+  the word with the max_ngram_order - 1 words before it in the same sentence, so there is no need to materialize padded queries.
+  Results are laid out like vocabIDs, one per position. Positions that are only context (the begin of sentence marker) get 0.*/
+struct CompactQueries {
+    std::vector<unsigned int> vocabIDs;
+    std::vector<unsigned int> sentence_starts;
+    bool first_is_context = true; //The first word of every sentence is not scored
+
+    size_t numSentences() const {
+        return sentence_starts.size();
+    }
+    unsigned int sentenceEnd(size_t sentence) const {
+        return sentence + 1 < sentence_starts.size() ? sentence_starts[sentence + 1] : vocabIDs.size();
+    }
+    //Number of scored positions
+    size_t numQueries() const {
+        return first_is_context ? vocabIDs.size() - sentence_starts.size() : vocabIDs.size();
+    }
+};
+
+inline void sent2CompactQueries(boost::string_view sentence, CompactQueries& batch, const VocabTable& vocab, bool addBeginEndMarkers) {
+    batch.first_is_context = addBeginEndMarkers;
+    batch.sentence_starts.push_back(batch.vocabIDs.size());
+    vocab.sentence2vocabIDs(sentence, batch.vocabIDs, addBeginEndMarkers);
+}
+
+//Tokenizes all the sentences first and then looks up all of their words with one batched lookup.
+inline void sentences2CompactQueries(const std::vector<std::string>& sentences, CompactQueries& batch, const VocabTable& vocab, bool addBeginEndMarkers) {
+    GLM_TRACE_SPAN_ARG("sentences2CompactQueries", "sentences", sentences.size());
+    std::vector<boost::string_view> tokens;
+    std::vector<size_t> token_ends;
+    token_ends.reserve(sentences.size());
+    for (const std::string& sentence : sentences) {
+        VocabTable::tokenize(sentence, tokens);
+        token_ends.push_back(tokens.size());
+    }
+    std::vector<unsigned int> vocabIDs(tokens.size());
+    vocab.findBatch(tokens.data(), tokens.size(), vocabIDs.data());
+
+    batch.first_is_context = addBeginEndMarkers;
+    batch.vocabIDs.reserve(batch.vocabIDs.size() + tokens.size() + (addBeginEndMarkers ? 2*sentences.size() : 0));
+    size_t token = 0;
+    for (size_t token_end : token_ends) {
+        batch.sentence_starts.push_back(batch.vocabIDs.size());
+        if (addBeginEndMarkers) {
+            batch.vocabIDs.push_back(vocab.begin_sentence);
+        }
+        batch.vocabIDs.insert(batch.vocabIDs.end(), vocabIDs.begin() + token, vocabIDs.begin() + token_end);
+        if (addBeginEndMarkers) {
+            batch.vocabIDs.push_back(vocab.end_sentence);
+        }
+        token = token_end;
+    }
+}
+
+#define SENTENCES_PER_LOOKUP_BATCH 4096
+
+template<class StringType>
+void sentencesToCompactQueries(CompactQueries& batch, LM& lm, StringType sentsFile, bool addBeginEndMarkers = true) {
+    GLM_TRACE_SPAN("sentencesToCompactQueries");
+    std::ifstream queryFile;
+    queryFile.open(sentsFile);
+
+    if (queryFile.fail()) {
+        std::cerr << "Failed to open file " << sentsFile << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    VocabTable vocab(lm.encode_map);
+    std::vector<std::string> sentences;
+    std::string curr_sent;
+    while (std::getline(queryFile, curr_sent)) {
+        if (curr_sent == "") {
+            continue; //Skip empty lines
+        }
+        sentences.push_back(curr_sent);
+        if (sentences.size() == SENTENCES_PER_LOOKUP_BATCH) {
+            sentences2CompactQueries(sentences, batch, vocab, addBeginEndMarkers);
+            sentences.clear();
+        }
+    }
+    sentences2CompactQueries(sentences, batch, vocab, addBeginEndMarkers);
+}
+
+//Expands a compact batch to padded queries, one per position including the context only ones, which become bogus all zero queries.
+inline std::vector<unsigned int> compact2paddedQueries(const CompactQueries& batch, unsigned short ngram_order) {
+    std::vector<unsigned int> queries(batch.vocabIDs.size()*ngram_order, 0);
+    for (size_t sentence = 0; sentence < batch.numSentences(); sentence++) {
+        unsigned int start = batch.sentence_starts[sentence];
+        unsigned int first = batch.first_is_context ? start + 1 : start;
+        for (unsigned int pos = first; pos < batch.sentenceEnd(sentence); pos++) {
+            unsigned int window_start = (pos + 1 >= start + ngram_order) ? pos + 1 - ngram_order : start;
+            std::memcpy(&queries[pos*ngram_order], &batch.vocabIDs[window_start], (pos + 1 - window_start)*sizeof(unsigned int));
+        }
+    }
+    return queries;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdint>
+
+/*What a loaded model and the structures around it hold in memory, component by component. Heap components count the bytes
+  their containers ask for and the bytes the allocator hands out for them, which are what actually adds up: every malloc block
+  carries a header and is rounded up (the glibc rules, see mallocBlockBytes). Hash maps are counted node by node, with their
+  bucket array and the heap buffers of the strings they hold. Mapped components are file mappings, whose resident size only the
+  kernel knows: see ProcessMemory.*/
+struct MemoryComponent {
+    std::string name;
+    size_t bytes = 0; //Requested
+    size_t allocated = 0; //Handed out by the allocator, or the mapping size rounded to pages
+    size_t allocations = 0;
+    const void * mapping = nullptr; //Start of the file mapping for mapped components
+};
+
+//The memory of one mapping of /proc/self/smaps.
+struct MappingMemory {
+    uintptr_t start;
+    uintptr_t end;
+    std::string path; //Empty for anonymous mappings
+    size_t rss = 0;
+    size_t pss = 0;
+    size_t anonymous = 0;
+    size_t swap = 0;
+};
+
+//The memory of the whole process according to /proc/self/smaps, in bytes. PSS splits shared pages among their sharers.
+struct ProcessMemory {
+    bool valid = false; //False if smaps couldn't be read
+    size_t rss = 0;
+    size_t pss = 0;
+    size_t anonymous = 0;
+    size_t swap = 0;
+    size_t heap_rss = 0; //The brk heap. Large malloc blocks are anonymous mappings of their own.
+    std::vector<MappingMemory> mappings;
+
+    const MappingMemory * find(const void * address) const;
+};
+
+ProcessMemory readProcessMemory(const std::string& smaps_path = "/proc/self/smaps");
+
+struct MemoryReport {
+    std::vector<MemoryComponent> components;
+
+    void add(const MemoryComponent& component) {
+        components.push_back(component);
+    }
+    void addAllocation(const std::string& name, size_t bytes); //A single heap block, such as the storage of a vector
+    void addMapping(const std::string& name, const void * start, size_t bytes);
+    //A structure that reports its own memoryUsage() and doesn't say how it's allocated: counted as requested.
+    void addReported(const std::string& name, size_t bytes);
+
+    size_t heapBytes() const;
+    size_t heapAllocated() const;
+    size_t mappedBytes() const;
+    //Components, then totals. With process memory, also the resident size of every mapped component and how the heap total compares
+    //to the anonymous resident memory of the process, of which it should be the bulk once a model is loaded.
+    void print(std::ostream& out, const ProcessMemory * process = nullptr) const;
+};
+
+size_t mallocBlockBytes(size_t bytes);
+size_t stringHeapBytes(const std::string& str);
+template<class HashMap>
+void addHashMap(MemoryReport& report, const std::string& name, const HashMap& map);
@@ -0,0 +1,249 @@
+#pragma once
+#include "memory_report.hh"
+#include "lm_impl.hh"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unordered_map>
+#include <unistd.h>
+
+/*Size of the malloc block that serves a request of bytes, header included: with glibc a request is padded with an 8 byte header
+  to a multiple of 16, at least 32. Requests from 128KiB up (the default mmap threshold) get a mapping of their own, rounded to
+  pages. Other allocators round differently, so elsewhere this is an estimate.*/
+inline size_t mallocBlockBytes(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    const size_t header = sizeof(size_t);
+    if (bytes >= 128*1024) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        return (bytes + 2*header + page - 1)/page*page;
+    }
+    return std::max<size_t>(32, (bytes + header + 15) & ~(size_t)15);
+}
+
+//The heap buffer of a string, 0 if the string fits in the string object itself (the short string optimization).
+inline size_t stringHeapBytes(const std::string& str) {
+    const char * object = reinterpret_cast<const char *>(&str);
+    if (str.data() >= object && str.data() < object + sizeof(str)) {
+        return 0;
+    }
+    return str.capacity() + 1;
+}
+
+//Only strings own heap memory among the keys and values of our maps.
+template<class T>
+inline size_t heapBytesOf(const T&) {
+    return 0;
+}
+inline size_t heapBytesOf(const std::string& str) {
+    return stringHeapBytes(str);
+}
+
+/*The node of a std::unordered_map holds the next pointer, the key and value and, when the hash isn't trivial to recompute, the
+  hash code. libstdc++ caches the hash exactly when it's not a "fast" one (std::hash of integers is, of strings isn't).*/
+template<class HashMap>
+struct HashNodeBytes {
+#ifdef __GLIBCXX__
+    static const bool cached = std::__cache_default<typename HashMap::key_type, typename HashMap::hasher>::value;
+#else
+    static const bool cached = true;
+#endif
+    struct Node {
+        void * next;
+        typename HashMap::value_type value;
+    };
+    struct CachedNode {
+        void * next;
+        typename HashMap::value_type value;
+        size_t hash;
+    };
+    static const size_t value = cached ? sizeof(CachedNode) : sizeof(Node);
+};
+
+//Nodes, buckets and string buffers of a hash map, as three components. A map of a single bucket keeps it inside the map object.
+template<class HashMap>
+void addHashMap(MemoryReport& report, const std::string& name, const HashMap& map) {
+    MemoryComponent nodes;
+    nodes.name = name + " nodes";
+    nodes.allocations = map.size();
+    nodes.bytes = map.size()*HashNodeBytes<HashMap>::value;
+    nodes.allocated = map.size()*mallocBlockBytes(HashNodeBytes<HashMap>::value);
+    report.add(nodes);
+
+    report.addAllocation(name + " buckets", map.bucket_count() > 1 ? map.bucket_count()*sizeof(void *) : 0);
+
+    MemoryComponent strings;
+    strings.name = name + " strings";
+    for (const typename HashMap::value_type& entry : map) {
+        size_t buffers[2] = {heapBytesOf(entry.first), heapBytesOf(entry.second)};
+        for (size_t buffer : buffers) {
+            if (buffer) {
+                strings.allocations++;
+                strings.bytes += buffer;
+                strings.allocated += mallocBlockBytes(buffer);
+            }
+        }
+    }
+    report.add(strings);
+}
+
+inline void MemoryReport::addAllocation(const std::string& name, size_t bytes) {
+    MemoryComponent component;
+    component.name = name;
+    component.bytes = bytes;
+    component.allocated = mallocBlockBytes(bytes);
+    component.allocations = bytes ? 1 : 0;
+    components.push_back(component);
+}
+
+inline void MemoryReport::addMapping(const std::string& name, const void * start, size_t bytes) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    MemoryComponent component;
+    component.name = name;
+    component.bytes = bytes;
+    component.allocated = (bytes + page - 1)/page*page;
+    component.mapping = start;
+    components.push_back(component);
+}
+
+inline void MemoryReport::addReported(const std::string& name, size_t bytes) {
+    MemoryComponent component;
+    component.name = name;
+    component.bytes = bytes;
+    component.allocated = bytes;
+    components.push_back(component);
+}
+
+inline size_t MemoryReport::heapBytes() const {
+    size_t bytes = 0;
+    for (const MemoryComponent& component : components) {
+        bytes += component.mapping ? 0 : component.bytes;
+    }
+    return bytes;
+}
+
+inline size_t MemoryReport::heapAllocated() const {
+    size_t bytes = 0;
+    for (const MemoryComponent& component : components) {
+        bytes += component.mapping ? 0 : component.allocated;
+    }
+    return bytes;
+}
+
+inline size_t MemoryReport::mappedBytes() const {
+    size_t bytes = 0;
+    for (const MemoryComponent& component : components) {
+        bytes += component.mapping ? component.allocated : 0;
+    }
+    return bytes;
+}
+
+inline void MemoryReport::print(std::ostream& out, const ProcessMemory * process) const {
+    std::ios::fmtflags flags = out.flags();
+    out << std::left << std::setw(28) << "component" << std::right << std::setw(16) << "bytes" << std::setw(16) << "allocated"
+    << std::setw(12) << "blocks" << std::endl;
+    for (const MemoryComponent& component : components) {
+        out << std::left << std::setw(28) << component.name << std::right << std::setw(16) << component.bytes << std::setw(16)
+        << component.allocated << std::setw(12) << component.allocations;
+        if (component.mapping && process && process->valid) {
+            const MappingMemory * mapping = process->find(component.mapping);
+            if (mapping) {
+                out << "  mapped, resident " << mapping->rss << ", pss " << mapping->pss;
+            }
+        }
+        out << std::endl;
+    }
+    out << "Heap: " << heapBytes() << " bytes requested, " << heapAllocated() << " allocated. Mapped: " << mappedBytes() << " bytes."
+    << std::endl;
+    if (process && process->valid) {
+        out << "Process: RSS " << process->rss << ", PSS " << process->pss << ", anonymous " << process->anonymous << " (heap "
+        << process->heap_rss << "), swap " << process->swap << ". The heap components are " << std::fixed << std::setprecision(1)
+        << (process->anonymous ? 100.0*heapAllocated()/process->anonymous : 0) << "% of the anonymous memory." << std::endl;
+    }
+    out.flags(flags);
+}
+
+inline const MappingMemory * ProcessMemory::find(const void * address) const {
+    uintptr_t position = reinterpret_cast<uintptr_t>(address);
+    for (const MappingMemory& mapping : mappings) {
+        if (position >= mapping.start && position < mapping.end) {
+            return &mapping;
+        }
+    }
+    return nullptr;
+}
+
+/*Every mapping of smaps starts with a line "start-end perms offset dev inode [path]" followed by "Field: value kB" lines, of which
+  we keep Rss, Pss, Anonymous and Swap.*/
+inline ProcessMemory readProcessMemory(const std::string& smaps_path) {
+    ProcessMemory process;
+    std::ifstream smaps(smaps_path);
+    if (smaps.fail()) {
+        return process;
+    }
+    std::string line;
+    while (std::getline(smaps, line)) {
+        std::stringstream fields(line);
+        std::string first;
+        fields >> first;
+        if (first.empty()) {
+            continue;
+        }
+        if (first.back() != ':') {
+            MappingMemory mapping;
+            size_t dash = first.find('-');
+            mapping.start = std::stoull(first.substr(0, dash), nullptr, 16);
+            mapping.end = std::stoull(first.substr(dash + 1), nullptr, 16);
+            std::string perms, offset, device, inode;
+            fields >> perms >> offset >> device >> inode;
+            std::getline(fields >> std::ws, mapping.path);
+            process.mappings.push_back(mapping);
+            continue;
+        }
+        if (process.mappings.empty()) {
+            continue;
+        }
+        size_t kilobytes = 0;
+        fields >> kilobytes;
+        MappingMemory& mapping = process.mappings.back();
+        if (first == "Rss:") {
+            mapping.rss = kilobytes*1024;
+        } else if (first == "Pss:") {
+            mapping.pss = kilobytes*1024;
+        } else if (first == "Anonymous:") {
+            mapping.anonymous = kilobytes*1024;
+        } else if (first == "Swap:") {
+            mapping.swap = kilobytes*1024;
+        }
+    }
+    for (const MappingMemory& mapping : process.mappings) {
+        process.rss += mapping.rss;
+        process.pss += mapping.pss;
+        process.anonymous += mapping.anonymous;
+        process.swap += mapping.swap;
+        if (mapping.path == "[heap]") {
+            process.heap_rss += mapping.rss;
+        }
+    }
+    process.valid = !process.mappings.empty();
+    return process;
+}
+
+/*The trie and first level as their vectors hold them, both vocabulary maps and, for a model read from disk, the mappings of
+  lm.bin and first_lvl.bin, which stay mapped after they're copied to the vectors.*/
+inline MemoryReport LM::memoryReport() const {
+    MemoryReport report;
+    report.addReported("LM object", sizeof(LM));
+    report.addAllocation("trie byte array", trieByteArray.capacity());
+    report.addAllocation("first level", first_lvl.capacity()*sizeof(unsigned int));
+    addHashMap(report, "encode_map", encode_map);
+    addHashMap(report, "decode_map", decode_map);
+    if (diskIO) {
+        report.addMapping("lm.bin mapping", mmapedByteArray, metadata.byteArraySize);
+        if (metadata.intArraySize) {
+            report.addMapping("first_lvl.bin mapping", mmapedFirst_lvl, metadata.intArraySize*sizeof(unsigned int));
+        }
+    }
+    return report;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/utility/string_view.hpp>
+
+/*Flat open addressing table from words to vocabIDs, built once from the encode_map of an LM. The words are stored back to back
+  in one char array and the slots keep 32 bits of the hash, so a probe compares the strings only on a likely match.
+  Sentences are split on spaces in place into string_views, no std::string is ever made. The special tokens are resolved
+  at construction, which throws std::invalid_argument for a model without <unk>, <s> or </s>. Unknown words map to <unk>.*/
+class VocabTable {
+    private:
+        struct Slot {
+            uint32_t hash;
+            unsigned int vocabID; //0 marks an empty slot
+            unsigned int offset; //Into strings
+            unsigned int length;
+        };
+        std::vector<Slot> slots;
+        std::vector<char> strings;
+        size_t mask;
+        size_t num_words = 0;
+
+        static uint64_t hashWord(const char * word, size_t length);
+        void insert(const std::string& word, unsigned int vocabID);
+
+    public:
+        unsigned int unk = 0;
+        unsigned int begin_sentence = 0;
+        unsigned int end_sentence = 0;
+
+        explicit VocabTable(const std::unordered_map<std::string, unsigned int>& encode_map);
+        unsigned int find(boost::string_view word) const;
+        //Looks up many words at once, prefetching the slots of a group of words before probing any of them.
+        void findBatch(const boost::string_view * words, size_t num_words, unsigned int * vocabIDs) const;
+
+        //Splits on spaces and skips empty tokens, like boost::char_separator<char>(" ").
+        static void tokenize(boost::string_view sentence, std::vector<boost::string_view>& tokens);
+        void sentence2vocabIDs(boost::string_view sentence, std::vector<unsigned int>& vocabIDs, bool addBeginEndMarkers) const;
+
+        size_t size() const {
+            return num_words;
+        }
+        size_t memoryUsage() const {
+            return slots.size()*sizeof(Slot) + strings.size();
+        }
+};
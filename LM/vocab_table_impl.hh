@@ -0,0 +1,132 @@
+#pragma once
+#include "vocab_table.hh"
+#include <cstring>
+#include <stdexcept>
+
+#define VOCAB_LOOKUP_GROUP 16
+
+inline VocabTable::VocabTable(const std::unordered_map<std::string, unsigned int>& encode_map) {
+    //Load factor at most 0.5
+    size_t capacity = 2;
+    while (capacity < 2*encode_map.size()) {
+        capacity *= 2;
+    }
+    mask = capacity - 1;
+    Slot empty = {0, 0, 0, 0};
+    slots.resize(capacity, empty);
+
+    size_t total_length = 0;
+    for (auto& entry : encode_map) {
+        total_length += entry.first.size();
+    }
+    strings.reserve(total_length);
+    for (auto& entry : encode_map) {
+        insert(entry.first, entry.second);
+    }
+
+    //vocabID 0 is the padding of a query, the searchers would read out of bounds with it. So the special tokens must be there.
+    std::string missing;
+    unsigned int * special[3] = {&unk, &begin_sentence, &end_sentence};
+    const char * names[3] = {"<unk>", "<s>", "</s>"};
+    for (int i = 0; i < 3; i++) {
+        std::unordered_map<std::string, unsigned int>::const_iterator it = encode_map.find(names[i]);
+        if (it == encode_map.end()) {
+            missing += std::string(missing.empty() ? "" : ", ") + names[i];
+        } else {
+            *special[i] = it->second;
+        }
+    }
+    if (!missing.empty()) {
+        throw std::invalid_argument("The model has no " + missing + ". Every word must map to a vocabID and sentences need their markers.");
+    }
+}
+
+inline uint64_t VocabTable::hashWord(const char * word, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)word[i])*0x100000001B3ULL;
+    }
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline void VocabTable::insert(const std::string& word, unsigned int vocabID) {
+    uint64_t hash = hashWord(word.data(), word.size());
+    size_t idx = (hash >> 32) & mask;
+    while (slots[idx].vocabID != 0) {
+        idx = (idx + 1) & mask;
+    }
+    slots[idx].hash = (uint32_t)hash;
+    slots[idx].vocabID = vocabID;
+    slots[idx].offset = strings.size();
+    slots[idx].length = word.size();
+    strings.insert(strings.end(), word.begin(), word.end());
+    num_words++;
+}
+
+inline unsigned int VocabTable::find(boost::string_view word) const {
+    uint64_t hash = hashWord(word.data(), word.size());
+    size_t idx = (hash >> 32) & mask;
+    while (slots[idx].vocabID != 0) {
+        const Slot& slot = slots[idx];
+        if (slot.hash == (uint32_t)hash && slot.length == word.size() && std::memcmp(&strings[slot.offset], word.data(), word.size()) == 0) {
+            return slot.vocabID;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return unk;
+}
+
+inline void VocabTable::findBatch(const boost::string_view * words, size_t num_words, unsigned int * vocabIDs) const {
+    uint64_t hashes[VOCAB_LOOKUP_GROUP];
+    for (size_t group = 0; group < num_words; group += VOCAB_LOOKUP_GROUP) {
+        size_t group_size = std::min((size_t)VOCAB_LOOKUP_GROUP, num_words - group);
+        for (size_t i = 0; i < group_size; i++) {
+            hashes[i] = hashWord(words[group + i].data(), words[group + i].size());
+            __builtin_prefetch(&slots[(hashes[i] >> 32) & mask]);
+        }
+        for (size_t i = 0; i < group_size; i++) {
+            const boost::string_view& word = words[group + i];
+            size_t idx = (hashes[i] >> 32) & mask;
+            vocabIDs[group + i] = unk;
+            while (slots[idx].vocabID != 0) {
+                const Slot& slot = slots[idx];
+                if (slot.hash == (uint32_t)hashes[i] && slot.length == word.size() && std::memcmp(&strings[slot.offset], word.data(), word.size()) == 0) {
+                    vocabIDs[group + i] = slot.vocabID;
+                    break;
+                }
+                idx = (idx + 1) & mask;
+            }
+        }
+    }
+}
+
+inline void VocabTable::tokenize(boost::string_view sentence, std::vector<boost::string_view>& tokens) {
+    size_t pos = 0;
+    while (pos < sentence.size()) {
+        while (pos < sentence.size() && sentence[pos] == ' ') {
+            pos++;
+        }
+        size_t start = pos;
+        while (pos < sentence.size() && sentence[pos] != ' ') {
+            pos++;
+        }
+        if (pos > start) {
+            tokens.push_back(sentence.substr(start, pos - start));
+        }
+    }
+}
+
+inline void VocabTable::sentence2vocabIDs(boost::string_view sentence, std::vector<unsigned int>& vocabIDs, bool addBeginEndMarkers) const {
+    std::vector<boost::string_view> tokens;
+    tokenize(sentence, tokens);
+    if (addBeginEndMarkers) {
+        vocabIDs.push_back(begin_sentence);
+    }
+    size_t offset = vocabIDs.size();
+    vocabIDs.resize(offset + tokens.size());
+    findBatch(tokens.data(), tokens.size(), &vocabIDs[offset]);
+    if (addBeginEndMarkers) {
+        vocabIDs.push_back(end_sentence);
+    }
+}
@@ -66,4 +66,20 @@ BOOST_AUTO_TEST_CASE(Btree_semitrivial_innerngram) {
     BOOST_CHECK_MESSAGE(res.first, res.second);
 }
 
+BOOST_AUTO_TEST_CASE(Btree_traversal_lastngram) {
+    unsigned int num_elements = 15321;
+    unsigned int BtreeNodeSize = 7;
+    bool lastNgram = true;
+    std::pair<bool, std::string> res = test_btree_v2_traversal(num_elements, BtreeNodeSize, lastNgram);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(Btree_traversal_innerngram) {
+    unsigned int num_elements = 45;
+    unsigned int BtreeNodeSize = 33;
+    bool lastNgram = false;
+    std::pair<bool, std::string> res = test_btree_v2_traversal(num_elements, BtreeNodeSize, lastNgram);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
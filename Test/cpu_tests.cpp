@@ -0,0 +1,1418 @@
+#include "tests_common.hh"
+#include "cpu_search_impl.hh"
+#include "lm_impl.hh"
+#include "lm_utils.hh"
+#include "thread_pool_impl.hh"
+#include "streaming_impl.hh"
+#include "beam_scorer_impl.hh"
+#include "nbest_rescorer_impl.hh"
+#include "interpolated_lm_impl.hh"
+#include "perf_counters.hh"
+#include "traversal_profiler_impl.hh"
+#include "query_server_impl.hh"
+#include "async_searcher_impl.hh"
+#include <thread>
+#include <set>
+#include <random>
+
+//Converts a space separated ngram to a padded query.
+std::vector<unsigned int> ngram2query(LM& lm, std::string ngram) {
+    std::vector<unsigned int> query;
+    std::stringstream ss(ngram);
+    std::string word;
+    while (ss >> word) {
+        query.push_back(lm.encode_map.find(word)->second);
+    }
+    query.resize(lm.metadata.max_ngram_order, 0);
+    return query;
+}
+
+//Every ngram of the arpa file followed by the same ngrams with a different last word, so that half of them back off.
+std::vector<unsigned int> arpa2queries(LM& lm) {
+    ArpaReader infile(ARPA_TESTFILEPATH);
+    processed_line text = infile.readline();
+    std::vector<unsigned int> queries;
+    std::vector<unsigned int> shifted;
+    while (!text.filefinished) {
+        text.ngrams.resize(lm.metadata.max_ngram_order, 0);
+        queries.insert(queries.end(), text.ngrams.begin(), text.ngrams.end());
+        text.ngrams[text.ngram_size - 1] = 1 + (text.ngrams[0] % (lm.first_lvl.size()/3));
+        shifted.insert(shifted.end(), text.ngrams.begin(), text.ngrams.end());
+        text = infile.readline();
+    }
+    queries.insert(queries.end(), shifted.begin(), shifted.end());
+    return queries;
+}
+
+BOOST_AUTO_TEST_SUITE(CPU_search)
+
+BOOST_AUTO_TEST_CASE(all_ngrams_small_node) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::pair<bool, std::string> res = testCPUSearch(lm, ARPA_TESTFILEPATH);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(all_ngrams_hot_contexts) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    HotContextTable hot_contexts(lm, 2000);
+    BOOST_CHECK_MESSAGE(hot_contexts.size() == 2000, "Expected 2000 hot contexts, got: " << hot_contexts.size());
+    std::pair<bool, std::string> res = testCPUSearch(lm, ARPA_TESTFILEPATH, &hot_contexts);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(backoff_scores) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    HotContextTable hot_contexts(lm, 500);
+    CPUSearcher cold(lm);
+    CPUSearcher hot(lm, &hot_contexts);
+
+    //Expected values computed by hand from the arpa file.
+    std::string ngrams[4] = {"<s> the european parliament adjourned", "of the session", "the resumption of", "parliament adjourned on friday"};
+    float expected[4] = {-1.598683, -2.584211, -0.705991, -0.945827};
+
+    for (int i = 0; i < 4; i++) {
+        std::vector<unsigned int> query = ngram2query(lm, ngrams[i]);
+        float cold_score = cold.scoreNgram(query.data());
+        float hot_score = hot.scoreNgram(query.data());
+        BOOST_CHECK_MESSAGE(float_compare(cold_score, expected[i]), "Expected: " << expected[i] << ", got: " << cold_score << " for: " << ngrams[i]);
+        BOOST_CHECK_MESSAGE(cold_score == hot_score, "Hot context lookup changed the score of: " << ngrams[i]);
+    }
+    BOOST_CHECK_MESSAGE(hot.hotContextHits > 0, "Expected at least one hot context hit.");
+
+    //Bogus queries score 0
+    std::vector<unsigned int> bogus(lm.metadata.max_ngram_order, 0);
+    BOOST_CHECK_MESSAGE(cold.scoreNgram(bogus.data()) == 0, "Bogus query should score 0.");
+}
+
+BOOST_AUTO_TEST_CASE(all_ngrams_reversed_contexts) {
+    LM lm;
+    createReversedTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::pair<bool, std::string> res = testCPUSearch(lm, ARPA_TESTFILEPATH);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(reversed_contexts_match_forward) {
+    LM forward;
+    createTrie(ARPA_TESTFILEPATH, forward, 31);
+    LM reversed;
+    createReversedTrie(ARPA_TESTFILEPATH, reversed, 31);
+    std::vector<unsigned int> queries = arpa2queries(forward);
+
+    CPUSearcher forward_searcher(forward);
+    CPUSearcher reversed_searcher(reversed);
+    std::vector<float> expected = forward_searcher.search(queries);
+    std::vector<float> results = reversed_searcher.search(queries);
+    for (size_t i = 0; i < results.size(); i++) {
+        BOOST_REQUIRE_MESSAGE(float_compare(results[i], expected[i]), "Expected " << expected[i] << " got " << results[i] << " at " << i);
+    }
+
+    std::vector<unsigned int> query = ngram2query(reversed, "<s> the european parliament adjourned");
+    float score = reversed_searcher.scoreNgram(query.data());
+    BOOST_CHECK_MESSAGE(float_compare(score, -1.598683), "Expected: -1.598683, got: " << score);
+}
+
+//A walk taken one step at a time scores exactly like scoreWindow, for every suffix of every query and both layouts.
+BOOST_AUTO_TEST_CASE(stepped_walks_match_windows) {
+    for (int reversed = 0; reversed < 2; reversed++) {
+        LM lm;
+        if (reversed) {
+            createReversedTrie(ARPA_TESTFILEPATH, lm, 7);
+        } else {
+            createTrie(ARPA_TESTFILEPATH, lm, 7);
+        }
+        std::vector<unsigned int> queries = arpa2queries(lm);
+        unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+        CPUSearcher searcher(lm);
+        for (size_t i = 0; i < queries.size(); i += max_ngram_order) {
+            const unsigned int * query = &queries[i];
+            unsigned short ngram_size = 0;
+            while (ngram_size < max_ngram_order && query[ngram_size] != 0) {
+                ngram_size++;
+            }
+            for (unsigned short start = 0; start < ngram_size; start++) {
+                SteppedWalk walk;
+                searcher.startWalk(&query[start], ngram_size - start, walk);
+                unsigned int steps = 0;
+                while (!searcher.stepWalk(walk)) {
+                    searcher.prefetchWalk(walk);
+                    BOOST_REQUIRE(++steps < 4*max_ngram_order*max_ngram_order);
+                }
+                float expected = searcher.scoreWindow(&query[start], ngram_size - start);
+                BOOST_REQUIRE_MESSAGE(walk.score == expected, "Expected " << expected << " got " << walk.score << " at " << i/max_ngram_order
+                    << " from word " << start << (reversed ? " with reversed contexts" : ""));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Result_cache)
+
+BOOST_AUTO_TEST_CASE(cached_scores_match) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    //Small budget, so that we evict a lot
+    ResultCache cache(64*1024, lm.metadata.max_ngram_order, 8);
+    BOOST_CHECK_MESSAGE(cache.memoryUsage() <= 64*1024 + 8*1024, "Cache exceeds its budget: " << cache.memoryUsage());
+    CPUSearcher cached(lm, nullptr, &cache);
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<float> results = cached.search(queries);
+        for (size_t i = 0; i < results.size(); i++) {
+            BOOST_REQUIRE_MESSAGE(results[i] == expected[i], "Pass " << pass << ": expected " << expected[i] << " got " << results[i] << " at " << i);
+        }
+    }
+    BOOST_CHECK_MESSAGE(cache.size() <= cache.capacity(), "Cache holds " << cache.size() << " entries, capacity " << cache.capacity());
+
+    //Large budget: the second pass should only hit
+    ResultCache big_cache(64*1024*1024, lm.metadata.max_ngram_order);
+    CPUSearcher big(lm, nullptr, &big_cache);
+    big.search(queries);
+    size_t misses = big.cacheMisses;
+    std::vector<float> results = big.search(queries);
+    BOOST_CHECK_MESSAGE(big.cacheMisses == misses, "Expected no misses on the second pass, got: " << big.cacheMisses - misses);
+    BOOST_CHECK_MESSAGE(results == expected, "Cached results differ from uncached ones.");
+}
+
+BOOST_AUTO_TEST_CASE(clock_eviction) {
+    unsigned int key[3] = {0, 0, 0};
+    float score;
+    ResultCache cache(0, 3, 1); //The smallest cache: 4 slots, 3 entries
+    BOOST_REQUIRE_EQUAL(cache.capacity(), 3);
+    for (unsigned int i = 1; i <= 3; i++) {
+        key[0] = i;
+        cache.insert(key, (float)i);
+    }
+    //Inserting what is already there evicts nothing
+    key[0] = 2;
+    cache.insert(key, 2);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+    for (unsigned int i = 1; i <= 3; i++) {
+        key[0] = i;
+        BOOST_CHECK(cache.find(key, score) && score == i);
+    }
+
+    //Every entry has been used: the hand clears all the bits and evicts the first entry it comes back to
+    key[0] = 4;
+    cache.insert(key, 4);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+    //The newcomer starts referenced while the survivors lost their bits, so the next insert evicts one of them
+    key[0] = 5;
+    cache.insert(key, 5);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+    key[0] = 4;
+    BOOST_CHECK(cache.find(key, score) && score == 4);
+    key[0] = 5;
+    BOOST_CHECK(cache.find(key, score) && score == 5);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_cache) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    ResultCache cache(256*1024, lm.metadata.max_ngram_order, 4);
+    const int num_threads = 4;
+    std::vector<std::vector<float> > results(num_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            CPUSearcher searcher(lm, nullptr, &cache);
+            results[t] = searcher.search(queries);
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int t = 0; t < num_threads; t++) {
+        BOOST_CHECK_MESSAGE(results[t] == expected, "Thread " << t << " got different results than the uncached search.");
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Batch_preprocessing)
+
+BOOST_AUTO_TEST_CASE(unique_and_scatter) {
+    const unsigned short width = 4;
+    //Random queries over a small vocabulary with zero padding so that there are plenty of duplicates. Large IDs need several radix passes.
+    std::vector<unsigned int> queries;
+    srand(42);
+    for (int i = 0; i < 20000; i++) {
+        unsigned short len = 1 + rand() % width;
+        for (unsigned short j = 0; j < width; j++) {
+            unsigned int id = 1 + rand() % 6;
+            if (id == 6) {
+                id = 5000000 + rand() % 3;
+            }
+            queries.push_back(j < len ? id : 0);
+        }
+    }
+    DedupedBatch batch;
+    dedupQueries(queries.data(), queries.size()/width, width, batch);
+    size_t num_unique = batch.numUnique(width);
+    BOOST_CHECK_MESSAGE(num_unique < queries.size()/width, "Expected duplicates, got " << num_unique << " unique queries.");
+
+    std::set<std::vector<unsigned int> > expected_unique;
+    for (size_t i = 0; i < queries.size(); i += width) {
+        expected_unique.insert(std::vector<unsigned int>(&queries[i], &queries[i + width]));
+    }
+    BOOST_CHECK_MESSAGE(expected_unique.size() == num_unique, "Expected " << expected_unique.size() << " unique queries, got " << num_unique);
+
+    //The unique queries come out sorted, which is also the order of the set.
+    std::vector<std::vector<unsigned int> > unique;
+    for (size_t i = 0; i < num_unique; i++) {
+        unique.push_back(std::vector<unsigned int>(&batch.unique_queries[i*width], &batch.unique_queries[(i + 1)*width]));
+    }
+    BOOST_CHECK_MESSAGE(std::equal(unique.begin(), unique.end(), expected_unique.begin()), "Unique queries are not sorted.");
+
+    //Scattering the unique queries themselves must give back the original batch.
+    std::vector<std::vector<unsigned int> > scattered(queries.size()/width);
+    scatterResults(unique.data(), batch, scattered.data());
+    for (size_t i = 0; i < scattered.size(); i++) {
+        BOOST_REQUIRE_MESSAGE(std::equal(scattered[i].begin(), scattered[i].end(), &queries[i*width]), "Wrong query scattered to position " << i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(deduplicated_search) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    //Repeat the batch so that every query has a duplicate
+    std::vector<unsigned int> doubled(queries);
+    doubled.insert(doubled.end(), queries.begin(), queries.end());
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(doubled);
+
+    CPUSearcher dedup(lm);
+    dedup.deduplicate = true;
+    std::vector<float> results = dedup.search(doubled);
+    BOOST_CHECK_MESSAGE(results == expected, "Deduplicated results differ from the plain ones.");
+    BOOST_CHECK_MESSAGE(dedup.uniqueRatio() <= 0.5, "Expected at most half of the queries to be unique, got: " << dedup.uniqueRatio());
+}
+
+BOOST_AUTO_TEST_CASE(reordered_search) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    ResultCache cache(1024*1024, lm.metadata.max_ngram_order);
+    CPUSearcher reordered(lm, nullptr, &cache);
+    reordered.reorder = true;
+    std::vector<float> results = reordered.search(queries);
+    BOOST_CHECK_MESSAGE(results == expected, "Reordered results differ from the plain ones.");
+
+    //Only the first two words take part in the sort and it is stable.
+    std::vector<size_t> order = radixSortQueries(queries.data(), queries.size()/lm.metadata.max_ngram_order, lm.metadata.max_ngram_order, 2);
+    for (size_t i = 1; i < order.size(); i++) {
+        const unsigned int * prev = &queries[order[i - 1]*lm.metadata.max_ngram_order];
+        const unsigned int * curr = &queries[order[i]*lm.metadata.max_ngram_order];
+        bool sorted = prev[0] < curr[0] || (prev[0] == curr[0] && (prev[1] < curr[1] || (prev[1] == curr[1] && order[i - 1] < order[i])));
+        BOOST_REQUIRE_MESSAGE(sorted, "Queries out of order at position " << i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scoring_queries) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    VocabTable vocab(lm.encode_map);
+    std::string sentence("the european parliament adjourned on friday");
+    std::vector<unsigned int> queries;
+    unsigned int num_queries = sent2ScoringQueries(sentence, queries, vocab, lm.metadata.max_ngram_order, true);
+    //Every word plus the end of sentence marker, but not the begin of sentence one.
+    BOOST_CHECK_MESSAGE(num_queries == 7, "Expected 7 queries, got: " << num_queries);
+    BOOST_CHECK_MESSAGE(queries.size() == num_queries*lm.metadata.max_ngram_order, "Wrong query vector size: " << queries.size());
+
+    std::vector<unsigned int> first = ngram2query(lm, "<s> the");
+    std::vector<unsigned int> last = ngram2query(lm, "parliament adjourned on friday </s>");
+    BOOST_CHECK_MESSAGE(std::equal(first.begin(), first.end(), queries.begin()), "Wrong first query.");
+    BOOST_CHECK_MESSAGE(std::equal(last.begin(), last.end(), queries.end() - lm.metadata.max_ngram_order), "Wrong last query.");
+}
+
+BOOST_AUTO_TEST_CASE(compact_queries) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    LM reversed;
+    createReversedTrie(ARPA_TESTFILEPATH, reversed, 7);
+    VocabTable vocab(lm.encode_map);
+    std::string sentences[3] = {"the european parliament adjourned on friday", "of", "resumption of the session of the european parliament"};
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+
+    for (int markers = 0; markers < 2; markers++) {
+        CompactQueries batch;
+        std::vector<unsigned int> padded;
+        for (int i = 0; i < 3; i++) {
+            sent2CompactQueries(sentences[i], batch, vocab, markers);
+            sent2ScoringQueries(sentences[i], padded, vocab, max_ngram_order, markers);
+        }
+        BOOST_CHECK_MESSAGE(batch.numQueries()*max_ngram_order == padded.size(), "Compact and padded batches have a different number of queries.");
+
+        //The compact batch expands to the same queries, plus bogus ones for the context only positions
+        std::vector<unsigned int> expanded = compact2paddedQueries(batch, max_ngram_order);
+        std::vector<unsigned int> scored;
+        for (size_t pos = 0; pos < batch.vocabIDs.size(); pos++) {
+            if (expanded[pos*max_ngram_order] != 0) {
+                scored.insert(scored.end(), &expanded[pos*max_ngram_order], &expanded[(pos + 1)*max_ngram_order]);
+            }
+        }
+        BOOST_CHECK_MESSAGE(scored == padded, "Expanded compact queries differ from the padded ones.");
+
+        //And scores the same, with either trie layout and with the result cache
+        ResultCache cache(1024*1024, max_ngram_order);
+        CPUSearcher plain(lm);
+        CPUSearcher cached(lm, nullptr, &cache);
+        CPUSearcher reversed_searcher(reversed);
+        std::vector<float> expected = plain.search(expanded);
+        std::vector<float> results = plain.searchCompact(batch);
+        std::vector<float> cached_results = cached.searchCompact(batch);
+        std::vector<float> reversed_results = reversed_searcher.searchCompact(batch);
+        BOOST_REQUIRE_MESSAGE(results.size() == batch.vocabIDs.size(), "Expected one result per position.");
+        for (size_t pos = 0; pos < results.size(); pos++) {
+            BOOST_CHECK_MESSAGE(results[pos] == expected[pos], "Expected " << expected[pos] << " got " << results[pos] << " at " << pos);
+            BOOST_CHECK_MESSAGE(cached_results[pos] == expected[pos], "Cached: expected " << expected[pos] << " got " << cached_results[pos]);
+            BOOST_CHECK_MESSAGE(float_compare(reversed_results[pos], expected[pos]), "Reversed: expected " << expected[pos] << " got " << reversed_results[pos]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(vocab_table) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    VocabTable vocab(lm.encode_map);
+    BOOST_CHECK_MESSAGE(vocab.size() == lm.encode_map.size(), "Expected " << lm.encode_map.size() << " words, got " << vocab.size());
+    for (auto& entry : lm.encode_map) {
+        BOOST_CHECK_MESSAGE(vocab.find(entry.first) == entry.second, "Wrong vocabID for " << entry.first);
+    }
+    BOOST_CHECK(vocab.unk == lm.encode_map["<unk>"]);
+    BOOST_CHECK(vocab.find("notaword") == vocab.unk);
+    BOOST_CHECK(vocab.find("") == vocab.unk);
+    BOOST_CHECK(vocab.find("parliamen") == vocab.unk);
+    BOOST_CHECK(vocab.begin_sentence == lm.encode_map["<s>"] && vocab.end_sentence == lm.encode_map["</s>"]);
+    //Without the special tokens, words would map to vocabID 0, which no searcher can score
+    std::unordered_map<std::string, unsigned int> no_unk = {{"<s>", 1}, {"</s>", 2}, {"the", 3}};
+    BOOST_CHECK_THROW(VocabTable table(no_unk), std::invalid_argument);
+    std::unordered_map<std::string, unsigned int> no_markers = {{"<unk>", 1}, {"the", 2}};
+    BOOST_CHECK_THROW(VocabTable table(no_markers), std::invalid_argument);
+    LM no_unk_lm;
+    no_unk_lm.encode_map = no_unk;
+    BOOST_CHECK_THROW(sent2vocabIDs(no_unk_lm, std::vector<std::string>(1, "the"), false), std::invalid_argument);
+
+    //Same tokens as boost::tokenizer on odd spacing
+    std::string sentence = "  the european  parliament notaword adjourned   on friday ";
+    std::vector<boost::string_view> tokens;
+    VocabTable::tokenize(sentence, tokens);
+    boost::char_separator<char> sep(" ");
+    boost::tokenizer<boost::char_separator<char> > tokenizer(sentence, sep);
+    std::vector<std::string> expected_tokens(tokenizer.begin(), tokenizer.end());
+    BOOST_REQUIRE_MESSAGE(tokens.size() == expected_tokens.size(), "Expected " << expected_tokens.size() << " tokens, got " << tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+        BOOST_CHECK_MESSAGE(tokens[i] == expected_tokens[i], "Expected token " << expected_tokens[i] << " got " << tokens[i]);
+    }
+
+    //Batched lookups, across several groups, agree with single ones and with the encode_map path
+    std::vector<boost::string_view> many;
+    for (int i = 0; i < 10; i++) {
+        many.insert(many.end(), tokens.begin(), tokens.end());
+    }
+    std::vector<unsigned int> batched(many.size());
+    vocab.findBatch(many.data(), many.size(), batched.data());
+    for (size_t i = 0; i < many.size(); i++) {
+        BOOST_CHECK_MESSAGE(batched[i] == vocab.find(many[i]), "Batched lookup of " << many[i] << " differs.");
+    }
+    for (int markers = 0; markers < 2; markers++) {
+        std::vector<unsigned int> ids;
+        vocab.sentence2vocabIDs(sentence, ids, markers);
+        BOOST_CHECK_MESSAGE(ids == sent2vocabIDs(lm, expected_tokens, markers), "Different vocabIDs from the encode_map path.");
+
+        //The query builders match the boost::tokenizer and encode_map path
+        std::vector<std::string> sentences = {sentence, "of", "resumption of the session"};
+        CompactQueries expected_batch;
+        CompactQueries batch;
+        CompactQueries single_batch;
+        std::vector<unsigned int> expected_padded;
+        std::vector<unsigned int> padded;
+        for (std::string& sent : sentences) {
+            boost::tokenizer<boost::char_separator<char> > words(sent, sep);
+            std::vector<unsigned int> expected_ids = sent2vocabIDs(lm, std::vector<std::string>(words.begin(), words.end()), markers);
+            expected_batch.sentence_starts.push_back(expected_batch.vocabIDs.size());
+            expected_batch.vocabIDs.insert(expected_batch.vocabIDs.end(), expected_ids.begin(), expected_ids.end());
+            vocabIDsent2scoringQueries(expected_ids, expected_padded, lm.metadata.max_ngram_order, markers);
+            sent2CompactQueries(sent, single_batch, vocab, markers);
+            sent2ScoringQueries(sent, padded, vocab, lm.metadata.max_ngram_order, markers);
+        }
+        sentences2CompactQueries(sentences, batch, vocab, markers);
+        BOOST_CHECK(batch.vocabIDs == expected_batch.vocabIDs && batch.sentence_starts == expected_batch.sentence_starts);
+        BOOST_CHECK(single_batch.vocabIDs == expected_batch.vocabIDs && single_batch.sentence_starts == expected_batch.sentence_starts);
+        BOOST_CHECK(padded == expected_padded);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Context_scoring)
+
+//Scores every word of a shuffled output vocabulary, with a few repeated positions, after contexts taken from the arpa file
+//and compares the rows with scoring every [context, word] window on its own.
+std::pair<bool, std::string> testContextScorer(LM& lm) {
+    std::stringstream error;
+    bool passes = true;
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    unsigned int vocab_size = lm.first_lvl.size()/(lm.metadata.reversed_contexts ? 4 : 3);
+    std::vector<unsigned int> output_vocab;
+    for (unsigned int id = 1; id <= vocab_size; id++) {
+        output_vocab.push_back(id);
+    }
+    output_vocab.push_back(lm.encode_map["<unk>"]);
+    output_vocab.push_back(lm.encode_map["the"]);
+    srand(7);
+    std::random_shuffle(output_vocab.begin(), output_vocab.end(), [](int n) { return rand() % n; });
+
+    //Every arpa ngram is used as a context, including full order ones that have to be truncated, padded with a zero in front.
+    std::vector<std::vector<unsigned int> > contexts(1); //And the empty context
+    ArpaReader infile(ARPA_TESTFILEPATH);
+    processed_line text = infile.readline();
+    while (!text.filefinished) {
+        std::vector<unsigned int> context(1, 0);
+        context.insert(context.end(), text.ngrams.begin(), text.ngrams.begin() + text.ngram_size);
+        contexts.push_back(context);
+        context.back() = 1 + (context.back() % vocab_size); //Mostly a context that is not in the model
+        contexts.push_back(context);
+        text = infile.readline();
+    }
+
+    ContextScorer scorer(lm, output_vocab);
+    CPUSearcher searcher(lm);
+    std::vector<float> row(scorer.rowSize());
+    std::vector<float> dense(scorer.rowSize());
+    SparseScores sparse;
+    ResolvedContext resolved;
+    std::vector<std::pair<unsigned int, float> > best;
+    for (std::vector<unsigned int>& context : contexts) {
+        scorer.scoreContext(context.data(), context.size(), row.data());
+
+        //The sparse row densifies to the same row, and its normalizer and best words agree with the dense ones.
+        scorer.resolve(context.data(), context.size(), resolved);
+        scorer.appendSparseRow(resolved, sparse);
+        size_t sparse_row = sparse.numRows() - 1;
+        scorer.densify(sparse, sparse_row, dense.data());
+        if (dense != row) {
+            passes = false;
+            error << "Densified sparse row differs from the dense one, " << sparse.rowSize(sparse_row) << " explicit words." << std::endl;
+        }
+        double mass = 0;
+        for (float score : row) {
+            mass += std::pow(10.0, score);
+        }
+        if (!float_compare(scorer.log10Sum(sparse, sparse_row), std::log10(mass))) {
+            passes = false;
+            error << "Expected a row log10 sum of " << std::log10(mass) << " got " << scorer.log10Sum(sparse, sparse_row) << std::endl;
+        }
+        std::vector<float> sorted_row(row);
+        std::sort(sorted_row.begin(), sorted_row.end(), std::greater<float>());
+        scorer.topK(sparse, sparse_row, 10, best);
+        for (size_t i = 0; i < best.size(); i++) {
+            if (best[i].second != sorted_row[i] || row[best[i].first] != best[i].second) {
+                passes = false;
+                error << "Top " << i << " should score " << sorted_row[i] << " got " << best[i].second << std::endl;
+            }
+        }
+
+        std::vector<unsigned int> window;
+        for (unsigned int word : context) {
+            if (word != 0) {
+                window.push_back(word);
+            }
+        }
+        if (window.size() > (size_t)(max_ngram_order - 1)) {
+            window.erase(window.begin(), window.end() - (max_ngram_order - 1));
+        }
+        window.push_back(0);
+        for (size_t pos = 0; pos < output_vocab.size(); pos++) {
+            window.back() = output_vocab[pos];
+            float expected = searcher.scoreWindow(window.data(), window.size());
+            if (!float_compare(row[pos], expected)) {
+                passes = false;
+                error << "Context of " << window.size() - 1 << " words, position " << pos << ": expected " << expected << " got " << row[pos] << std::endl;
+            }
+        }
+    }
+    if (sparse.numRows() != contexts.size() || sparse.positions.size() >= contexts.size()*output_vocab.size()/10) {
+        passes = false;
+        error << "Expected sparse rows to store far fewer than " << contexts.size()*output_vocab.size() << " scores, got "
+            << sparse.positions.size() << std::endl;
+    }
+    return std::pair<bool, std::string>(passes, error.str());
+}
+
+BOOST_AUTO_TEST_CASE(rows_match_windows) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::pair<bool, std::string> res = testContextScorer(lm);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(rows_match_windows_reversed_contexts) {
+    LM lm;
+    createReversedTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::pair<bool, std::string> res = testContextScorer(lm);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(beam_steps) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    std::vector<unsigned int> output_vocab;
+    for (unsigned int id = 1; id <= lm.first_lvl.size()/3; id++) {
+        output_vocab.push_back(id);
+    }
+    BeamScorer beam(lm, output_vocab);
+    CPUSearcher searcher(lm);
+    WorkStealingPool pool(3);
+
+    //Three hypotheses per step: two of them follow the same sentence so their states repeat, the third a different one.
+    std::string sentences[2] = {"resumption of the session of the european parliament adjourned on friday", "the european parliament adjourned"};
+    std::vector<std::vector<unsigned int> > words(2);
+    for (int i = 0; i < 2; i++) {
+        std::stringstream ss(sentences[i]);
+        std::string word;
+        while (ss >> word) {
+            words[i].push_back(lm.encode_map.find(word)->second);
+        }
+    }
+    std::vector<LMState> states(3, beam.initialState());
+    std::vector<std::vector<unsigned int> > prefixes(3, std::vector<unsigned int>(1, lm.encode_map["<s>"]));
+    std::vector<float> results(3*beam.rowSize());
+    std::vector<float> pooled_results(3*beam.rowSize());
+    std::vector<float> dense(beam.rowSize());
+    for (size_t step = 0; step < words[0].size(); step++) {
+        beam.score(states, results.data());
+        beam.score(states, pooled_results.data(), &pool);
+        BOOST_REQUIRE_MESSAGE(results == pooled_results, "Scoring with a pool changed the results at step " << step);
+        SparseScores sparse;
+        beam.scoreSparse(states, sparse);
+
+        for (size_t hyp = 0; hyp < states.size(); hyp++) {
+            //Score the next word of the sentence given the whole prefix
+            const std::vector<unsigned int>& sentence = words[hyp == 2 ? 1 : 0];
+            unsigned int next = sentence[step % sentence.size()];
+            std::vector<unsigned int> window(prefixes[hyp].end() - std::min(prefixes[hyp].size(), (size_t)(max_ngram_order - 1)), prefixes[hyp].end());
+            window.push_back(next);
+            float expected = searcher.scoreWindow(window.data(), window.size());
+            BOOST_CHECK_MESSAGE(float_compare(results[hyp*beam.rowSize() + next - 1], expected), "Step " << step << " hypothesis " << hyp
+                << ": expected " << expected << " got " << results[hyp*beam.rowSize() + next - 1]);
+            beam.contextScorer().densify(sparse, hyp, dense.data());
+            BOOST_CHECK_MESSAGE(std::equal(dense.begin(), dense.end(), &results[hyp*beam.rowSize()]), "Sparse row differs at step " << step);
+
+            states[hyp] = beam.extend(states[hyp], next);
+            prefixes[hyp].push_back(next);
+        }
+    }
+    BOOST_CHECK_MESSAGE(beam.distinctStatesScored*3 < beam.statesScored*2, "Repeated states should be scored once, scored "
+        << beam.distinctStatesScored << " distinct out of " << beam.statesScored);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(NBest_rescoring)
+
+std::vector<unsigned int> words2vocabIDs(LM& lm, std::string sentence) {
+    std::vector<unsigned int> ids;
+    std::stringstream ss(sentence);
+    std::string word;
+    while (ss >> word) {
+        ids.push_back(lm.encode_map.find(word)->second);
+    }
+    return ids;
+}
+
+BOOST_AUTO_TEST_CASE(shared_prefixes) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    std::string nbest[6] = {"resumption of the session of the european parliament", "resumption of the session", "resumption of the european parliament",
+        "resumption of the session of the european parliament", "the european parliament adjourned on friday", ""};
+
+    for (int markers = 0; markers < 2; markers++) {
+        std::vector<std::vector<unsigned int> > hypotheses;
+        for (std::string& hyp : nbest) {
+            hypotheses.push_back(words2vocabIDs(lm, hyp));
+        }
+        NBestRescorer rescorer(lm, markers);
+        NBestScores scores;
+        rescorer.rescore(hypotheses, scores);
+        BOOST_REQUIRE(scores.totals.size() == hypotheses.size());
+
+        //Same as scoring every hypothesis on its own
+        VocabTable vocab(lm.encode_map);
+        CPUSearcher searcher(lm);
+        for (size_t hyp = 0; hyp < hypotheses.size(); hyp++) {
+            std::vector<unsigned int> queries;
+            sent2ScoringQueries(nbest[hyp], queries, vocab, lm.metadata.max_ngram_order, markers);
+            std::vector<float> expected = searcher.search(queries);
+            BOOST_REQUIRE_MESSAGE(expected.size() == scores.word_starts[hyp + 1] - scores.word_starts[hyp], "Wrong number of words for " << nbest[hyp]);
+            double total = 0;
+            for (size_t word = 0; word < expected.size(); word++) {
+                BOOST_CHECK_MESSAGE(scores.word_scores[scores.word_starts[hyp] + word] == expected[word], "Word " << word << " of " << nbest[hyp]
+                    << ": expected " << expected[word] << " got " << scores.word_scores[scores.word_starts[hyp] + word]);
+                total += expected[word];
+            }
+            BOOST_CHECK_MESSAGE(float_compare(scores.totals[hyp], total), "Expected total " << total << " got " << scores.totals[hyp]);
+        }
+        BOOST_CHECK_MESSAGE(rescorer.trieEdges*3 < rescorer.wordsSeen*2, "Shared prefixes should be scored once, got " << rescorer.trieEdges
+            << " edges for " << rescorer.wordsSeen << " words.");
+        BOOST_CHECK(rescorer.queriesSearched <= rescorer.trieEdges);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lattice_and_lists) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    //"resumption of the (session|european parliament) (adjourned|)" as a lattice
+    std::vector<unsigned int> w = words2vocabIDs(lm, "resumption of the session european parliament adjourned");
+    Lattice lattice;
+    Lattice::Arc arcs[8] = {{0, 1, w[0]}, {1, 2, w[1]}, {2, 3, w[2]}, {3, 5, w[3]}, {3, 4, w[4]}, {4, 5, w[5]}, {5, 6, w[6]}, {0, 2, w[1]}};
+    lattice.arcs.assign(arcs, arcs + 8);
+    lattice.finals.push_back(5);
+    lattice.finals.push_back(6);
+
+    std::vector<std::vector<unsigned int> > paths;
+    NBestRescorer rescorer(lm);
+    NBestScores lattice_scores;
+    BOOST_CHECK(rescorer.rescore(lattice, 100, paths, lattice_scores));
+    BOOST_CHECK_MESSAGE(paths.size() == 8, "Expected 8 lattice paths, got " << paths.size());
+    std::vector<std::vector<unsigned int> > capped;
+    BOOST_CHECK(!latticePaths(lattice, 3, capped));
+    BOOST_CHECK(capped.size() == 3);
+    BOOST_CHECK(latticePaths(lattice, 8, capped));
+
+    //The dynamic program finds the best of the listed paths, with and without sentence markers
+    for (bool markers : {true, false}) {
+        NBestRescorer best_rescorer(lm, markers);
+        NBestScores listed;
+        best_rescorer.rescore(paths, listed);
+        size_t expected = std::max_element(listed.totals.begin(), listed.totals.end()) - listed.totals.begin();
+        std::vector<unsigned int> best_path;
+        NBestScores best;
+        BOOST_REQUIRE(best_rescorer.rescoreBest(lattice, best_path, best));
+        BOOST_CHECK(best_path == paths[expected]);
+        BOOST_CHECK(float_compare(best.totals[0], listed.totals[expected]));
+        BOOST_CHECK(best.word_scores.size() == listed.word_starts[expected + 1] - listed.word_starts[expected]);
+    }
+    Lattice unreachable = lattice;
+    unreachable.finals.assign(1, 9);
+    std::vector<unsigned int> best_path;
+    NBestScores best;
+    BOOST_CHECK(!rescorer.rescoreBest(unreachable, best_path, best));
+    Lattice cyclic = lattice;
+    cyclic.arcs.push_back({5, 3, w[3]});
+    BOOST_CHECK_THROW(rescorer.rescoreBest(cyclic, best_path, best), std::invalid_argument);
+
+    //Lists rescored in parallel match the serial results
+    std::vector<std::vector<std::vector<unsigned int> > > lists(20, paths);
+    for (size_t i = 0; i < lists.size(); i++) {
+        lists[i].resize(1 + i % paths.size());
+    }
+    WorkStealingPool pool(3);
+    std::vector<NBestScores> list_scores;
+    rescoreNBestLists(lm, lists, list_scores, pool);
+    BOOST_REQUIRE(list_scores.size() == lists.size());
+    for (size_t i = 0; i < lists.size(); i++) {
+        for (size_t hyp = 0; hyp < lists[i].size(); hyp++) {
+            BOOST_CHECK(list_scores[i].totals[hyp] == lattice_scores.totals[hyp]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Interpolation)
+
+BOOST_AUTO_TEST_CASE(mixes_models_with_different_vocabularies) {
+    //A bigram model that knows a word the toy model doesn't and only a few of its words
+    std::string small_arpa = boost::filesystem::unique_path("/tmp/small_%%%%%%.arpa").string();
+    std::ofstream out(small_arpa);
+    out << "\\data\\\nngram 1=6\nngram 2=3\n\n\\1-grams:\n-1.5\t<unk>\t0\n0\t<s>\t-0.3\n-0.9\t</s>\t0\n-0.8\tthe\t-0.2\n-1.0\tsession\t-0.1\n-1.2\tzebra\t-0.1\n"
+        << "\n\\2-grams:\n-0.2\t<s> the\n-0.3\tthe session\n-0.4\tthe zebra\n\n\\end\\\n";
+    out.close();
+    LM toy;
+    createTrie(ARPA_TESTFILEPATH, toy, 7);
+    LM small;
+    createTrie(small_arpa, small, 7);
+    boost::filesystem::remove(small_arpa);
+
+    std::vector<LM *> models = {&toy, &small};
+    SharedVocab vocab(models);
+    BOOST_CHECK(vocab.encode_map.size() == toy.encode_map.size() + 1);
+    unsigned int zebra = vocab.encode_map.find("zebra")->second;
+    BOOST_CHECK(vocab.model_ids[0][zebra] == toy.encode_map.find("<unk>")->second);
+    BOOST_CHECK(vocab.model_ids[1][zebra] == small.encode_map.find("zebra")->second);
+
+    InterpolatedSearcher searcher(models, vocab);
+    BOOST_CHECK(searcher.max_ngram_order == toy.metadata.max_ngram_order);
+    CPUSearcher toy_searcher(toy);
+    CPUSearcher small_searcher(small);
+    VocabTable toy_vocab(toy.encode_map);
+    VocabTable small_vocab(small.encode_map);
+    std::string sentences[3] = {"the session of the european parliament", "the zebra session", ""};
+    for (std::string& sentence : sentences) {
+        //All the weight on one model gives that model's scores
+        std::vector<float> toy_scores;
+        std::vector<float> small_scores;
+        float only_toy[2] = {1, 0};
+        float only_small[2] = {0, 1};
+        searcher.scoreSentence(sentence, true, &toy_scores, only_toy);
+        searcher.scoreSentence(sentence, true, &small_scores, only_small);
+        std::vector<unsigned int> queries;
+        sent2ScoringQueries(sentence, queries, toy_vocab, toy.metadata.max_ngram_order, true);
+        std::vector<float> expected = toy_searcher.search(queries);
+        BOOST_REQUIRE(expected.size() == toy_scores.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            BOOST_CHECK_MESSAGE(float_compare(toy_scores[i], expected[i]), "Word " << i << " of " << sentence << ": expected "
+                << expected[i] << " got " << toy_scores[i]);
+        }
+        queries.clear();
+        sent2ScoringQueries(sentence, queries, small_vocab, small.metadata.max_ngram_order, true);
+        expected = small_searcher.search(queries);
+        BOOST_REQUIRE(expected.size() == small_scores.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            BOOST_CHECK_MESSAGE(float_compare(small_scores[i], expected[i]), "Word " << i << " of " << sentence << ": expected "
+                << expected[i] << " got " << small_scores[i]);
+        }
+
+        //Default uniform weights mix the probabilities, not the log probabilities
+        std::vector<float> mixed;
+        double total = searcher.scoreSentence(sentence, true, &mixed);
+        double expected_total = 0;
+        for (size_t i = 0; i < mixed.size(); i++) {
+            float mix = std::log10(0.5*std::pow(10.0, toy_scores[i]) + 0.5*std::pow(10.0, small_scores[i]));
+            BOOST_CHECK_MESSAGE(float_compare(mixed[i], mix), "Word " << i << " of " << sentence << ": expected " << mix << " got " << mixed[i]);
+            expected_total += mixed[i];
+        }
+        BOOST_CHECK(float_compare(total, expected_total));
+    }
+
+    //A model without <unk> has nothing to map the words it doesn't know to
+    std::string no_unk_arpa = boost::filesystem::unique_path("/tmp/no_unk_%%%%%%.arpa").string();
+    std::ofstream no_unk_out(no_unk_arpa);
+    no_unk_out << "\\data\\\nngram 1=3\n\n\\1-grams:\n0\t<s>\t-0.3\n-0.9\t</s>\t0\n-0.8\tthe\t0\n\n\\end\\\n";
+    no_unk_out.close();
+    LM no_unk;
+    createTrie(no_unk_arpa, no_unk, 7);
+    boost::filesystem::remove(no_unk_arpa);
+    std::vector<LM *> with_no_unk = {&toy, &no_unk};
+    BOOST_CHECK_THROW(SharedVocab shared(with_no_unk), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Thread_pool)
+
+BOOST_AUTO_TEST_CASE(every_task_runs_once) {
+    const size_t num_tasks = 1000;
+    std::vector<std::atomic<int> > runs(num_tasks);
+    for (auto& run : runs) {
+        run = 0;
+    }
+    WorkStealingPool pool(4);
+    //Uneven tasks, all on the queue of a single worker so that the others have to steal them.
+    for (size_t i = 0; i < num_tasks; i++) {
+        pool.submit([&runs, i](unsigned int worker) {
+            if (i % 100 == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            runs[i]++;
+        }, 0);
+    }
+    pool.wait();
+    for (size_t i = 0; i < num_tasks; i++) {
+        BOOST_REQUIRE_MESSAGE(runs[i] == 1, "Task " << i << " ran " << runs[i] << " times.");
+    }
+
+    //The pool is reusable after a wait
+    std::atomic<int> second_batch(0);
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&second_batch](unsigned int worker) { second_batch++; });
+    }
+    pool.wait();
+    BOOST_CHECK_MESSAGE(second_batch == 10, "Expected 10 tasks in the second batch, got: " << second_batch);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_search) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    size_t num_queries = queries.size()/max_ngram_order;
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    WorkStealingPool pool(3);
+    std::vector<std::unique_ptr<CPUSearcher> > searchers;
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        searchers.push_back(std::unique_ptr<CPUSearcher>(new CPUSearcher(lm)));
+    }
+    std::vector<float> results(num_queries);
+    const size_t chunk = 997;
+    for (size_t start = 0; start < num_queries; start += chunk) {
+        size_t this_chunk = std::min(chunk, num_queries - start);
+        pool.submit([&, start, this_chunk](unsigned int worker) {
+            searchers[worker]->search(&queries[start*max_ngram_order], this_chunk, &results[start]);
+        });
+    }
+    pool.wait();
+    BOOST_CHECK_MESSAGE(results == expected, "Parallel results differ from the sequential ones.");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Streaming)
+
+BOOST_AUTO_TEST_CASE(bounded_queue) {
+    BoundedQueue<size_t> queue(5);
+    BOOST_CHECK_MESSAGE(queue.capacity() == 8, "Expected capacity 8, got: " << queue.capacity());
+
+    //Several producers and consumers: every item comes out exactly once.
+    const size_t items_per_producer = 20000;
+    const int num_producers = 3;
+    const int num_consumers = 3;
+    std::vector<std::atomic<int> > seen(items_per_producer*num_producers);
+    for (auto& item : seen) {
+        item = 0;
+    }
+    std::atomic<int> live_producers(num_producers);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < num_producers; p++) {
+        threads.push_back(std::thread([&, p]() {
+            for (size_t i = 0; i < items_per_producer; i++) {
+                queue.push(p*items_per_producer + i);
+            }
+            if (--live_producers == 0) {
+                queue.close();
+            }
+        }));
+    }
+    for (int c = 0; c < num_consumers; c++) {
+        threads.push_back(std::thread([&]() {
+            size_t item;
+            while (queue.pop(item)) {
+                seen[item]++;
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < seen.size(); i++) {
+        BOOST_REQUIRE_MESSAGE(seen[i] == 1, "Item " << i << " popped " << seen[i] << " times.");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bounded_queue_parks_idle_threads) {
+    BoundedQueue<size_t> queue(2);
+    //A consumer waiting on an empty queue sleeps instead of spinning, and wakes up for the next push and for close
+    std::vector<size_t> popped;
+    double cpu_seconds = 0;
+    std::thread consumer([&]() {
+        size_t item;
+        while (queue.pop(item)) {
+            popped.push_back(item);
+        }
+        timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpu_seconds = cpu.tv_sec + cpu.tv_nsec/1e9;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    queue.push(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    //A producer waiting on a full queue is woken up by pops
+    for (size_t i = 2; i < 100; i++) {
+        queue.push(i);
+    }
+    queue.close();
+    consumer.join();
+    BOOST_REQUIRE_EQUAL(popped.size(), 99);
+    BOOST_CHECK_EQUAL(popped.front(), 1);
+    BOOST_CHECK_EQUAL(popped.back(), 99);
+    BOOST_CHECK_MESSAGE(cpu_seconds < 0.1, "The idle consumer used " << cpu_seconds << "s of CPU.");
+}
+
+BOOST_AUTO_TEST_CASE(ordered_output) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    //Sentences of random words, with some empty lines
+    std::vector<std::string> words;
+    for (auto& entry : lm.encode_map) {
+        words.push_back(entry.first);
+    }
+    std::sort(words.begin(), words.end());
+    srand(7);
+    std::stringstream input;
+    std::vector<std::string> lines;
+    for (int i = 0; i < 500; i++) {
+        std::string line;
+        int length = (i % 37 == 0) ? 0 : 1 + rand() % 40;
+        for (int j = 0; j < length; j++) {
+            line += (j ? " " : "") + words[rand() % words.size()];
+        }
+        lines.push_back(line);
+        input << line << '\n';
+    }
+
+    //Small batches, few of them in flight and several threads in every stage, so that batches finish out of order.
+    StreamingOptions options;
+    options.tokenizer_threads = 2;
+    options.scorer_threads = 3;
+    options.sentences_per_batch = 7;
+    options.max_batches_in_flight = 3;
+    StreamingScorer scorer(lm, options);
+    std::stringstream output;
+    StreamingStats stats = scorer.run(input, output);
+    BOOST_CHECK_MESSAGE(stats.sentences == lines.size(), "Expected " << lines.size() << " sentences, got: " << stats.sentences);
+
+    CPUSearcher searcher(lm);
+    VocabTable vocab(lm.encode_map);
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::vector<unsigned int> queries;
+        unsigned int num_queries = lines[i].empty() ? 0 : sent2ScoringQueries(lines[i], queries, vocab, lm.metadata.max_ngram_order, true);
+        std::vector<float> results = searcher.search(queries);
+        double expected = 0;
+        for (unsigned int j = 0; j < num_queries; j++) {
+            expected += results[j];
+        }
+        double score;
+        output >> score;
+        BOOST_REQUIRE_MESSAGE(std::abs(score - expected) < 0.001, "Line " << i << ": expected " << expected << ", got: " << score);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Perf_counters)
+
+//Counters may well be unavailable on the test host, in which case the events read n/a but the phases are still timed.
+BOOST_AUTO_TEST_CASE(search_phase) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries;
+    std::string sentence = "he is a good man";
+    VocabTable vocab(lm.encode_map);
+    unsigned int num_queries = sent2ScoringQueries(sentence, queries, vocab, lm.metadata.max_ngram_order, true);
+    CPUSearcher searcher(lm);
+
+    PerfProfile profile(true);
+    profile.begin("search");
+    float sum = 0;
+    for (int i = 0; i < 1000; i++) {
+        std::vector<float> results = searcher.search(queries);
+        sum += results[0];
+    }
+    const PhaseSample& phase = profile.end(1000*num_queries);
+    BOOST_CHECK(sum < 0);
+    BOOST_CHECK_EQUAL(phase.name, "search");
+    BOOST_CHECK(phase.sample.seconds > 0);
+    for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+        BOOST_CHECK(phase.sample.valid[event] || phase.sample.values[event] == 0);
+    }
+    if (phase.sample.valid[PERF_INSTRUCTIONS]) {
+        BOOST_CHECK(phase.sample.values[PERF_INSTRUCTIONS] > 1000*num_queries);
+    }
+
+    std::stringstream report;
+    profile.report(report);
+    BOOST_CHECK(report.str().find("per query") != std::string::npos);
+
+    PerfProfile disabled(false);
+    disabled.begin("search");
+    BOOST_CHECK(!disabled.end().sample.valid[PERF_CYCLES]);
+    std::stringstream empty;
+    disabled.report(empty);
+    BOOST_CHECK(empty.str().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Traversal_profiler)
+
+//The profiler walks the trie like the searcher does, so it scores the same and both layouts back off to the same orders.
+BOOST_AUTO_TEST_CASE(replays_like_the_searcher) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    LM reversed;
+    createReversedTrie(ARPA_TESTFILEPATH, reversed, 7);
+    std::string sentences[3] = {"the european parliament adjourned on friday", "of", "resumption of the session of the european parliament"};
+    VocabTable vocab(lm.encode_map);
+    CompactQueries batch;
+    for (int i = 0; i < 3; i++) {
+        sent2CompactQueries(sentences[i], batch, vocab, true);
+    }
+
+    TraversalProfiler forward_profiler(lm);
+    TraversalProfiler reversed_profiler(reversed);
+    CPUSearcher searcher(lm);
+    std::vector<float> expected = searcher.searchCompact(batch);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    for (size_t sentence = 0; sentence < batch.numSentences(); sentence++) {
+        for (unsigned int pos = batch.sentence_starts[sentence] + 1; pos < batch.sentenceEnd(sentence); pos++) {
+            unsigned int window_start = std::max<int>(batch.sentence_starts[sentence], pos + 1 - max_ngram_order);
+            float forward_score = forward_profiler.scoreWindow(&batch.vocabIDs[window_start], pos + 1 - window_start);
+            float reversed_score = reversed_profiler.scoreWindow(&batch.vocabIDs[window_start], pos + 1 - window_start);
+            BOOST_CHECK_MESSAGE(forward_score == expected[pos], "Expected " << expected[pos] << " got " << forward_score << " at " << pos);
+            BOOST_CHECK_MESSAGE(float_compare(reversed_score, expected[pos]), "Reversed: expected " << expected[pos] << " got " << reversed_score);
+        }
+    }
+    BOOST_CHECK(forward_profiler.backoff_depth == reversed_profiler.backoff_depth);
+
+    TraversalProfiler replayed(lm);
+    replayed.replay(batch);
+    BOOST_CHECK_EQUAL(replayed.lookups, batch.numQueries());
+    BOOST_CHECK(replayed.nodes_histogram == forward_profiler.nodes_histogram);
+    BOOST_CHECK(replayed.hits == forward_profiler.hits && replayed.attempts == forward_profiler.attempts);
+    size_t lookups = 0;
+    for (size_t order = 0; order < max_ngram_order; order++) {
+        lookups += replayed.backoff_depth[order];
+        BOOST_CHECK(replayed.hits[order] <= replayed.attempts[order]);
+    }
+    BOOST_CHECK_EQUAL(lookups, replayed.lookups);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Latency)
+
+BOOST_AUTO_TEST_CASE(histogram_precision) {
+    std::mt19937_64 rng(5);
+    for (int i = 0; i < 100000; i++) {
+        uint64_t value = rng() >> (rng() % 64);
+        unsigned int bucket = LatencyHistogram::bucketOf(value);
+        BOOST_REQUIRE(bucket < LatencyHistogram::NUM_BUCKETS);
+        uint64_t upper = LatencyHistogram::bucketUpperBound(bucket);
+        BOOST_REQUIRE_MESSAGE(upper >= value && upper - value <= value/64, value << " went to a bucket ending at " << upper);
+        BOOST_REQUIRE(bucket == 0 || LatencyHistogram::bucketUpperBound(bucket - 1) < value);
+    }
+
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 100000; value++) {
+        histogram.record(value);
+    }
+    double percentiles[4] = {50, 90, 99, 99.9};
+    for (double percentile : percentiles) {
+        double expected = percentile*1000;
+        BOOST_CHECK_MESSAGE(std::abs(histogram.percentile(percentile) - expected) <= expected/64 + 1, "p" << percentile << " is "
+            << histogram.percentile(percentile));
+    }
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 100000);
+    BOOST_CHECK_EQUAL(histogram.max(), 100000);
+    BOOST_CHECK_CLOSE(histogram.mean(), 50000.5, 0.001);
+}
+
+//Every thread records into its own histogram and the summary sees all of them.
+BOOST_AUTO_TEST_CASE(recorder_merges_threads) {
+    LatencyRecorder recorder("test");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(std::thread([&recorder, t]() {
+            for (int i = 0; i < 1000; i++) {
+                recorder.record(1000*(t + 1));
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    LatencySummary summary = recorder.summary();
+    BOOST_CHECK_EQUAL(summary.count, 4000);
+    BOOST_CHECK_EQUAL(summary.max_ns, 4000);
+    BOOST_CHECK(summary.p50_ns >= 2000 && summary.p50_ns <= 2000 + 2000/64);
+    std::stringstream json;
+    summary.writeJSON(json);
+    BOOST_CHECK(json.str().find("\"p99.9\"") != std::string::npos);
+
+    recorder.reset();
+    BOOST_CHECK_EQUAL(recorder.summary().count, 0);
+    recorder.record(10);
+    BOOST_CHECK_EQUAL(recorder.summary().count, 1);
+
+    //Searchers record a sample per batch and per compact sentence
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 7);
+    CPUSearcher searcher(lm);
+    LatencyRecorder batches("batch");
+    searcher.latency = &batches;
+    std::string sentence = "he is a good man";
+    VocabTable vocab(lm.encode_map);
+    std::vector<unsigned int> queries;
+    sent2ScoringQueries(sentence, queries, vocab, lm.metadata.max_ngram_order, true);
+    searcher.search(queries);
+    searcher.search(queries);
+    CompactQueries batch;
+    sent2CompactQueries(sentence, batch, vocab, true);
+    sent2CompactQueries(sentence, batch, vocab, true);
+    sent2CompactQueries(sentence, batch, vocab, true);
+    searcher.searchCompact(batch);
+    BOOST_CHECK_EQUAL(batches.summary().count, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Query_server)
+
+BOOST_AUTO_TEST_CASE(micro_batches) {
+    MicroBatcher batcher(2, 100, std::chrono::milliseconds(20), 1000);
+    std::vector<size_t> scored;
+    auto submit = [&](size_t num_requests) {
+        for (size_t i = 0; i < num_requests; i++) {
+            MicroBatcher::Request request;
+            request.queries.resize(3*2, 1);
+            request.done = [&scored](const float *, size_t num_scores) { scored.push_back(num_scores); };
+            request.arrival = std::chrono::steady_clock::now();
+            batcher.submit(std::move(request));
+        }
+    };
+    std::vector<MicroBatcher::Request> batch;
+
+    //Small requests wait for each other until the oldest one is due
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    submit(10);
+    BOOST_REQUIRE(batcher.nextBatch(batch));
+    BOOST_CHECK_EQUAL(batch.size(), 10);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    //A full batch goes right away, with as many whole requests as fit
+    submit(50);
+    BOOST_REQUIRE(batcher.nextBatch(batch));
+    BOOST_CHECK_EQUAL(batch.size(), 33);
+    batch[0].done(nullptr, 3);
+    BOOST_CHECK_EQUAL(scored.size(), 1);
+
+    //What is left is still handed out after closing
+    batcher.close();
+    BOOST_REQUIRE(batcher.nextBatch(batch));
+    BOOST_CHECK_EQUAL(batch.size(), 17);
+    BOOST_CHECK(!batcher.nextBatch(batch));
+    BOOST_CHECK_EQUAL(batcher.num_requests.load(), 60);
+    BOOST_CHECK_EQUAL(batcher.num_batches.load(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(scores_over_a_socket) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    size_t num_queries = queries.size()/max_ngram_order;
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    QueryServerOptions options;
+    options.socket_path = boost::filesystem::unique_path("/tmp/glm_%%%%%%.sock").string();
+    options.max_wait_us = 2000;
+    options.scorer_threads = 2;
+    options.max_request_ngrams = 1000;
+    LatencyRecorder latency("request");
+    options.latency = &latency;
+    QueryServer server(lm, options);
+    std::thread serving([&]() { server.run(); });
+
+    //Decoders sending a few ngrams at a time
+    const unsigned int num_clients = 4;
+    const size_t chunk = 7;
+    std::vector<float> results(num_queries);
+    std::vector<std::thread> clients;
+    for (unsigned int client_id = 0; client_id < num_clients; client_id++) {
+        clients.push_back(std::thread([&, client_id]() {
+            QueryClient client(options.socket_path);
+            for (size_t start = client_id*chunk; start < num_queries; start += num_clients*chunk) {
+                size_t end = std::min(start + chunk, num_queries);
+                std::vector<unsigned int> request(&queries[start*max_ngram_order], &queries[end*max_ngram_order]);
+                std::vector<float> scores = client.score(request);
+                std::copy(scores.begin(), scores.end(), &results[start]);
+            }
+        }));
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    BOOST_CHECK_MESSAGE(results == expected, "Served scores differ from the searcher's.");
+
+    QueryClient client(options.socket_path);
+    BOOST_CHECK_EQUAL(client.maxNgramOrder(), max_ngram_order);
+    std::vector<unsigned int> vocabIDs = client.lookup("<s> the no_such_word");
+    BOOST_REQUIRE_EQUAL(vocabIDs.size(), 3);
+    BOOST_CHECK_EQUAL(vocabIDs[0], lm.encode_map["<s>"]);
+    BOOST_CHECK_EQUAL(vocabIDs[1], lm.encode_map["the"]);
+    BOOST_CHECK_EQUAL(vocabIDs[2], lm.encode_map["<unk>"]);
+    BOOST_CHECK(client.score(std::vector<unsigned int>()).empty());
+    //Bad requests get an error, and the server hangs up
+    std::vector<unsigned int> unknown(max_ngram_order, 1 << 30);
+    BOOST_CHECK_THROW(client.score(unknown), std::runtime_error);
+    QueryClient other(options.socket_path);
+    BOOST_CHECK_THROW(other.score(std::vector<unsigned int>(1001*max_ngram_order, 1)), std::runtime_error);
+
+    server.stop();
+    serving.join();
+    BOOST_CHECK(!boost::filesystem::exists(options.socket_path));
+    size_t num_requests = (num_queries + chunk - 1)/chunk;
+    BOOST_CHECK_EQUAL(latency.summary().count, num_requests);
+    std::stringstream stats;
+    server.printStats(stats);
+    BOOST_CHECK_MESSAGE(stats.str().find("Requests: " + std::to_string(num_requests) + ",") == 0, stats.str());
+}
+
+BOOST_AUTO_TEST_CASE(drops_clients_that_stop_reading) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    QueryServerOptions options;
+    options.socket_path = boost::filesystem::unique_path("/tmp/glm_%%%%%%.sock").string();
+    options.max_outbound_bytes = 1 << 16;
+    QueryServer server(lm, options);
+    std::thread serving([&]() { server.run(); });
+
+    //A client that sends requests and never reads the responses, until the server gives up on it
+    int stalled = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, options.socket_path.c_str());
+    BOOST_REQUIRE_EQUAL(connect(stalled, (sockaddr *)&address, sizeof(address)), 0);
+    QueryRequestHeader header = {SCORE_NGRAMS, {0, 0, 0}, 0, (uint32_t)(queries.size()/lm.metadata.max_ngram_order)};
+    size_t sent = 0;
+    while (querySendAll(stalled, &header, sizeof(header)) && querySendAll(stalled, queries.data(), queries.size()*sizeof(unsigned int))) {
+        header.request_id++;
+        sent++;
+        BOOST_REQUIRE_LT(sent, 100000);
+    }
+
+    //The only scorer still serves everybody else
+    QueryClient client(options.socket_path);
+    BOOST_CHECK(client.score(queries) == expected);
+
+    char buffer[4096];
+    while (recv(stalled, buffer, sizeof(buffer), 0) > 0) {}
+    ::close(stalled);
+    server.stop();
+    serving.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Async_search)
+
+BOOST_AUTO_TEST_CASE(futures_and_callbacks) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    size_t num_queries = queries.size()/max_ngram_order;
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    AsyncSearchOptions options;
+    options.threads = 3;
+    options.max_in_flight = 4;
+    options.chunk_ngrams = 5;
+    LatencyRecorder latency("request");
+    options.latency = &latency;
+    AsyncSearcher searcher(lm, options);
+
+    //More requests than may be in flight: submit holds back until earlier ones complete
+    const size_t chunk = 11;
+    std::vector<AsyncQuery> pending;
+    std::vector<float> called_back(num_queries);
+    std::atomic<size_t> num_callbacks(0);
+    for (size_t start = 0; start < num_queries; start += chunk) {
+        size_t end = std::min(start + chunk, num_queries);
+        std::vector<unsigned int> request(&queries[start*max_ngram_order], &queries[end*max_ngram_order]);
+        float * out = &called_back[start];
+        pending.push_back(searcher.submit(request, [out, &num_callbacks](const std::vector<float>& scores, bool cancelled) {
+            BOOST_CHECK(!cancelled);
+            std::copy(scores.begin(), scores.end(), out);
+            num_callbacks++;
+        }));
+        BOOST_CHECK_LE(searcher.inFlight(), options.max_in_flight);
+    }
+    std::vector<float> results;
+    for (AsyncQuery& query : pending) {
+        std::vector<float> scores = query.scores.get();
+        results.insert(results.end(), scores.begin(), scores.end());
+    }
+    searcher.wait();
+    BOOST_CHECK_MESSAGE(results == expected, "Futures differ from the searcher's scores.");
+    BOOST_CHECK_MESSAGE(called_back == expected, "Callbacks differ from the searcher's scores.");
+    BOOST_CHECK_EQUAL(num_callbacks.load(), pending.size());
+    BOOST_CHECK_EQUAL(latency.summary().count, pending.size());
+    BOOST_CHECK_EQUAL(searcher.inFlight(), 0);
+    BOOST_CHECK(!pending[0].cancel()); //Too late
+
+    std::vector<unsigned int> ragged(max_ngram_order + 1, 1);
+    BOOST_CHECK_THROW(searcher.submit(ragged), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(backpressure_and_cancellation) {
+    LM lm;
+    createTrie(ARPA_TESTFILEPATH, lm, 31);
+    std::vector<unsigned int> queries = arpa2queries(lm);
+    CPUSearcher plain(lm);
+    std::vector<float> expected = plain.search(queries);
+
+    AsyncSearchOptions options;
+    options.threads = 1;
+    options.max_in_flight = 2;
+    AsyncSearcher searcher(lm, options);
+
+    //The first request holds the only worker in its callback
+    std::promise<void> started, release;
+    std::shared_future<void> gate = release.get_future().share();
+    AsyncQuery blocking = searcher.submit(queries, [&started, gate](const std::vector<float>&, bool) {
+        started.set_value();
+        gate.wait();
+    });
+    started.get_future().wait();
+
+    std::vector<unsigned int> request = queries;
+    AsyncQuery queued;
+    bool callback_cancelled = false;
+    std::thread::id callback_thread;
+    BOOST_REQUIRE(searcher.trySubmit(request, queued, [&callback_cancelled, &callback_thread](const std::vector<float>& scores, bool cancelled) {
+        callback_cancelled = cancelled && scores.empty();
+        callback_thread = std::this_thread::get_id();
+    }));
+    BOOST_CHECK(request.empty());
+    std::vector<unsigned int> refused = queries;
+    AsyncQuery full;
+    BOOST_CHECK(!searcher.trySubmit(refused, full));
+    BOOST_CHECK_EQUAL(refused.size(), queries.size());
+
+    //Cancelling the queued request doesn't answer it on this thread, and it keeps its slot until the worker drops it
+    BOOST_CHECK(queued.cancel());
+    BOOST_CHECK(!queued.cancel());
+    BOOST_CHECK(queued.scores.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+    BOOST_CHECK(!callback_cancelled);
+    BOOST_CHECK(!searcher.trySubmit(refused, full));
+    BOOST_CHECK_EQUAL(searcher.inFlight(), 2);
+
+    release.set_value();
+    BOOST_CHECK(blocking.scores.get() == expected);
+    BOOST_CHECK_THROW(queued.scores.get(), QueryCancelled);
+    BOOST_CHECK(callback_cancelled);
+    BOOST_CHECK(callback_thread != std::this_thread::get_id());
+    AsyncQuery last = searcher.submit(queries);
+    BOOST_CHECK(last.scores.get() == expected);
+    searcher.wait();
+    BOOST_CHECK_EQUAL(searcher.inFlight(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,10 @@
 #include "tests_common.hh"
 #include "trie_v2_impl.hh"
+#include "trie_stats_impl.hh"
 #include "lm_impl.hh"
+#include "memory_report_impl.hh"
+#include "../Benchmark/synthetic_arpa_impl.hh"
+#include "../Benchmark/perf_baseline.hh"
 
 BOOST_AUTO_TEST_SUITE(Trie_array)
 
@@ -28,6 +32,18 @@ BOOST_AUTO_TEST_CASE(Btree_trie_array_23) {
     BOOST_CHECK_MESSAGE(res.first, res.second);
 }
 
+BOOST_AUTO_TEST_CASE(Reversed_trie_array_31) {
+    unsigned short btree_node_size = 31;
+    std::pair<bool, std::string> res = test_reversed_trie(ARPA_TESTFILEPATH, btree_node_size);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
+BOOST_AUTO_TEST_CASE(Reversed_trie_array_7) {
+    unsigned short btree_node_size = 7;
+    std::pair<bool, std::string> res = test_reversed_trie(ARPA_TESTFILEPATH, btree_node_size);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(LM_serialization)
@@ -59,4 +75,334 @@ BOOST_AUTO_TEST_CASE(LM_serialization_test) {
     boost::filesystem::remove_all(s.str());
 }
 
+BOOST_AUTO_TEST_CASE(LM_serialization_reversed) {
+    std::stringstream s;
+    s << "/tmp/" << time(0) << "_reversed";
+
+    LM out_lm;
+    createReversedTrie(ARPA_TESTFILEPATH, out_lm, 31);
+    out_lm.writeBinary(s.str());
+
+    LM in_lm(s.str());
+    BOOST_CHECK_MESSAGE(in_lm.metadata.reversed_contexts, "The reversed layout flag was lost.");
+    BOOST_CHECK_MESSAGE(in_lm.metadata == out_lm.metadata, "Mismatch in the read in and written metadata.");
+    BOOST_CHECK_MESSAGE(out_lm.trieByteArray == in_lm.trieByteArray, "Read and written binary btree trie arrays differ.");
+    BOOST_CHECK_MESSAGE(out_lm.first_lvl == in_lm.first_lvl, "Read and written binary first_lvl arrays differ.");
+
+    boost::filesystem::remove_all(s.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Pruning)
+
+//Sum of p(w|context) over the vocabulary, <s> excluded as it is never predicted.
+double contextMass(ArpaModel& arpa, std::string context) {
+    std::vector<unsigned int> ngram;
+    std::stringstream ss(context);
+    std::string word;
+    while (ss >> word) {
+        ngram.push_back(arpa.encode_map.find(word)->second);
+    }
+    ngram.push_back(0);
+    double mass = 0;
+    for (processed_line& unigram : arpa.orders[0]) {
+        if (unigram.ngrams[0] != arpa.encode_map.find("<s>")->second) {
+            ngram.back() = unigram.ngrams[0];
+            mass += std::pow(10.0, arpa.logProb(ngram.data(), ngram.size()));
+        }
+    }
+    return mass;
+}
+
+//The first level ends with a spare entry holding the first line read after the unigrams, which is never looked up.
+bool sameFirstLevel(LM& left, LM& right, unsigned short entry_size) {
+    return left.first_lvl.size() == right.first_lvl.size() &&
+        std::equal(left.first_lvl.begin(), left.first_lvl.end() - entry_size, right.first_lvl.begin());
+}
+
+BOOST_AUTO_TEST_CASE(unpruned_model_builds_the_same_trie) {
+    ArpaModel arpa(ARPA_TESTFILEPATH);
+    LM from_file;
+    createTrie(ARPA_TESTFILEPATH, from_file, 31);
+    LM from_model;
+    buildTrie(arpa, from_model, 31);
+    BOOST_CHECK(from_file.trieByteArray == from_model.trieByteArray);
+    BOOST_CHECK(sameFirstLevel(from_file, from_model, 3));
+    BOOST_CHECK_EQUAL(arpa.estimateBinarySize(31, false), from_file.trieByteArray.size() + 4*from_file.first_lvl.size());
+
+    arpa.rewind();
+    LM reversed_from_file;
+    createReversedTrie(ARPA_TESTFILEPATH, reversed_from_file, 7);
+    LM reversed_from_model;
+    buildReversedTrie(arpa, reversed_from_model, 7);
+    BOOST_CHECK(reversed_from_file.trieByteArray == reversed_from_model.trieByteArray);
+    BOOST_CHECK(sameFirstLevel(reversed_from_file, reversed_from_model, 4));
+    BOOST_CHECK_EQUAL(arpa.estimateBinarySize(7, true), reversed_from_file.trieByteArray.size() + 4*reversed_from_file.first_lvl.size());
+}
+
+BOOST_AUTO_TEST_CASE(pruned_models_stay_normalized) {
+    std::string contexts[4] = {"of the", "the european", "<s> resumption of", "i"};
+    ArpaModel unpruned(ARPA_TESTFILEPATH);
+    for (int criterion = PRUNE_THRESHOLD; criterion <= PRUNE_RELATIVE_ENTROPY; criterion++) {
+        ArpaModel arpa(ARPA_TESTFILEPATH);
+        PruneOptions options;
+        options.criterion = (PruneCriterion)criterion;
+        options.threshold = (criterion == PRUNE_THRESHOLD) ? 0.3 : 1e-6;
+        size_t removed = arpa.prune(options);
+        BOOST_CHECK(removed > 0);
+        BOOST_CHECK_EQUAL(arpa.numNgrams() + removed, unpruned.numNgrams());
+        BOOST_CHECK(arpa.orders[0].size() == unpruned.orders[0].size());
+        for (std::string& context : contexts) {
+            double expected = contextMass(unpruned, context);
+            double mass = contextMass(arpa, context);
+            BOOST_CHECK_MESSAGE(std::fabs(mass - expected) < 1e-3, "p(w|" << context << ") sums to " << mass << " instead of " << expected);
+        }
+
+        //Every ngram left is in the trie with its probability
+        LM lm;
+        buildTrie(arpa, lm, 31);
+        for (unsigned short n = 1; n <= arpa.max_ngrams; n++) {
+            for (processed_line& line : arpa.orders[n - 1]) {
+                Entry_with_offset res = searchTrie(lm.trieByteArray, lm.first_lvl, line.ngrams, 31, n == arpa.max_ngrams);
+                BOOST_REQUIRE_MESSAGE(res.found && res.prob == line.score, "Missing or wrong pruned " << n << "-gram with probability " << line.score);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(target_size) {
+    for (int reversed = 0; reversed < 2; reversed++) {
+        size_t target_bytes = 200000;
+        ArpaModel arpa(ARPA_TESTFILEPATH);
+        PruneOptions options;
+        options.criterion = PRUNE_RELATIVE_ENTROPY;
+        options.target_bytes = target_bytes;
+        options.btree_node_size = 31;
+        options.reversed_contexts = reversed;
+        arpa.prune(options);
+
+        LM lm;
+        if (reversed) {
+            buildReversedTrie(arpa, lm, 31);
+        } else {
+            buildTrie(arpa, lm, 31);
+        }
+        size_t bytes = lm.trieByteArray.size() + 4*lm.first_lvl.size();
+        BOOST_CHECK_MESSAGE(bytes <= target_bytes, "The pruned model takes " << bytes << " bytes, more than " << target_bytes);
+        BOOST_CHECK_MESSAGE(bytes > target_bytes*9/10, "The pruned model takes " << bytes << " bytes, pruned too much for " << target_bytes);
+        BOOST_CHECK_EQUAL(arpa.estimateBinarySize(31, reversed), bytes);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Synthetic_arpa)
+
+BOOST_AUTO_TEST_CASE(valid_and_deterministic) {
+    SyntheticArpaOptions options;
+    options.max_order = 4;
+    options.vocab_size = 500;
+    options.counts = {3000, 4000, 2000};
+    options.seed = 7;
+    std::stringstream first;
+    SyntheticArpa(options).write(first);
+    std::stringstream second;
+    SyntheticArpa(options).write(second);
+    BOOST_CHECK(first.str() == second.str());
+
+    std::string path = boost::filesystem::unique_path("/tmp/synthetic_%%%%%%.arpa").string();
+    std::ofstream out(path);
+    out << first.str();
+    out.close();
+    //Both layouts need the prefix and the suffix of every ngram
+    std::pair<bool, std::string> res = test_trie(path, 31);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+    res = test_reversed_trie(path, 31);
+    BOOST_CHECK_MESSAGE(res.first, res.second);
+
+    //Backoffs normalize every context
+    ArpaModel arpa(path);
+    boost::filesystem::remove(path);
+    BOOST_CHECK_EQUAL(arpa.orders[1].size(), 3000);
+    for (unsigned short n = 1; n < arpa.max_ngrams; n++) {
+        for (size_t i = 0; i < arpa.orders[n - 1].size(); i += arpa.orders[n - 1].size()/5) {
+            std::string context;
+            for (unsigned int word : arpa.orders[n - 1][i].ngrams) {
+                context += arpa.decode_map[word] + " ";
+            }
+            if (arpa.orders[n - 1][i].ngrams.back() != arpa.encode_map["</s>"]) {
+                double mass = Pruning::contextMass(arpa, context);
+                BOOST_CHECK_MESSAGE(std::fabs(mass - 1) < 1e-4, "p(w|" << context << ") sums to " << mass);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Trie_stats)
+
+//Every byte after the 4 empty ones belongs to exactly one Btree, and every ngram is exactly one entry.
+BOOST_AUTO_TEST_CASE(accounts_for_every_byte_and_ngram) {
+    ArpaModel arpa(ARPA_TESTFILEPATH);
+    for (int reversed = 0; reversed < 2; reversed++) {
+        LM lm;
+        if (reversed) {
+            createReversedTrie(ARPA_TESTFILEPATH, lm, 7);
+        } else {
+            createTrie(ARPA_TESTFILEPATH, lm, 7);
+        }
+        TrieStats stats = trieStats(lm);
+        BOOST_CHECK_EQUAL(stats.btreeBytes() + 4, lm.trieByteArray.size());
+        for (const BtreeLevelStats& level : stats.levels) {
+            BOOST_CHECK_EQUAL(level.entries, arpa.orders[level.order - 1].size());
+            BOOST_CHECK(level.inner_nodes <= level.nodes && level.stumps <= level.btrees);
+            size_t histogram_btrees = 0;
+            for (const std::pair<const unsigned int, size_t>& bucket : level.depth_histogram) {
+                histogram_btrees += bucket.second;
+            }
+            BOOST_CHECK_EQUAL(histogram_btrees, level.btrees);
+            BOOST_CHECK_EQUAL(level.depth_histogram.begin()->second, level.stumps);
+        }
+        //Forward: one kind per order above unigrams. Reversed: contexts up to max order - 1 and predictions for every order.
+        size_t expected_levels = reversed ? 2*arpa.max_ngrams - 3 : arpa.max_ngrams - 1;
+        BOOST_CHECK_EQUAL(stats.levels.size(), expected_levels);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Perf_baseline)
+
+BOOST_AUTO_TEST_CASE(regressions_beyond_noise) {
+    BenchReport baseline;
+    const char * names[] = {"steady", "noisy", "slower", "faster"};
+    for (const char * name : names) {
+        BenchResult result;
+        result.name = name;
+        result.params = {{"node_size", 31}};
+        result.ops = 1;
+        result.repetitions = 5;
+        result.ns_per_op = benchStats({100, 101, 99, 100, 102});
+        baseline.results.push_back(result);
+    }
+    std::string path = boost::filesystem::unique_path("/tmp/baseline_%%%%%%.json").string();
+    baseline.writeJSON(path);
+    std::map<std::string, BenchStats> read = readBenchJSON(path);
+    boost::filesystem::remove(path);
+    BOOST_CHECK_EQUAL(read.size(), 4);
+    BOOST_CHECK_EQUAL(read["steady/node_size=31"].median, 100);
+    BOOST_CHECK_EQUAL(read["steady/node_size=31"].mad, 1);
+
+    BenchReport current = baseline;
+    current.results[0].ns_per_op = benchStats({104, 105, 103, 104, 106}); //Beyond the noise but within the tolerance
+    current.results[1].ns_per_op = benchStats({130, 80, 150, 95, 120}); //Beyond the tolerance but within the noise
+    current.results[2].ns_per_op = benchStats({130, 131, 129, 130, 132});
+    current.results[3].ns_per_op = benchStats({70, 71, 69, 70, 72});
+    current.results.push_back(current.results[0]);
+    current.results.back().name = "new";
+    std::vector<PerfComparison> comparisons = compareToBaseline(current.results, read, PerfThresholds());
+    BOOST_CHECK(comparisons[0].verdict == PerfVerdict::Unchanged);
+    BOOST_CHECK(comparisons[1].verdict == PerfVerdict::Unchanged);
+    BOOST_CHECK(comparisons[2].verdict == PerfVerdict::Regression);
+    BOOST_CHECK(comparisons[3].verdict == PerfVerdict::Improvement);
+    BOOST_CHECK(comparisons[4].verdict == PerfVerdict::Missing);
+    std::stringstream out;
+    BOOST_CHECK_EQUAL(printComparisons(out, comparisons), 1);
+
+    //Drift across runs widens the noise
+    std::vector<BenchReport> runs(3, current);
+    runs[1].results[2].ns_per_op.median = 100;
+    runs[2].results[2].ns_per_op.median = 160;
+    BenchReport combined = combineRuns(runs);
+    BOOST_CHECK_EQUAL(combined.results[2].ns_per_op.median, 130);
+    BOOST_CHECK_EQUAL(combined.results[2].ns_per_op.mad, 30);
+    BOOST_CHECK(perfVerdict(read["slower/node_size=31"], combined.results[2].ns_per_op, PerfThresholds()) == PerfVerdict::Unchanged);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(Memory_report)
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+//The accounting of a hash map matches what malloc hands out for it, but for the odd block carved from a free one whose remainder was
+//too small to split off.
+BOOST_AUTO_TEST_CASE(hash_maps_match_malloc) {
+    std::vector<std::string> words;
+    for (unsigned int i = 0; i < 3000; i++) {
+        words.push_back("w" + std::to_string(i) + (i % 3 ? "" : "_a_word_long_enough_for_the_heap"));
+    }
+    //mallinfo2 counts the blocks of the per thread caches of small freed blocks as in use, so empty them first
+    std::vector<void *> drained;
+    for (size_t size = 24; size <= 1032; size += 16) {
+        for (int i = 0; i < 8; i++) {
+            drained.push_back(malloc(size));
+        }
+    }
+    struct mallinfo2 before = mallinfo2();
+    std::unordered_map<std::string, unsigned int> * encode_map = new std::unordered_map<std::string, unsigned int>();
+    std::unordered_map<unsigned int, std::string> * decode_map = new std::unordered_map<unsigned int, std::string>();
+    encode_map->reserve(words.size());
+    decode_map->reserve(words.size());
+    for (unsigned int i = 0; i < words.size(); i++) {
+        encode_map->emplace(words[i], i);
+        decode_map->emplace(i, words[i]);
+    }
+    struct mallinfo2 after = mallinfo2();
+
+    MemoryReport report;
+    addHashMap(report, "encode_map", *encode_map);
+    addHashMap(report, "decode_map", *decode_map);
+    report.addAllocation("maps", sizeof(*encode_map));
+    report.addAllocation("maps", sizeof(*decode_map));
+    size_t malloced = (after.uordblks + after.hblkhd) - (before.uordblks + before.hblkhd);
+    size_t difference = std::max(malloced, report.heapAllocated()) - std::min(malloced, report.heapAllocated());
+    BOOST_CHECK_MESSAGE(difference <= malloced/1000, "Accounted " << report.heapAllocated() << " bytes, malloc has " << malloced);
+    BOOST_CHECK_EQUAL(report.components[2].allocations, 1000); //The long words
+    BOOST_CHECK_EQUAL(report.components[5].allocations, 1000);
+    delete encode_map;
+    delete decode_map;
+    for (void * block : drained) {
+        free(block);
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(loaded_model_against_smaps) {
+    std::stringstream s;
+    s << "/tmp/" << time(0) << "_memory";
+    LM out_lm;
+    createTrie(ARPA_TESTFILEPATH, out_lm, 31);
+    out_lm.writeBinary(s.str());
+    LM lm(s.str());
+    boost::filesystem::remove_all(s.str());
+
+    MemoryReport report = lm.memoryReport();
+    BOOST_CHECK_EQUAL(report.components[1].name, "trie byte array");
+    BOOST_CHECK_EQUAL(report.components[1].bytes, lm.metadata.byteArraySize);
+    BOOST_CHECK_EQUAL(report.components[2].bytes, lm.metadata.intArraySize*sizeof(unsigned int));
+    size_t page = sysconf(_SC_PAGESIZE);
+    BOOST_CHECK_EQUAL(report.mappedBytes(), (lm.metadata.byteArraySize + page - 1)/page*page + (lm.metadata.intArraySize*4 + page - 1)/page*page);
+    BOOST_CHECK(report.heapAllocated() >= report.heapBytes());
+
+    //Both files are mapped where the report says and, being read in full, resident
+    ProcessMemory process = readProcessMemory();
+    BOOST_REQUIRE(process.valid);
+    BOOST_CHECK(process.rss >= process.anonymous && process.rss > 0);
+    for (const MemoryComponent& component : report.components) {
+        if (component.mapping) {
+            const MappingMemory * mapping = process.find(component.mapping);
+            BOOST_REQUIRE_MESSAGE(mapping, component.name << " not in smaps");
+            BOOST_CHECK_EQUAL(mapping->end - mapping->start, component.allocated);
+            BOOST_CHECK_EQUAL(mapping->rss, component.allocated);
+            BOOST_CHECK(mapping->path.find(".bin") != std::string::npos);
+        }
+    }
+    std::stringstream printed;
+    report.print(printed, &process);
+    BOOST_CHECK(printed.str().find("mapped, resident") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,53 @@
+#pragma once
+#include "../Parser/tokenizer.hh"
+#include <vector>
+
+enum PruneCriterion {
+    PRUNE_NONE,
+    PRUNE_THRESHOLD, //|log10 p(w|h) - log10 p_backoff(w|h)| below the threshold: the ngram says little the backoff doesn't
+    PRUNE_RELATIVE_ENTROPY //Stolcke: the weighted relative entropy between the model with and without the ngram below the threshold
+};
+
+struct PruneOptions {
+    PruneCriterion criterion = PRUNE_NONE;
+    double threshold = 0;
+    size_t target_bytes = 0; //If not 0, the threshold is picked so that the binarized model fits in this many bytes
+    unsigned short btree_node_size = 31; //The layout the target size refers to
+    bool reversed_contexts = false;
+};
+
+/*An ARPA file held in memory order by order, each order sorted, so that ngrams can be pruned and backoffs renormalized before the
+  trie is built. It reads back like an ArpaReader, order by order, so the trie builders take it in place of the file.
+  Pruning never removes unigrams, nor an ngram that is the prefix or the suffix of one that stays, as the tries need both.*/
+class ArpaModel {
+    private:
+        unsigned short read_order = 0;
+        size_t read_pos = 0;
+        unsigned int begin_sentence;
+
+        const processed_line * find(const unsigned int * ngram, unsigned short ngram_size) const;
+        double logContextProb(const unsigned int * context, unsigned short context_size) const;
+        std::vector<std::vector<double> > pruneScores(PruneCriterion criterion) const;
+        std::vector<std::vector<bool> > survivors(const std::vector<std::vector<double> >& scores, double threshold) const;
+        size_t estimateSize(const std::vector<std::vector<bool> >& keep, unsigned short btree_node_size, bool reversed_contexts) const;
+        void renormalizeBackoffs(const std::vector<std::vector<std::vector<unsigned int> > >& lost_children);
+
+    public:
+        std::unordered_map<std::string, unsigned int> encode_map;
+        std::unordered_map<unsigned int, std::string> decode_map;
+        unsigned short max_ngrams;
+        std::vector<std::vector<processed_line> > orders; //orders[n - 1] holds the ngrams of order n
+
+        template<class StringType>
+        explicit ArpaModel(const StringType filename);
+        processed_line readline(); //Same as ArpaReader::readline
+        void rewind() {
+            read_order = 0;
+            read_pos = 0;
+        }
+
+        float logProb(const unsigned int * ngram, unsigned short ngram_size) const; //log10 p(last word | the others) with backoff
+        size_t numNgrams() const;
+        size_t estimateBinarySize(unsigned short btree_node_size, bool reversed_contexts) const; //Trie byte array plus first level
+        size_t prune(const PruneOptions& options); //Returns the number of ngrams removed
+};
@@ -0,0 +1,344 @@
+#pragma once
+#include "arpa_pruning.hh"
+#include <cmath>
+#include <limits>
+
+template<class StringType>
+ArpaModel::ArpaModel(const StringType filename) {
+    ArpaReader arpain(filename);
+    max_ngrams = arpain.max_ngrams;
+    orders.resize(max_ngrams);
+    processed_line text = arpain.readline();
+    while (!text.filefinished) {
+        orders[text.ngram_size - 1].push_back(text);
+        text = arpain.readline();
+    }
+    for (std::vector<processed_line>& order : orders) {
+        std::sort(order.begin(), order.end());
+    }
+    encode_map = arpain.encode_map;
+    decode_map = arpain.decode_map;
+    std::unordered_map<std::string, unsigned int>::iterator it = encode_map.find("<s>");
+    begin_sentence = (it != encode_map.end()) ? it->second : 0;
+}
+
+inline processed_line ArpaModel::readline() {
+    while (read_order < max_ngrams && read_pos == orders[read_order].size()) {
+        read_order++;
+        read_pos = 0;
+    }
+    if (read_order == max_ngrams) {
+        processed_line finished;
+        finished.ngram_size = 0;
+        finished.score = 0;
+        finished.backoff = 0;
+        finished.filefinished = true;
+        return finished;
+    }
+    return orders[read_order][read_pos++];
+}
+
+inline const processed_line * ArpaModel::find(const unsigned int * ngram, unsigned short ngram_size) const {
+    if (ngram_size == 0 || ngram_size > max_ngrams) {
+        return nullptr;
+    }
+    const std::vector<processed_line>& order = orders[ngram_size - 1];
+    std::vector<processed_line>::const_iterator it = std::lower_bound(order.begin(), order.end(), ngram,
+        [ngram_size](const processed_line& line, const unsigned int * key) {
+            return std::lexicographical_compare(line.ngrams.begin(), line.ngrams.end(), key, key + ngram_size);
+        });
+    if (it == order.end() || !std::equal(it->ngrams.begin(), it->ngrams.end(), ngram)) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+inline float ArpaModel::logProb(const unsigned int * ngram, unsigned short ngram_size) const {
+    float backoff = 0;
+    for (unsigned short start = 0; start < ngram_size; start++) {
+        const processed_line * line = find(ngram + start, ngram_size - start);
+        if (line) {
+            return backoff + line->score;
+        }
+        const processed_line * context = find(ngram + start, ngram_size - start - 1);
+        if (context) {
+            backoff += context->backoff;
+        }
+    }
+    return backoff; //Only for words outside the vocabulary
+}
+
+//log10 p(context) by the chain rule. A context that starts a sentence doesn't pay for the <s>.
+inline double ArpaModel::logContextProb(const unsigned int * context, unsigned short context_size) const {
+    double prob = 0;
+    for (unsigned short i = (context[0] == begin_sentence) ? 1 : 0; i < context_size; i++) {
+        prob += logProb(context, i + 1);
+    }
+    return prob;
+}
+
+inline size_t ArpaModel::numNgrams() const {
+    size_t total = 0;
+    for (const std::vector<processed_line>& order : orders) {
+        total += order.size();
+    }
+    return total;
+}
+
+inline std::vector<std::vector<double> > ArpaModel::pruneScores(PruneCriterion criterion) const {
+    std::vector<std::vector<double> > scores(max_ngrams);
+    for (unsigned short n = 2; n <= max_ngrams; n++) {
+        const std::vector<processed_line>& order = orders[n - 1];
+        std::vector<double>& order_scores = scores[n - 1];
+        order_scores.resize(order.size());
+        //Children of the same context are next to each other
+        size_t group_start = 0;
+        while (group_start < order.size()) {
+            const unsigned int * context = order[group_start].ngrams.data();
+            size_t group_end = group_start + 1;
+            while (group_end < order.size() && std::equal(context, context + n - 1, order[group_end].ngrams.begin())) {
+                group_end++;
+            }
+            const processed_line * context_line = find(context, n - 1);
+            float backoff = context_line ? context_line->backoff : 0;
+
+            if (criterion == PRUNE_THRESHOLD) {
+                for (size_t i = group_start; i < group_end; i++) {
+                    float backed_off = backoff + logProb(order[i].ngrams.data() + 1, n - 1);
+                    order_scores[i] = std::fabs(order[i].score - backed_off);
+                }
+            } else {
+                /*The ngram (h, w) goes: p(w|h) becomes bo'(h) p(w|h'), with bo'(h) renormalized without w, and every other backed off
+                  word of h moves from bo(h) to bo'(h). Weighted by p(h), that is the relative entropy of Stolcke (1998), in nats.*/
+                double explicit_mass = 0;
+                double lower_mass = 0;
+                std::vector<double> lower(group_end - group_start);
+                for (size_t i = group_start; i < group_end; i++) {
+                    lower[i - group_start] = std::pow(10.0, (double)logProb(order[i].ngrams.data() + 1, n - 1));
+                    explicit_mass += std::pow(10.0, (double)order[i].score);
+                    lower_mass += lower[i - group_start];
+                }
+                double context_prob = std::pow(10.0, logContextProb(context, n - 1));
+                double old_backoff = std::pow(10.0, (double)backoff);
+                for (size_t i = group_start; i < group_end; i++) {
+                    double prob = std::pow(10.0, (double)order[i].score);
+                    double lower_prob = lower[i - group_start];
+                    double numerator = 1 - explicit_mass + prob;
+                    double denominator = 1 - lower_mass + lower_prob;
+                    if (numerator <= 0 || denominator <= 0) {
+                        order_scores[i] = std::numeric_limits<double>::infinity();
+                        continue;
+                    }
+                    double new_backoff = numerator/denominator;
+                    double entropy = prob*(std::log(lower_prob) + std::log(new_backoff) - std::log(prob)) +
+                        (1 - explicit_mass)*(std::log(new_backoff) - std::log(old_backoff));
+                    order_scores[i] = -context_prob*entropy;
+                }
+            }
+            group_start = group_end;
+        }
+    }
+    return scores;
+}
+
+//Highest order first: an ngram stays if its score reaches the threshold or if a longer ngram that stays needs it.
+inline std::vector<std::vector<bool> > ArpaModel::survivors(const std::vector<std::vector<double> >& scores, double threshold) const {
+    std::vector<std::vector<bool> > keep(max_ngrams);
+    keep[0].assign(orders[0].size(), true);
+    for (unsigned short n = 2; n <= max_ngrams; n++) {
+        keep[n - 1].assign(orders[n - 1].size(), false);
+    }
+    for (unsigned short n = max_ngrams; n >= 2; n--) {
+        const std::vector<processed_line>& order = orders[n - 1];
+        for (size_t i = 0; i < order.size(); i++) {
+            if (!keep[n - 1][i] && scores[n - 1][i] < threshold) {
+                continue;
+            }
+            keep[n - 1][i] = true;
+            if (n > 2) {
+                const processed_line * prefix = find(order[i].ngrams.data(), n - 1);
+                const processed_line * suffix = find(order[i].ngrams.data() + 1, n - 1);
+                if (prefix) {
+                    keep[n - 2][prefix - orders[n - 2].data()] = true;
+                }
+                if (suffix) {
+                    keep[n - 2][suffix - orders[n - 2].data()] = true;
+                }
+            }
+        }
+    }
+    return keep;
+}
+
+//Bytes of the headers of the inner nodes of a Btree of num_entries, split the way array2balancedBtree does it.
+inline size_t innerNodeBytes(size_t num_entries, unsigned short btree_node_size) {
+    if (num_entries <= btree_node_size) {
+        return 0;
+    }
+    size_t child_entries = (num_entries - btree_node_size)/(btree_node_size + 1);
+    size_t bigger_children = (num_entries - btree_node_size) % (btree_node_size + 1);
+    size_t bytes = 4 + (4*(btree_node_size + 1))/2;
+    bytes += bigger_children*innerNodeBytes(child_entries + 1, btree_node_size);
+    bytes += (btree_node_size + 1 - bigger_children)*innerNodeBytes(child_entries, btree_node_size);
+    return bytes;
+}
+
+/*Every ngram is a Btree entry of 4 bytes of vocabID and its payload, every context with children adds the 4 byte size of its Btree.
+  The forward layout has a 12 byte payload below the max order and a 4 byte one at the max order. The reversed layout stores every
+  ngram as a prediction with a 4 byte payload and, below the max order, again as a context node with a 12 byte payload under its
+  suffix. The first level is an array of 3 (forward) or 4 (reversed) uints per word, plus one.*/
+inline size_t ArpaModel::estimateSize(const std::vector<std::vector<bool> >& keep, unsigned short btree_node_size, bool reversed_contexts) const {
+    size_t bytes = sizeof(unsigned int) + (reversed_contexts ? 4 : 3)*sizeof(unsigned int)*(orders[0].size() + 1);
+    for (unsigned short n = 2; n <= max_ngrams; n++) {
+        const std::vector<processed_line>& order = orders[n - 1];
+        size_t entries = 0;
+        size_t groups = 0;
+        size_t inner_bytes = 0;
+        size_t group_size = 0;
+        const processed_line * prev = nullptr;
+        for (size_t i = 0; i < order.size(); i++) {
+            if (!keep[n - 1][i]) {
+                continue;
+            }
+            entries++;
+            if (!prev || !std::equal(prev->ngrams.begin(), prev->ngrams.begin() + n - 1, order[i].ngrams.begin())) {
+                groups++;
+                inner_bytes += innerNodeBytes(group_size, btree_node_size);
+                group_size = 0;
+            }
+            group_size++;
+            prev = &order[i];
+        }
+        inner_bytes += innerNodeBytes(group_size, btree_node_size);
+        bool lastNgram = (n == max_ngrams);
+        if (!reversed_contexts) {
+            bytes += (lastNgram ? 8 : 16)*entries + 4*groups + inner_bytes;
+            continue;
+        }
+        bytes += 8*entries + 4*groups + inner_bytes;
+        if (!lastNgram) {
+            //Context nodes are the children of their suffix
+            std::vector<size_t> children(orders[n - 2].size(), 0);
+            for (size_t i = 0; i < order.size(); i++) {
+                if (keep[n - 1][i]) {
+                    const processed_line * parent = find(order[i].ngrams.data() + 1, n - 1);
+                    children[parent - orders[n - 2].data()]++;
+                }
+            }
+            bytes += 16*entries;
+            for (size_t num_children : children) {
+                if (num_children) {
+                    bytes += 4 + innerNodeBytes(num_children, btree_node_size);
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+inline size_t ArpaModel::estimateBinarySize(unsigned short btree_node_size, bool reversed_contexts) const {
+    std::vector<std::vector<bool> > keep(max_ngrams);
+    for (unsigned short n = 1; n <= max_ngrams; n++) {
+        keep[n - 1].assign(orders[n - 1].size(), true);
+    }
+    return estimateSize(keep, btree_node_size, reversed_contexts);
+}
+
+//Lowest order first, so that the lower order probabilities in the denominator are already final.
+inline void ArpaModel::renormalizeBackoffs(const std::vector<std::vector<std::vector<unsigned int> > >& lost_children) {
+    for (unsigned short n = 1; n < max_ngrams; n++) {
+        for (const std::vector<unsigned int>& context : lost_children[n - 1]) {
+            processed_line * context_line = const_cast<processed_line *>(find(context.data(), n));
+            if (!context_line) {
+                continue; //Pruned itself
+            }
+            const std::vector<processed_line>& children = orders[n];
+            std::vector<processed_line>::const_iterator child = std::lower_bound(children.begin(), children.end(), context,
+                [n](const processed_line& line, const std::vector<unsigned int>& key) {
+                    return std::lexicographical_compare(line.ngrams.begin(), line.ngrams.begin() + n, key.begin(), key.end());
+                });
+            double explicit_mass = 0;
+            double lower_mass = 0;
+            for (; child != children.end() && std::equal(context.begin(), context.end(), child->ngrams.begin()); child++) {
+                explicit_mass += std::pow(10.0, (double)child->score);
+                lower_mass += std::pow(10.0, (double)logProb(child->ngrams.data() + 1, n));
+            }
+            if (explicit_mass < 1 && lower_mass < 1) {
+                context_line->backoff = std::log10((1 - explicit_mass)/(1 - lower_mass));
+            }
+        }
+    }
+}
+
+inline size_t ArpaModel::prune(const PruneOptions& options) {
+    if (options.criterion == PRUNE_NONE || max_ngrams < 2) {
+        return 0;
+    }
+    std::vector<std::vector<double> > scores = pruneScores(options.criterion);
+    double threshold = options.threshold;
+
+    if (options.target_bytes) {
+        //Bigger thresholds prune more, so the smallest score that fits the budget is found by bisection over the sorted scores.
+        std::vector<double> candidates;
+        for (const std::vector<double>& order_scores : scores) {
+            for (double score : order_scores) {
+                if (score != std::numeric_limits<double>::infinity()) {
+                    candidates.push_back(score);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        candidates.push_back(std::numeric_limits<double>::infinity());
+        size_t low = 0;
+        size_t high = candidates.size() - 1;
+        //Thresholds are exclusive: candidates[i] prunes every score strictly below it
+        if (estimateSize(survivors(scores, -std::numeric_limits<double>::infinity()), options.btree_node_size, options.reversed_contexts) <= options.target_bytes) {
+            return 0;
+        }
+        while (low < high) {
+            size_t mid = (low + high)/2;
+            if (estimateSize(survivors(scores, std::nextafter(candidates[mid], std::numeric_limits<double>::infinity())),
+             options.btree_node_size, options.reversed_contexts) <= options.target_bytes) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        threshold = std::nextafter(candidates[low], std::numeric_limits<double>::infinity());
+        if (candidates[low] == std::numeric_limits<double>::infinity()) {
+            std::cerr << "The target size of " << options.target_bytes << " bytes can't be met by pruning, pruning as much as possible." << std::endl;
+        }
+    }
+
+    std::vector<std::vector<bool> > keep = survivors(scores, threshold);
+    std::vector<std::vector<std::vector<unsigned int> > > lost_children(max_ngrams);
+    size_t removed = 0;
+    for (unsigned short n = 2; n <= max_ngrams; n++) {
+        std::vector<processed_line> kept;
+        for (size_t i = 0; i < orders[n - 1].size(); i++) {
+            if (keep[n - 1][i]) {
+                kept.push_back(orders[n - 1][i]);
+                continue;
+            }
+            std::vector<unsigned int> context(orders[n - 1][i].ngrams.begin(), orders[n - 1][i].ngrams.begin() + n - 1);
+            if (lost_children[n - 2].empty() || lost_children[n - 2].back() != context) {
+                lost_children[n - 2].push_back(context);
+            }
+            removed++;
+        }
+        orders[n - 1].swap(kept);
+    }
+    renormalizeBackoffs(lost_children);
+
+    //Orders pruned away entirely are dropped, the new max order has no backoffs.
+    while (max_ngrams > 1 && orders[max_ngrams - 1].empty()) {
+        orders.pop_back();
+        max_ngrams--;
+    }
+    for (processed_line& line : orders[max_ngrams - 1]) {
+        line.backoff = 0;
+    }
+    rewind();
+    return removed;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "trie_v2_impl.hh"
+#include <map>
+
+/*Structure of the Btrees of one trie level. Forward tries have a single kind of Btree per order, "ngrams". Tries with reversed
+  contexts have "contexts" Btrees, whose entries are the context nodes of that many words, and "predictions" Btrees, whose entries
+  are the ngrams of that order. Histograms count Btrees: by number of entries, in buckets of powers of two, and by depth.*/
+struct BtreeLevelStats {
+    unsigned short order;
+    std::string kind;
+    size_t btrees = 0;
+    size_t entries = 0;
+    size_t nodes = 0;
+    size_t inner_nodes = 0;
+    size_t stumps = 0; //Btrees that are a single node
+    size_t header_bytes = 0; //The root size at the start of every Btree
+    size_t key_bytes = 0;
+    size_t offset_bytes = 0; //Child offsets of the inner nodes
+    size_t payload_bytes = 0;
+    std::map<size_t, size_t> size_histogram;
+    std::map<unsigned int, size_t> depth_histogram;
+
+    size_t totalBytes() const {
+        return header_bytes + key_bytes + offset_bytes + payload_bytes;
+    }
+    //Entries over the slots of the nodes that hold them
+    double fillFactor(unsigned short btree_node_size) const {
+        return nodes ? (double)entries/(nodes*btree_node_size) : 0;
+    }
+};
+
+struct TrieStats {
+    unsigned short btree_node_size;
+    bool reversed_contexts;
+    size_t first_level_bytes;
+    size_t byte_array_bytes;
+    std::vector<BtreeLevelStats> levels; //By order, contexts before predictions
+
+    //Bytes of the byte array that belong to some Btree. All but the 4 empty bytes at the start.
+    size_t btreeBytes() const {
+        size_t bytes = 0;
+        for (const BtreeLevelStats& level : levels) {
+            bytes += level.totalBytes();
+        }
+        return bytes;
+    }
+};
+
+TrieStats trieStats(LM& lm);
+void printTrieStats(std::ostream& out, const TrieStats& stats);
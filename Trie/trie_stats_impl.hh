@@ -0,0 +1,139 @@
+#pragma once
+#include "trie_stats.hh"
+#include <iomanip>
+
+inline BtreeLevelStats& levelStats(TrieStats& stats, unsigned short order, const std::string& kind) {
+    for (BtreeLevelStats& level : stats.levels) {
+        if (level.order == order && level.kind == kind) {
+            return level;
+        }
+    }
+    stats.levels.push_back(BtreeLevelStats());
+    stats.levels.back().order = order;
+    stats.levels.back().kind = kind;
+    return stats.levels.back();
+}
+
+//Adds the Btree starting at btree_start to the statistics of its level.
+inline void addBtreeStats(TrieStats& stats, LM& lm, size_t btree_start, unsigned short order, const std::string& kind, bool lastNgram) {
+    BtreeLevelStats& level = levelStats(stats, order, kind);
+    unsigned int payload_size = lastNgram ? 4 : 12;
+    size_t entries = 0;
+    size_t nodes = 0;
+    unsigned int depth = 0;
+    auto visit = [&](unsigned int node_depth, unsigned int node_entries, bool is_leaf) {
+        nodes++;
+        entries += node_entries;
+        depth = std::max(depth, node_depth);
+        if (!is_leaf) {
+            level.inner_nodes++;
+            level.offset_bytes += 4 + 2*(stats.btree_node_size + 1);
+        }
+    };
+    traverseBtreeNodes(lm.trieByteArray, btree_start, stats.btree_node_size, lastNgram, visit);
+
+    level.btrees++;
+    level.entries += entries;
+    level.nodes += nodes;
+    level.stumps += (nodes == 1);
+    level.header_bytes += 4;
+    level.key_bytes += 4*entries;
+    level.payload_bytes += payload_size*entries;
+    size_t bucket = 1;
+    while (bucket*2 <= entries) {
+        bucket *= 2;
+    }
+    level.size_histogram[bucket]++;
+    level.depth_histogram[depth]++;
+}
+
+/*Walks every Btree of the trie. Next level offsets are relative to the start of the Btree that holds the entry, and absolute (in units
+  of 4 bytes) from the first level.*/
+inline TrieStats trieStats(LM& lm) {
+    TrieStats stats;
+    stats.btree_node_size = lm.metadata.btree_node_size;
+    stats.reversed_contexts = lm.metadata.reversed_contexts;
+    stats.first_level_bytes = lm.first_lvl.size()*sizeof(unsigned int);
+    stats.byte_array_bytes = lm.trieByteArray.size();
+    unsigned short max_order = lm.metadata.max_ngram_order;
+
+    //Btrees still to visit: start, order, and for reversed contexts whether they hold predictions
+    struct PendingBtree {
+        size_t start;
+        unsigned short order;
+        bool predictions;
+    };
+    std::vector<PendingBtree> pending;
+    unsigned int first_lvl_width = stats.reversed_contexts ? 4 : 3;
+    for (size_t i = 0; i < lm.first_lvl.size()/first_lvl_width; i++) {
+        const unsigned int * entry = &lm.first_lvl[i*first_lvl_width];
+        if (entry[0]) {
+            pending.push_back({(size_t)entry[0]*4, 2, false});
+        }
+        if (stats.reversed_contexts && entry[1]) {
+            pending.push_back({(size_t)entry[1]*4, 2, true});
+        }
+    }
+
+    while (!pending.empty()) {
+        PendingBtree btree = pending.back();
+        pending.pop_back();
+        if (!stats.reversed_contexts) {
+            bool lastNgram = btree.order == max_order;
+            addBtreeStats(stats, lm, btree.start, btree.order, "ngrams", lastNgram);
+            if (!lastNgram) {
+                auto children = [&](unsigned int, unsigned int * payload) {
+                    if (payload[0]) {
+                        pending.push_back({btree.start + payload[0]*4, (unsigned short)(btree.order + 1), false});
+                    }
+                };
+                traverseBtree(lm.trieByteArray, btree.start, stats.btree_node_size, false, children);
+            }
+        } else if (btree.predictions) {
+            addBtreeStats(stats, lm, btree.start, btree.order, "predictions", true);
+        } else {
+            //Context nodes: children, predictions, backoff
+            addBtreeStats(stats, lm, btree.start, btree.order, "contexts", false);
+            auto children = [&](unsigned int, unsigned int * payload) {
+                if (payload[0]) {
+                    pending.push_back({btree.start + payload[0]*4, (unsigned short)(btree.order + 1), false});
+                }
+                if (payload[1]) {
+                    pending.push_back({btree.start + payload[1]*4, (unsigned short)(btree.order + 1), true});
+                }
+            };
+            traverseBtree(lm.trieByteArray, btree.start, stats.btree_node_size, false, children);
+        }
+    }
+
+    std::sort(stats.levels.begin(), stats.levels.end(), [](const BtreeLevelStats& left, const BtreeLevelStats& right) {
+        return left.order != right.order ? left.order < right.order : left.kind < right.kind;
+    });
+    return stats;
+}
+
+inline void printTrieStats(std::ostream& out, const TrieStats& stats) {
+    std::ios::fmtflags flags = out.flags();
+    out << "Btree node size: " << stats.btree_node_size << (stats.reversed_contexts ? ", reversed contexts" : "") << std::endl;
+    out << "First level: " << stats.first_level_bytes << " bytes. Btrees: " << stats.btreeBytes() << " out of "
+    << stats.byte_array_bytes << " bytes of the byte array." << std::endl;
+    for (const BtreeLevelStats& level : stats.levels) {
+        size_t total = level.totalBytes();
+        out << std::endl << level.order << "-gram " << level.kind << ": " << level.btrees << " Btrees, " << level.entries << " entries, "
+        << level.nodes << " nodes (" << level.inner_nodes << " inner), " << level.stumps << " stumps, fill factor "
+        << std::fixed << std::setprecision(3) << level.fillFactor(stats.btree_node_size) << std::endl;
+        out << "  bytes: " << total << " total, keys " << level.key_bytes << ", offsets " << level.offset_bytes << ", payloads "
+        << level.payload_bytes << ", headers " << level.header_bytes << " (" << std::setprecision(1)
+        << (total ? 100.0*(level.offset_bytes + level.header_bytes)/total : 0) << "% overhead)" << std::endl;
+        out << "  entries:";
+        for (const std::pair<const size_t, size_t>& bucket : level.size_histogram) {
+            out << ' ' << bucket.first << (bucket.first > 1 ? "-" + std::to_string(2*bucket.first - 1) : "") << ':' << bucket.second;
+        }
+        out << std::endl << "  depth:";
+        for (const std::pair<const unsigned int, size_t>& bucket : level.depth_histogram) {
+            out << ' ' << bucket.first << ':' << bucket.second;
+        }
+        out << std::endl;
+    }
+    out.flags(flags);
+}
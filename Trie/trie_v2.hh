@@ -2,9 +2,14 @@
 #include "../Btree/btree_v2_impl.hh"
 #include "../Parser/tokenizer.hh"
 #include "../LM/lm.hh"
+#include "../misc/trace.hh"
+#include "arpa_pruning_impl.hh"
 
 template<class StringType>
 void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize);
+//Same, from anything that reads like an ArpaReader, such as a pruned ArpaModel
+template<class ArpaSource>
+void buildTrie(ArpaSource& arpain, LM& lm, unsigned short BtreeNodeSize);
 void addBtreeToTrie(std::vector<Entry_v2> &entries_to_insert, std::vector<unsigned char> &byte_arr, std::vector<unsigned int> &first_lvl,
  std::vector<unsigned int> context, unsigned short BtreeNodeSize, bool lastNgram);
 Entry_with_offset searchTrie(std::vector<unsigned char> &btree_trie_byte_arr, std::vector<unsigned int> &first_lvl,
@@ -12,5 +17,17 @@ Entry_with_offset searchTrie(std::vector<unsigned char> &btree_trie_byte_arr, st
 
 template<class StringType>
 std::pair<bool, std::string> test_trie(LM &lm, const StringType filename, unsigned short BtreeNodeSize);
+
+//Reversed context layout
+template<class StringType>
+void createReversedTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize);
+template<class ArpaSource>
+void buildReversedTrie(ArpaSource& arpain, LM& lm, unsigned short BtreeNodeSize);
+void addReversedBtreeToTrie(std::vector<Entry_v2> &entries_to_insert, std::vector<unsigned char> &byte_arr, std::vector<unsigned int> &first_lvl,
+ std::vector<unsigned int> &context, unsigned short BtreeNodeSize, bool predictions);
+Entry_with_offset searchReversedContext(std::vector<unsigned char> &btree_trie_byte_arr, std::vector<unsigned int> &first_lvl,
+    const unsigned int * context, unsigned short context_len, unsigned short BtreeNodeSize);
+template<class StringType>
+std::pair<bool, std::string> test_reversed_trie(const StringType filename, unsigned short BtreeNodeSize);
 template<class StringType>
 std::pair<bool, std::string> test_trie(const StringType filename, unsigned short BtreeNodeSize);
@@ -3,6 +3,13 @@
 
 template<class StringType>
 void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize) {
+    ArpaReader arpain(filename);
+    buildTrie(arpain, lm, BtreeNodeSize);
+}
+
+template<class ArpaSource>
+void buildTrie(ArpaSource& arpain, LM& lm, unsigned short BtreeNodeSize) {
+    GLM_TRACE_SPAN("buildTrie");
     //Initialize the LM datastructure
     lm.metadata.api_version = API_VERSION;
     lm.metadata.btree_node_size = BtreeNodeSize;
@@ -10,8 +17,6 @@ void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize)
     //next_level field.
     lm.trieByteArray.resize(sizeof(unsigned int), 0);
 
-    //Open the arpa file
-    ArpaReader arpain(filename);
     processed_line text;
 
     //Some info about BTree stumps
@@ -19,14 +24,17 @@ void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize)
     std::vector<size_t> total_btrees(arpain.max_ngrams - 1, 0);
 
     //First level is just an array. Lay the elements as: next_level, prob, backoff. VocabID is a function of the index of the array
-    do {
-        text = arpain.readline();
-        //Store in the following manner: next_level, prob, backoff, next_level...
-        size_t current_size = lm.first_lvl.size();
-        lm.first_lvl.resize(current_size + 3, 0); //Resize to accomodate the four elements necessary for this entry and initialize them to 0
-        std::memcpy(&lm.first_lvl[current_size + 1], &text.score, sizeof(text.score)); //prob
-        std::memcpy(&lm.first_lvl[current_size + 2], &text.backoff, sizeof(text.backoff)); //VocabID
-    } while (text.ngram_size == 1 && !text.filefinished);
+    {
+        GLM_TRACE_SPAN("first level");
+        do {
+            text = arpain.readline();
+            //Store in the following manner: next_level, prob, backoff, next_level...
+            size_t current_size = lm.first_lvl.size();
+            lm.first_lvl.resize(current_size + 3, 0); //Resize to accomodate the four elements necessary for this entry and initialize them to 0
+            std::memcpy(&lm.first_lvl[current_size + 1], &text.score, sizeof(text.score)); //prob
+            std::memcpy(&lm.first_lvl[current_size + 2], &text.backoff, sizeof(text.backoff)); //VocabID
+        } while (text.ngram_size == 1 && !text.filefinished);
+    }
 
     /*Subsecuent levels except the last one are all the same:
      1) Read in all ngrams from the order.
@@ -38,9 +46,12 @@ void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize)
 
     while (!text.filefinished) {
         std::vector<processed_line> ngrams;
-        while (text.ngram_size == current_ngram_size && !text.filefinished) {
-            ngrams.push_back(text);
-            text = arpain.readline();
+        {
+            GLM_TRACE_SPAN_ARG("read ngrams", "order", current_ngram_size);
+            while (text.ngram_size == current_ngram_size && !text.filefinished) {
+                ngrams.push_back(text);
+                text = arpain.readline();
+            }
         }
 
         bool lastNgram = false;
@@ -49,7 +60,11 @@ void createTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize)
         }
 
         //sort the ngrams
-        std::sort(ngrams.begin(), ngrams.end());
+        {
+            GLM_TRACE_SPAN_ARG("sort ngrams", "order", current_ngram_size);
+            std::sort(ngrams.begin(), ngrams.end());
+        }
+        GLM_TRACE_SPAN_ARG("build btrees", "order", current_ngram_size);
 
         //Create a BTree from each of them
         processed_line prev_line = ngrams[0]; //Fake the previous line to be the first line. 
@@ -278,3 +293,197 @@ std::pair<bool, std::string> test_trie(LM &lm, const StringType filename, unsign
 
     return std::pair<bool, std::string>(correct, error.str());
 }
+
+/*Reversed context layout, KenLM style. Every ngram below the max order is a context node, keyed newest word first: the node for
+  "a b c" is found by looking up c on the first level, then b, then a. A node holds the backoff of its context, the Btree of its
+  children (the same context extended one word into the past) and the Btree of the words predicted after it, with their probabilities.
+  Scoring is then a single walk from the most recent word backwards that collects the backoffs and the longest match probability together.
+  The first level takes 4 uints per vocabID: children, predictions, unigram prob and backoff. Inside Btrees context nodes use the usual
+  12 byte payload with the predictions offset in place of the prob, prediction Btrees use the 4 byte payload of the last trie level.
+  Offsets are in units of 4 bytes, absolute from the first level and relative to the start of the containing Btree elsewhere, 0 means none.*/
+template<class StringType>
+void createReversedTrie(const StringType filename, LM& lm, unsigned short BtreeNodeSize) {
+    ArpaReader arpain(filename);
+    buildReversedTrie(arpain, lm, BtreeNodeSize);
+}
+
+template<class ArpaSource>
+void buildReversedTrie(ArpaSource& arpain, LM& lm, unsigned short BtreeNodeSize) {
+    GLM_TRACE_SPAN("buildReversedTrie");
+    lm.metadata.api_version = API_VERSION;
+    lm.metadata.btree_node_size = BtreeNodeSize;
+    lm.metadata.reversed_contexts = true;
+    //Keep the first 4 bytes empty, same as in the forward layout, so that 0 is never a valid offset.
+    lm.trieByteArray.resize(sizeof(unsigned int), 0);
+
+    processed_line text;
+
+    //First level: children, predictions, prob, backoff. The offsets are filled in when we add the next levels.
+    {
+        GLM_TRACE_SPAN("first level");
+        do {
+            text = arpain.readline();
+            size_t current_size = lm.first_lvl.size();
+            lm.first_lvl.resize(current_size + 4, 0);
+            std::memcpy(&lm.first_lvl[current_size + 2], &text.score, sizeof(text.score));
+            std::memcpy(&lm.first_lvl[current_size + 3], &text.backoff, sizeof(text.backoff));
+        } while (text.ngram_size == 1 && !text.filefinished);
+    }
+
+    unsigned short current_ngram_size = 2;
+    while (!text.filefinished) {
+        std::vector<processed_line> ngrams;
+        {
+            GLM_TRACE_SPAN_ARG("read ngrams", "order", current_ngram_size);
+            while (text.ngram_size == current_ngram_size && !text.filefinished) {
+                ngrams.push_back(text);
+                text = arpain.readline();
+            }
+        }
+        bool lastNgram = text.filefinished;
+        std::vector<unsigned int> context(current_ngram_size - 1);
+        std::vector<Entry_v2> entries_to_insert;
+
+        //1) Predictions: group by the context, which is everything but the last word.
+        {
+            GLM_TRACE_SPAN_ARG("build prediction btrees", "order", current_ngram_size);
+            std::sort(ngrams.begin(), ngrams.end());
+            for (size_t i = 0; i < ngrams.size(); i++) {
+                Entry_v2 entry = {ngrams[i].ngrams[current_ngram_size - 1], ngrams[i].score, 0};
+                entries_to_insert.push_back(entry);
+                bool group_ends = (i + 1 == ngrams.size()) ||
+                    !std::equal(ngrams[i].ngrams.begin(), ngrams[i].ngrams.begin() + current_ngram_size - 1, ngrams[i + 1].ngrams.begin());
+                if (group_ends) {
+                    std::copy(ngrams[i].ngrams.begin(), ngrams[i].ngrams.begin() + current_ngram_size - 1, context.begin());
+                    addReversedBtreeToTrie(entries_to_insert, lm.trieByteArray, lm.first_lvl, context, BtreeNodeSize, true);
+                    entries_to_insert.clear();
+                }
+            }
+        }
+
+        //2) Context nodes, unless this is the last order: group by the parent context, which is everything but the oldest word.
+        if (!lastNgram) {
+            GLM_TRACE_SPAN_ARG("build context btrees", "order", current_ngram_size);
+            std::sort(ngrams.begin(), ngrams.end(), [](const processed_line &left, const processed_line &right) {
+                return std::lexicographical_compare(left.ngrams.rbegin(), left.ngrams.rend(), right.ngrams.rbegin(), right.ngrams.rend());
+            });
+            for (size_t i = 0; i < ngrams.size(); i++) {
+                //The predictions offset is set later. A 0.0f prob has all bits 0.
+                Entry_v2 entry = {ngrams[i].ngrams[0], 0.0f, ngrams[i].backoff};
+                entries_to_insert.push_back(entry);
+                bool group_ends = (i + 1 == ngrams.size()) ||
+                    !std::equal(ngrams[i].ngrams.begin() + 1, ngrams[i].ngrams.end(), ngrams[i + 1].ngrams.begin() + 1);
+                if (group_ends) {
+                    std::copy(ngrams[i].ngrams.begin() + 1, ngrams[i].ngrams.end(), context.begin());
+                    addReversedBtreeToTrie(entries_to_insert, lm.trieByteArray, lm.first_lvl, context, BtreeNodeSize, false);
+                    entries_to_insert.clear();
+                }
+            }
+        }
+        current_ngram_size++;
+    }
+
+    lm.metadata.max_ngram_order = arpain.max_ngrams;
+    lm.metadata.byteArraySize = lm.trieByteArray.size();
+    lm.metadata.intArraySize = lm.first_lvl.size();
+    lm.encode_map = arpain.encode_map;
+    lm.decode_map = arpain.decode_map;
+}
+
+//Creates a Btree at the end of the byte array and points either the children or the predictions of the context node to it.
+inline void addReversedBtreeToTrie(std::vector<Entry_v2> &entries_to_insert, std::vector<unsigned char> &byte_arr, std::vector<unsigned int> &first_lvl,
+ std::vector<unsigned int> &context, unsigned short BtreeNodeSize, bool predictions) {
+    Entry_with_offset node = searchReversedContext(byte_arr, first_lvl, context.data(), context.size(), BtreeNodeSize);
+
+    //Check for buggy arpa files
+    if (!node.found) {
+        std::cerr << "Could not find a lower order ngram even though a higher order one exists!" << std::endl;
+        std::cerr << "Context that wasn't found: ";
+        for (auto word : context) {
+            std::cerr << word << ' ';
+        }
+        std::cerr << std::endl << "Please rebuild the ARPA file using lmplz from KenLM." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    assert((byte_arr.size() - node.currentBtreeStart) % 4 == 0); //Sanity check.
+    unsigned int * offset = predictions ? node.next_level + 1 : node.next_level;
+    *offset = (byte_arr.size() - node.currentBtreeStart)/4;
+
+    array2balancedBtree(byte_arr, entries_to_insert, BtreeNodeSize, predictions);
+}
+
+/*Finds the context node of the given context (oldest word first). next_level points to the children offset of the node, followed by
+  the predictions offset. currentBtreeStart is the Btree the node lives in, 0 for the first level. prob is not meaningful.*/
+inline Entry_with_offset searchReversedContext(std::vector<unsigned char> &btree_trie_byte_arr, std::vector<unsigned int> &first_lvl,
+    const unsigned int * context, unsigned short context_len, unsigned short BtreeNodeSize) {
+    unsigned int newest = context[context_len - 1];
+    assert(newest <= first_lvl.size()/4);
+
+    Entry_with_offset node = {newest, &first_lvl[(newest - 1)*4], 0.0, 0.0, 0, 0, true, 0, 0};
+    std::memcpy(&node.prob, &first_lvl[(newest - 1)*4 + 2], sizeof(node.prob));
+    std::memcpy(&node.backoff, &first_lvl[(newest - 1)*4 + 3], sizeof(node.backoff));
+
+    for (int i = context_len - 2; i >= 0; i--) {
+        if (*node.next_level == 0) {
+            node.found = false;
+            return node;
+        }
+        size_t children_start = node.currentBtreeStart + (*node.next_level)*4;
+        node = searchBtree(btree_trie_byte_arr, children_start, BtreeNodeSize, context[i], false);
+        if (!node.found) {
+            return node;
+        }
+    }
+    return node;
+}
+
+//Checks that every ngram is present in the reversed layout: its probability under its context and, below the max order, its backoff.
+template<class StringType>
+std::pair<bool, std::string> test_reversed_trie(const StringType filename, unsigned short BtreeNodeSize) {
+    LM lm;
+    createReversedTrie(filename, lm, BtreeNodeSize);
+
+    ArpaReader infile(filename);
+    processed_line text = infile.readline();
+    bool correct = true;
+    std::stringstream error;
+
+    while (!text.filefinished) {
+        unsigned int word = text.ngrams[text.ngram_size - 1];
+        float prob;
+        if (text.ngram_size == 1) {
+            std::memcpy(&prob, &lm.first_lvl[(word - 1)*4 + 2], sizeof(prob));
+        } else {
+            Entry_with_offset context = searchReversedContext(lm.trieByteArray, lm.first_lvl, text.ngrams.data(), text.ngram_size - 1, BtreeNodeSize);
+            if (!context.found || context.next_level[1] == 0) {
+                error << "Couldn't find the context of " << text << std::endl;
+                correct = false;
+                break;
+            }
+            Entry_with_offset prediction = searchBtree(lm.trieByteArray, context.currentBtreeStart + context.next_level[1]*4, BtreeNodeSize, word, true);
+            if (!prediction.found) {
+                error << "Couldn't find entry " << text << std::endl;
+                correct = false;
+                break;
+            }
+            prob = prediction.prob;
+        }
+        if (prob != text.score) {
+            error << "Expected probability: " << text.score << ", got: " << prob << std::endl << text;
+            correct = false;
+            break;
+        }
+        if (text.ngram_size < infile.max_ngrams) {
+            Entry_with_offset node = searchReversedContext(lm.trieByteArray, lm.first_lvl, text.ngrams.data(), text.ngram_size, BtreeNodeSize);
+            if (!node.found || node.backoff != text.backoff) {
+                error << "Expected backoff: " << text.backoff << ", got: " << node.backoff << std::endl << text;
+                correct = false;
+                break;
+            }
+        }
+        text = infile.readline();
+    }
+
+    return std::pair<bool, std::string>(correct, error.str());
+}
@@ -0,0 +1,166 @@
+#include "cpu_search_impl.hh"
+#include "thread_pool_impl.hh"
+#include "lm_impl.hh"
+#include "lm_utils.hh"
+#include "memory_report_impl.hh"
+#include "perf_counters.hh"
+#include <chrono>
+#include <cmath>
+
+//Scores a file of sentences on the CPU. The sentences are kept in compact form and split in chunks which run on a work stealing thread pool.
+
+#define QUERIES_PER_CHUNK 4096
+
+struct SentenceChunk {
+    size_t first_sentence;
+    size_t num_sentences;
+};
+
+std::vector<unsigned int> parseThreadCounts(std::string arg) {
+    std::vector<unsigned int> thread_counts;
+    std::stringstream ss(arg);
+    std::string count;
+    while (std::getline(ss, count, ',')) {
+        if (atoi(count.c_str()) > 0) {
+            thread_counts.push_back(atoi(count.c_str()));
+        }
+    }
+    return thread_counts;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 7) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir path_to_test_file [thread_counts=1,2,4..all_cores] "
+            << "[addBeginEndMarkers_bool=1] [hot_contexts=0] [latency_json_file]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::vector<unsigned int> thread_counts;
+    bool addBeginEndMarkers = true;
+    size_t num_hot_contexts = 0;
+    std::string latency_json;
+    if (argc >= 4) {
+        thread_counts = parseThreadCounts(argv[3]);
+    }
+    if (argc >= 5) {
+        addBeginEndMarkers = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        num_hot_contexts = atoll(argv[5]);
+    }
+    if (argc == 7) {
+        latency_json = argv[6];
+    }
+    if (thread_counts.empty()) {
+        unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int threads = 1; threads < cores; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(cores);
+    }
+
+    PerfProfile profile; //Hardware counters when GLM_PERF_COUNTERS is set
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    profile.begin("load");
+    LM lm(argv[1]);
+    profile.end();
+    std::cerr << "Read in language model:" << std::endl << lm.metadata << "Loading took: "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " seconds." << std::endl;
+    HotContextTable hot_contexts(lm, num_hot_contexts);
+
+    CompactQueries batch;
+    profile.begin("query-prep");
+    sentencesToCompactQueries(batch, lm, argv[2], addBeginEndMarkers);
+    size_t num_sentences = batch.numSentences();
+    size_t num_queries = batch.numQueries();
+    profile.end(num_queries);
+
+    //Chunks of whole sentences with about QUERIES_PER_CHUNK queries each
+    std::vector<SentenceChunk> chunks;
+    SentenceChunk chunk = {0, 0};
+    size_t chunk_words = 0;
+    for (size_t i = 0; i < num_sentences; i++) {
+        chunk.num_sentences++;
+        chunk_words += batch.sentenceEnd(i) - batch.sentence_starts[i];
+        if (chunk_words >= QUERIES_PER_CHUNK || i + 1 == num_sentences) {
+            chunks.push_back(chunk);
+            chunk.first_sentence = i + 1;
+            chunk.num_sentences = 0;
+            chunk_words = 0;
+        }
+    }
+
+    std::vector<float> results(batch.vocabIDs.size());
+    std::vector<double> sentence_scores(num_sentences);
+
+    //The model, the tables around it and the scratch of the search, against what the process holds
+    MemoryReport memory = lm.memoryReport();
+    memory.addReported("hot contexts", hot_contexts.memoryUsage());
+    memory.addAllocation("query vocabIDs", batch.vocabIDs.capacity()*sizeof(unsigned int));
+    memory.addAllocation("query sentence starts", batch.sentence_starts.capacity()*sizeof(unsigned int));
+    memory.addAllocation("results", results.capacity()*sizeof(float));
+    memory.addAllocation("sentence scores", sentence_scores.capacity()*sizeof(double));
+    ProcessMemory process = readProcessMemory();
+    memory.print(std::cerr, &process);
+
+    std::vector<double> queries_per_second;
+    LatencyRecorder sentence_latency("sentence"); //Per sentence, across the workers
+    std::vector<LatencySummary> latencies;
+    for (unsigned int num_threads : thread_counts) {
+        //The workers' counts reach this thread when they exit, so the phase ends after the pool is gone.
+        profile.begin("search-" + std::to_string(num_threads));
+        {
+            WorkStealingPool pool(num_threads);
+            //One searcher per worker, they keep statistics that aren't thread safe.
+            std::vector<std::unique_ptr<CPUSearcher> > searchers;
+            for (unsigned int i = 0; i < num_threads; i++) {
+                searchers.push_back(std::unique_ptr<CPUSearcher>(new CPUSearcher(lm, &hot_contexts)));
+                searchers.back()->latency = &sentence_latency;
+            }
+            sentence_latency.reset();
+
+            std::chrono::time_point<std::chrono::steady_clock> searchStart = std::chrono::steady_clock::now();
+            for (SentenceChunk& current : chunks) {
+                pool.submit([&, current](unsigned int worker) {
+                    searchers[worker]->searchCompact(batch, current.first_sentence, current.num_sentences, results.data());
+                    for (size_t sent = current.first_sentence; sent < current.first_sentence + current.num_sentences; sent++) {
+                        double sum = 0;
+                        for (unsigned int pos = batch.sentence_starts[sent]; pos < batch.sentenceEnd(sent); pos++) {
+                            sum += results[pos];
+                        }
+                        sentence_scores[sent] = sum;
+                    }
+                });
+            }
+            pool.wait();
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - searchStart).count();
+            queries_per_second.push_back(num_queries/elapsed);
+            std::cerr << "Searching with " << num_threads << " threads took: " << elapsed << " seconds, " << pool.steals() << " steals." << std::endl;
+            latencies.push_back(sentence_latency.summary());
+            latencies.back().name = "sentence/threads=" + std::to_string(num_threads);
+        }
+        profile.end(num_queries);
+    }
+
+    //Per sentence log10 probabilities, then the totals
+    double total_score = 0;
+    for (double score : sentence_scores) {
+        std::cout << score << std::endl;
+        total_score += score;
+    }
+    std::cout << "Sentences: " << num_sentences << " Words: " << num_queries << std::endl;
+    std::cout << "Total log10 probability: " << total_score << std::endl;
+    std::cout << "Perplexity: " << (num_queries ? std::pow(10.0, -total_score/num_queries) : 0) << std::endl;
+    std::cout << "threads\tqueries_per_second" << std::endl;
+    for (size_t i = 0; i < thread_counts.size(); i++) {
+        std::cout << thread_counts[i] << "\t" << queries_per_second[i] << std::endl;
+    }
+    for (LatencySummary& latency : latencies) {
+        latency.print(std::cerr);
+    }
+    if (!latency_json.empty()) {
+        writeLatencyJSON(latencies, latency_json);
+    }
+    profile.report(std::cerr);
+    GLM_TRACE_WRITE();
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "gpu_LM_utils_v2.hh"
 #include "lm_impl.hh"
+#include "perf_counters.hh"
 #include <memory>
 #include <chrono>
 #include <ctime>
@@ -21,9 +22,12 @@ int main(int argc, char* argv[]){
     std::chrono::time_point<std::chrono::system_clock> start, readBinaryLM, memcpyBytearrayStart, memcpyBytearray,
         queryFileIOstart, queryFileIOend, gpuPrepareStart, gpuPrepareEnd, copyBackStart, copyBackEnd, memFreeStart, memFreeEnd;
 
+    PerfProfile profile; //Hardware counters when GLM_PERF_COUNTERS is set
     start = std::chrono::system_clock::now();
 
+    profile.begin("load");
     LM lm(argv[1]); //The read in language model
+    profile.end();
 
     readBinaryLM = std::chrono::system_clock::now();
     std::cout << "Read in language model:" << std::endl << lm.metadata << "Loading took: "
@@ -41,7 +45,9 @@ int main(int argc, char* argv[]){
 
     std::vector<unsigned int> queries;
     std::vector<unsigned int> sent_lengths;
+    profile.begin("query-prep");
     sentencesToQueryVector(queries, sent_lengths, lm, argv[2], addBeginEndMarkers);
+    profile.end(queries.size()/lm.metadata.max_ngram_order);
 
     queryFileIOend = std::chrono::system_clock::now();
     std::cout << "Preparing the queries took: " << std::chrono::duration<double>(queryFileIOend - queryFileIOstart).count() << " seconds." << std::endl;
@@ -63,8 +69,10 @@ int main(int argc, char* argv[]){
     gpuPrepareEnd = std::chrono::system_clock::now();
     std::cout << "Copying queries to gpu and other gpu work took: " << std::chrono::duration<double>(gpuPrepareEnd - gpuPrepareStart).count() << " seconds." << std::endl;
     
-    //Now execute the search
+    //Now execute the search. The counters only see the host side of it: kernel launches and waiting for the GPU.
+    profile.begin("search");
     searchWrapper(allvocabIDs.size(), btree_trie_gpu, first_lvl_gpu, gpuKeys, num_keys, results, lm.metadata.btree_node_size, lm.metadata.max_ngram_order);
+    profile.end(num_keys);
 
     //copy results back to CPU
     copyBackStart = std::chrono::system_clock::now();
@@ -95,5 +103,7 @@ int main(int argc, char* argv[]){
     }
    // std::cout << "Total file sum is: " << sum << std::endl;
 	std::cout << "The number of returns for all queries" << sum << std::endl;
+    profile.report(std::cout);
+    GLM_TRACE_WRITE();
     return 0;
 }
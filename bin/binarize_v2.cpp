@@ -1,20 +1,90 @@
 #include "trie_v2_impl.hh"
 #include "lm_impl.hh"
 #include "gpu_search.hh"
+#include "perf_counters.hh"
+
+//Sizes like 512M or 2G
+size_t parseBytes(const std::string& size) {
+    size_t bytes = std::stoull(size);
+    switch (size.back()) {
+        case 'G': case 'g': return bytes << 30;
+        case 'M': case 'm': return bytes << 20;
+        case 'K': case 'k': return bytes << 10;
+        default: return bytes;
+    }
+}
 
 int main(int argc, char* argv[]){
-    if (argc != 5 && argc != 3 && argc != 4) {
-        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_arpa_file output_path [btree_node_size=31]." << std::endl;
+    //Pruning options come first, the positional arguments after them
+    PruneOptions prune_options;
+    int arg = 1;
+    while (arg + 1 < argc && std::string(argv[arg]).compare(0, 2, "--") == 0) {
+        std::string option = argv[arg];
+        if (option == "--prune-threshold") {
+            prune_options.criterion = PRUNE_THRESHOLD;
+            prune_options.threshold = atof(argv[arg + 1]);
+        } else if (option == "--prune-entropy") {
+            prune_options.criterion = PRUNE_RELATIVE_ENTROPY;
+            prune_options.threshold = atof(argv[arg + 1]);
+        } else if (option == "--target-size") {
+            prune_options.target_bytes = parseBytes(argv[arg + 1]);
+            if (prune_options.criterion == PRUNE_NONE) {
+                prune_options.criterion = PRUNE_RELATIVE_ENTROPY;
+            }
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        arg += 2;
+    }
+    int positional = argc - arg;
+    if (positional != 4 && positional != 2 && positional != 3) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " [--prune-threshold log10_difference | --prune-entropy relative_entropy] [--target-size bytes[K|M|G]]"
+        << " path_to_arpa_file output_path [btree_node_size=31] [reversed_contexts_bool=0]." << std::endl;
+        std::cerr << "Reversed contexts make backoff a single trie walk, but are only supported by the CPU search." << std::endl;
+        std::cerr << "Pruning drops the higher order ngrams that score below the threshold and renormalizes the backoffs of their contexts. "
+        << "--target-size picks the threshold that fits the binarized model in the given size, with relative entropy pruning by default." << std::endl;
         std::exit(EXIT_FAILURE);
     }
     unsigned short btree_node_size = 31;
+    bool reversed_contexts = false;
 
-    if (argc == 4) {
-        btree_node_size = atoi(argv[3]);
+    if (positional >= 3) {
+        btree_node_size = atoi(argv[arg + 2]);
+    }
+    if (positional == 4) {
+        reversed_contexts = atoi(argv[arg + 3]);
     }
     //Create the LM
+    PerfProfile profile; //Hardware counters when GLM_PERF_COUNTERS is set
+    profile.begin("binarize");
     LM lm;
-    createTrie(argv[1], lm, btree_node_size);
-    lm.writeBinary(argv[2]);
+    if (prune_options.criterion == PRUNE_NONE) {
+        if (reversed_contexts) {
+            createReversedTrie(argv[arg], lm, btree_node_size);
+        } else {
+            createTrie(argv[arg], lm, btree_node_size);
+        }
+    } else {
+        ArpaModel arpa(argv[arg]);
+        size_t num_ngrams = arpa.numNgrams();
+        size_t unpruned_bytes = arpa.estimateBinarySize(btree_node_size, reversed_contexts);
+        prune_options.btree_node_size = btree_node_size;
+        prune_options.reversed_contexts = reversed_contexts;
+        size_t removed = arpa.prune(prune_options);
+        std::cout << "Pruned " << removed << " out of " << num_ngrams << " ngrams, " << unpruned_bytes << " bytes down to "
+        << arpa.estimateBinarySize(btree_node_size, reversed_contexts) << " bytes." << std::endl;
+        if (reversed_contexts) {
+            buildReversedTrie(arpa, lm, btree_node_size);
+        } else {
+            buildTrie(arpa, lm, btree_node_size);
+        }
+    }
+    profile.end();
+    profile.begin("write");
+    lm.writeBinary(argv[arg + 1]);
+    profile.end();
+    profile.report(std::cout);
+    GLM_TRACE_WRITE();
     return 0;
 }
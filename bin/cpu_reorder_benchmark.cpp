@@ -0,0 +1,78 @@
+#include "cpu_search_impl.hh"
+#include "lm_impl.hh"
+#include "lm_utils.hh"
+#include <chrono>
+
+//Times the CPU search of the same batches in sentence order and sorted by their first two vocabIDs, for several batch sizes.
+
+//Best of repetitions wall clock time in seconds of searching all queries in batches of batch_size
+double timeSearch(CPUSearcher& searcher, std::vector<unsigned int>& queries, size_t batch_size, int repetitions, std::vector<float>& results) {
+    unsigned short max_ngram_order = searcher.lm.metadata.max_ngram_order;
+    size_t num_queries = queries.size()/max_ngram_order;
+    results.resize(num_queries);
+    double best = 0;
+    for (int rep = 0; rep < repetitions; rep++) {
+        std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_queries; i += batch_size) {
+            size_t this_batch = std::min(batch_size, num_queries - i);
+            searcher.search(&queries[i*max_ngram_order], this_batch, &results[i]);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4 && argc != 5) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir path_to_test_file [repetitions=5] [addBeginEndMarkers_bool=1]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    int repetitions = 5;
+    bool addBeginEndMarkers = true;
+    if (argc >= 4) {
+        repetitions = atoi(argv[3]);
+    }
+    if (argc == 5) {
+        addBeginEndMarkers = atoi(argv[4]);
+    }
+
+    LM lm(argv[1]);
+    std::cout << "Read in language model:" << std::endl << lm.metadata;
+
+    std::vector<unsigned int> queries;
+    std::vector<unsigned int> sent_lengths;
+    sentencesToScoringQueries(queries, sent_lengths, lm, argv[2], addBeginEndMarkers);
+    size_t num_queries = queries.size()/lm.metadata.max_ngram_order;
+    std::cout << "Queries: " << num_queries << " from " << sent_lengths.size() << " sentences." << std::endl;
+
+    CPUSearcher plain(lm);
+    CPUSearcher sorted(lm);
+    sorted.reorder = true;
+
+    //The sort itself, to see how much of the gain it eats
+    std::chrono::time_point<std::chrono::steady_clock> sortStart = std::chrono::steady_clock::now();
+    radixSortQueries(queries.data(), num_queries, lm.metadata.max_ngram_order, 2);
+    double sortTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - sortStart).count();
+    std::cout << "Sorting the whole file took: " << sortTime << " seconds." << std::endl;
+
+    std::cout << "batch_size\tin_order_qps\treordered_qps\tspeedup" << std::endl;
+    size_t batch_sizes[5] = {100, 1000, 10000, 100000, num_queries};
+    std::vector<float> plain_results;
+    std::vector<float> sorted_results;
+    for (size_t batch_size : batch_sizes) {
+        if (batch_size == 0 || (batch_size > num_queries && batch_size != batch_sizes[4])) {
+            continue;
+        }
+        double plainTime = timeSearch(plain, queries, batch_size, repetitions, plain_results);
+        double sortedTime = timeSearch(sorted, queries, batch_size, repetitions, sorted_results);
+        if (plain_results != sorted_results) {
+            std::cerr << "Reordered results differ from in order results at batch size " << batch_size << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::cout << batch_size << "\t" << num_queries/plainTime << "\t" << num_queries/sortedTime << "\t" << plainTime/sortedTime << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "trie_stats_impl.hh"
+#include "traversal_profiler_impl.hh"
+#include "lm_impl.hh"
+#include "memory_report_impl.hh"
+
+/*Reports the layout of a binarized model per order, what it holds in memory checked against /proc/self/smaps and, given a file of
+  sentences, what looking them up touches.*/
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir [path_to_test_file] [addBeginEndMarkers_bool=1]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    bool addBeginEndMarkers = true;
+    if (argc == 4) {
+        addBeginEndMarkers = atoi(argv[3]);
+    }
+
+    ProcessMemory before = readProcessMemory();
+    LM lm(argv[1]);
+    ProcessMemory loaded = readProcessMemory();
+    std::cout << lm.metadata << std::endl;
+    printTrieStats(std::cout, trieStats(lm));
+
+    std::cout << std::endl;
+    MemoryReport memory = lm.memoryReport();
+    memory.print(std::cout, &loaded);
+    if (before.valid && loaded.valid) {
+        std::cout << "Loading grew the anonymous memory by " << (long long)(loaded.anonymous - before.anonymous) << " bytes and RSS by "
+        << (long long)(loaded.rss - before.rss) << " bytes." << std::endl;
+    }
+
+    if (argc >= 3) {
+        CompactQueries batch;
+        sentencesToCompactQueries(batch, lm, argv[2], addBeginEndMarkers);
+        TraversalProfiler profiler(lm);
+        profiler.replay(batch);
+        std::cout << std::endl;
+        profiler.report(std::cout);
+    }
+    return 0;
+}
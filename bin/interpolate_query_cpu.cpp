@@ -0,0 +1,43 @@
+#include "interpolated_lm_impl.hh"
+#include "lm_impl.hh"
+#include <chrono>
+
+//Scores every sentence of a file with the linear interpolation of several models on the CPU. Writes the interpolated log10 probability
+//of every sentence to stdout.
+
+int main(int argc, char* argv[]) {
+    if (argc < 7 || argc % 2 == 0) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_sentences addBeginEndMarkers_bool weight path_to_binary_lm_dir weight path_to_binary_lm_dir [weight path_to_binary_lm_dir ...]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    bool addBeginEndMarkers = atoi(argv[2]);
+    std::vector<std::unique_ptr<LM> > lms;
+    std::vector<LM *> models;
+    std::vector<float> weights;
+    for (int i = 3; i < argc; i += 2) {
+        weights.push_back(atof(argv[i]));
+        lms.push_back(std::unique_ptr<LM>(new LM(argv[i + 1])));
+        models.push_back(lms.back().get());
+        std::cerr << "Read in language model " << argv[i + 1] << " with weight " << weights.back() << ":" << std::endl << lms.back()->metadata;
+    }
+
+    SharedVocab vocab(models);
+    InterpolatedSearcher searcher(models, vocab);
+    searcher.weights = weights;
+
+    std::ifstream infile(argv[1]);
+    if (infile.fail()) {
+        std::cerr << "Failed to open file " << argv[1] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    std::string line;
+    size_t sentences = 0;
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    while (std::getline(infile, line)) {
+        std::cout << searcher.scoreSentence(line, addBeginEndMarkers) << '\n';
+        sentences++;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Scoring " << sentences << " sentences with " << models.size() << " models took: " << elapsed << " seconds." << std::endl;
+    return 0;
+}
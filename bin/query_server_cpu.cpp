@@ -0,0 +1,65 @@
+#include "query_server_impl.hh"
+#include "lm_impl.hh"
+#include <csignal>
+
+//Serves a model to local decoders over a Unix domain socket and optionally localhost TCP, see cpu/query_server.hh. Stops on SIGINT or SIGTERM.
+
+QueryServer * running_server = nullptr;
+
+void stopServer(int) {
+    if (running_server) {
+        running_server->stop();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 9) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir socket_path [tcp_port=0 (none)] [max_batch_ngrams=8192] "
+            << "[max_wait_us=500] [scorer_threads=1] [hot_contexts=0] [latency_json_file]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    QueryServerOptions options;
+    options.socket_path = argv[2];
+    size_t num_hot_contexts = 0;
+    if (argc >= 4) {
+        options.tcp_port = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        options.max_batch_ngrams = atoll(argv[4]);
+    }
+    if (argc >= 6) {
+        options.max_wait_us = atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        options.scorer_threads = atoi(argv[6]);
+    }
+    if (argc >= 8) {
+        num_hot_contexts = atoll(argv[7]);
+    }
+    LatencyRecorder request_latency("request");
+    options.latency = &request_latency;
+
+    LM lm(argv[1]);
+    std::cerr << "Read in language model:" << std::endl << lm.metadata;
+    HotContextTable hot_contexts(lm, num_hot_contexts);
+
+    QueryServer server(lm, options, &hot_contexts);
+    running_server = &server;
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+    std::cerr << "Listening on " << options.socket_path;
+    if (options.tcp_port) {
+        std::cerr << " and 127.0.0.1:" << options.tcp_port;
+    }
+    std::cerr << std::endl;
+    server.run();
+    running_server = nullptr;
+
+    server.printStats(std::cerr);
+    LatencySummary latency = request_latency.summary();
+    latency.print(std::cerr);
+    if (argc == 9) {
+        writeLatencyJSON(std::vector<LatencySummary>(1, latency), argv[8]);
+    }
+    return 0;
+}
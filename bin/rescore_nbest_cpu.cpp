@@ -0,0 +1,73 @@
+#include "nbest_rescorer_impl.hh"
+#include "lm_impl.hh"
+#include <chrono>
+
+//Rescores a Moses style n-best file (id ||| hypothesis ||| ...) on the CPU, one n-best list per task. Writes id ||| hypothesis ||| log10 probability
+//for every input line to stdout.
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir path_to_nbest_file [threads=all_cores] [addBeginEndMarkers_bool=1]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    bool addBeginEndMarkers = true;
+    if (argc >= 4) {
+        num_threads = std::max(atoi(argv[3]), 1);
+    }
+    if (argc == 5) {
+        addBeginEndMarkers = atoi(argv[4]);
+    }
+
+    LM lm(argv[1]);
+    std::cerr << "Read in language model:" << std::endl << lm.metadata;
+    VocabTable vocab(lm.encode_map);
+
+    std::ifstream infile(argv[2]);
+    if (infile.fail()) {
+        std::cerr << "Failed to open file " << argv[2] << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    //Consecutive lines with the same id form one n-best list
+    std::vector<std::string> ids;
+    std::vector<std::string> hypotheses;
+    std::vector<std::vector<std::vector<unsigned int> > > lists;
+    std::string line;
+    const std::string separator = " ||| ";
+    while (std::getline(infile, line)) {
+        size_t id_end = line.find(separator);
+        if (id_end == std::string::npos) {
+            std::cerr << "Malformed n-best line: " << line << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        size_t hyp_start = id_end + separator.size();
+        size_t hyp_end = line.find(separator, hyp_start);
+        std::string id = line.substr(0, id_end);
+        std::string hypothesis = line.substr(hyp_start, hyp_end == std::string::npos ? std::string::npos : hyp_end - hyp_start);
+        if (ids.empty() || ids.back() != id) {
+            lists.push_back(std::vector<std::vector<unsigned int> >());
+        }
+        lists.back().push_back(std::vector<unsigned int>());
+        vocab.sentence2vocabIDs(hypothesis, lists.back().back(), false);
+        ids.push_back(id);
+        hypotheses.push_back(hypothesis);
+    }
+
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    WorkStealingPool pool(num_threads);
+    std::vector<NBestScores> scores;
+    rescoreNBestLists(lm, lists, scores, pool, addBeginEndMarkers);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t line_num = 0;
+    size_t words = 0;
+    for (size_t list = 0; list < lists.size(); list++) {
+        for (size_t hyp = 0; hyp < lists[list].size(); hyp++, line_num++) {
+            std::cout << ids[line_num] << separator << hypotheses[line_num] << separator << scores[list].totals[hyp] << '\n';
+        }
+        words += scores[list].word_scores.size();
+    }
+    std::cerr << "Lists: " << lists.size() << " Hypotheses: " << line_num << " Words: " << words << std::endl;
+    std::cerr << "Rescoring with " << num_threads << " threads took: " << elapsed << " seconds, " << words/elapsed << " words per second." << std::endl;
+    return 0;
+}
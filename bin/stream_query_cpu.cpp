@@ -0,0 +1,63 @@
+#include "streaming_impl.hh"
+#include "lm_impl.hh"
+#include <chrono>
+#include <cmath>
+
+//Scores arbitrarily large files with bounded memory. Writes one log10 probability per input line to stdout and a summary to stderr.
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 8) {
+        std::cerr << "Usage:" << std::endl << argv[0] << " path_to_binary_lm_dir [path_to_test_file=- (stdin)] [scorer_threads=all_cores] "
+            << "[tokenizer_threads=1] [addBeginEndMarkers_bool=1] [word_scores_bool=0] [latency_json_file]" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    StreamingOptions options;
+    options.scorer_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc >= 4) {
+        options.scorer_threads = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        options.tokenizer_threads = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        options.addBeginEndMarkers = atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        options.word_scores = atoi(argv[6]);
+    }
+    LatencyRecorder batch_latency("batch");
+    options.latency = &batch_latency;
+
+    LM lm(argv[1]);
+    std::cerr << "Read in language model:" << std::endl << lm.metadata;
+
+    std::ifstream infile;
+    bool use_stdin = (argc < 3 || std::string(argv[2]) == "-");
+    if (!use_stdin) {
+        infile.open(argv[2]);
+        if (infile.fail()) {
+            std::cerr << "Failed to open file " << argv[2] << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    std::istream& in = use_stdin ? std::cin : infile;
+    std::ios_base::sync_with_stdio(false);
+
+    std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+    StreamingScorer scorer(lm, options);
+    StreamingStats stats = scorer.run(in, std::cout);
+    std::cout.flush();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "Sentences: " << stats.sentences << " Words: " << stats.words << std::endl;
+    std::cerr << "Total log10 probability: " << stats.total_score << std::endl;
+    std::cerr << "Perplexity: " << (stats.words ? std::pow(10.0, -stats.total_score/stats.words) : 0) << std::endl;
+    std::cerr << "Scoring took: " << elapsed << " seconds, " << stats.words/elapsed << " queries per second." << std::endl;
+    LatencySummary latency = batch_latency.summary();
+    latency.print(std::cerr);
+    if (argc == 8) {
+        writeLatencyJSON(std::vector<LatencySummary>(1, latency), argv[7]);
+    }
+    GLM_TRACE_WRITE();
+    return 0;
+}
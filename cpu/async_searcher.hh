@@ -0,0 +1,87 @@
+#pragma once
+#include "cpu_search_impl.hh"
+#include "thread_pool_impl.hh"
+#include <deque>
+#include <future>
+#include <stdexcept>
+
+struct AsyncSearchOptions {
+    unsigned int threads = 1;
+    size_t max_in_flight = 64; //Submitted requests that haven't completed yet. Submitting more blocks, or fails with trySubmit.
+    size_t chunk_ngrams = 4096; //Requests are scored in chunks of this many ngrams and can be cancelled between them
+    bool deduplicate = false;
+    LatencyRecorder * latency = nullptr; //If set, records every request from submission until it completes
+};
+
+//What the future of a cancelled request throws.
+struct QueryCancelled : public std::runtime_error {
+    QueryCancelled() : std::runtime_error("The query was cancelled") {}
+};
+
+struct AsyncQueryState {
+    enum Stage {QUEUED, RUNNING, FINISHED};
+    std::vector<unsigned int> queries;
+    std::promise<std::vector<float> > promise;
+    std::function<void(const std::vector<float>&, bool)> done;
+    std::chrono::time_point<std::chrono::steady_clock> submitted;
+    std::atomic<int> stage;
+    std::atomic<bool> cancel_requested;
+
+    AsyncQueryState() : stage(QUEUED), cancel_requested(false) {}
+};
+
+/*The handle of a submitted request. The scores arrive through the future. cancel() drops a request that hasn't started yet and stops
+  a running one at its next chunk. Either way the future then throws QueryCancelled and the callback gets cancelled set, both from
+  the pool thread that reaches the request, which for a queued one takes no scoring. Until then the request keeps its slot among the
+  max_in_flight. cancel() returns whether the request was dropped before any of it was scored; a request may also complete before
+  a late cancel takes effect. Handles can outlive their requests and their searcher.*/
+class AsyncQuery {
+    private:
+        friend class AsyncSearcher;
+        std::shared_ptr<AsyncQueryState> state;
+
+    public:
+        std::future<std::vector<float> > scores;
+
+        bool cancel();
+};
+
+/*Scores requests of padded queries (the CPUSearcher layout) on an internal thread pool, without blocking the caller, so that a
+  decoder can overlap LM scoring with its own work. Results come back through a future, and through a callback if given one, which
+  runs on a pool thread and must neither throw nor block for long. Requests start in the order they're submitted. At most
+  max_in_flight requests are queued or running at a time, cancelled ones included until a worker has dropped them. Every worker has
+  its own CPUSearcher, over the shared hot context table and result cache if any. The destructor waits for every request.*/
+class AsyncSearcher {
+    public:
+        typedef std::function<void(const std::vector<float>& scores, bool cancelled)> Callback;
+
+    private:
+        LM& lm;
+        AsyncSearchOptions options;
+        std::vector<std::unique_ptr<CPUSearcher> > searchers;
+        std::mutex lock;
+        std::condition_variable slot_free;
+        std::condition_variable idle;
+        size_t in_flight = 0;
+        std::deque<std::shared_ptr<AsyncQueryState> > queue; //Submitted in order, one pool task each
+        WorkStealingPool pool; //Last, so that its workers stop before the rest goes away
+
+        AsyncQuery enqueue(std::vector<unsigned int>& queries, Callback& done);
+        void run(const std::shared_ptr<AsyncQueryState>& state, unsigned int worker);
+        void finish(AsyncQueryState& state, std::vector<float>& scores, bool cancelled);
+
+    public:
+        AsyncSearcher(LM&, AsyncSearchOptions, const HotContextTable * = nullptr, ResultCache * = nullptr);
+        ~AsyncSearcher();
+
+        //Blocks while max_in_flight requests are in flight.
+        AsyncQuery submit(std::vector<unsigned int> queries, Callback done = Callback());
+        //Fails instead of blocking. queries is moved from only on success.
+        bool trySubmit(std::vector<unsigned int>& queries, AsyncQuery& query, Callback done = Callback());
+        void wait(); //Until no request is in flight
+
+        size_t inFlight() {
+            std::lock_guard<std::mutex> guard(lock);
+            return in_flight;
+        }
+};
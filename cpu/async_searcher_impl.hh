@@ -0,0 +1,133 @@
+#pragma once
+#include "async_searcher.hh"
+
+inline bool AsyncQuery::cancel() {
+    if (!state) {
+        return false;
+    }
+    state->cancel_requested = true;
+    //A request still queued won't run. The worker that reaches it answers it and frees its slot, without scoring it.
+    int expected = AsyncQueryState::QUEUED;
+    return state->stage.compare_exchange_strong(expected, AsyncQueryState::FINISHED);
+}
+
+inline AsyncSearcher::AsyncSearcher(LM& lm_, AsyncSearchOptions options_, const HotContextTable * hot_contexts, ResultCache * result_cache)
+    : lm(lm_), options(options_), pool(std::max(1u, options_.threads)) {
+    options.max_in_flight = std::max<size_t>(1, options.max_in_flight);
+    options.chunk_ngrams = std::max<size_t>(1, options.chunk_ngrams);
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        searchers.emplace_back(new CPUSearcher(lm, hot_contexts, result_cache));
+        searchers.back()->deduplicate = options.deduplicate;
+    }
+}
+
+inline AsyncSearcher::~AsyncSearcher() {
+    wait();
+}
+
+inline AsyncQuery AsyncSearcher::enqueue(std::vector<unsigned int>& queries, Callback& done) {
+    std::shared_ptr<AsyncQueryState> state = std::make_shared<AsyncQueryState>();
+    state->queries.swap(queries);
+    state->done.swap(done);
+    state->submitted = std::chrono::steady_clock::now();
+
+    AsyncQuery query;
+    query.state = state;
+    query.scores = state->promise.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(state);
+    }
+    //Workers run their own tasks newest first, so tasks only say that a request is waiting and take the oldest one
+    pool.submit([this](unsigned int worker) {
+        std::shared_ptr<AsyncQueryState> oldest;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            oldest = queue.front();
+            queue.pop_front();
+        }
+        run(oldest, worker);
+    });
+    return query;
+}
+
+inline AsyncQuery AsyncSearcher::submit(std::vector<unsigned int> queries, Callback done) {
+    if (queries.size() % lm.metadata.max_ngram_order != 0) {
+        throw std::invalid_argument("Queries must hold max_ngram_order vocabIDs each");
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        slot_free.wait(guard, [this]{ return in_flight < options.max_in_flight; });
+        in_flight++;
+    }
+    return enqueue(queries, done);
+}
+
+inline bool AsyncSearcher::trySubmit(std::vector<unsigned int>& queries, AsyncQuery& query, Callback done) {
+    if (queries.size() % lm.metadata.max_ngram_order != 0) {
+        throw std::invalid_argument("Queries must hold max_ngram_order vocabIDs each");
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (in_flight >= options.max_in_flight) {
+            return false;
+        }
+        in_flight++;
+    }
+    query = enqueue(queries, done);
+    return true;
+}
+
+inline void AsyncSearcher::run(const std::shared_ptr<AsyncQueryState>& state, unsigned int worker) {
+    int expected = AsyncQueryState::QUEUED;
+    if (!state->stage.compare_exchange_strong(expected, AsyncQueryState::RUNNING)) {
+        std::vector<float> no_scores;
+        finish(*state, no_scores, true); //Cancelled while queued
+        return;
+    }
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    size_t num_ngrams = state->queries.size()/max_ngram_order;
+    std::vector<float> scores(num_ngrams);
+    bool cancelled = false;
+    for (size_t first = 0; first < num_ngrams; first += options.chunk_ngrams) {
+        if (state->cancel_requested) {
+            cancelled = true;
+            break;
+        }
+        size_t chunk = std::min(options.chunk_ngrams, num_ngrams - first);
+        searchers[worker]->search(state->queries.data() + first*max_ngram_order, chunk, scores.data() + first);
+    }
+    state->stage = AsyncQueryState::FINISHED;
+    finish(*state, scores, cancelled);
+}
+
+//Answers a request exactly once, through its callback and then its future, and frees its slot.
+inline void AsyncSearcher::finish(AsyncQueryState& state, std::vector<float>& scores, bool cancelled) {
+    if (options.latency) {
+        options.latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state.submitted).count());
+    }
+    if (cancelled) {
+        scores.clear(); //The callback of a cancelled request gets no scores, not the part scored before the cancel
+    }
+    if (state.done) {
+        state.done(scores, cancelled);
+    }
+    if (cancelled) {
+        state.promise.set_exception(std::make_exception_ptr(QueryCancelled()));
+    } else {
+        state.promise.set_value(std::move(scores));
+    }
+    state.queries = std::vector<unsigned int>();
+
+    std::lock_guard<std::mutex> guard(lock);
+    in_flight--;
+    slot_free.notify_one();
+    if (in_flight == 0) {
+        idle.notify_all();
+    }
+}
+
+inline void AsyncSearcher::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]{ return in_flight == 0; });
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "context_scorer_impl.hh"
+#include "thread_pool_impl.hh"
+#include "latency_histogram.hh"
+
+//Everything the LM sees of a hypothesis: its last max_ngram_order - 1 words, oldest first, zero padded in front.
+typedef std::vector<unsigned int> LMState;
+
+/*Scores the next word of beam search hypotheses over an output vocabulary, one row per hypothesis. Hypotheses are carried as their
+  LM states, so extending one with the word it emitted is a shift and a decoding step costs the same no matter how long the
+  prefixes are. Hypotheses with the same state (common within a beam and across sentences of a batch) share one row: every
+  distinct state of a step is resolved and filled once, and the others get a copy. With a pool, the distinct states of a step are
+  split between its workers.*/
+class BeamScorer {
+    private:
+        ContextScorer scorer;
+        unsigned short state_size;
+        unsigned int begin_sentence;
+
+        void distinctStates(const std::vector<LMState>& states, std::vector<size_t>& first_of);
+
+    public:
+        size_t statesScored = 0; //Hypotheses scored and the distinct states among them
+        size_t distinctStatesScored = 0;
+        LatencyRecorder * latency = nullptr; //If set, records every decoding step, a call of score or scoreSparse
+
+        BeamScorer(LM& lm, const std::vector<unsigned int>& output_vocab);
+        LMState initialState() const;
+        LMState extend(const LMState& state, unsigned int vocabID) const;
+        void score(const std::vector<LMState>& states, float * results, WorkStealingPool * pool = nullptr);
+        void scoreSparse(const std::vector<LMState>& states, SparseScores& sparse);
+
+        size_t rowSize() const {
+            return scorer.rowSize();
+        }
+        const ContextScorer& contextScorer() const {
+            return scorer;
+        }
+};
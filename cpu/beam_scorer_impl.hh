@@ -0,0 +1,82 @@
+#pragma once
+#include "beam_scorer.hh"
+#include <map>
+
+inline BeamScorer::BeamScorer(LM& lm, const std::vector<unsigned int>& output_vocab)
+  : scorer(lm, output_vocab), state_size(lm.metadata.max_ngram_order - 1) {
+    std::unordered_map<std::string, unsigned int>::iterator it = lm.encode_map.find("<s>");
+    begin_sentence = (it != lm.encode_map.end()) ? it->second : 0;
+}
+
+inline LMState BeamScorer::initialState() const {
+    LMState state(state_size, 0);
+    if (state_size) {
+        state.back() = begin_sentence;
+    }
+    return state;
+}
+
+inline LMState BeamScorer::extend(const LMState& state, unsigned int vocabID) const {
+    if (state.empty()) {
+        return state;
+    }
+    LMState next(state.begin() + 1, state.end());
+    next.push_back(vocabID);
+    return next;
+}
+
+//first_of[i] is the first hypothesis with the same state as hypothesis i.
+inline void BeamScorer::distinctStates(const std::vector<LMState>& states, std::vector<size_t>& first_of) {
+    std::map<LMState, size_t> seen;
+    first_of.resize(states.size());
+    for (size_t i = 0; i < states.size(); i++) {
+        first_of[i] = seen.insert(std::make_pair(states[i], i)).first->second;
+    }
+    statesScored += states.size();
+    distinctStatesScored += seen.size();
+}
+
+inline void BeamScorer::score(const std::vector<LMState>& states, float * results, WorkStealingPool * pool) {
+    ScopedLatency timer(latency);
+    std::vector<size_t> first_of;
+    distinctStates(states, first_of);
+    size_t row_size = rowSize();
+
+    for (size_t i = 0; i < states.size(); i++) {
+        if (first_of[i] != i) {
+            continue;
+        }
+        if (pool) {
+            pool->submit([this, &states, results, row_size, i](unsigned int) {
+                scorer.scoreContext(states[i].data(), states[i].size(), &results[i*row_size]);
+            });
+        } else {
+            scorer.scoreContext(states[i].data(), states[i].size(), &results[i*row_size]);
+        }
+    }
+    if (pool) {
+        pool->wait();
+    }
+
+    for (size_t i = 0; i < states.size(); i++) {
+        if (first_of[i] != i) {
+            std::memcpy(&results[i*row_size], &results[first_of[i]*row_size], row_size*sizeof(float));
+        }
+    }
+}
+
+inline void BeamScorer::scoreSparse(const std::vector<LMState>& states, SparseScores& sparse) {
+    ScopedLatency timer(latency);
+    std::vector<size_t> first_of;
+    distinctStates(states, first_of);
+    size_t first_row = sparse.numRows();
+    ResolvedContext resolved;
+    for (size_t i = 0; i < states.size(); i++) {
+        if (first_of[i] != i) {
+            sparse.appendCopyOf(first_row + first_of[i]);
+        } else {
+            scorer.resolve(states[i].data(), states[i].size(), resolved);
+            scorer.appendSparseRow(resolved, sparse);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <stdint.h>
+
+/*Bounded lock free multi producer multi consumer queue (Dmitry Vyukov's ring buffer). Every cell carries a sequence number
+  that tells producers and consumers whether it is their turn, so the only contention is the CAS on the two positions.
+  push blocks while the queue is full. Once the producers are done they close the queue, and pop returns false after it has drained.
+  Blocked threads spin for a little while, then park on a condition variable until the other side makes room or pushes, so
+  idle pipeline stages don't take cores from busy ones. The lock is only ever taken when somebody has parked.*/
+template<class T>
+class BoundedQueue {
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        alignas(64) std::atomic<size_t> enqueue_pos;
+        alignas(64) std::atomic<size_t> dequeue_pos;
+        std::atomic<bool> closed;
+        static const unsigned int spins = 64; //Failed attempts before parking
+        std::mutex park_lock;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+        std::atomic<size_t> parked_pushers;
+        std::atomic<size_t> parked_poppers;
+
+        void wake(std::atomic<size_t>& parked, std::condition_variable& waiting);
+
+    public:
+        explicit BoundedQueue(size_t capacity); //Rounded up to a power of two
+        bool tryPush(T& item); //item is moved from only on success
+        bool tryPop(T& item);
+        void push(T item);
+        bool pop(T& item);
+        void close();
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+};
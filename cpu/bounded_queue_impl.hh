@@ -0,0 +1,125 @@
+#pragma once
+#include "bounded_queue.hh"
+
+template<class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : enqueue_pos(0), dequeue_pos(0), closed(false), parked_pushers(0), parked_poppers(0) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    mask = size - 1;
+    cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T>
+bool BoundedQueue<T>::tryPush(T& item) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            //The cell is free, try to claim it
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.data = std::move(item);
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; //Full
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<class T>
+bool BoundedQueue<T>::tryPop(T& item) {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                item = std::move(cell.data);
+                cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; //Empty
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/*Called after a push or pop. The fence orders it before the look at the parked count, and parking threads bump the count before
+  their last try, so either the parked thread sees the change or we see the parked thread. Taking the lock to notify makes sure
+  the thread is already waiting.*/
+template<class T>
+void BoundedQueue<T>::wake(std::atomic<size_t>& parked, std::condition_variable& waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(park_lock);
+        waiting.notify_one();
+    }
+}
+
+template<class T>
+void BoundedQueue<T>::push(T item) {
+    for (unsigned int i = 0; i < spins; i++) {
+        if (tryPush(item)) {
+            wake(parked_poppers, not_empty);
+            return;
+        }
+        std::this_thread::yield();
+    }
+    {
+        std::unique_lock<std::mutex> guard(park_lock);
+        parked_pushers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full.wait(guard, [&]() { return tryPush(item); });
+        parked_pushers.fetch_sub(1);
+    }
+    wake(parked_poppers, not_empty);
+}
+
+template<class T>
+bool BoundedQueue<T>::pop(T& item) {
+    bool popped = false;
+    for (unsigned int i = 0; i < spins && !popped; i++) {
+        if (tryPop(item)) {
+            popped = true;
+        } else if (closed.load(std::memory_order_acquire)) {
+            //Everything pushed before close is visible now, one last look.
+            return tryPop(item);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if (!popped) {
+        std::unique_lock<std::mutex> guard(park_lock);
+        parked_poppers.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_empty.wait(guard, [&]() { return (popped = tryPop(item)) || closed.load(std::memory_order_acquire); });
+        parked_poppers.fetch_sub(1);
+        if (!popped) {
+            popped = tryPop(item);
+        }
+    }
+    if (popped) {
+        wake(parked_pushers, not_full);
+    }
+    return popped;
+}
+
+template<class T>
+void BoundedQueue<T>::close() {
+    closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> guard(park_lock);
+    not_empty.notify_all();
+}
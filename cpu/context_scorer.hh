@@ -0,0 +1,95 @@
+#pragma once
+#include "../Trie/trie_v2_impl.hh"
+
+//The trie state of one suffix of a context: where its explicit continuations live and what it costs to back off from it.
+struct ContextLevel {
+    bool found;
+    size_t continuations; //Absolute byte offset of the Btree with the words that follow this suffix. 0 if there are none.
+    bool lastNgram; //The continuations are max order ngrams, prob only payload
+    float backoff;
+};
+
+//levels[i] holds the suffix of the last i+1 context words.
+struct ResolvedContext {
+    std::vector<ContextLevel> levels;
+};
+
+/*Rows of scores in sparse form. A row only stores the words with an explicit continuation under some suffix of its context, sorted
+  by output position. Every other word of row i scores its unigram probability plus backoffs[i], which is the same for all of them.
+  Row i is positions/scores[row_starts[i]..row_starts[i+1]).*/
+struct SparseScores {
+    std::vector<float> backoffs;
+    std::vector<size_t> row_starts = std::vector<size_t>(1, 0);
+    std::vector<unsigned int> positions;
+    std::vector<float> scores;
+
+    size_t numRows() const {
+        return backoffs.size();
+    }
+    size_t rowSize(size_t row) const {
+        return row_starts[row + 1] - row_starts[row];
+    }
+    //Appends another copy of an existing row, for contexts that repeat.
+    void appendCopyOf(size_t row) {
+        for (size_t i = row_starts[row]; i < row_starts[row + 1]; i++) {
+            unsigned int position = positions[i];
+            float score = scores[i];
+            positions.push_back(position);
+            scores.push_back(score);
+        }
+        float backoff = backoffs[row];
+        backoffs.push_back(backoff);
+        row_starts.push_back(positions.size());
+    }
+    void clear() {
+        backoffs.clear();
+        row_starts.assign(1, 0);
+        positions.clear();
+        scores.clear();
+    }
+};
+
+/*Scores every word of an output vocabulary (e.g. an NMT softmax, in its own order) given one context, without building a query
+  per word. The context is resolved once: for every suffix of it we find its continuations Btree and its backoff weight. The row
+  then starts from the unigram probabilities plus all the backoffs and every explicit continuation of a suffix overwrites its words,
+  shortest suffix first, with its probability plus the backoffs of the longer suffixes. The result equals CPUSearcher::scoreWindow
+  on [context, word] for every word. Works with both trie layouts. Contexts are oldest word first and may contain zeroes, which
+  are skipped. Output words unknown to the LM should be passed as <unk>, several positions may share a vocabID. The sparse form
+  of a row costs as much as its explicit continuations, usually a few hundred words, and top-k or the normalizer can be computed
+  from it directly.*/
+class ContextScorer {
+    private:
+        std::vector<float> unigram_row; //Unigram log probability of every output position
+        std::vector<size_t> positions_start; //positions[positions_start[id]..positions_start[id+1]) are the output positions of vocabID id
+        std::vector<unsigned int> positions;
+        std::vector<unsigned int> unigram_order; //Output positions by descending unigram probability
+        double unigram_mass; //Sum of the unigram probabilities of all output positions
+
+        template<class Functor>
+        void forEachExplicit(const ResolvedContext& resolved, Functor& fn) const;
+        float unigramProb(unsigned int vocabID) const;
+        float totalBackoff(const ResolvedContext& resolved) const;
+        void resolveForward(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const;
+        void resolveReversed(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const;
+
+    public:
+        LM& lm;
+
+        ContextScorer(LM& lm, const std::vector<unsigned int>& output_vocab);
+        void resolve(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const;
+        void fillRow(const ResolvedContext& resolved, float * row) const;
+        void scoreContext(const unsigned int * context, unsigned short len, float * row) const;
+
+        void appendSparseRow(const ResolvedContext& resolved, SparseScores& sparse) const;
+        void densify(const SparseScores& sparse, size_t row, float * dense_row) const;
+        float log10Sum(const SparseScores& sparse, size_t row) const; //log10 of the probability mass of the whole row
+        //The k best (position, score) pairs of a row, best first
+        void topK(const SparseScores& sparse, size_t row, size_t k, std::vector<std::pair<unsigned int, float> >& best) const;
+
+        size_t rowSize() const {
+            return unigram_row.size();
+        }
+        const std::vector<float>& unigramRow() const {
+            return unigram_row;
+        }
+};
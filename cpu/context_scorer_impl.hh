@@ -0,0 +1,269 @@
+#pragma once
+#include "context_scorer.hh"
+#include <algorithm>
+#include <cmath>
+
+inline ContextScorer::ContextScorer(LM& lm_, const std::vector<unsigned int>& output_vocab) : lm(lm_) {
+    unsigned int first_lvl_stride = lm.metadata.reversed_contexts ? 4 : 3;
+    size_t vocab_size = lm.first_lvl.size()/first_lvl_stride;
+
+    unigram_row.resize(output_vocab.size());
+    for (size_t i = 0; i < output_vocab.size(); i++) {
+        unigram_row[i] = unigramProb(output_vocab[i]);
+    }
+
+    //Bucket the output positions by vocabID
+    positions_start.assign(vocab_size + 2, 0);
+    for (unsigned int vocabID : output_vocab) {
+        positions_start[vocabID + 1]++;
+    }
+    for (size_t i = 1; i < positions_start.size(); i++) {
+        positions_start[i] += positions_start[i - 1];
+    }
+    positions.resize(output_vocab.size());
+    std::vector<size_t> next(positions_start.begin(), positions_start.end() - 1);
+    for (size_t i = 0; i < output_vocab.size(); i++) {
+        positions[next[output_vocab[i]]++] = i;
+    }
+
+    unigram_mass = 0;
+    unigram_order.resize(output_vocab.size());
+    for (size_t i = 0; i < output_vocab.size(); i++) {
+        unigram_mass += std::pow(10.0, unigram_row[i]);
+        unigram_order[i] = i;
+    }
+    std::stable_sort(unigram_order.begin(), unigram_order.end(), [this](unsigned int a, unsigned int b) {
+        return unigram_row[a] > unigram_row[b];
+    });
+}
+
+inline float ContextScorer::unigramProb(unsigned int vocabID) const {
+    float prob;
+    if (lm.metadata.reversed_contexts) {
+        assert(vocabID != 0 && vocabID <= lm.first_lvl.size()/4);
+        std::memcpy(&prob, &lm.first_lvl[(vocabID - 1)*4 + 2], sizeof(prob));
+    } else {
+        assert(vocabID != 0 && vocabID <= lm.first_lvl.size()/3);
+        std::memcpy(&prob, &lm.first_lvl[(vocabID - 1)*3 + 1], sizeof(prob));
+    }
+    return prob;
+}
+
+inline void ContextScorer::resolve(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const {
+    //Drop the padding and keep the most recent max_ngram_order - 1 words, the rest can't affect the score.
+    std::vector<unsigned int> words;
+    for (unsigned short i = 0; i < len; i++) {
+        if (context[i] != 0) {
+            words.push_back(context[i]);
+        }
+    }
+    size_t max_context = lm.metadata.max_ngram_order - 1;
+    size_t first = words.size() > max_context ? words.size() - max_context : 0;
+
+    ContextLevel missing = {false, 0, false, 0};
+    resolved.levels.assign(words.size() - first, missing);
+    if (lm.metadata.reversed_contexts) {
+        resolveReversed(words.data() + first, words.size() - first, resolved);
+    } else {
+        resolveForward(words.data() + first, words.size() - first, resolved);
+    }
+}
+
+//Every suffix is its own walk from the first level, same as CPUSearcher::findContext.
+inline void ContextScorer::resolveForward(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const {
+    for (unsigned short suffix_len = 1; suffix_len <= len; suffix_len++) {
+        const unsigned int * suffix = &context[len - suffix_len];
+        assert(suffix[0] <= lm.first_lvl.size()/3);
+        const unsigned int * first_lvl_entry = &lm.first_lvl[(suffix[0] - 1)*3];
+        size_t next_btree = first_lvl_entry[0]*4;
+        float backoff;
+        std::memcpy(&backoff, &first_lvl_entry[2], sizeof(backoff));
+
+        bool found = true;
+        for (unsigned short i = 1; i < suffix_len; i++) {
+            if (next_btree == 0) {
+                found = false;
+                break;
+            }
+            Entry_with_offset entry = searchBtree(lm.trieByteArray, next_btree, lm.metadata.btree_node_size, suffix[i], false);
+            if (!entry.found) {
+                found = false;
+                break;
+            }
+            next_btree = *entry.next_level ? next_btree + (*entry.next_level)*4 : 0;
+            backoff = entry.backoff;
+        }
+        if (found) {
+            ContextLevel& level = resolved.levels[suffix_len - 1];
+            level.found = true;
+            level.continuations = next_btree;
+            level.lastNgram = (suffix_len + 1 == lm.metadata.max_ngram_order);
+            level.backoff = backoff;
+        }
+    }
+}
+
+//One walk from the most recent word into the past, same as CPUSearcher::scoreReversed.
+inline void ContextScorer::resolveReversed(const unsigned int * context, unsigned short len, ResolvedContext& resolved) const {
+    if (len == 0) {
+        return;
+    }
+    assert(context[len - 1] <= lm.first_lvl.size()/4);
+    const unsigned int * node = &lm.first_lvl[(context[len - 1] - 1)*4];
+    size_t node_btree_start = 0;
+    float backoff;
+    std::memcpy(&backoff, &node[3], sizeof(backoff));
+
+    for (unsigned short suffix_len = 1; ; suffix_len++) {
+        ContextLevel& level = resolved.levels[suffix_len - 1];
+        level.found = true;
+        level.continuations = node[1] ? node_btree_start + node[1]*4 : 0;
+        level.lastNgram = true; //Predictions are always prob only
+        level.backoff = backoff;
+
+        if (suffix_len == len || node[0] == 0) {
+            break;
+        }
+        size_t children_start = node_btree_start + node[0]*4;
+        Entry_with_offset child = searchBtree(lm.trieByteArray, children_start, lm.metadata.btree_node_size, context[len - 1 - suffix_len], false);
+        if (!child.found) {
+            break;
+        }
+        node = child.next_level;
+        node_btree_start = children_start;
+        backoff = child.backoff;
+    }
+}
+
+/*Calls fn(position, score) for every output position that some suffix of the context continues with, shortest suffix first, so the
+  last call for a position is its final score.*/
+template<class Functor>
+void ContextScorer::forEachExplicit(const ResolvedContext& resolved, Functor& fn) const {
+    //longer_backoffs[i] is what we pay for backing off from the longest suffix down to suffix i, summed longest first like scoreWindow.
+    size_t num_levels = resolved.levels.size();
+    std::vector<float> longer_backoffs(num_levels + 1, 0);
+    float total_backoff = 0;
+    for (size_t i = num_levels; i > 0; i--) {
+        longer_backoffs[i - 1] = total_backoff;
+        if (resolved.levels[i - 1].found) {
+            total_backoff += resolved.levels[i - 1].backoff;
+        }
+    }
+
+    for (size_t i = 0; i < num_levels; i++) {
+        const ContextLevel& level = resolved.levels[i];
+        if (!level.found || level.continuations == 0) {
+            continue;
+        }
+        float backoff = longer_backoffs[i];
+        unsigned int prob_idx = level.lastNgram ? 0 : 1;
+        auto visit = [&](unsigned int vocabID, const unsigned int * payload) {
+            if (vocabID + 1 >= positions_start.size()) {
+                return;
+            }
+            float prob;
+            std::memcpy(&prob, &payload[prob_idx], sizeof(prob));
+            for (size_t j = positions_start[vocabID]; j < positions_start[vocabID + 1]; j++) {
+                fn(positions[j], backoff + prob);
+            }
+        };
+        traverseBtree(lm.trieByteArray, level.continuations, lm.metadata.btree_node_size, level.lastNgram, visit);
+    }
+}
+
+//The backoff paid by the words no suffix continues with. Summed in the same order as in forEachExplicit.
+inline float ContextScorer::totalBackoff(const ResolvedContext& resolved) const {
+    float total_backoff = 0;
+    for (size_t i = resolved.levels.size(); i > 0; i--) {
+        if (resolved.levels[i - 1].found) {
+            total_backoff += resolved.levels[i - 1].backoff;
+        }
+    }
+    return total_backoff;
+}
+
+inline void ContextScorer::fillRow(const ResolvedContext& resolved, float * row) const {
+    float backoff = totalBackoff(resolved);
+    for (size_t pos = 0; pos < unigram_row.size(); pos++) {
+        row[pos] = backoff + unigram_row[pos];
+    }
+    auto overwrite = [row](unsigned int position, float score) {
+        row[position] = score;
+    };
+    forEachExplicit(resolved, overwrite);
+}
+
+inline void ContextScorer::appendSparseRow(const ResolvedContext& resolved, SparseScores& sparse) const {
+    std::vector<std::pair<unsigned int, float> > explicit_scores;
+    auto collect = [&explicit_scores](unsigned int position, float score) {
+        explicit_scores.push_back(std::make_pair(position, score));
+    };
+    forEachExplicit(resolved, collect);
+    //Stable, so within a position the longest suffix comes last and wins.
+    std::stable_sort(explicit_scores.begin(), explicit_scores.end(),
+        [](const std::pair<unsigned int, float>& a, const std::pair<unsigned int, float>& b) { return a.first < b.first; });
+
+    for (size_t i = 0; i < explicit_scores.size(); i++) {
+        if (i + 1 < explicit_scores.size() && explicit_scores[i + 1].first == explicit_scores[i].first) {
+            continue;
+        }
+        sparse.positions.push_back(explicit_scores[i].first);
+        sparse.scores.push_back(explicit_scores[i].second);
+    }
+    sparse.backoffs.push_back(totalBackoff(resolved));
+    sparse.row_starts.push_back(sparse.positions.size());
+}
+
+inline void ContextScorer::densify(const SparseScores& sparse, size_t row, float * dense_row) const {
+    float backoff = sparse.backoffs[row];
+    for (size_t pos = 0; pos < unigram_row.size(); pos++) {
+        dense_row[pos] = backoff + unigram_row[pos];
+    }
+    for (size_t i = sparse.row_starts[row]; i < sparse.row_starts[row + 1]; i++) {
+        dense_row[sparse.positions[i]] = sparse.scores[i];
+    }
+}
+
+//The unigram mass of the implicit words is the total unigram mass minus that of the explicit ones, scaled by the backoff.
+inline float ContextScorer::log10Sum(const SparseScores& sparse, size_t row) const {
+    double implicit_unigram_mass = unigram_mass;
+    double explicit_mass = 0;
+    for (size_t i = sparse.row_starts[row]; i < sparse.row_starts[row + 1]; i++) {
+        implicit_unigram_mass -= std::pow(10.0, unigram_row[sparse.positions[i]]);
+        explicit_mass += std::pow(10.0, sparse.scores[i]);
+    }
+    implicit_unigram_mass = std::max(implicit_unigram_mass, 0.0);
+    return std::log10(explicit_mass + std::pow(10.0, sparse.backoffs[row])*implicit_unigram_mass);
+}
+
+//The best implicit words are the best unigrams that aren't explicit, so only the first k + row size of unigram_order can make it.
+inline void ContextScorer::topK(const SparseScores& sparse, size_t row, size_t k, std::vector<std::pair<unsigned int, float> >& best) const {
+    const unsigned int * explicit_begin = sparse.positions.data() + sparse.row_starts[row];
+    const unsigned int * explicit_end = sparse.positions.data() + sparse.row_starts[row + 1];
+
+    best.clear();
+    for (size_t i = sparse.row_starts[row]; i < sparse.row_starts[row + 1]; i++) {
+        best.push_back(std::make_pair(sparse.positions[i], sparse.scores[i]));
+    }
+    size_t implicit_taken = 0;
+    for (size_t i = 0; i < unigram_order.size() && implicit_taken < k; i++) {
+        unsigned int position = unigram_order[i];
+        if (!std::binary_search(explicit_begin, explicit_end, position)) {
+            best.push_back(std::make_pair(position, sparse.backoffs[row] + unigram_row[position]));
+            implicit_taken++;
+        }
+    }
+
+    k = std::min(k, best.size());
+    std::partial_sort(best.begin(), best.begin() + k, best.end(),
+        [](const std::pair<unsigned int, float>& a, const std::pair<unsigned int, float>& b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+    best.resize(k);
+}
+
+inline void ContextScorer::scoreContext(const unsigned int * context, unsigned short len, float * row) const {
+    ResolvedContext resolved;
+    resolve(context, len, resolved);
+    fillRow(resolved, row);
+}
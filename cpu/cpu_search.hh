@@ -0,0 +1,178 @@
+#pragma once
+#include "../Trie/trie_v2_impl.hh"
+#include "result_cache_impl.hh"
+#include "batch_dedup.hh"
+#include "latency_histogram.hh"
+#include "trace.hh"
+#include "../LM/lm_utils.hh"
+
+//The trie state of a fully matched context.
+struct ContextMatch {
+    size_t next_btree; //Absolute byte offset of the Btree with the continuations of the context. 0 if there are none.
+    float prob;
+    float backoff;
+};
+
+/*A small precomputed table that maps the most probable bigram and trigram contexts directly to their trie state,
+  so that the searcher can skip the first trie levels for them. The contexts are chosen at load time by their joint
+  probability estimated from the model itself: p(w1)*p(w2|w1) and p(w1)*p(w2|w1)*p(w3|w1 w2). The table stays empty for models with
+  reversed contexts, which don't need it.*/
+class HotContextTable {
+    private:
+        struct Slot {
+            unsigned int words[3]; //words[2] is 0 for bigram contexts. Empty slots have words[0] == 0.
+            size_t next_btree;
+            float prob;
+            float backoff;
+        };
+        std::vector<Slot> slots;
+        size_t mask;
+        size_t num_entries = 0;
+
+        size_t hashContext(const unsigned int * words, unsigned short len) const;
+        void insert(const unsigned int * words, unsigned short len, ContextMatch& match);
+
+    public:
+        unsigned short maxContextLength; //3 if the model can have trigram contexts, 2 for bigrams only, 0 for a bigram model.
+
+        HotContextTable(LM& lm, size_t max_entries);
+        bool find(const unsigned int * words, unsigned short len, ContextMatch& match) const;
+
+        size_t size() const {
+            return num_entries;
+        }
+        size_t memoryUsage() const {
+            return slots.size()*sizeof(Slot);
+        }
+};
+
+/*Counting policies for the trie walks of CPUSearcher. node() is called for every Btree node searched, attempt(order) whenever the
+  searcher looks for the word under a context of order - 1 words, hit(order) when it finds it there. The plain entry points count
+  with NoTraversalCounting, which compiles away. TraversalProfiler counts with a TraversalCounter.*/
+struct NoTraversalCounting : public NoNodeCounting {
+    void attempt(unsigned short) {}
+    void hit(unsigned short) {}
+};
+
+/*The walk of one unpadded ngram, advanced one lookup at a time by CPUSearcher::stepWalk so that the walks of several models can be
+  interleaved. Every step reads one first level entry or searches one Btree node, and prefetchWalk touches what the next step reads.
+  It scores exactly like scoreWindow, but without the hot context table.*/
+struct SteppedWalk {
+    enum Step {FIRST_LEVEL, CONTEXT, WORD, UNIGRAM, REVERSED_START, PREDICT, EXTEND, DONE};
+    const unsigned int * ngram;
+    unsigned short ngram_size;
+    Step next;
+    float score; //Once next is DONE
+    //The Btree that CONTEXT, WORD, PREDICT and EXTEND search, and its node to search next. node_start is 0 before the root.
+    size_t btree_start;
+    size_t node_start;
+    unsigned int node_bytes;
+    //Forward contexts: the attempt with the context starting at start, of which matched words out of len are found so far
+    unsigned short start;
+    unsigned short len;
+    unsigned short matched;
+    ContextMatch match;
+    float accumulated;
+    //Reversed contexts: the context node of the words from position on, as in scoreReversed
+    int position;
+    const unsigned int * node;
+    size_t node_btree_start;
+    float backoff;
+    float prob;
+
+    void finish(float final_score) {
+        score = final_score;
+        next = DONE;
+    }
+    void search(Step step, size_t btree) {
+        next = step;
+        btree_start = btree;
+        node_start = 0;
+    }
+    //Forward: on to the next shorter context, or to the unigram after the last one
+    void nextAttempt() {
+        start++;
+        if (start + 1 < ngram_size) {
+            len = ngram_size - 1 - start;
+            next = FIRST_LEVEL;
+        } else {
+            next = UNIGRAM;
+        }
+    }
+    //Forward: after a context word matched, on to the next one, or to the word once the whole context did
+    void advance() {
+        if (match.next_btree == 0) {
+            if (matched == len) {
+                accumulated += match.backoff;
+            }
+            nextAttempt(); //The trie doesn't continue from here
+        } else {
+            search(matched < len ? CONTEXT : WORD, match.next_btree);
+        }
+    }
+    //Reversed: after looking for the word under the current node, extend the context one word into the past if the trie does
+    void extend() {
+        if (position == 0 || node[0] == 0) {
+            finish(prob + accumulated);
+        } else {
+            search(EXTEND, node_btree_start + node[0]*4);
+        }
+    }
+    //Reversed: look for the word under a new context node, if it predicts anything
+    void predict() {
+        if (node[1] != 0) {
+            search(PREDICT, node_btree_start + node[1]*4);
+        } else {
+            accumulated += backoff;
+            extend();
+        }
+    }
+};
+
+/*Scores ngram queries on the CPU. The queries use the same layout as the ones we send to the GPU: max_ngram_order vocabIDs each,
+  oldest word first, padded with zeroes at the end. The result is the backed off log probability of the last non zero word given the
+  rest. A query with a leading zero is bogus and scores 0. Searchers are cheap, use one per thread. The hot context table and the
+  result cache are optional and can be shared between searchers. With deduplicate set, batches are uniqued before the search and only
+  the unique queries are scored. With reorder set, batches are searched sorted by their first two vocabIDs, so that queries sharing
+  a trie path run back to back and find it in cache. Results always come back in the original order. Models binarized with reversed
+  contexts are scored with a single walk per query and don't use the hot context table. Compact batches are scored straight from
+  the sentences, without expanding them to padded queries. Their results are indexed like batch.vocabIDs.*/
+class CPUSearcher {
+    private:
+        const HotContextTable * hot_contexts;
+        ResultCache * result_cache;
+        template<class Counter>
+        bool findContext(const unsigned int * words, unsigned short len, ContextMatch& match, Counter& count);
+        void searchBatch(const unsigned int * keys, size_t num_ngram_queries, float * results);
+        template<class Counter>
+        float scoreReversed(const unsigned int * ngram, unsigned short ngram_size, Counter& count);
+        bool stepBtree(SteppedWalk& walk, unsigned int vocabID, bool lastNgram, Entry_with_offset& entry);
+
+    public:
+        LM& lm;
+        size_t hotContextHits = 0;
+        size_t hotContextMisses = 0;
+        size_t cacheHits = 0;
+        size_t cacheMisses = 0;
+        bool deduplicate = false;
+        bool reorder = false;
+        size_t dedupInputQueries = 0; //Queries seen and unique queries scored while deduplicating
+        size_t dedupUniqueQueries = 0;
+        LatencyRecorder * latency = nullptr; //If set, records every batch searched and every sentence of a compact batch
+
+        float scoreNgram(const unsigned int * ngram);
+        float scoreWindow(const unsigned int * ngram, unsigned short ngram_size); //An unpadded ngram of ngram_size words
+        template<class Counter>
+        float scoreWindow(const unsigned int * ngram, unsigned short ngram_size, Counter& count); //Reporting the walk to count
+        void startWalk(const unsigned int * ngram, unsigned short ngram_size, SteppedWalk& walk);
+        bool stepWalk(SteppedWalk& walk); //Returns whether the walk is done
+        void prefetchWalk(const SteppedWalk& walk) const;
+        void search(const unsigned int * keys, size_t num_ngram_queries, float * results);
+        std::vector<float> search(std::vector<unsigned int>& queries);
+        void searchCompact(const CompactQueries& batch, size_t first_sentence, size_t num_sentences, float * results);
+        std::vector<float> searchCompact(const CompactQueries& batch);
+        double hotContextHitRate() const;
+        double cacheHitRate() const;
+        double uniqueRatio() const;
+        CPUSearcher(LM&, const HotContextTable * = nullptr, ResultCache * = nullptr);
+};
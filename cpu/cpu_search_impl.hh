@@ -0,0 +1,625 @@
+#pragma once
+#include "cpu_search.hh"
+#include <queue>
+#include <functional>
+
+//Candidate context for the HotContextTable, ordered by joint log probability.
+struct HotContextCandidate {
+    float score;
+    unsigned int words[3];
+    unsigned short len;
+    ContextMatch match;
+};
+
+inline bool operator> (const HotContextCandidate &left, const HotContextCandidate &right) {
+    return (left.score > right.score);
+}
+
+inline HotContextTable::HotContextTable(LM& lm, size_t max_entries) {
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    unsigned short btree_node_size = lm.metadata.btree_node_size;
+    //A context must have continuations in the trie, so bigram contexts need at least a trigram model and trigram ones a 4-gram model.
+    if (lm.metadata.reversed_contexts) {
+        maxContextLength = 0;
+    } else if (max_ngram_order >= 4) {
+        maxContextLength = 3;
+    } else if (max_ngram_order == 3) {
+        maxContextLength = 2;
+    } else {
+        maxContextLength = 0;
+    }
+
+    //Keep the load factor at most 0.5 so that probing stays short.
+    size_t capacity = 2;
+    while (capacity < 2*max_entries) {
+        capacity *= 2;
+    }
+    mask = capacity - 1;
+    if (maxContextLength == 0 || max_entries == 0) {
+        slots.resize(1);
+        mask = 0;
+        return;
+    }
+    slots.resize(capacity);
+    std::memset(slots.data(), 0, capacity*sizeof(Slot));
+
+    //Min heap of the best max_entries contexts seen so far.
+    std::priority_queue<HotContextCandidate, std::vector<HotContextCandidate>, std::greater<HotContextCandidate> > best;
+    auto consider = [&best, max_entries](HotContextCandidate& candidate) {
+        if (best.size() < max_entries) {
+            best.push(candidate);
+        } else if (candidate.score > best.top().score) {
+            best.pop();
+            best.push(candidate);
+        }
+    };
+
+    //Bigram contexts: every continuation of every unigram.
+    size_t num_unigrams = lm.first_lvl.size()/3;
+    for (unsigned int w1 = 1; w1 <= num_unigrams; w1++) {
+        unsigned int next_level = lm.first_lvl[(w1 - 1)*3];
+        if (next_level == 0) {
+            continue;
+        }
+        float unigram_prob;
+        std::memcpy(&unigram_prob, &lm.first_lvl[(w1 - 1)*3 + 1], sizeof(unigram_prob));
+        size_t btree_start = next_level*4;
+
+        auto visit_bigram = [&](unsigned int w2, unsigned int * payload) {
+            HotContextCandidate candidate;
+            candidate.words[0] = w1;
+            candidate.words[1] = w2;
+            candidate.words[2] = 0;
+            candidate.len = 2;
+            candidate.match.next_btree = payload[0] ? btree_start + payload[0]*4 : 0;
+            std::memcpy(&candidate.match.prob, &payload[1], sizeof(float));
+            std::memcpy(&candidate.match.backoff, &payload[2], sizeof(float));
+            candidate.score = unigram_prob + candidate.match.prob;
+            consider(candidate);
+        };
+        traverseBtree(lm.trieByteArray, btree_start, btree_node_size, max_ngram_order == 2, visit_bigram);
+    }
+
+    //Trigram contexts. A trigram can't be more probable than its bigram prefix, so only the prefixes that made the cut need expanding.
+    if (maxContextLength == 3) {
+        std::vector<HotContextCandidate> bigrams;
+        bigrams.reserve(best.size());
+        std::priority_queue<HotContextCandidate, std::vector<HotContextCandidate>, std::greater<HotContextCandidate> > copy = best;
+        while (!copy.empty()) {
+            bigrams.push_back(copy.top());
+            copy.pop();
+        }
+        for (auto& bigram : bigrams) {
+            if (bigram.match.next_btree == 0) {
+                continue;
+            }
+            auto visit_trigram = [&](unsigned int w3, unsigned int * payload) {
+                HotContextCandidate candidate;
+                candidate.words[0] = bigram.words[0];
+                candidate.words[1] = bigram.words[1];
+                candidate.words[2] = w3;
+                candidate.len = 3;
+                candidate.match.next_btree = payload[0] ? bigram.match.next_btree + payload[0]*4 : 0;
+                std::memcpy(&candidate.match.prob, &payload[1], sizeof(float));
+                std::memcpy(&candidate.match.backoff, &payload[2], sizeof(float));
+                candidate.score = bigram.score + candidate.match.prob;
+                consider(candidate);
+            };
+            traverseBtree(lm.trieByteArray, bigram.match.next_btree, btree_node_size, max_ngram_order == 3, visit_trigram);
+        }
+    }
+
+    while (!best.empty()) {
+        HotContextCandidate candidate = best.top();
+        insert(candidate.words, candidate.len, candidate.match);
+        best.pop();
+    }
+}
+
+inline size_t HotContextTable::hashContext(const unsigned int * words, unsigned short len) const {
+    uint64_t hash = words[0];
+    hash = hash*0x9E3779B97F4A7C15ULL + words[1];
+    hash = hash*0x9E3779B97F4A7C15ULL + (len == 3 ? words[2] : 0);
+    hash ^= hash >> 29;
+    return (size_t)hash & mask;
+}
+
+inline void HotContextTable::insert(const unsigned int * words, unsigned short len, ContextMatch& match) {
+    size_t idx = hashContext(words, len);
+    while (slots[idx].words[0] != 0) {
+        idx = (idx + 1) & mask;
+    }
+    slots[idx].words[0] = words[0];
+    slots[idx].words[1] = words[1];
+    slots[idx].words[2] = (len == 3) ? words[2] : 0;
+    slots[idx].next_btree = match.next_btree;
+    slots[idx].prob = match.prob;
+    slots[idx].backoff = match.backoff;
+    num_entries++;
+}
+
+inline bool HotContextTable::find(const unsigned int * words, unsigned short len, ContextMatch& match) const {
+    if (num_entries == 0) {
+        return false;
+    }
+    unsigned int third = (len == 3) ? words[2] : 0;
+    size_t idx = hashContext(words, len);
+    while (slots[idx].words[0] != 0) {
+        if (slots[idx].words[0] == words[0] && slots[idx].words[1] == words[1] && slots[idx].words[2] == third) {
+            match.next_btree = slots[idx].next_btree;
+            match.prob = slots[idx].prob;
+            match.backoff = slots[idx].backoff;
+            return true;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return false;
+}
+
+inline CPUSearcher::CPUSearcher(LM& lm_, const HotContextTable * hot_contexts_, ResultCache * result_cache_)
+  : hot_contexts(hot_contexts_), result_cache(result_cache_), lm(lm_) {}
+
+//Matches all len words as a context. Returns false if any of them is missing from the trie.
+template<class Counter>
+inline bool CPUSearcher::findContext(const unsigned int * words, unsigned short len, ContextMatch& match, Counter& count) {
+    unsigned short matched = 0;
+    if (hot_contexts && len >= 2 && hot_contexts->maxContextLength >= 2) {
+        unsigned short probe = std::min(len, hot_contexts->maxContextLength);
+        for (; probe >= 2; probe--) {
+            if (hot_contexts->find(words, probe, match)) {
+                matched = probe;
+                break;
+            }
+        }
+        if (matched) {
+            hotContextHits++;
+        } else {
+            hotContextMisses++;
+        }
+    }
+
+    if (!matched) {
+        //First level search is easy -> the next_level, prob and backoff for vocabID n are located at (n-1)*3, (n-1)*3+1 and (n-1)*3+2
+        assert(words[0] <= lm.first_lvl.size()/3);
+        unsigned int * first_lvl_entry = &lm.first_lvl[(words[0] - 1)*3];
+        match.next_btree = first_lvl_entry[0]*4;
+        std::memcpy(&match.prob, &first_lvl_entry[1], sizeof(match.prob));
+        std::memcpy(&match.backoff, &first_lvl_entry[2], sizeof(match.backoff));
+        matched = 1;
+    }
+
+    for (; matched < len; matched++) {
+        if (match.next_btree == 0) {
+            return false; //The trie doesn't continue from here
+        }
+        //Contexts are never of max order so they always live on the inner trie levels.
+        Entry_with_offset entry = searchBtree(lm.trieByteArray, match.next_btree, lm.metadata.btree_node_size, words[matched], false, count);
+        if (!entry.found) {
+            return false;
+        }
+        match.next_btree = *entry.next_level ? match.next_btree + (*entry.next_level)*4 : 0;
+        match.prob = entry.prob;
+        match.backoff = entry.backoff;
+    }
+    return true;
+}
+
+inline float CPUSearcher::scoreNgram(const unsigned int * ngram) {
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    unsigned short ngram_size = 0;
+    while (ngram_size < max_ngram_order && ngram[ngram_size] != 0) {
+        ngram_size++;
+    }
+    if (ngram_size == 0) {
+        return 0; //Bogus query
+    }
+    return scoreWindow(ngram, ngram_size);
+}
+
+inline float CPUSearcher::scoreWindow(const unsigned int * ngram, unsigned short ngram_size) {
+    NoTraversalCounting no_counting;
+    return scoreWindow(ngram, ngram_size, no_counting);
+}
+
+template<class Counter>
+inline float CPUSearcher::scoreWindow(const unsigned int * ngram, unsigned short ngram_size, Counter& count) {
+    if (lm.metadata.reversed_contexts) {
+        return scoreReversed(ngram, ngram_size, count);
+    }
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+
+    unsigned int word = ngram[ngram_size - 1];
+    float accumulated_score = 0;
+    //Try the longest match first. Every context that we find but which doesn't continue with our word contributes its backoff.
+    for (unsigned short start = 0; start < ngram_size - 1; start++) {
+        ContextMatch context;
+        unsigned short context_len = ngram_size - 1 - start;
+        count.attempt(context_len + 1);
+        if (!findContext(&ngram[start], context_len, context, count)) {
+            continue;
+        }
+        if (context.next_btree != 0) {
+            bool lastNgram = (context_len + 1 == max_ngram_order);
+            Entry_with_offset entry = searchBtree(lm.trieByteArray, context.next_btree, lm.metadata.btree_node_size, word, lastNgram, count);
+            if (entry.found) {
+                count.hit(context_len + 1);
+                return accumulated_score + entry.prob;
+            }
+        }
+        accumulated_score += context.backoff;
+    }
+
+    //Unigram
+    count.attempt(1);
+    count.hit(1);
+    assert(word <= lm.first_lvl.size()/3);
+    float prob;
+    std::memcpy(&prob, &lm.first_lvl[(word - 1)*3 + 1], sizeof(prob));
+    return accumulated_score + prob;
+}
+
+/*Walks the context nodes from the most recent word backwards. A context that predicts our word replaces the probability found so far
+  and cancels the backoffs of the shorter contexts collected before it, one that doesn't adds its backoff.*/
+template<class Counter>
+inline float CPUSearcher::scoreReversed(const unsigned int * ngram, unsigned short ngram_size, Counter& count) {
+    unsigned int word = ngram[ngram_size - 1];
+    assert(word <= lm.first_lvl.size()/4);
+    float prob;
+    std::memcpy(&prob, &lm.first_lvl[(word - 1)*4 + 2], sizeof(prob));
+    count.attempt(1);
+    count.hit(1);
+    float accumulated_backoff = 0;
+
+    //Context node of the previous word: children, predictions, prob, backoff
+    int position = ngram_size - 2;
+    const unsigned int * node = position >= 0 ? &lm.first_lvl[(ngram[position] - 1)*4] : nullptr;
+    float backoff = 0;
+    size_t node_btree_start = 0;
+    if (node) {
+        std::memcpy(&backoff, &node[3], sizeof(backoff));
+    }
+
+    while (node) {
+        bool predicted = false;
+        unsigned short order = ngram_size - position;
+        count.attempt(order);
+        if (node[1] != 0) {
+            Entry_with_offset entry = searchBtree(lm.trieByteArray, node_btree_start + node[1]*4, lm.metadata.btree_node_size, word, true, count);
+            if (entry.found) {
+                prob = entry.prob;
+                accumulated_backoff = 0;
+                predicted = true;
+                count.hit(order);
+            }
+        }
+        if (!predicted) {
+            accumulated_backoff += backoff;
+        }
+
+        //Extend the context one word into the past.
+        if (position == 0 || node[0] == 0) {
+            break;
+        }
+        position--;
+        size_t children_start = node_btree_start + node[0]*4;
+        Entry_with_offset child = searchBtree(lm.trieByteArray, children_start, lm.metadata.btree_node_size, ngram[position], false, count);
+        if (!child.found) {
+            break;
+        }
+        node = child.next_level;
+        node_btree_start = children_start;
+        backoff = child.backoff;
+    }
+    return prob + accumulated_backoff;
+}
+
+inline void CPUSearcher::startWalk(const unsigned int * ngram, unsigned short ngram_size, SteppedWalk& walk) {
+    walk.ngram = ngram;
+    walk.ngram_size = ngram_size;
+    walk.accumulated = 0;
+    if (lm.metadata.reversed_contexts) {
+        walk.next = SteppedWalk::REVERSED_START;
+        return;
+    }
+    walk.start = 0;
+    walk.len = ngram_size - 1;
+    walk.next = walk.len ? SteppedWalk::FIRST_LEVEL : SteppedWalk::UNIGRAM;
+}
+
+//Searches one node of the Btree of the walk, like an iteration of searchBtree. Returns whether the search is over, found or not.
+inline bool CPUSearcher::stepBtree(SteppedWalk& walk, unsigned int vocabID, bool lastNgram, Entry_with_offset& entry) {
+    if (walk.node_start == 0) {
+        std::memcpy(&walk.node_bytes, &lm.trieByteArray[walk.btree_start], sizeof(walk.node_bytes));
+        walk.node_start = walk.btree_start + 4;
+    }
+    entry = searchNode(lm.trieByteArray, walk.node_start, walk.node_bytes, vocabID, lastNgram ? 4 : 12, lm.metadata.btree_node_size);
+    if (entry.found || (entry.next_child_offset == 0 && entry.next_child_size == 0)) {
+        return true;
+    }
+    walk.node_start = entry.next_child_offset;
+    walk.node_bytes = entry.next_child_size;
+    return false;
+}
+
+//The same lookups as scoreWindow and scoreReversed, one per call.
+inline bool CPUSearcher::stepWalk(SteppedWalk& walk) {
+    unsigned int word = walk.ngram[walk.ngram_size - 1];
+    Entry_with_offset entry;
+    switch (walk.next) {
+        case SteppedWalk::FIRST_LEVEL: {
+            assert(walk.ngram[walk.start] <= lm.first_lvl.size()/3);
+            unsigned int * first_lvl_entry = &lm.first_lvl[(walk.ngram[walk.start] - 1)*3];
+            walk.match.next_btree = first_lvl_entry[0]*4;
+            std::memcpy(&walk.match.prob, &first_lvl_entry[1], sizeof(walk.match.prob));
+            std::memcpy(&walk.match.backoff, &first_lvl_entry[2], sizeof(walk.match.backoff));
+            walk.matched = 1;
+            walk.advance();
+            break;
+        }
+        case SteppedWalk::CONTEXT:
+            //Contexts are never of max order so they always live on the inner trie levels.
+            if (!stepBtree(walk, walk.ngram[walk.start + walk.matched], false, entry)) {
+                break;
+            }
+            if (!entry.found) {
+                walk.nextAttempt();
+                break;
+            }
+            walk.match.next_btree = *entry.next_level ? walk.match.next_btree + (*entry.next_level)*4 : 0;
+            walk.match.prob = entry.prob;
+            walk.match.backoff = entry.backoff;
+            walk.matched++;
+            walk.advance();
+            break;
+        case SteppedWalk::WORD:
+            if (!stepBtree(walk, word, walk.len + 1 == lm.metadata.max_ngram_order, entry)) {
+                break;
+            }
+            if (entry.found) {
+                walk.finish(walk.accumulated + entry.prob);
+            } else {
+                walk.accumulated += walk.match.backoff;
+                walk.nextAttempt();
+            }
+            break;
+        case SteppedWalk::UNIGRAM: {
+            assert(word <= lm.first_lvl.size()/3);
+            float prob;
+            std::memcpy(&prob, &lm.first_lvl[(word - 1)*3 + 1], sizeof(prob));
+            walk.finish(walk.accumulated + prob);
+            break;
+        }
+        case SteppedWalk::REVERSED_START:
+            assert(word <= lm.first_lvl.size()/4);
+            std::memcpy(&walk.prob, &lm.first_lvl[(word - 1)*4 + 2], sizeof(walk.prob));
+            if (walk.ngram_size < 2) {
+                walk.finish(walk.prob);
+                break;
+            }
+            walk.position = walk.ngram_size - 2;
+            walk.node = &lm.first_lvl[(walk.ngram[walk.position] - 1)*4];
+            walk.node_btree_start = 0;
+            std::memcpy(&walk.backoff, &walk.node[3], sizeof(walk.backoff));
+            walk.predict();
+            break;
+        case SteppedWalk::PREDICT:
+            if (!stepBtree(walk, word, true, entry)) {
+                break;
+            }
+            if (entry.found) {
+                walk.prob = entry.prob;
+                walk.accumulated = 0;
+            } else {
+                walk.accumulated += walk.backoff;
+            }
+            walk.extend();
+            break;
+        case SteppedWalk::EXTEND:
+            if (!stepBtree(walk, walk.ngram[walk.position - 1], false, entry)) {
+                break;
+            }
+            if (!entry.found) {
+                walk.finish(walk.prob + walk.accumulated);
+                break;
+            }
+            walk.position--;
+            walk.node = entry.next_level;
+            walk.node_btree_start = walk.btree_start;
+            walk.backoff = entry.backoff;
+            walk.predict();
+            break;
+        case SteppedWalk::DONE:
+            break;
+    }
+    return walk.next == SteppedWalk::DONE;
+}
+
+//Touches the first level entries or the Btree node that the next step of the walk reads.
+inline void CPUSearcher::prefetchWalk(const SteppedWalk& walk) const {
+    switch (walk.next) {
+        case SteppedWalk::FIRST_LEVEL:
+            __builtin_prefetch(&lm.first_lvl[(walk.ngram[walk.start] - 1)*3]);
+            break;
+        case SteppedWalk::UNIGRAM:
+            __builtin_prefetch(&lm.first_lvl[(walk.ngram[walk.ngram_size - 1] - 1)*3]);
+            break;
+        case SteppedWalk::REVERSED_START:
+            __builtin_prefetch(&lm.first_lvl[(walk.ngram[walk.ngram_size - 1] - 1)*4]);
+            if (walk.ngram_size > 1) {
+                __builtin_prefetch(&lm.first_lvl[(walk.ngram[walk.ngram_size - 2] - 1)*4]);
+            }
+            break;
+        case SteppedWalk::DONE:
+            break;
+        default:
+            //The vocabIDs of a node, which its linear search reads first
+            const unsigned char * node = &lm.trieByteArray[walk.node_start ? walk.node_start : walk.btree_start];
+            __builtin_prefetch(node);
+            __builtin_prefetch(node + 64);
+            break;
+    }
+}
+
+inline void CPUSearcher::search(const unsigned int * keys, size_t num_ngram_queries, float * results) {
+    ScopedLatency timer(latency);
+    GLM_TRACE_SPAN_ARG("CPUSearcher::search", "queries", num_ngram_queries);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    if (reorder && !deduplicate) {
+        //The trie is keyed oldest word first, so the first two words pick the first level entry and the Btree of its continuations.
+        std::vector<unsigned int> sorted_keys(num_ngram_queries*max_ngram_order);
+        std::vector<size_t> order;
+        {
+            GLM_TRACE_SPAN("reorder");
+            order = radixSortQueries(keys, num_ngram_queries, max_ngram_order, 2);
+            for (size_t i = 0; i < num_ngram_queries; i++) {
+                std::memcpy(&sorted_keys[i*max_ngram_order], &keys[order[i]*max_ngram_order], max_ngram_order*sizeof(unsigned int));
+            }
+        }
+        std::vector<float> sorted_results(num_ngram_queries);
+        searchBatch(sorted_keys.data(), num_ngram_queries, sorted_results.data());
+        GLM_TRACE_SPAN("write-back");
+        for (size_t i = 0; i < num_ngram_queries; i++) {
+            results[order[i]] = sorted_results[i];
+        }
+        return;
+    }
+    if (!deduplicate) {
+        searchBatch(keys, num_ngram_queries, results);
+        return;
+    }
+    //The unique queries come out sorted, so there is nothing left for reorder to do.
+    DedupedBatch batch;
+    {
+        GLM_TRACE_SPAN("dedup");
+        dedupQueries(keys, num_ngram_queries, max_ngram_order, batch);
+    }
+    size_t num_unique = batch.numUnique(max_ngram_order);
+    dedupInputQueries += num_ngram_queries;
+    dedupUniqueQueries += num_unique;
+
+    std::vector<float> unique_results(num_unique);
+    searchBatch(batch.unique_queries.data(), num_unique, unique_results.data());
+    GLM_TRACE_SPAN("write-back");
+    scatterResults(unique_results.data(), batch, results);
+}
+
+inline void CPUSearcher::searchBatch(const unsigned int * keys, size_t num_ngram_queries, float * results) {
+    GLM_TRACE_SPAN_ARG("lookup", "queries", num_ngram_queries);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    if (!result_cache) {
+        for (size_t i = 0; i < num_ngram_queries; i++) {
+            results[i] = scoreNgram(&keys[i*max_ngram_order]);
+        }
+        return;
+    }
+
+    //Consult the cache before traversing the trie. Bogus queries are cheap, don't let them take up cache space.
+    for (size_t i = 0; i < num_ngram_queries; i++) {
+        const unsigned int * query = &keys[i*max_ngram_order];
+        if (query[0] == 0) {
+            results[i] = 0;
+        } else if (result_cache->find(query, results[i])) {
+            cacheHits++;
+        } else {
+            cacheMisses++;
+            results[i] = scoreNgram(query);
+            result_cache->insert(query, results[i]);
+        }
+    }
+}
+
+inline std::vector<float> CPUSearcher::search(std::vector<unsigned int>& queries) {
+    size_t num_ngram_queries = queries.size()/lm.metadata.max_ngram_order;
+    std::vector<float> results(num_ngram_queries);
+    search(queries.data(), num_ngram_queries, results.data());
+    return results;
+}
+
+inline void CPUSearcher::searchCompact(const CompactQueries& batch, size_t first_sentence, size_t num_sentences, float * results) {
+    GLM_TRACE_SPAN_ARG("CPUSearcher::searchCompact", "sentences", num_sentences);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    std::vector<unsigned int> key(max_ngram_order); //Padded key for the result cache
+    for (size_t sentence = first_sentence; sentence < first_sentence + num_sentences; sentence++) {
+        ScopedLatency timer(latency);
+        unsigned int start = batch.sentence_starts[sentence];
+        unsigned int end = batch.sentenceEnd(sentence);
+        if (batch.first_is_context && start < end) {
+            results[start] = 0;
+            start++;
+        }
+        for (unsigned int pos = start; pos < end; pos++) {
+            unsigned int window_start = (pos + 1 >= batch.sentence_starts[sentence] + max_ngram_order) ?
+                pos + 1 - max_ngram_order : batch.sentence_starts[sentence];
+            const unsigned int * window = &batch.vocabIDs[window_start];
+            unsigned short window_len = pos + 1 - window_start;
+            if (!result_cache) {
+                results[pos] = scoreWindow(window, window_len);
+                continue;
+            }
+            std::fill(key.begin(), key.end(), 0);
+            std::memcpy(key.data(), window, window_len*sizeof(unsigned int));
+            if (result_cache->find(key.data(), results[pos])) {
+                cacheHits++;
+            } else {
+                cacheMisses++;
+                results[pos] = scoreWindow(window, window_len);
+                result_cache->insert(key.data(), results[pos]);
+            }
+        }
+    }
+}
+
+inline std::vector<float> CPUSearcher::searchCompact(const CompactQueries& batch) {
+    std::vector<float> results(batch.vocabIDs.size());
+    searchCompact(batch, 0, batch.numSentences(), results.data());
+    return results;
+}
+
+inline double CPUSearcher::hotContextHitRate() const {
+    size_t total = hotContextHits + hotContextMisses;
+    if (total == 0) {
+        return 0;
+    }
+    return (double)hotContextHits/(double)total;
+}
+
+inline double CPUSearcher::cacheHitRate() const {
+    size_t total = cacheHits + cacheMisses;
+    if (total == 0) {
+        return 0;
+    }
+    return (double)cacheHits/(double)total;
+}
+
+inline double CPUSearcher::uniqueRatio() const {
+    if (dedupInputQueries == 0) {
+        return 1;
+    }
+    return (double)dedupUniqueQueries/(double)dedupInputQueries;
+}
+
+//Checks that every ngram in the arpa file scores to its own probability, with and without the hot context table.
+template<class StringType>
+std::pair<bool, std::string> testCPUSearch(LM& lm, StringType arpafile, const HotContextTable * hot_contexts = nullptr) {
+    ArpaReader infile(arpafile);
+    processed_line text = infile.readline();
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    CPUSearcher searcher(lm, hot_contexts);
+
+    bool allcorrect = true;
+    std::stringstream error;
+    unsigned int line = 0;
+    while (!text.filefinished) {
+        text.ngrams.resize(max_ngram_order, 0); //Pad with zeroes
+        float res_prob = searcher.scoreNgram(text.ngrams.data());
+        if (res_prob != text.score) {
+            error << "Error expected prob: " << text.score << " got: " << res_prob << " at line: " << line << "." << std::endl;
+            allcorrect = false;
+            break;
+        }
+        line++;
+        text = infile.readline();
+    }
+
+    return std::pair<bool, std::string>(allcorrect, error.str());
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "cpu_search_impl.hh"
+
+/*The union of the vocabularies of several models. Sentences are tokenized and looked up once, into shared IDs, and every model maps
+  a shared ID to its own vocabID with a plain array lookup. Words a model doesn't know map to its <unk>, so every model must have one:
+  the constructor throws std::invalid_argument otherwise.*/
+class SharedVocab {
+    private:
+        std::unique_ptr<VocabTable> table;
+
+    public:
+        std::unordered_map<std::string, unsigned int> encode_map; //Shared IDs start at 1, 0 stays padding
+        std::vector<std::vector<unsigned int> > model_ids; //model_ids[model][shared ID]
+
+        explicit SharedVocab(const std::vector<LM *>& models);
+        const VocabTable& vocabTable() const {
+            return *table;
+        }
+        size_t numModels() const {
+            return model_ids.size();
+        }
+};
+
+/*Linear interpolation of several models: log10(sum_i weight_i * 10^score_i). Queries use shared IDs and the layout of CPUSearcher,
+  as wide as the highest order model, and each model sees as much of the history as its order allows. The walks of all the models
+  are interleaved a Btree node at a time, each prefetching the next node it needs while the others take their step, so their
+  cache misses overlap instead of queuing behind each other. A batch is a single pass. The weights should sum to 1, they default to
+  uniform and can be replaced per call. Searchers are cheap, use one per thread.*/
+class InterpolatedSearcher {
+    private:
+        const SharedVocab& vocab;
+        std::vector<std::unique_ptr<CPUSearcher> > searchers;
+        std::vector<unsigned int> mapped; //Scratch space for one query in the IDs of every model, max_ngram_order apart
+        std::vector<SteppedWalk> walks; //One per model
+
+    public:
+        unsigned short max_ngram_order; //Over all the models
+        std::vector<float> weights;
+        LatencyRecorder * latency = nullptr; //If set, records every batch searched and every sentence scored
+
+        InterpolatedSearcher(const std::vector<LM *>& models, const SharedVocab& vocab);
+        float scoreNgram(const unsigned int * ngram, const float * model_weights);
+        void search(const unsigned int * keys, size_t num_ngram_queries, float * results, const float * model_weights = nullptr);
+        //Interpolated log10 probability of a sentence, tokenized and mapped once. word_scores gets one score per word, if given.
+        double scoreSentence(boost::string_view sentence, bool addBeginEndMarkers, std::vector<float> * word_scores = nullptr,
+         const float * model_weights = nullptr);
+        size_t numModels() const {
+            return searchers.size();
+        }
+};
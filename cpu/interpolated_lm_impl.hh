@@ -0,0 +1,119 @@
+#pragma once
+#include "interpolated_lm.hh"
+#include <cmath>
+#include <stdexcept>
+
+inline SharedVocab::SharedVocab(const std::vector<LM *>& models) {
+    for (LM * lm : models) {
+        for (auto& entry : lm->encode_map) {
+            if (encode_map.find(entry.first) == encode_map.end()) {
+                unsigned int id = encode_map.size() + 1;
+                encode_map.insert(std::make_pair(entry.first, id));
+            }
+        }
+    }
+    table.reset(new VocabTable(encode_map));
+
+    model_ids.resize(models.size());
+    for (size_t model = 0; model < models.size(); model++) {
+        std::unordered_map<std::string, unsigned int>& model_map = models[model]->encode_map;
+        std::unordered_map<std::string, unsigned int>::iterator unk = model_map.find("<unk>");
+        //Words the model doesn't know would get vocabID 0, which its searcher can't score
+        if (unk == model_map.end()) {
+            throw std::invalid_argument("Interpolated model " + std::to_string(model) + " has no <unk>.");
+        }
+        model_ids[model].assign(encode_map.size() + 1, unk->second);
+        model_ids[model][0] = 0;
+        for (auto& entry : model_map) {
+            model_ids[model][encode_map[entry.first]] = entry.second;
+        }
+    }
+}
+
+inline InterpolatedSearcher::InterpolatedSearcher(const std::vector<LM *>& models, const SharedVocab& vocab_) : vocab(vocab_), max_ngram_order(0) {
+    assert(models.size() == vocab.numModels());
+    for (LM * lm : models) {
+        searchers.push_back(std::unique_ptr<CPUSearcher>(new CPUSearcher(*lm)));
+        max_ngram_order = std::max(max_ngram_order, lm->metadata.max_ngram_order);
+    }
+    weights.assign(models.size(), 1.0f/models.size());
+    mapped.resize(models.size()*max_ngram_order);
+    walks.resize(models.size());
+}
+
+inline float InterpolatedSearcher::scoreNgram(const unsigned int * ngram, const float * model_weights) {
+    unsigned short ngram_size = 0;
+    while (ngram_size < max_ngram_order && ngram[ngram_size] != 0) {
+        ngram_size++;
+    }
+    if (ngram_size == 0) {
+        return 0; //Bogus query
+    }
+
+    for (size_t model = 0; model < searchers.size(); model++) {
+        //The most recent words that fit in the order of this model
+        unsigned short window = std::min(ngram_size, searchers[model]->lm.metadata.max_ngram_order);
+        const unsigned int * window_start = &ngram[ngram_size - window];
+        const std::vector<unsigned int>& ids = vocab.model_ids[model];
+        unsigned int * model_window = &mapped[model*max_ngram_order];
+        for (unsigned short i = 0; i < window; i++) {
+            model_window[i] = ids[window_start[i]];
+        }
+        searchers[model]->startWalk(model_window, window, walks[model]);
+        searchers[model]->prefetchWalk(walks[model]);
+    }
+
+    //Every round takes one step of every walk still going, which prefetches its next step for the next round
+    size_t walking = searchers.size();
+    while (walking) {
+        for (size_t model = 0; model < searchers.size(); model++) {
+            if (walks[model].next == SteppedWalk::DONE) {
+                continue;
+            }
+            if (searchers[model]->stepWalk(walks[model])) {
+                walking--;
+            } else {
+                searchers[model]->prefetchWalk(walks[model]);
+            }
+        }
+    }
+
+    double probability = 0;
+    for (size_t model = 0; model < searchers.size(); model++) {
+        probability += model_weights[model]*std::pow(10.0, (double)walks[model].score);
+    }
+    return std::log10(probability);
+}
+
+inline void InterpolatedSearcher::search(const unsigned int * keys, size_t num_ngram_queries, float * results, const float * model_weights) {
+    ScopedLatency timer(latency);
+    if (!model_weights) {
+        model_weights = weights.data();
+    }
+    for (size_t i = 0; i < num_ngram_queries; i++) {
+        results[i] = scoreNgram(&keys[i*max_ngram_order], model_weights);
+    }
+}
+
+inline double InterpolatedSearcher::scoreSentence(boost::string_view sentence, bool addBeginEndMarkers, std::vector<float> * word_scores,
+ const float * model_weights) {
+    ScopedLatency timer(latency);
+    if (!model_weights) {
+        model_weights = weights.data();
+    }
+    std::vector<unsigned int> queries;
+    unsigned int num_queries = sent2ScoringQueries(sentence, queries, vocab.vocabTable(), max_ngram_order, addBeginEndMarkers);
+    std::vector<float> results(num_queries);
+    for (unsigned int i = 0; i < num_queries; i++) {
+        results[i] = scoreNgram(&queries[i*max_ngram_order], model_weights);
+    }
+
+    double total = 0;
+    for (float score : results) {
+        total += score;
+    }
+    if (word_scores) {
+        word_scores->swap(results);
+    }
+    return total;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "cpu_search_impl.hh"
+#include "thread_pool_impl.hh"
+
+//Scores of an n-best list: a total per hypothesis and a score per word, </s> included when sentence markers are on.
+struct NBestScores {
+    std::vector<double> totals;
+    std::vector<size_t> word_starts = std::vector<size_t>(1, 0); //Hypothesis i scored word_scores[word_starts[i]..word_starts[i+1])
+    std::vector<float> word_scores;
+};
+
+//A word lattice: states joined by word arcs, from start to any of the final states. It must be acyclic.
+struct Lattice {
+    struct Arc {
+        unsigned int from;
+        unsigned int to;
+        unsigned int vocabID;
+    };
+    unsigned int start = 0;
+    std::vector<unsigned int> finals;
+    std::vector<Arc> arcs;
+};
+
+/*Rescores n-best lists, whose hypotheses mostly share long prefixes. The hypotheses are sorted and merged into a prefix trie so that
+  every shared prefix is scored once. The (context, word) queries of the trie edges are deduplicated again before the search,
+  because different prefixes often end in the same max_ngram_order - 1 words. Lattices can be rescored as the n-best list of their
+  paths, which the trie folds back into their shared prefixes, but their number grows exponentially with the lattice: rescoreBest
+  finds the best path without listing them. Hypotheses are vocabIDs without sentence markers. Rescorers are cheap, use one per thread.*/
+class NBestRescorer {
+    private:
+        CPUSearcher searcher;
+        bool addBeginEndMarkers;
+        unsigned int begin_sentence;
+        unsigned int end_sentence;
+
+    public:
+        size_t wordsSeen = 0; //Words of all hypotheses, the trie edges they share and the distinct queries actually searched
+        size_t trieEdges = 0;
+        size_t queriesSearched = 0;
+
+        NBestRescorer(LM& lm, bool addBeginEndMarkers = true, const HotContextTable * hot_contexts = nullptr);
+        void rescore(const std::vector<std::vector<unsigned int> >& hypotheses, NBestScores& scores);
+        //False if the lattice has more than max_paths paths and only the first max_paths were rescored.
+        bool rescore(const Lattice& lattice, size_t max_paths, std::vector<std::vector<unsigned int> >& paths, NBestScores& scores);
+        /*The most probable path of the lattice, by dynamic programming over pairs of a lattice state and the last max_ngram_order - 1
+          words that led there, which is all the model can see. The queries leaving a state are searched together. scores gets the
+          path as its only hypothesis. False if no final state can be reached. Throws std::invalid_argument if the lattice has a cycle.*/
+        bool rescoreBest(const Lattice& lattice, std::vector<unsigned int>& best_path, NBestScores& scores);
+};
+
+//The paths of the lattice from start to a final state in depth first order, at most max_paths of them. False if there are more.
+bool latticePaths(const Lattice& lattice, size_t max_paths, std::vector<std::vector<unsigned int> >& paths);
+
+//Rescores many n-best lists on the pool, one task per list, with a rescorer per worker.
+void rescoreNBestLists(LM& lm, const std::vector<std::vector<std::vector<unsigned int> > >& lists, std::vector<NBestScores>& scores,
+ WorkStealingPool& pool, bool addBeginEndMarkers = true, const HotContextTable * hot_contexts = nullptr);
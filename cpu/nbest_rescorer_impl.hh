@@ -0,0 +1,304 @@
+#pragma once
+#include "nbest_rescorer.hh"
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <stdexcept>
+
+inline NBestRescorer::NBestRescorer(LM& lm, bool addBeginEndMarkers_, const HotContextTable * hot_contexts)
+  : searcher(lm, hot_contexts), addBeginEndMarkers(addBeginEndMarkers_) {
+    std::unordered_map<std::string, unsigned int>::iterator it = lm.encode_map.find("<s>");
+    begin_sentence = (it != lm.encode_map.end()) ? it->second : 0;
+    it = lm.encode_map.find("</s>");
+    end_sentence = (it != lm.encode_map.end()) ? it->second : 0;
+}
+
+inline void NBestRescorer::rescore(const std::vector<std::vector<unsigned int> >& hypotheses, NBestScores& scores) {
+    unsigned short max_ngram_order = searcher.lm.metadata.max_ngram_order;
+    size_t num_hypotheses = hypotheses.size();
+
+    //The sequence of a hypothesis is its words between the markers. Everything but the <s> gets scored.
+    size_t first_scored = addBeginEndMarkers ? 1 : 0;
+    auto length = [&](size_t hyp) -> size_t {
+        return hypotheses[hyp].size() + (addBeginEndMarkers ? 2 : 0);
+    };
+    auto wordAt = [&](size_t hyp, size_t pos) -> unsigned int {
+        if (!addBeginEndMarkers) {
+            return hypotheses[hyp][pos];
+        }
+        if (pos == 0) {
+            return begin_sentence;
+        }
+        return pos > hypotheses[hyp].size() ? end_sentence : hypotheses[hyp][pos - 1];
+    };
+
+    scores.totals.assign(num_hypotheses, 0);
+    scores.word_starts.assign(1, 0);
+    for (size_t hyp = 0; hyp < num_hypotheses; hyp++) {
+        scores.word_starts.push_back(scores.word_starts.back() + length(hyp) - first_scored);
+    }
+    scores.word_scores.resize(scores.word_starts.back());
+
+    //In sorted order every hypothesis shares its longest prefix with the one before it, so the trie path of the previous
+    //hypothesis is all we need to keep. Every new edge is one padded query: the edge's word and its history.
+    std::vector<size_t> order(num_hypotheses);
+    for (size_t i = 0; i < num_hypotheses; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&hypotheses](size_t a, size_t b) { return hypotheses[a] < hypotheses[b]; });
+
+    std::vector<size_t> edge_of(scores.word_scores.size()); //Trie edge of every scored word, laid out like word_scores
+    std::vector<size_t> path; //Edges of the previous hypothesis by position
+    std::vector<unsigned int> queries;
+    size_t num_edges = 0;
+    for (size_t i = 0; i < num_hypotheses; i++) {
+        size_t hyp = order[i];
+        size_t shared = 0;
+        if (i > 0) {
+            size_t prev = order[i - 1];
+            while (shared < length(hyp) && shared < length(prev) && wordAt(hyp, shared) == wordAt(prev, shared)) {
+                shared++;
+            }
+        }
+        path.resize(length(hyp));
+        for (size_t pos = std::max(shared, first_scored); pos < length(hyp); pos++) {
+            size_t history_start = (pos + 1 >= max_ngram_order) ? pos + 1 - max_ngram_order : 0;
+            for (size_t word = history_start; word <= pos; word++) {
+                queries.push_back(wordAt(hyp, word));
+            }
+            queries.resize(queries.size() + max_ngram_order - (pos + 1 - history_start), 0);
+            path[pos] = num_edges++;
+        }
+        for (size_t pos = first_scored; pos < length(hyp); pos++) {
+            edge_of[scores.word_starts[hyp] + pos - first_scored] = path[pos];
+        }
+    }
+
+    //Only the distinct queries are searched
+    DedupedBatch batch;
+    dedupQueries(queries.data(), num_edges, max_ngram_order, batch);
+    std::vector<float> unique_results = searcher.search(batch.unique_queries);
+    std::vector<float> edge_scores(num_edges);
+    scatterResults(unique_results.data(), batch, edge_scores.data());
+
+    for (size_t hyp = 0; hyp < num_hypotheses; hyp++) {
+        double total = 0;
+        for (size_t word = scores.word_starts[hyp]; word < scores.word_starts[hyp + 1]; word++) {
+            scores.word_scores[word] = edge_scores[edge_of[word]];
+            total += scores.word_scores[word];
+        }
+        scores.totals[hyp] = total;
+    }
+
+    wordsSeen += scores.word_scores.size();
+    trieEdges += num_edges;
+    queriesSearched += batch.numUnique(max_ngram_order);
+}
+
+inline bool NBestRescorer::rescore(const Lattice& lattice, size_t max_paths, std::vector<std::vector<unsigned int> >& paths, NBestScores& scores) {
+    bool complete = latticePaths(lattice, max_paths, paths);
+    rescore(paths, scores);
+    return complete;
+}
+
+inline bool NBestRescorer::rescoreBest(const Lattice& lattice, std::vector<unsigned int>& best_path, NBestScores& scores) {
+    unsigned short max_ngram_order = searcher.lm.metadata.max_ngram_order;
+    size_t history_length = max_ngram_order - 1;
+    unsigned int num_states = lattice.start + 1;
+    for (const Lattice::Arc& arc : lattice.arcs) {
+        num_states = std::max(num_states, std::max(arc.from, arc.to) + 1);
+    }
+    std::vector<std::vector<const Lattice::Arc *> > outgoing(num_states);
+    std::vector<unsigned int> incoming(num_states, 0);
+    for (const Lattice::Arc& arc : lattice.arcs) {
+        outgoing[arc.from].push_back(&arc);
+        incoming[arc.to]++;
+    }
+
+    //Best way to reach a state with a given history. Hypotheses are kept in one array and point back to the one they extend.
+    struct Hypothesis {
+        double score;
+        size_t previous;
+        unsigned int word;
+        float word_score;
+    };
+    const size_t none = std::numeric_limits<size_t>::max();
+    std::vector<Hypothesis> hypotheses;
+    std::vector<std::map<std::vector<unsigned int>, size_t> > best(num_states);
+    std::vector<unsigned int> history;
+    if (addBeginEndMarkers) {
+        history.push_back(begin_sentence);
+    }
+    hypotheses.push_back(Hypothesis{0, none, 0, 0});
+    best[lattice.start][history] = 0;
+
+    //Query of word after history: the history oldest word first, then the word, padded with zeroes
+    std::vector<unsigned int> queries;
+    auto addQuery = [&](const std::vector<unsigned int>& context, unsigned int word) {
+        queries.insert(queries.end(), context.begin(), context.end());
+        queries.push_back(word);
+        queries.resize(queries.size() + max_ngram_order - context.size() - 1, 0);
+    };
+
+    //States in topological order, expanding each one once everything that leads to it is done
+    std::vector<unsigned int> ready;
+    for (unsigned int state = 0; state < num_states; state++) {
+        if (incoming[state] == 0) {
+            ready.push_back(state);
+        }
+    }
+    size_t num_expanded = 0;
+    while (!ready.empty()) {
+        unsigned int state = ready.back();
+        ready.pop_back();
+        num_expanded++;
+        queries.clear();
+        for (const std::pair<const std::vector<unsigned int>, size_t>& reached : best[state]) {
+            for (const Lattice::Arc * arc : outgoing[state]) {
+                addQuery(reached.first, arc->vocabID);
+            }
+        }
+        std::vector<float> results = searcher.search(queries);
+        queriesSearched += results.size();
+        size_t query = 0;
+        for (const std::pair<const std::vector<unsigned int>, size_t>& reached : best[state]) {
+            for (const Lattice::Arc * arc : outgoing[state]) {
+                history = reached.first;
+                history.push_back(arc->vocabID);
+                if (history.size() > history_length) {
+                    history.erase(history.begin(), history.begin() + (history.size() - history_length));
+                }
+                double score = hypotheses[reached.second].score + results[query];
+                std::map<std::vector<unsigned int>, size_t>::iterator it = best[arc->to].find(history);
+                if (it == best[arc->to].end()) {
+                    best[arc->to][history] = hypotheses.size();
+                    hypotheses.push_back(Hypothesis{score, reached.second, arc->vocabID, results[query]});
+                } else if (score > hypotheses[it->second].score) {
+                    hypotheses[it->second] = Hypothesis{score, reached.second, arc->vocabID, results[query]};
+                }
+                query++;
+            }
+        }
+        for (const Lattice::Arc * arc : outgoing[state]) {
+            if (--incoming[arc->to] == 0) {
+                ready.push_back(arc->to);
+            }
+        }
+    }
+    if (num_expanded != num_states) {
+        throw std::invalid_argument("The lattice has a cycle");
+    }
+
+    //Close every hypothesis that reached a final state with </s>
+    std::vector<size_t> finished;
+    queries.clear();
+    for (unsigned int state : lattice.finals) {
+        if (state >= num_states) {
+            continue;
+        }
+        for (const std::pair<const std::vector<unsigned int>, size_t>& reached : best[state]) {
+            finished.push_back(reached.second);
+            if (addBeginEndMarkers) {
+                addQuery(reached.first, end_sentence);
+            }
+        }
+    }
+    std::vector<float> end_scores = searcher.search(queries);
+    queriesSearched += end_scores.size();
+    size_t winner = none;
+    float winner_end = 0;
+    double winner_score = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < finished.size(); i++) {
+        float end_score = addBeginEndMarkers ? end_scores[i] : 0;
+        double score = hypotheses[finished[i]].score + end_score;
+        if (winner == none || score > winner_score) {
+            winner = finished[i];
+            winner_end = end_score;
+            winner_score = score;
+        }
+    }
+
+    best_path.clear();
+    scores.totals.clear();
+    scores.word_starts.assign(1, 0);
+    scores.word_scores.clear();
+    if (winner == none) {
+        return false;
+    }
+    for (size_t hyp = winner; hypotheses[hyp].previous != none; hyp = hypotheses[hyp].previous) {
+        best_path.push_back(hypotheses[hyp].word);
+        scores.word_scores.push_back(hypotheses[hyp].word_score);
+    }
+    std::reverse(best_path.begin(), best_path.end());
+    std::reverse(scores.word_scores.begin(), scores.word_scores.end());
+    if (addBeginEndMarkers) {
+        scores.word_scores.push_back(winner_end);
+    }
+    scores.totals.push_back(winner_score);
+    scores.word_starts.push_back(scores.word_scores.size());
+    wordsSeen += scores.word_scores.size();
+    return true;
+}
+
+inline bool latticePaths(const Lattice& lattice, size_t max_paths, std::vector<std::vector<unsigned int> >& paths) {
+    unsigned int num_states = lattice.start + 1;
+    for (const Lattice::Arc& arc : lattice.arcs) {
+        num_states = std::max(num_states, std::max(arc.from, arc.to) + 1);
+    }
+    std::vector<std::vector<const Lattice::Arc *> > outgoing(num_states);
+    for (const Lattice::Arc& arc : lattice.arcs) {
+        outgoing[arc.from].push_back(&arc);
+    }
+    std::vector<bool> is_final(num_states, false);
+    for (unsigned int state : lattice.finals) {
+        if (state < num_states) {
+            is_final[state] = true;
+        }
+    }
+
+    //Depth first, the stack holds the state and the next arc to follow for every word of the current path.
+    paths.clear();
+    std::vector<std::pair<unsigned int, size_t> > stack(1, std::make_pair(lattice.start, 0));
+    std::vector<unsigned int> words;
+    if (is_final[lattice.start]) {
+        if (max_paths == 0) {
+            return false;
+        }
+        paths.push_back(words);
+    }
+    while (!stack.empty()) {
+        std::pair<unsigned int, size_t>& top = stack.back();
+        if (top.second == outgoing[top.first].size()) {
+            stack.pop_back();
+            if (!words.empty()) {
+                words.pop_back();
+            }
+            continue;
+        }
+        const Lattice::Arc * arc = outgoing[top.first][top.second++];
+        words.push_back(arc->vocabID);
+        stack.push_back(std::make_pair(arc->to, 0));
+        if (is_final[arc->to]) {
+            if (paths.size() == max_paths) {
+                return false; //There is one more
+            }
+            paths.push_back(words);
+        }
+    }
+    return true;
+}
+
+inline void rescoreNBestLists(LM& lm, const std::vector<std::vector<std::vector<unsigned int> > >& lists, std::vector<NBestScores>& scores,
+ WorkStealingPool& pool, bool addBeginEndMarkers, const HotContextTable * hot_contexts) {
+    std::vector<std::unique_ptr<NBestRescorer> > rescorers;
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        rescorers.push_back(std::unique_ptr<NBestRescorer>(new NBestRescorer(lm, addBeginEndMarkers, hot_contexts)));
+    }
+    scores.resize(lists.size());
+    for (size_t i = 0; i < lists.size(); i++) {
+        pool.submit([&, i](unsigned int worker) {
+            rescorers[worker]->rescore(lists[i], scores[i]);
+        });
+    }
+    pool.wait();
+}
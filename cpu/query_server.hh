@@ -0,0 +1,187 @@
+#pragma once
+#include "cpu_search_impl.hh"
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+/*Binary protocol of the query server. Every integer and float is in host byte order, the server only listens locally. On connect the
+  server sends a QueryHello. A client then sends requests, each a QueryRequestHeader and its payload, and gets back for each a
+  QueryResponseHeader and its payload, matched by request_id. Requests are answered as soon as they're scored, not necessarily in order.
+    SCORE_NGRAMS: count padded queries of max_ngram_order vocabIDs each, oldest word first (the CPUSearcher layout). Answered with
+                  count floats, the log10 probability of every query.
+    LOOKUP_WORDS: count bytes of space separated words. Answered with count vocabIDs, one per word, <unk> for unknown words.
+  A request the server can't take gets a response with an error status and no payload, and the server closes the connection.*/
+#define QUERY_SERVER_MAGIC 0x324d4c67 //"gLM2"
+#define QUERY_MAX_LOOKUP_BYTES (1 << 24)
+
+enum QueryMessageType : uint8_t {SCORE_NGRAMS = 1, LOOKUP_WORDS = 2};
+enum QueryStatus : uint8_t {QUERY_OK = 0, QUERY_BAD_REQUEST = 1, QUERY_TOO_LARGE = 2};
+
+struct QueryHello {
+    uint32_t magic;
+    uint16_t max_ngram_order;
+    uint16_t reversed_contexts;
+    uint32_t max_request_ngrams;
+};
+
+struct QueryRequestHeader {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t request_id;
+    uint32_t count;
+};
+
+struct QueryResponseHeader {
+    uint8_t status;
+    uint8_t reserved[3];
+    uint32_t request_id;
+    uint32_t count;
+};
+
+/*Coalesces small scoring requests into batches. A batch closes once it holds max_batch_ngrams ngrams or its oldest request has
+  waited max_wait, whichever comes first, so batching adds at most max_wait to the latency of a request when the scorers keep up.
+  Submitters block while max_pending_ngrams ngrams are waiting, which bounds the memory of a server that is falling behind.
+  Any number of scorer threads can take batches.*/
+class MicroBatcher {
+    public:
+        struct Request {
+            std::vector<unsigned int> queries; //max_ngram_order vocabIDs per ngram
+            std::function<void(const float *, size_t)> done; //Called by the scorer with the score of every ngram
+            std::chrono::time_point<std::chrono::steady_clock> arrival;
+        };
+
+    private:
+        std::mutex lock;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<Request> pending;
+        size_t pending_ngrams = 0;
+        bool closed = false;
+        unsigned short max_ngram_order;
+        size_t max_batch_ngrams;
+        size_t max_pending_ngrams;
+        std::chrono::microseconds max_wait;
+
+    public:
+        std::atomic<size_t> num_requests;
+        std::atomic<size_t> num_ngrams;
+        std::atomic<size_t> num_batches;
+
+        MicroBatcher(unsigned short max_ngram_order, size_t max_batch_ngrams, std::chrono::microseconds max_wait, size_t max_pending_ngrams);
+        void submit(Request request);
+        bool nextBatch(std::vector<Request>& batch); //Blocks until a batch is ready. False once closed and drained.
+        void close();
+};
+
+struct QueryServerOptions {
+    std::string socket_path; //Unix domain socket, replaced if it exists
+    int tcp_port = 0; //Also listen on 127.0.0.1 at this port, if not 0
+    size_t max_batch_ngrams = 8192;
+    unsigned int max_wait_us = 500;
+    unsigned int scorer_threads = 1;
+    size_t max_request_ngrams = 65536;
+    size_t max_pending_ngrams = 1 << 20;
+    size_t max_outbound_bytes = 1 << 26; //Responses a client may leave unread before it's dropped
+    unsigned int send_timeout_ms = 10000; //A client that takes no bytes for this long is dropped
+    bool deduplicate = true; //Concurrent decoders ask for the same ngrams a lot
+    LatencyRecorder * latency = nullptr; //If set, records every scoring request from arrival until its response is sent
+};
+
+/*Serves one shared model to the decoders of a host. Every connection gets a reader thread that parses requests and hands the
+  scoring ones to the MicroBatcher, and a writer thread that sends the responses queued for it. Scorer threads, each with its own
+  CPUSearcher, score the batches and queue the responses on the connections they came from, so a client that stops reading holds
+  up nobody but itself. Word lookups are answered by the reader straight away.*/
+class QueryServer {
+    private:
+        struct Connection {
+            struct Outbound {
+                std::vector<char> message;
+                std::chrono::time_point<std::chrono::steady_clock> arrival; //Of the request, if its latency is recorded
+            };
+
+            int fd;
+            size_t max_outbound_bytes;
+            LatencyRecorder * latency;
+            std::mutex lock;
+            std::condition_variable wake_writer;
+            std::deque<Outbound> outbound;
+            size_t outbound_bytes = 0;
+            size_t outstanding = 0; //Scoring requests submitted and not answered yet
+            bool reading = true;
+            std::atomic<bool> dropped;
+            std::atomic<int> threads_done; //The reader and the writer, reaped once both are
+
+            Connection(int fd_, size_t max_outbound_bytes_, LatencyRecorder * latency_) : fd(fd_), max_outbound_bytes(max_outbound_bytes_),
+             latency(latency_), dropped(false), threads_done(0) {}
+            ~Connection();
+            //Queues a response without blocking. False if the connection is gone, or dropped because the client isn't reading.
+            bool send(const QueryResponseHeader& header, const void * payload, size_t payload_bytes,
+             std::chrono::time_point<std::chrono::steady_clock> arrival = std::chrono::time_point<std::chrono::steady_clock>());
+            bool sendRaw(const void * data, size_t bytes, std::chrono::time_point<std::chrono::steady_clock> arrival);
+            void submitted();
+            void answered();
+            void stopReading();
+            void drop();
+            void write(); //The writer thread, until the reader is done and every request answered, or the client is dropped
+        };
+        struct Served {
+            std::shared_ptr<Connection> connection;
+            std::thread reader;
+            std::thread writer;
+        };
+
+        LM& lm;
+        VocabTable vocab;
+        const HotContextTable * hot_contexts;
+        QueryServerOptions options;
+        MicroBatcher batcher;
+        unsigned int max_vocabID;
+        int unix_fd = -1;
+        int tcp_fd = -1;
+        int wake_pipe[2]; //Written by stop() and by connections whose threads are done
+        std::atomic<bool> stopping;
+        std::list<Served> connections;
+
+        void listen();
+        void serve(std::shared_ptr<Connection> connection);
+        void writeResponses(std::shared_ptr<Connection> connection);
+        void threadDone(Connection& connection);
+        void score();
+
+    public:
+        QueryServer(LM&, QueryServerOptions, const HotContextTable * = nullptr);
+        ~QueryServer();
+        void run(); //Serves until stop() is called, then answers what has been submitted and returns
+        void stop(); //Async signal safe
+        void printStats(std::ostream& out) const;
+};
+
+//A blocking client for a single thread. Throws std::runtime_error if the server can't be reached or fails a request.
+class QueryClient {
+    private:
+        int fd;
+        QueryHello hello;
+        uint32_t next_id = 1;
+
+        void connected();
+        QueryResponseHeader exchange(QueryMessageType type, const void * payload, size_t payload_bytes, uint32_t count);
+
+    public:
+        explicit QueryClient(const std::string& socket_path);
+        QueryClient(const std::string& address, int tcp_port); //Numeric IPv4 address
+        ~QueryClient();
+        QueryClient(const QueryClient&) = delete;
+        QueryClient& operator=(const QueryClient&) = delete;
+
+        unsigned short maxNgramOrder() const {
+            return hello.max_ngram_order;
+        }
+        std::vector<unsigned int> lookup(const std::string& words);
+        std::vector<float> score(const std::vector<unsigned int>& queries);
+};
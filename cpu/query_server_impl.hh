@@ -0,0 +1,540 @@
+#pragma once
+#include "query_server.hh"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//Blocking send and receive of exactly bytes. False if the peer went away.
+inline bool querySendAll(int fd, const void * data, size_t bytes) {
+    const char * position = static_cast<const char *>(data);
+    while (bytes) {
+        ssize_t sent = ::send(fd, position, bytes, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        position += sent;
+        bytes -= sent;
+    }
+    return true;
+}
+
+inline bool queryRecvAll(int fd, void * data, size_t bytes) {
+    char * position = static_cast<char *>(data);
+    while (bytes) {
+        ssize_t received = ::recv(fd, position, bytes, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        position += received;
+        bytes -= received;
+    }
+    return true;
+}
+
+inline MicroBatcher::MicroBatcher(unsigned short max_ngram_order_, size_t max_batch_ngrams_, std::chrono::microseconds max_wait_,
+ size_t max_pending_ngrams_) : max_ngram_order(max_ngram_order_), max_batch_ngrams(std::max(max_batch_ngrams_, (size_t)1)),
+ max_pending_ngrams(std::max(max_pending_ngrams_, (size_t)1)), max_wait(max_wait_), num_requests(0), num_ngrams(0), num_batches(0) {}
+
+inline void MicroBatcher::submit(Request request) {
+    size_t ngrams = request.queries.size()/max_ngram_order;
+    std::unique_lock<std::mutex> guard(lock);
+    //A request larger than the bound still gets in once nothing else is waiting
+    not_full.wait(guard, [&]() { return closed || pending_ngrams == 0 || pending_ngrams + ngrams <= max_pending_ngrams; });
+    pending.push_back(std::move(request));
+    pending_ngrams += ngrams;
+    num_requests++;
+    num_ngrams += ngrams;
+    not_empty.notify_all();
+}
+
+/*Waits for a request, then for the batch to fill up until the oldest request has waited max_wait. With several scorers they all
+  wait on the same window and whoever wakes first takes it, the others go back to waiting for the next one.*/
+inline bool MicroBatcher::nextBatch(std::vector<Request>& batch) {
+    batch.clear();
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        not_empty.wait(guard, [&]() { return closed || !pending.empty(); });
+        if (pending.empty()) {
+            return false;
+        }
+        std::chrono::time_point<std::chrono::steady_clock> deadline = pending.front().arrival + max_wait;
+        while (!closed && pending_ngrams < max_batch_ngrams && !pending.empty() && std::chrono::steady_clock::now() < deadline) {
+            not_empty.wait_until(guard, deadline);
+        }
+        if (pending.empty()) {
+            continue;
+        }
+        size_t batch_ngrams = 0;
+        while (!pending.empty()) {
+            size_t ngrams = pending.front().queries.size()/max_ngram_order;
+            if (!batch.empty() && batch_ngrams + ngrams > max_batch_ngrams) {
+                break;
+            }
+            batch_ngrams += ngrams;
+            batch.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+        pending_ngrams -= batch_ngrams;
+        num_batches++;
+        not_full.notify_all();
+        if (!pending.empty()) {
+            not_empty.notify_all();
+        }
+        return true;
+    }
+}
+
+inline void MicroBatcher::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    not_empty.notify_all();
+    not_full.notify_all();
+}
+
+inline QueryServer::Connection::~Connection() {
+    ::close(fd);
+}
+
+//Header and payload in one message, so that small responses go out in a single packet.
+inline bool QueryServer::Connection::send(const QueryResponseHeader& header, const void * payload, size_t payload_bytes,
+ std::chrono::time_point<std::chrono::steady_clock> arrival) {
+    std::vector<char> message(sizeof(header) + payload_bytes);
+    std::memcpy(message.data(), &header, sizeof(header));
+    if (payload_bytes) {
+        std::memcpy(message.data() + sizeof(header), payload, payload_bytes);
+    }
+    return sendRaw(message.data(), message.size(), arrival);
+}
+
+inline bool QueryServer::Connection::sendRaw(const void * data, size_t bytes, std::chrono::time_point<std::chrono::steady_clock> arrival) {
+    if (dropped) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        //A response larger than the bound still goes out once the client has read everything else
+        if (outbound.empty() || outbound_bytes + bytes <= max_outbound_bytes) {
+            const char * position = static_cast<const char *>(data);
+            outbound.push_back(Outbound());
+            outbound.back().message.assign(position, position + bytes);
+            outbound.back().arrival = arrival;
+            outbound_bytes += bytes;
+            wake_writer.notify_one();
+            return true;
+        }
+    }
+    drop();
+    return false;
+}
+
+inline void QueryServer::Connection::submitted() {
+    std::lock_guard<std::mutex> guard(lock);
+    outstanding++;
+}
+
+inline void QueryServer::Connection::answered() {
+    std::lock_guard<std::mutex> guard(lock);
+    outstanding--;
+    wake_writer.notify_one();
+}
+
+inline void QueryServer::Connection::stopReading() {
+    std::lock_guard<std::mutex> guard(lock);
+    reading = false;
+    wake_writer.notify_one();
+}
+
+//Shutting the socket down wakes the reader, responses still to come are thrown away.
+inline void QueryServer::Connection::drop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        dropped = true;
+        outbound.clear();
+        outbound_bytes = 0;
+        wake_writer.notify_one();
+    }
+    ::shutdown(fd, SHUT_RDWR);
+}
+
+inline void QueryServer::Connection::write() {
+    while (true) {
+        Outbound next;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake_writer.wait(guard, [&]() { return dropped || !outbound.empty() || (!reading && outstanding == 0); });
+            if (dropped || outbound.empty()) {
+                return;
+            }
+            next = std::move(outbound.front());
+            outbound.pop_front();
+            outbound_bytes -= next.message.size();
+        }
+        //Times out after send_timeout_ms, see SO_SNDTIMEO in run()
+        if (!querySendAll(fd, next.message.data(), next.message.size())) {
+            drop();
+            return;
+        }
+        if (latency && next.arrival.time_since_epoch().count()) {
+            latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - next.arrival).count());
+        }
+    }
+}
+
+inline QueryServer::QueryServer(LM& lm_, QueryServerOptions options_, const HotContextTable * hot_contexts_) : lm(lm_),
+ vocab(lm_.encode_map), hot_contexts(hot_contexts_), options(options_), batcher(lm_.metadata.max_ngram_order,
+ options_.max_batch_ngrams, std::chrono::microseconds(options_.max_wait_us), options_.max_pending_ngrams) {
+    options.scorer_threads = std::max(options.scorer_threads, 1u);
+    max_vocabID = lm.first_lvl.size()/(lm.metadata.reversed_contexts ? 4 : 3);
+    stopping = false;
+    //Non blocking at both ends: wakers never wait on a full pipe and run() drains it without waiting
+    if (pipe(wake_pipe) != 0 || fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+        perror("Error creating the wake up pipe");
+        std::exit(EXIT_FAILURE);
+    }
+    listen();
+}
+
+inline QueryServer::~QueryServer() {
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+}
+
+//Binds the sockets in the constructor, so that clients can connect as soon as the server exists.
+inline void QueryServer::listen() {
+    if (!options.socket_path.empty()) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (options.socket_path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << options.socket_path << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::strcpy(address.sun_path, options.socket_path.c_str());
+        unlink(options.socket_path.c_str());
+        unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (unix_fd < 0 || bind(unix_fd, (sockaddr *)&address, sizeof(address)) != 0 || ::listen(unix_fd, 128) != 0) {
+            perror(("Error listening on " + options.socket_path).c_str());
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    if (options.tcp_port) {
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(options.tcp_port);
+        tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (tcp_fd < 0 || setsockopt(tcp_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+         bind(tcp_fd, (sockaddr *)&address, sizeof(address)) != 0 || ::listen(tcp_fd, 128) != 0) {
+            perror(("Error listening on port " + std::to_string(options.tcp_port)).c_str());
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    if (unix_fd < 0 && tcp_fd < 0) {
+        std::cerr << "The query server needs a socket path or a TCP port." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+inline void QueryServer::run() {
+    std::vector<std::thread> scorers;
+    for (unsigned int i = 0; i < options.scorer_threads; i++) {
+        scorers.push_back(std::thread(&QueryServer::score, this));
+    }
+
+    std::vector<pollfd> fds = {{wake_pipe[0], POLLIN, 0}};
+    for (int fd : {unix_fd, tcp_fd}) {
+        if (fd >= 0) {
+            fds.push_back({fd, POLLIN, 0});
+        }
+    }
+    while (true) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error polling the sockets");
+            break;
+        }
+        if (fds[0].revents) {
+            char bytes[64];
+            while (read(wake_pipe[0], bytes, sizeof(bytes)) > 0) {}
+            if (stopping) {
+                break;
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            int client = accept(fds[i].fd, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+            if (fds[i].fd == tcp_fd) {
+                int no_delay = 1; //Requests and responses are small, don't hold them back
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            }
+            timeval timeout = {(time_t)(options.send_timeout_ms/1000), (suseconds_t)(options.send_timeout_ms % 1000)*1000};
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            connections.push_back(Served());
+            Served& served = connections.back();
+            served.connection.reset(new Connection(client, options.max_outbound_bytes, options.latency));
+            served.reader = std::thread(&QueryServer::serve, this, served.connection);
+            served.writer = std::thread(&QueryServer::writeResponses, this, served.connection);
+        }
+        //Reap connections whose reader and writer are both done, they wake us up when they are
+        for (std::list<Served>::iterator it = connections.begin(); it != connections.end();) {
+            if (it->connection->threads_done == 2) {
+                it->reader.join();
+                it->writer.join();
+                it = connections.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    //Stop reading, but answer every request that has been submitted
+    for (int fd : {unix_fd, tcp_fd}) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    if (unix_fd >= 0) {
+        unlink(options.socket_path.c_str());
+    }
+    for (Served& served : connections) {
+        ::shutdown(served.connection->fd, SHUT_RD);
+    }
+    for (Served& served : connections) {
+        served.reader.join();
+    }
+    batcher.close();
+    for (std::thread& scorer : scorers) {
+        scorer.join();
+    }
+    for (Served& served : connections) {
+        served.writer.join();
+    }
+    connections.clear();
+}
+
+inline void QueryServer::stop() {
+    stopping = true;
+    char byte = 0;
+    ssize_t written = write(wake_pipe[1], &byte, 1);
+    (void)written;
+}
+
+inline void QueryServer::serve(std::shared_ptr<Connection> connection) {
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    QueryHello hello = {QUERY_SERVER_MAGIC, max_ngram_order, lm.metadata.reversed_contexts, (uint32_t)options.max_request_ngrams};
+    connection->sendRaw(&hello, sizeof(hello), std::chrono::time_point<std::chrono::steady_clock>());
+    QueryRequestHeader header;
+    while (queryRecvAll(connection->fd, &header, sizeof(header))) {
+        QueryResponseHeader response = {QUERY_OK, {0, 0, 0}, header.request_id, 0};
+        if (header.type == SCORE_NGRAMS) {
+            if (header.count > options.max_request_ngrams) {
+                response.status = QUERY_TOO_LARGE;
+                connection->send(response, nullptr, 0);
+                break;
+            }
+            MicroBatcher::Request request;
+            request.arrival = std::chrono::steady_clock::now();
+            request.queries.resize((size_t)header.count*max_ngram_order);
+            if (!queryRecvAll(connection->fd, request.queries.data(), request.queries.size()*sizeof(unsigned int))) {
+                break;
+            }
+            //The searcher trusts its vocabIDs
+            if (std::any_of(request.queries.begin(), request.queries.end(), [&](unsigned int vocabID) { return vocabID > max_vocabID; })) {
+                response.status = QUERY_BAD_REQUEST;
+                connection->send(response, nullptr, 0);
+                break;
+            }
+            if (header.count == 0) {
+                connection->send(response, nullptr, 0);
+                continue;
+            }
+            uint32_t request_id = header.request_id;
+            std::chrono::time_point<std::chrono::steady_clock> arrival = request.arrival;
+            request.done = [connection, request_id, arrival](const float * scores, size_t num_scores) {
+                QueryResponseHeader scored = {QUERY_OK, {0, 0, 0}, request_id, (uint32_t)num_scores};
+                connection->send(scored, scores, num_scores*sizeof(float), arrival);
+                connection->answered();
+            };
+            connection->submitted();
+            batcher.submit(std::move(request));
+        } else if (header.type == LOOKUP_WORDS) {
+            if (header.count > QUERY_MAX_LOOKUP_BYTES) {
+                response.status = QUERY_TOO_LARGE;
+                connection->send(response, nullptr, 0);
+                break;
+            }
+            std::string words(header.count, ' ');
+            if (!queryRecvAll(connection->fd, &words[0], words.size())) {
+                break;
+            }
+            std::vector<boost::string_view> tokens;
+            VocabTable::tokenize(words, tokens);
+            std::vector<unsigned int> vocabIDs(tokens.size());
+            vocab.findBatch(tokens.data(), tokens.size(), vocabIDs.data());
+            response.count = vocabIDs.size();
+            connection->send(response, vocabIDs.data(), vocabIDs.size()*sizeof(unsigned int));
+        } else {
+            response.status = QUERY_BAD_REQUEST;
+            connection->send(response, nullptr, 0);
+            break;
+        }
+    }
+    connection->stopReading();
+    threadDone(*connection);
+}
+
+inline void QueryServer::writeResponses(std::shared_ptr<Connection> connection) {
+    connection->write();
+    threadDone(*connection);
+}
+
+inline void QueryServer::threadDone(Connection& connection) {
+    if (++connection.threads_done == 2) {
+        char byte = 0;
+        ssize_t written = ::write(wake_pipe[1], &byte, 1);
+        (void)written;
+    }
+}
+
+//Scores the batches of the batcher as one search each, then hands every request its slice of the results.
+inline void QueryServer::score() {
+    CPUSearcher searcher(lm, hot_contexts);
+    searcher.deduplicate = options.deduplicate;
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    std::vector<MicroBatcher::Request> batch;
+    std::vector<unsigned int> keys;
+    std::vector<float> scores;
+    while (batcher.nextBatch(batch)) {
+        keys.clear();
+        for (MicroBatcher::Request& request : batch) {
+            keys.insert(keys.end(), request.queries.begin(), request.queries.end());
+        }
+        scores.resize(keys.size()/max_ngram_order);
+        searcher.search(keys.data(), scores.size(), scores.data());
+        size_t offset = 0;
+        for (MicroBatcher::Request& request : batch) {
+            size_t num_scores = request.queries.size()/max_ngram_order;
+            request.done(&scores[offset], num_scores);
+            offset += num_scores;
+        }
+    }
+}
+
+inline void QueryServer::printStats(std::ostream& out) const {
+    size_t requests = batcher.num_requests.load();
+    size_t ngrams = batcher.num_ngrams.load();
+    size_t batches = batcher.num_batches.load();
+    out << "Requests: " << requests << ", ngrams: " << ngrams << ", batches: " << batches << " (" << (batches ? (double)requests/batches : 0)
+    << " requests and " << (batches ? (double)ngrams/batches : 0) << " ngrams per batch)" << std::endl;
+}
+
+inline QueryClient::QueryClient(const std::string& socket_path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + socket_path);
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+        std::string error = std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Failed to connect to " + socket_path + ": " + error);
+    }
+    connected();
+}
+
+inline QueryClient::QueryClient(const std::string& ip_address, int tcp_port) {
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(tcp_port);
+    if (inet_pton(AF_INET, ip_address.c_str(), &address.sin_addr) != 1) {
+        throw std::runtime_error("Not an IPv4 address: " + ip_address);
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+        std::string error = std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Failed to connect to " + ip_address + ":" + std::to_string(tcp_port) + ": " + error);
+    }
+    int no_delay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    connected();
+}
+
+inline QueryClient::~QueryClient() {
+    ::close(fd);
+}
+
+inline void QueryClient::connected() {
+    if (!queryRecvAll(fd, &hello, sizeof(hello)) || hello.magic != QUERY_SERVER_MAGIC) {
+        ::close(fd);
+        throw std::runtime_error("Not a gLM query server");
+    }
+}
+
+inline QueryResponseHeader QueryClient::exchange(QueryMessageType type, const void * payload, size_t payload_bytes, uint32_t count) {
+    QueryRequestHeader header = {type, {0, 0, 0}, next_id++, count};
+    QueryResponseHeader response;
+    if (!querySendAll(fd, &header, sizeof(header)) || !querySendAll(fd, payload, payload_bytes) ||
+     !queryRecvAll(fd, &response, sizeof(response))) {
+        throw std::runtime_error("Lost the connection to the query server");
+    }
+    if (response.status != QUERY_OK) {
+        throw std::runtime_error(response.status == QUERY_TOO_LARGE ? "Request too large for the query server" : "Bad request");
+    }
+    if (response.request_id != header.request_id) {
+        throw std::runtime_error("Response to another request");
+    }
+    return response;
+}
+
+inline std::vector<unsigned int> QueryClient::lookup(const std::string& words) {
+    QueryResponseHeader response = exchange(LOOKUP_WORDS, words.data(), words.size(), words.size());
+    std::vector<unsigned int> vocabIDs(response.count);
+    if (!queryRecvAll(fd, vocabIDs.data(), vocabIDs.size()*sizeof(unsigned int))) {
+        throw std::runtime_error("Lost the connection to the query server");
+    }
+    return vocabIDs;
+}
+
+inline std::vector<float> QueryClient::score(const std::vector<unsigned int>& queries) {
+    if (queries.size() % hello.max_ngram_order) {
+        throw std::invalid_argument("Queries must have max_ngram_order vocabIDs each");
+    }
+    QueryResponseHeader response = exchange(SCORE_NGRAMS, queries.data(), queries.size()*sizeof(unsigned int), queries.size()/hello.max_ngram_order);
+    std::vector<float> scores(response.count);
+    if (!queryRecvAll(fd, scores.data(), scores.size()*sizeof(float))) {
+        throw std::runtime_error("Lost the connection to the query server");
+    }
+    return scores;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+
+/*A concurrent cache of final (backed off) ngram scores, keyed by the padded query of max_ngram_order vocabIDs.
+  The cache is split in lock striped shards. Each shard is a linear probing hash table that evicts with the CLOCK
+  algorithm once it is full. The memory budget is fixed at construction. Scores are looked up by all threads, while the hit
+  rate statistics live in the CPUSearcher of each thread.*/
+class ResultCache {
+    private:
+        struct Shard {
+            std::mutex lock;
+            std::vector<uint64_t> hashes; //0 marks an empty slot
+            std::vector<unsigned int> keys; //max_ngram_order vocabIDs per slot
+            std::vector<float> scores;
+            std::vector<unsigned char> referenced; //CLOCK reference bits
+            size_t num_entries = 0;
+            size_t clock_hand = 0;
+        };
+        std::unique_ptr<Shard[]> shards;
+        unsigned int num_shards;
+        size_t shard_capacity; //Power of two
+        size_t max_shard_entries; //Keep the load factor at 0.75 at most
+        unsigned short max_ngram_order;
+
+        uint64_t hashKey(const unsigned int * key) const;
+        void evict(Shard& shard);
+        void erase(Shard& shard, size_t idx);
+
+    public:
+        ResultCache(size_t max_bytes, unsigned short max_ngram_order, unsigned int num_shards = 64);
+        bool find(const unsigned int * key, float& score);
+        void insert(const unsigned int * key, float score);
+        void clear();
+
+        size_t size();
+        size_t capacity() const {
+            return num_shards*max_shard_entries;
+        }
+        size_t memoryUsage() const;
+};
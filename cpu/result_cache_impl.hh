@@ -0,0 +1,151 @@
+#pragma once
+#include "result_cache.hh"
+#include <algorithm>
+
+inline ResultCache::ResultCache(size_t max_bytes, unsigned short max_ngram_order_, unsigned int num_shards_)
+  : num_shards(num_shards_), max_ngram_order(max_ngram_order_) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    //Every slot costs the hash, the key, the score and the reference bit
+    size_t slot_size = sizeof(uint64_t) + max_ngram_order*sizeof(unsigned int) + sizeof(float) + sizeof(unsigned char);
+    size_t slots_per_shard = max_bytes/(slot_size*num_shards);
+    shard_capacity = 1;
+    while (shard_capacity*2 <= slots_per_shard) {
+        shard_capacity *= 2;
+    }
+    if (shard_capacity < 4) {
+        //The budget is too small for this many shards. Still produce a functional, tiny cache.
+        shard_capacity = 4;
+    }
+    max_shard_entries = (shard_capacity*3)/4;
+
+    shards.reset(new Shard[num_shards]);
+    for (unsigned int i = 0; i < num_shards; i++) {
+        shards[i].hashes.resize(shard_capacity, 0);
+        shards[i].keys.resize(shard_capacity*max_ngram_order, 0);
+        shards[i].scores.resize(shard_capacity, 0);
+        shards[i].referenced.resize(shard_capacity, 0);
+    }
+}
+
+inline uint64_t ResultCache::hashKey(const unsigned int * key) const {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (unsigned short i = 0; i < max_ngram_order; i++) {
+        hash = (hash ^ key[i])*0x100000001B3ULL;
+    }
+    hash ^= hash >> 31;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+    return hash | 1; //Never 0, which marks empty slots
+}
+
+inline bool ResultCache::find(const unsigned int * key, float& score) {
+    uint64_t hash = hashKey(key);
+    Shard& shard = shards[hash % num_shards];
+    size_t mask = shard_capacity - 1;
+    size_t idx = (hash >> 16) & mask;
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    while (shard.hashes[idx] != 0) {
+        if (shard.hashes[idx] == hash && std::memcmp(&shard.keys[idx*max_ngram_order], key, max_ngram_order*sizeof(unsigned int)) == 0) {
+            score = shard.scores[idx];
+            shard.referenced[idx] = 1;
+            return true;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return false;
+}
+
+inline void ResultCache::insert(const unsigned int * key, float score) {
+    uint64_t hash = hashKey(key);
+    Shard& shard = shards[hash % num_shards];
+    size_t mask = shard_capacity - 1;
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    size_t idx = (hash >> 16) & mask;
+    while (shard.hashes[idx] != 0) {
+        if (shard.hashes[idx] == hash && std::memcmp(&shard.keys[idx*max_ngram_order], key, max_ngram_order*sizeof(unsigned int)) == 0) {
+            return; //Another thread got here first, nothing to evict for
+        }
+        idx = (idx + 1) & mask;
+    }
+    if (shard.num_entries >= max_shard_entries) {
+        evict(shard);
+        //Erasing shifts entries back, the free slot of our chain may have moved
+        idx = (hash >> 16) & mask;
+        while (shard.hashes[idx] != 0) {
+            idx = (idx + 1) & mask;
+        }
+    }
+    shard.hashes[idx] = hash;
+    std::memcpy(&shard.keys[idx*max_ngram_order], key, max_ngram_order*sizeof(unsigned int));
+    shard.scores[idx] = score;
+    shard.referenced[idx] = 1; //Otherwise the newest entry would be the next victim
+    shard.num_entries++;
+}
+
+//Sweep the clock hand, giving referenced entries a second chance, until we find a victim.
+inline void ResultCache::evict(Shard& shard) {
+    size_t mask = shard_capacity - 1;
+    while (true) {
+        size_t idx = shard.clock_hand;
+        shard.clock_hand = (shard.clock_hand + 1) & mask;
+        if (shard.hashes[idx] == 0) {
+            continue;
+        }
+        if (shard.referenced[idx]) {
+            shard.referenced[idx] = 0;
+        } else {
+            erase(shard, idx);
+            return;
+        }
+    }
+}
+
+//Backward shift deletion keeps the linear probing chains intact without tombstones.
+inline void ResultCache::erase(Shard& shard, size_t idx) {
+    size_t mask = shard_capacity - 1;
+    size_t hole = idx;
+    size_t next = (hole + 1) & mask;
+    while (shard.hashes[next] != 0) {
+        size_t home = (shard.hashes[next] >> 16) & mask;
+        //Move the entry into the hole only if the hole lies between its home slot and its current position.
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            shard.hashes[hole] = shard.hashes[next];
+            std::memcpy(&shard.keys[hole*max_ngram_order], &shard.keys[next*max_ngram_order], max_ngram_order*sizeof(unsigned int));
+            shard.scores[hole] = shard.scores[next];
+            shard.referenced[hole] = shard.referenced[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    shard.hashes[hole] = 0;
+    shard.referenced[hole] = 0;
+    shard.num_entries--;
+}
+
+inline void ResultCache::clear() {
+    for (unsigned int i = 0; i < num_shards; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        std::fill(shards[i].hashes.begin(), shards[i].hashes.end(), 0);
+        std::fill(shards[i].referenced.begin(), shards[i].referenced.end(), 0);
+        shards[i].num_entries = 0;
+        shards[i].clock_hand = 0;
+    }
+}
+
+inline size_t ResultCache::size() {
+    size_t total = 0;
+    for (unsigned int i = 0; i < num_shards; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        total += shards[i].num_entries;
+    }
+    return total;
+}
+
+inline size_t ResultCache::memoryUsage() const {
+    size_t slot_size = sizeof(uint64_t) + max_ngram_order*sizeof(unsigned int) + sizeof(float) + sizeof(unsigned char);
+    return num_shards*(shard_capacity*slot_size + sizeof(Shard));
+}
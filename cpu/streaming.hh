@@ -0,0 +1,55 @@
+#pragma once
+#include "cpu_search_impl.hh"
+#include "bounded_queue_impl.hh"
+#include "../LM/lm_utils.hh"
+#include <istream>
+#include <ostream>
+
+struct StreamingOptions {
+    unsigned int tokenizer_threads = 1;
+    unsigned int scorer_threads = 1;
+    size_t sentences_per_batch = 256;
+    size_t max_batches_in_flight = 64; //Bounds the memory use, together with sentences_per_batch.
+    bool addBeginEndMarkers = true;
+    bool word_scores = false; //Also print the score of every word, before the sentence total.
+    LatencyRecorder * latency = nullptr; //If set, records the scoring of every batch
+};
+
+struct StreamingStats {
+    size_t sentences = 0;
+    size_t words = 0;
+    double total_score = 0;
+};
+
+/*Scores a stream of sentences, one per line, without ever holding more than max_batches_in_flight batches of them in memory.
+  The reader, the tokenizers, the scorers and the writer run in their own threads and hand batches of sentences to each other through
+  bounded lock free queues, so reading and writing overlap with scoring. The writer puts the batches back in input order and writes
+  one line per input line with its log10 probability. Empty lines score 0.*/
+class StreamingScorer {
+    private:
+        struct TextBatch {
+            size_t sequence;
+            std::vector<std::string> lines;
+        };
+        struct QueryBatch {
+            size_t sequence;
+            std::vector<unsigned int> queries;
+            std::vector<unsigned int> sent_lengths;
+        };
+        struct ScoredBatch {
+            size_t sequence;
+            std::vector<unsigned int> sent_lengths;
+            std::vector<float> scores;
+        };
+
+        LM& lm;
+        VocabTable vocab;
+        const HotContextTable * hot_contexts;
+        StreamingOptions options;
+
+        void writeBatch(ScoredBatch& batch, std::ostream& out, StreamingStats& stats);
+
+    public:
+        StreamingScorer(LM&, StreamingOptions, const HotContextTable * = nullptr);
+        StreamingStats run(std::istream& in, std::ostream& out);
+};
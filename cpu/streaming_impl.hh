@@ -0,0 +1,131 @@
+#pragma once
+#include "streaming.hh"
+#include <map>
+
+inline StreamingScorer::StreamingScorer(LM& lm_, StreamingOptions options_, const HotContextTable * hot_contexts_)
+  : lm(lm_), vocab(lm_.encode_map), hot_contexts(hot_contexts_), options(options_) {
+    options.tokenizer_threads = std::max(options.tokenizer_threads, 1u);
+    options.scorer_threads = std::max(options.scorer_threads, 1u);
+    options.sentences_per_batch = std::max(options.sentences_per_batch, (size_t)1);
+    options.max_batches_in_flight = std::max(options.max_batches_in_flight, (size_t)1);
+}
+
+inline StreamingStats StreamingScorer::run(std::istream& in, std::ostream& out) {
+    BoundedQueue<TextBatch> text_queue(options.max_batches_in_flight);
+    BoundedQueue<QueryBatch> query_queue(options.max_batches_in_flight);
+    BoundedQueue<ScoredBatch> scored_queue(options.max_batches_in_flight);
+    size_t batches_written = 0;
+    std::mutex written_lock;
+    std::condition_variable batch_written;
+    std::atomic<unsigned int> live_tokenizers(options.tokenizer_threads);
+    std::atomic<unsigned int> live_scorers(options.scorer_threads);
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+
+    //Reader. Doesn't get more than max_batches_in_flight ahead of the writer, so a slow batch can't make the writer buffer the whole input.
+    std::thread reader([&]() {
+        size_t sequence = 0;
+        while (in) {
+            TextBatch batch;
+            batch.sequence = sequence;
+            std::string line;
+            while (batch.lines.size() < options.sentences_per_batch && std::getline(in, line)) {
+                batch.lines.push_back(line);
+            }
+            if (batch.lines.empty()) {
+                break;
+            }
+            {
+                std::unique_lock<std::mutex> guard(written_lock);
+                batch_written.wait(guard, [&]() { return sequence - batches_written < options.max_batches_in_flight; });
+            }
+            text_queue.push(std::move(batch));
+            sequence++;
+        }
+        text_queue.close();
+    });
+
+    std::vector<std::thread> tokenizers;
+    for (unsigned int i = 0; i < options.tokenizer_threads; i++) {
+        tokenizers.push_back(std::thread([&]() {
+            TextBatch text;
+            while (text_queue.pop(text)) {
+                QueryBatch batch;
+                batch.sequence = text.sequence;
+                for (std::string& line : text.lines) {
+                    batch.sent_lengths.push_back(line.empty() ? 0 : sent2ScoringQueries(line, batch.queries, vocab, max_ngram_order, options.addBeginEndMarkers));
+                }
+                query_queue.push(std::move(batch));
+            }
+            if (--live_tokenizers == 0) {
+                query_queue.close();
+            }
+        }));
+    }
+
+    std::vector<std::thread> scorers;
+    for (unsigned int i = 0; i < options.scorer_threads; i++) {
+        scorers.push_back(std::thread([&]() {
+            CPUSearcher searcher(lm, hot_contexts);
+            searcher.latency = options.latency;
+            QueryBatch queries;
+            while (query_queue.pop(queries)) {
+                ScoredBatch batch;
+                batch.sequence = queries.sequence;
+                batch.scores.resize(queries.queries.size()/max_ngram_order);
+                searcher.search(queries.queries.data(), batch.scores.size(), batch.scores.data());
+                batch.sent_lengths = std::move(queries.sent_lengths);
+                scored_queue.push(std::move(batch));
+            }
+            if (--live_scorers == 0) {
+                scored_queue.close();
+            }
+        }));
+    }
+
+    //Writer: batches can arrive out of order, hold on to them until their turn.
+    StreamingStats stats;
+    std::map<size_t, ScoredBatch> waiting;
+    size_t next_sequence = 0;
+    ScoredBatch scored;
+    while (scored_queue.pop(scored)) {
+        waiting[scored.sequence] = std::move(scored);
+        std::map<size_t, ScoredBatch>::iterator next;
+        while ((next = waiting.find(next_sequence)) != waiting.end()) {
+            writeBatch(next->second, out, stats);
+            waiting.erase(next);
+            next_sequence++;
+            std::lock_guard<std::mutex> guard(written_lock);
+            batches_written = next_sequence;
+            batch_written.notify_one();
+        }
+    }
+
+    reader.join();
+    for (auto& thread : tokenizers) {
+        thread.join();
+    }
+    for (auto& thread : scorers) {
+        thread.join();
+    }
+    return stats;
+}
+
+inline void StreamingScorer::writeBatch(ScoredBatch& batch, std::ostream& out, StreamingStats& stats) {
+    size_t query = 0;
+    for (unsigned int sent_length : batch.sent_lengths) {
+        double sentence_score = 0;
+        for (unsigned int i = 0; i < sent_length; i++) {
+            if (options.word_scores) {
+                out << batch.scores[query] << ' ';
+            }
+            sentence_score += batch.scores[query++];
+        }
+        if (options.word_scores) {
+            out << '\t';
+        }
+        out << sentence_score << '\n';
+        stats.sentences++;
+        stats.words += sent_length;
+        stats.total_score += sentence_score;
+    }
+}
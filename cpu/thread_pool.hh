@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+/*A fixed size thread pool with one task queue per worker. Workers take tasks from the back of their own queue and, once it runs dry,
+  steal from the front of the other queues, so uneven tasks (sentences vary wildly in length) still keep every thread busy.
+  Tasks get the index of the worker that runs them, which is handy for per thread state such as a CPUSearcher.*/
+class WorkStealingPool {
+    public:
+        typedef std::function<void(unsigned int)> Task;
+
+    private:
+        struct WorkerQueue {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+        std::vector<std::unique_ptr<WorkerQueue> > queues;
+        std::vector<std::thread> workers;
+
+        std::mutex state_lock;
+        std::condition_variable work_available;
+        std::condition_variable work_done;
+        size_t queued = 0; //Submitted tasks that no worker has claimed yet
+        size_t pending = 0; //Submitted tasks that haven't finished yet
+        unsigned int next_queue = 0;
+        bool stopping = false;
+        std::atomic<size_t> num_steals;
+
+        void workerLoop(unsigned int worker);
+        Task takeTask(unsigned int worker);
+
+    public:
+        explicit WorkStealingPool(unsigned int num_threads);
+        ~WorkStealingPool();
+
+        void submit(Task task); //Round robin over the worker queues
+        void submit(Task task, unsigned int worker);
+        void wait(); //Blocks until every submitted task has finished
+
+        unsigned int size() const {
+            return workers.size();
+        }
+        size_t steals() const {
+            return num_steals.load();
+        }
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include "thread_pool.hh"
+
+inline WorkStealingPool::WorkStealingPool(unsigned int num_threads) : num_steals(0) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (unsigned int i = 0; i < num_threads; i++) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue));
+    }
+    for (unsigned int i = 0; i < num_threads; i++) {
+        workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+inline void WorkStealingPool::submit(Task task) {
+    unsigned int worker;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        worker = next_queue;
+        next_queue = (next_queue + 1) % queues.size();
+    }
+    submit(task, worker);
+}
+
+inline void WorkStealingPool::submit(Task task, unsigned int worker) {
+    WorkerQueue& queue = *queues[worker % queues.size()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        queued++;
+        pending++;
+    }
+    work_available.notify_one();
+}
+
+inline void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> guard(state_lock);
+    work_done.wait(guard, [this]() { return pending == 0; });
+}
+
+//Only called after claiming a task, so there is at least one unclaimed task in some queue and we keep looking until we get it.
+inline WorkStealingPool::Task WorkStealingPool::takeTask(unsigned int worker) {
+    while (true) {
+        {
+            WorkerQueue& own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                Task task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        for (unsigned int i = 1; i < queues.size(); i++) {
+            WorkerQueue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                Task task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                num_steals++;
+                return task;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void WorkStealingPool::workerLoop(unsigned int worker) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            work_available.wait(guard, [this]() { return queued > 0 || stopping; });
+            if (queued == 0) {
+                return; //Stopping and nothing left to do
+            }
+            queued--;
+        }
+        Task task = takeTask(worker);
+        task(worker);
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            pending--;
+            if (pending == 0) {
+                work_done.notify_all();
+            }
+        }
+    }
+}
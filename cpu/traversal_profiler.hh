@@ -0,0 +1,47 @@
+#pragma once
+#include "cpu_search_impl.hh"
+#include <map>
+
+//Counts the trie walk of CPUSearcher, per order across lookups and per lookup for the nodes and the matched order.
+struct TraversalCounter {
+    std::vector<size_t> attempts; //By order - 1
+    std::vector<size_t> hits;
+    size_t nodes = 0;
+    unsigned short matched = 0; //The longest order that predicted the word
+
+    void node() {
+        nodes++;
+    }
+    void attempt(unsigned short order) {
+        attempts[order - 1]++;
+    }
+    void hit(unsigned short order) {
+        hits[order - 1]++;
+        matched = std::max(matched, order);
+    }
+};
+
+/*Replays lookups through CPUSearcher, without the hot context table or the result cache, and counts what they touch.
+  A lookup is the score of one word given its context. Nodes are Btree nodes searched, the first level doesn't count. The matched
+  order is the order of the ngram the probability comes from, and the backoff depth how many orders below the full window that is.
+  Attempts and hits of an order count the searches for the word under a context one shorter: the forward layout tries the longest
+  context first and stops at the first hit, the reversed one tries every context it can reach, from the shortest.*/
+class TraversalProfiler {
+    private:
+        CPUSearcher searcher;
+        TraversalCounter counter;
+
+    public:
+        LM& lm;
+        size_t lookups = 0;
+        size_t nodes_visited = 0;
+        std::map<size_t, size_t> nodes_histogram; //Lookups by nodes visited
+        std::vector<size_t> backoff_depth; //Lookups by backoff depth
+        const std::vector<size_t>& attempts; //By order - 1
+        const std::vector<size_t>& hits;
+
+        explicit TraversalProfiler(LM& lm);
+        float scoreWindow(const unsigned int * ngram, unsigned short ngram_size); //An unpadded ngram of ngram_size words
+        void replay(const CompactQueries& batch);
+        void report(std::ostream& out) const;
+};
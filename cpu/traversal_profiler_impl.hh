@@ -0,0 +1,57 @@
+#pragma once
+#include "traversal_profiler.hh"
+#include <iomanip>
+
+inline TraversalProfiler::TraversalProfiler(LM& lm_) : searcher(lm_), lm(lm_), attempts(counter.attempts), hits(counter.hits) {
+    backoff_depth.resize(lm.metadata.max_ngram_order, 0);
+    counter.attempts.resize(lm.metadata.max_ngram_order, 0);
+    counter.hits.resize(lm.metadata.max_ngram_order, 0);
+}
+
+inline float TraversalProfiler::scoreWindow(const unsigned int * ngram, unsigned short ngram_size) {
+    counter.nodes = 0;
+    counter.matched = 0;
+    float score = searcher.scoreWindow(ngram, ngram_size, counter);
+    lookups++;
+    nodes_visited += counter.nodes;
+    nodes_histogram[counter.nodes]++;
+    backoff_depth[ngram_size - counter.matched]++;
+    return score;
+}
+
+//The same windows as CPUSearcher::searchCompact
+inline void TraversalProfiler::replay(const CompactQueries& batch) {
+    unsigned short max_ngram_order = lm.metadata.max_ngram_order;
+    for (size_t sentence = 0; sentence < batch.numSentences(); sentence++) {
+        unsigned int start = batch.sentence_starts[sentence];
+        unsigned int end = batch.sentenceEnd(sentence);
+        if (batch.first_is_context && start < end) {
+            start++;
+        }
+        for (unsigned int pos = start; pos < end; pos++) {
+            unsigned int window_start = (pos + 1 >= batch.sentence_starts[sentence] + max_ngram_order) ?
+                pos + 1 - max_ngram_order : batch.sentence_starts[sentence];
+            scoreWindow(&batch.vocabIDs[window_start], pos + 1 - window_start);
+        }
+    }
+}
+
+inline void TraversalProfiler::report(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    out << "Lookups: " << lookups << ", Btree nodes visited: " << nodes_visited << " (" << std::fixed << std::setprecision(2)
+    << (lookups ? (double)nodes_visited/lookups : 0) << " per lookup)" << std::endl;
+    out << "Nodes visited per lookup:";
+    for (const std::pair<const size_t, size_t>& bucket : nodes_histogram) {
+        out << ' ' << bucket.first << ':' << bucket.second;
+    }
+    out << std::endl << "Backoff depth:";
+    for (size_t depth = 0; depth < backoff_depth.size(); depth++) {
+        out << ' ' << depth << ':' << backoff_depth[depth];
+    }
+    out << std::endl << "order\tattempts\thits\thit_rate" << std::endl;
+    for (size_t order = 0; order < attempts.size(); order++) {
+        out << order + 1 << '\t' << attempts[order] << '\t' << hits[order] << '\t' << std::setprecision(4)
+        << (attempts[order] ? (double)hits[order]/attempts[order] : 0) << std::endl;
+    }
+    out.flags(flags);
+}
@@ -2,6 +2,7 @@
 #include "memory_management.hh"
 #include "gpu_search_v2.hh"
 #include "../Trie/trie_v2_impl.hh"
+#include "../LM/lm_utils.hh"
 #include <sstream>
 
 inline std::vector<unsigned int> allwords (LM &lm);
@@ -68,36 +69,6 @@ std::pair<bool, std::string> testQueryNgrams(LM& lm, unsigned char * btree_trie_
 
 }
 
-//Converts a raw sentence into one suitable for generating ngrams from, with vocabIDs
-inline std::vector<unsigned int> sent2vocabIDs(LM &lm, std::vector<std::string> input, bool addBeginEndMarkers) {
-    std::vector<unsigned int> ret;
-    if (addBeginEndMarkers) {
-        ret.reserve(input.size() + 2);
-    } else {
-        ret.reserve(input.size());
-    }
-    unsigned int unktoken = lm.encode_map.find(std::string("<unk>"))->second; //@TODO don't look up UNKTOKEN every time, get it from somewhere
-    unsigned int beginsent = lm.encode_map.find(std::string("<s>"))->second;
-    unsigned int endsent = lm.encode_map.find(std::string("</s>"))->second;
-
-    if (addBeginEndMarkers) {
-        ret.push_back(beginsent);
-    }
-    for (auto item : input) {
-        std::unordered_map<std::string, unsigned int>::iterator it = lm.encode_map.find(item);
-        if (it != lm.encode_map.end()) {
-            ret.push_back(it->second);
-        } else {
-            ret.push_back(unktoken);
-        }
-    }
-    if (addBeginEndMarkers) {
-        ret.push_back(endsent);
-    }
-
-    return ret;
-}
-
 inline std::vector<unsigned int> allwords (LM &lm) {
     std::vector<unsigned int> ret;
     for (std::unordered_map<std::string, unsigned int>::iterator iter = lm.encode_map.begin(); iter != lm.encode_map.end(); iter++  )
@@ -211,22 +182,20 @@ inline std::vector<unsigned int> vocabIDsent2queries(std::vector<unsigned int> v
 
 inline std::vector<std::string> interactiveRead(LM &lm, unsigned char * btree_trie_gpu, unsigned int * gpu_first_lvl, bool addBeginEndMarkers = false) {
     std::string response;
-    boost::char_separator<char> sep(" ");
+    VocabTable vocab(lm.encode_map);
     while (true) {
         getline(std::cin, response);
         if (response == "/end") {
             break;
         }
-        std::vector<std::string> sentence;
-        boost::tokenizer<boost::char_separator<char> > tokens(response, sep);
-        for (auto word : tokens) {
-            sentence.push_back(word);
-        }
+        std::vector<boost::string_view> sentence;
+        VocabTable::tokenize(response, sentence);
         for (auto item : sentence) {
             std::cout << item << " ";
         }
         std::cout << std::endl << "Now vocabIDs:" << std::endl;
-        std::vector<unsigned int> vocabIDs = sent2vocabIDs(lm, sentence, addBeginEndMarkers);
+        std::vector<unsigned int> vocabIDs;
+        vocab.sentence2vocabIDs(response, vocabIDs, addBeginEndMarkers);
 
         for (auto item : vocabIDs) {
             std::cout << item << " ";
@@ -273,20 +242,19 @@ inline std::vector<std::string> interactiveRead(LM &lm, unsigned char * btree_tr
     return std::vector<std::string>{std::string("pesho")};
 }
 
-inline unsigned int sent2QueryVec(std::string& sentence, std::vector<unsigned int>& all_queries, LM& lm, bool addBeginEndMarkers) {
-    //Tokenize
-    boost::char_separator<char> sep(" ");
-    std::vector<std::string> tokenized_sentence;
-    boost::tokenizer<boost::char_separator<char> > tokens(sentence, sep);
-    for (auto word : tokens) {
-        tokenized_sentence.push_back(word);
+inline unsigned int sent2QueryVec(boost::string_view sentence, std::vector<unsigned int>& all_queries, const VocabTable& vocab,
+ unsigned short ngram_order, bool addBeginEndMarkers) {
+    GLM_TRACE_SPAN("sent2QueryVec");
+    //Tokenize and convert to vocabIDs
+    std::vector<unsigned int> vocabIDs;
+    {
+        GLM_TRACE_SPAN("vocabID mapping");
+        vocab.sentence2vocabIDs(sentence, vocabIDs, addBeginEndMarkers);
     }
 
-    //convert to vocabIDs
-    std::vector<unsigned int> vocabIDs = sent2vocabIDs(lm, tokenized_sentence, addBeginEndMarkers);
-
     //Convert to ngram Queries @TODO avoid memory copying here by writing directly into all_queries
-    std::vector<unsigned int> queries = vocabIDsent2queries(vocabIDs, lm.metadata.max_ngram_order);
+    GLM_TRACE_SPAN("query expansion");
+    std::vector<unsigned int> queries = vocabIDsent2queries(vocabIDs, ngram_order);
     unsigned int num_queries = queries.size(); //How many queries this sentence has.
 
     //Now write to the global queries vector
@@ -300,6 +268,7 @@ inline unsigned int sent2QueryVec(std::string& sentence, std::vector<unsigned in
 
 template<class StringType>
 void sentencesToQueryVector(std::vector<unsigned int>& queries, std::vector<unsigned int>& sent_lengths, LM& lm, StringType sentsFile, bool addBeginEndMarkers = true) {
+    GLM_TRACE_SPAN("sentencesToQueryVector");
     std::ifstream queryFile;
     queryFile.open(sentsFile);
 
@@ -308,6 +277,7 @@ void sentencesToQueryVector(std::vector<unsigned int>& queries, std::vector<unsi
         std::exit(EXIT_FAILURE);
     }
 
+    VocabTable vocab(lm.encode_map);
     while (!queryFile.eof()) {
         std::string curr_sent;
         std::getline(queryFile, curr_sent);
@@ -315,7 +285,7 @@ void sentencesToQueryVector(std::vector<unsigned int>& queries, std::vector<unsi
             continue; //Skip empty lines
         }
         //Make this sentence into queries
-        unsigned int this_sent_queries = sent2QueryVec(curr_sent, queries, lm, addBeginEndMarkers);
+        unsigned int this_sent_queries = sent2QueryVec(curr_sent, queries, vocab, lm.metadata.max_ngram_order, addBeginEndMarkers);
         sent_lengths.push_back(this_sent_queries);
     }
 }
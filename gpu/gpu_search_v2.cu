@@ -799,6 +799,42 @@ void searchWrapperStream(unsigned char * btree_trie_mem, unsigned int * first_lv
     }
 }
 
+//One thread per position. Context only positions get an all zero, bogus, query.
+__global__ void expandCompactQueries(unsigned int * vocabIDs, unsigned int num_positions, unsigned int * sentence_starts,
+ unsigned int num_sentences, bool first_is_context, unsigned int max_ngram, unsigned int * keys) {
+    unsigned int pos = blockIdx.x*blockDim.x + threadIdx.x;
+    if (pos >= num_positions) {
+        return;
+    }
+    //Binary search for the sentence of this position: the last one that starts at or before it
+    unsigned int low = 0;
+    unsigned int high = num_sentences;
+    while (high - low > 1) {
+        unsigned int mid = (low + high)/2;
+        if (sentence_starts[mid] <= pos) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    unsigned int sentence_start = sentence_starts[low];
+    unsigned int window_start = (pos + 1 >= sentence_start + max_ngram) ? pos + 1 - max_ngram : sentence_start;
+    bool context_only = first_is_context && pos == sentence_start;
+
+    unsigned int * key = &keys[pos*max_ngram];
+    for (unsigned int i = 0; i < max_ngram; i++) {
+        key[i] = (!context_only && window_start + i <= pos) ? vocabIDs[window_start + i] : 0;
+    }
+}
+
+void expandCompactWrapper(unsigned int * vocabIDs, unsigned int num_positions, unsigned int * sentence_starts, unsigned int num_sentences,
+ bool first_is_context, unsigned int max_ngram, unsigned int * keys, cudaStream_t& stream) {
+    unsigned int threads_per_block = 256;
+    unsigned int num_blocks = (num_positions + threads_per_block - 1)/threads_per_block;
+    expandCompactQueries<<<num_blocks, threads_per_block, 0, stream>>>(vocabIDs, num_positions, sentence_starts, num_sentences,
+     first_is_context, max_ngram, keys);
+}
+
 void cudaDevSync() {
     cudaDeviceSynchronize();
 }
@@ -843,7 +879,46 @@ std::vector<float> GPUSearcher::search(std::vector<unsigned int>& queries, int s
     return cpuResults;
 }
 
+std::vector<float> GPUSearcher::searchCompact(std::vector<unsigned int>& vocabIDs, std::vector<unsigned int>& sentence_starts,
+ bool first_is_context, int streamID, bool debug) {
+    if (streamID > num_streams - 1) {
+        std::cerr << "Provided stream greater than the available ones. Using stream 0 as default. Fix your code!" << std::endl;
+        streamID = 0;
+    }
+    unsigned int num_positions = vocabIDs.size();
+    std::vector<float> cpuResults(num_positions);
+    if (num_positions == 0) {
+        return cpuResults;
+    }
+
+    unsigned int * gpuVocabIDs = copyToGPUMemory(vocabIDs.data(), vocabIDs.size());
+    unsigned int * gpuSentenceStarts = copyToGPUMemory(sentence_starts.data(), sentence_starts.size());
+    unsigned int * gpuKeys;
+    allocateGPUMem(num_positions*lm.metadata.max_ngram_order, &gpuKeys);
+    float * results;
+    allocateGPUMem(num_positions, &results);
+
+    expandCompactWrapper(gpuVocabIDs, num_positions, gpuSentenceStarts, sentence_starts.size(), first_is_context,
+     lm.metadata.max_ngram_order, gpuKeys, streams[streamID]);
+    searchWrapperStream(btree_trie_gpu, first_lvl_gpu, gpuKeys, num_positions, results, lm.metadata.btree_node_size,
+     lm.metadata.max_ngram_order, streams[streamID], make_exp, debug);
+
+    copyToHostMemory(results, cpuResults.data(), num_positions);
+
+    //Free memory
+    freeGPUMemory(gpuVocabIDs);
+    freeGPUMemory(gpuSentenceStarts);
+    freeGPUMemory(gpuKeys);
+    freeGPUMemory(results);
+
+    return cpuResults;
+}
+
 void GPUSearcher::gpuInit() {
+    if (lm.metadata.reversed_contexts) {
+        std::cerr << "The GPU search doesn't support models binarized with reversed contexts. Rebinarize without them." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
     //Init GPU memory
     btree_trie_gpu = copyToGPUMemory(lm.trieByteArray.data(), lm.trieByteArray.size());
     first_lvl_gpu = copyToGPUMemory(lm.first_lvl.data(), lm.first_lvl.size());
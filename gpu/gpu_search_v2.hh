@@ -9,6 +9,10 @@ void searchWrapper(unsigned int num_vocabs, unsigned char * btree_trie_mem, unsi
 void searchWrapperStream(unsigned char * btree_trie_mem, unsigned int * first_lvl, unsigned int * keys,
  unsigned int num_ngram_queries, float * results, unsigned int entries_per_node, unsigned int max_ngram, cudaStream_t& stream, bool make_exp = false, bool debug = false);
 
+//Expands a compact batch (see CompactQueries) to padded queries in GPU memory, so that only the sentences cross the PCIe bus.
+void expandCompactWrapper(unsigned int * vocabIDs, unsigned int num_positions, unsigned int * sentence_starts, unsigned int num_sentences,
+ bool first_is_context, unsigned int max_ngram, unsigned int * keys, cudaStream_t& stream);
+
 void cudaDevSync();
 
 /*Tells the code to execute on a particular device. Useful on multiGPU systems*/
@@ -29,6 +33,9 @@ class GPUSearcher {
         LM& lm;
         void search(unsigned int * keys, unsigned int num_ngram_queries, float * results, int streamID, bool debug = false);
         std::vector<float> search(std::vector<unsigned int>& queries, int streamID, bool debug = false);
+        //Compact batch, given as CompactQueries' vocabIDs and sentence_starts. One result per position.
+        std::vector<float> searchCompact(std::vector<unsigned int>& vocabIDs, std::vector<unsigned int>& sentence_starts,
+         bool first_is_context, int streamID, bool debug = false);
         GPUSearcher(int, LM&, bool = false);
         GPUSearcher(int, LM&, int, bool = false);
         ~GPUSearcher();
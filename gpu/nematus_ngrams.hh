@@ -1,5 +1,8 @@
 #include "gpu_LM_utils_v2.hh"
 #include "lm_impl.hh"
+#include "batch_dedup.hh"
+#include "context_scorer_impl.hh"
+#include <map>
 
 //PythonNDarray bullshite
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
@@ -15,8 +18,13 @@ class NematusLM {
         bool debug;
 
         std::vector<float *> memory_tracker;
+        std::vector<std::unique_ptr<SparseScores> > sparse_tracker;
+        std::unique_ptr<ContextScorer> context_scorer;
 
         void doQueries(std::vector<unsigned int>& queries, float * result_storage, size_t results_start_idx);
+        void readNgrams(char * path_to_ngrams_file, std::vector<std::vector<unsigned int> >& orig_queries);
+        void sparseGroupedContexts(std::vector<std::vector<unsigned int> >& orig_queries, SparseScores& sparse);
+        float * scoreGroupedContexts(std::vector<std::vector<unsigned int> >& orig_queries);
 
     public:
         unsigned int gpuMemLimit;
@@ -24,6 +32,10 @@ class NematusLM {
         unsigned int queryMemory;
         unsigned int unktoken;
         size_t lastTotalNumQueries = 0; //Keep track of the length of the results array in the last batch
+        /*Instead of expanding every ngram line to one query per softmax word and searching them on the GPU, resolve every distinct
+          context once on the host copy of the trie and fill its softmax row from the explicit continuations plus backoff.
+          Needs no query memory at all and no trie walk per softmax word.*/
+        bool groupContexts = false;
 
         //This vector contains the softmax vocabulary in order in gLM vocab format.
         std::vector<unsigned int> softmax_vocab_vec;
@@ -42,12 +54,17 @@ class NematusLM {
         }
 
         float * processBatch(char * path_to_ngrams_file);
+        /*Grouped context scoring that stops at the sparse rows, one per ngram line, owned by us until freeResultsMemory.
+          Bogus lines come back as empty rows with zero backoff, which their consumer ignores like the zeroes of processBatch.*/
+        SparseScores& processBatchSparse(char * path_to_ngrams_file);
 
         void freeResultsMemory();
 
         size_t getLastNumQueries();
 
         boost::python::object processBatchNDARRAY(char * path_to_ngrams_file, long softmax_size, long sentence_length, long batch_size);
+        boost::python::object processBatchSparseNDARRAY(char * path_to_ngrams_file);
+        boost::python::object getUnigramRowNDARRAY();
         
         ~NematusLM() {
             freeResultsMemory();
@@ -83,29 +100,37 @@ NematusLM::NematusLM(char * path, char * vocabFilePath, unsigned int maxGPUMemor
             softmax_vocab_vec.push_back(unktoken);
         }
     }
+    context_scorer.reset(new ContextScorer(lm, softmax_vocab_vec));
 }
 
 void NematusLM::doQueries(std::vector<unsigned int>& queries, float * result_storage, size_t results_start_idx) {
-    unsigned int num_keys = queries.size()/lm.metadata.max_ngram_order; //Get how many ngram queries we have to do
-    unsigned int * gpuKeys = copyToGPUMemory(queries.data(), queries.size());
+    //The softmax queries repeat the same history for many words and the padded ones repeat a lot, so only send the unique ones.
+    DedupedBatch batch;
+    dedupQueries(queries.data(), queries.size()/lm.metadata.max_ngram_order, lm.metadata.max_ngram_order, batch);
+    unsigned int num_keys = batch.numUnique(lm.metadata.max_ngram_order); //Get how many ngram queries we have to do
+    if (debug) {
+        std::cerr << "Unique queries: " << num_keys << " out of " << batch.positions.size() << std::endl;
+    }
+    unsigned int * gpuKeys = copyToGPUMemory(batch.unique_queries.data(), batch.unique_queries.size());
     float * results;
     allocateGPUMem(num_keys, &results);
 
     //Search GPU
     engine.search(gpuKeys, num_keys, results, 0);
 
-    //Copy results to host and store them:
-    copyToHostMemory(results, &result_storage[results_start_idx], num_keys);
+    //Copy results to host and scatter them to the positions of the original queries:
+    std::vector<float> unique_results(num_keys);
+    copyToHostMemory(results, unique_results.data(), num_keys);
+    scatterResults(unique_results.data(), batch, &result_storage[results_start_idx]);
 
     //Free memory
     freeGPUMemory(gpuKeys);
     freeGPUMemory(results);
 }
 
-float * NematusLM::processBatch(char * path_to_ngrams_file) {
+void NematusLM::readNgrams(char * path_to_ngrams_file, std::vector<std::vector<unsigned int> >& orig_queries) {
     //Read in the ngrams file and convert to gLM vocabIDs
     //We need to replace their UNK with ours, replace BoS with 0s
-    std::vector<std::vector<unsigned int> > orig_queries;
     std::ifstream is(path_to_ngrams_file);
 
     if (is.fail() ){
@@ -160,6 +185,15 @@ float * NematusLM::processBatch(char * path_to_ngrams_file) {
 
     //Close the stream after we are done.
     is.close();
+}
+
+float * NematusLM::processBatch(char * path_to_ngrams_file) {
+    std::vector<std::vector<unsigned int> > orig_queries;
+    readNgrams(path_to_ngrams_file, orig_queries);
+
+    if (groupContexts) {
+        return scoreGroupedContexts(orig_queries);
+    }
 
     //Now we need to expand the queries. Basically every lm.metadata.max_ngram_order word (starting from the first)
     //needs to be replaced byt the full softmax layer
@@ -236,11 +270,72 @@ float * NematusLM::processBatch(char * path_to_ngrams_file) {
 
 }
 
+void NematusLM::sparseGroupedContexts(std::vector<std::vector<unsigned int> >& orig_queries, SparseScores& sparse) {
+    //Rows of the contexts scored so far. Lines of the same sentence position across the batch often share them.
+    std::map<std::vector<unsigned int>, size_t> scored_contexts;
+    ResolvedContext resolved;
+    for (size_t row = 0; row < orig_queries.size(); row++) {
+        std::vector<unsigned int>& orig_query = orig_queries[row];
+        if (orig_query[0] == 0) {
+            //Bogus ngram, an empty row
+            sparse.backoffs.push_back(0);
+            sparse.row_starts.push_back(sparse.positions.size());
+            continue;
+        }
+        //The line is the predicted word followed by its history newest word first, ending at <s>. The scorer wants it oldest first.
+        std::vector<unsigned int> context(orig_query.rbegin(), orig_query.rend() - 1);
+        std::map<std::vector<unsigned int>, size_t>::iterator it = scored_contexts.find(context);
+        if (it != scored_contexts.end()) {
+            sparse.appendCopyOf(it->second);
+        } else {
+            context_scorer->resolve(context.data(), context.size(), resolved);
+            context_scorer->appendSparseRow(resolved, sparse);
+            scored_contexts.insert(std::make_pair(context, row));
+        }
+    }
+    if (debug) {
+        std::cerr << "Distinct contexts: " << scored_contexts.size() << " out of " << orig_queries.size() << " rows, "
+            << sparse.positions.size() << " explicit scores out of " << orig_queries.size()*softmax_vocab_vec.size() << std::endl;
+    }
+}
+
+float * NematusLM::scoreGroupedContexts(std::vector<std::vector<unsigned int> >& orig_queries) {
+    SparseScores sparse;
+    sparseGroupedContexts(orig_queries, sparse);
+
+    size_t softmax_size = softmax_vocab_vec.size();
+    size_t total_num_queries = orig_queries.size()*softmax_size;
+    float * all_results = new float[total_num_queries];
+    for (size_t row = 0; row < orig_queries.size(); row++) {
+        if (orig_queries[row][0] == 0) {
+            std::fill(&all_results[row*softmax_size], &all_results[(row + 1)*softmax_size], 0.0f); //Bogus ngrams score 0
+        } else {
+            context_scorer->densify(sparse, row, &all_results[row*softmax_size]);
+        }
+    }
+
+    lastTotalNumQueries = total_num_queries;
+    memory_tracker.push_back(all_results);
+    return all_results;
+}
+
+SparseScores& NematusLM::processBatchSparse(char * path_to_ngrams_file) {
+    std::vector<std::vector<unsigned int> > orig_queries;
+    readNgrams(path_to_ngrams_file, orig_queries);
+
+    sparse_tracker.push_back(std::unique_ptr<SparseScores>(new SparseScores()));
+    SparseScores& sparse = *sparse_tracker.back();
+    sparseGroupedContexts(orig_queries, sparse);
+    lastTotalNumQueries = orig_queries.size()*softmax_vocab_vec.size();
+    return sparse;
+}
+
 void NematusLM::freeResultsMemory() {
     for (auto item : memory_tracker) {
         delete[] item;
     }
     memory_tracker.clear();
+    sparse_tracker.clear();
 }
 
 size_t NematusLM::getLastNumQueries() {
@@ -267,3 +362,24 @@ boost::python::object NematusLM::processBatchNDARRAY(char * path_to_ngrams_file,
     handle<> array( obj );
     return object(array);
 }
+
+//The sparse batch as four numpy arrays over our own memory: backoffs, row_starts, positions and scores. Dense row i is
+//getUnigramRow() + backoffs[i] with scores[row_starts[i]:row_starts[i+1]] written at positions[row_starts[i]:row_starts[i+1]].
+boost::python::object NematusLM::processBatchSparseNDARRAY(char * path_to_ngrams_file) {
+    SparseScores& sparse = processBatchSparse(path_to_ngrams_file);
+
+    npy_intp rows_shape[1] = {(npy_intp)sparse.backoffs.size()};
+    npy_intp starts_shape[1] = {(npy_intp)sparse.row_starts.size()};
+    npy_intp entries_shape[1] = {(npy_intp)sparse.positions.size()};
+    handle<> backoffs(PyArray_SimpleNewFromData(1, rows_shape, NPY_FLOAT, sparse.backoffs.data()));
+    handle<> row_starts(PyArray_SimpleNewFromData(1, starts_shape, NPY_UINT64, sparse.row_starts.data()));
+    handle<> positions(PyArray_SimpleNewFromData(1, entries_shape, NPY_UINT32, sparse.positions.data()));
+    handle<> scores(PyArray_SimpleNewFromData(1, entries_shape, NPY_FLOAT, sparse.scores.data()));
+    return make_tuple(object(backoffs), object(row_starts), object(positions), object(scores));
+}
+
+boost::python::object NematusLM::getUnigramRowNDARRAY() {
+    npy_intp shape[1] = {(npy_intp)context_scorer->rowSize()};
+    handle<> array(PyArray_SimpleNewFromData(1, shape, NPY_FLOAT, const_cast<float *>(context_scorer->unigramRow().data())));
+    return object(array);
+}
@@ -1,8 +1,8 @@
 #include "fakeRNN.hh"
 #include <yaml-cpp/yaml.h>
 
-fakeRNN::fakeRNN(std::string glmPath, std::string vocabPath, int softmax_size, int gpuDeviceID, int gpuMem, bool make_exp)
-  : lm(glmPath), engine(1, lm, gpuDeviceID, make_exp), softmax_layer_size(softmax_size), gpuMemLimit(gpuMem) {
+fakeRNN::fakeRNN(std::string glmPath, std::string vocabPath, int softmax_size, int gpuDeviceID, int gpuMem, bool make_exp_)
+  : lm(glmPath), engine(1, lm, gpuDeviceID, make_exp_), softmax_layer_size(softmax_size), make_exp(make_exp_), gpuMemLimit(gpuMem) {
 
     int modelMemoryUsage = lm.metadata.byteArraySize/(1024*1024) + (lm.metadata.intArraySize*4/(1024*1024)); //GPU memory used by the model in MB
 
@@ -13,8 +13,10 @@ fakeRNN::fakeRNN(std::string glmPath, std::string vocabPath, int softmax_size, i
     }
 
     queryMemory = gpuMemLimit - modelMemoryUsage;
+    unk_id = lm.encode_map.find("<unk>")->second;
     //Read in vocab from json or yaml and create a map from their IDs to ours, as well as softmax vocab vector
     loadVocab(vocabPath);
+    beam_scorer.reset(new BeamScorer(lm, softmax_layer));
 }
 
 void fakeRNN::batchRNNQuery(std::vector<size_t>& input, unsigned int batch_size, float * gpuMemoryResults) {
@@ -91,8 +93,63 @@ void fakeRNN::batchRNNQuery(std::vector<size_t>& input, unsigned int batch_size,
     
 }
 
+/*Scores the next token of input.size() hypotheses, batch_size sentences times the beam size, into gpuMemoryResults in input order.
+  input[i] holds the tokens hypothesis i emitted so far. Only the last max_ngram_order - 1 of them matter, so passing just those
+  is enough and the cost of a step doesn't grow with the prefix.*/
 void fakeRNN::decodeRNNQuery(std::vector<std::vector<int> >& input, unsigned int batch_size, float * gpuMemoryResults) {
-    std::cerr << "stub! decodenRNNQuery not implemented yet!" << std::endl;
+    assert(batch_size != 0 && input.size() % batch_size == 0);
+    std::vector<LMState> states;
+    states.reserve(input.size());
+    for (std::vector<int>& prefix : input) {
+        LMState state = beam_scorer->initialState();
+        size_t first = prefix.size() > state.size() ? prefix.size() - state.size() : 0;
+        for (size_t i = first; i < prefix.size(); i++) {
+            state = beam_scorer->extend(state, toGLM(prefix[i]));
+        }
+        states.push_back(state);
+    }
+
+    std::vector<float> results(states.size()*softmax_layer.size());
+    scoreStates(states, results.data());
+    copyToGPUMemoryNoAlloc(gpuMemoryResults, results.data(), results.size());
+}
+
+std::vector<LMState> fakeRNN::decodeStart(size_t num_hypotheses) {
+    return std::vector<LMState>(num_hypotheses, beam_scorer->initialState());
+}
+
+std::vector<LMState> fakeRNN::decodeStep(const std::vector<LMState>& states, const std::vector<size_t>& prev_hypotheses,
+ const std::vector<size_t>& tokens, float * results) {
+    assert(prev_hypotheses.size() == tokens.size());
+    std::vector<LMState> next_states;
+    next_states.reserve(tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+        next_states.push_back(beam_scorer->extend(states[prev_hypotheses[i]], toGLM(tokens[i])));
+    }
+    scoreStates(next_states, results);
+    return next_states;
+}
+
+void fakeRNN::setDecodeThreads(unsigned int num_threads) {
+    decode_pool.reset(num_threads > 1 ? new WorkStealingPool(num_threads) : nullptr);
+}
+
+//Same output as the GPU search: log10 probabilities, put through exp if make_exp is set.
+void fakeRNN::scoreStates(const std::vector<LMState>& states, float * results) {
+    beam_scorer->score(states, results, decode_pool.get());
+    if (make_exp) {
+        for (size_t i = 0; i < states.size()*softmax_layer.size(); i++) {
+            results[i] = expf(results[i]);
+        }
+    }
+}
+
+unsigned int fakeRNN::toGLM(size_t theirID) {
+    std::unordered_map<size_t, unsigned int>::iterator it = marian2glmIDs.find(theirID);
+    if (it != marian2glmIDs.end()) {
+        return it->second;
+    }
+    return unk_id;
 }
 
 void fakeRNN::makeSents(std::vector<size_t>& input, unsigned int batch_size, std::vector<std::vector<unsigned int> >& proper_sents) {
@@ -146,8 +203,7 @@ void fakeRNN::loadVocab(const std::string& vocabPath) {
     if (!ifs)   {
         throw std::runtime_error("Couldn't open stream at " + vocabPath);
     }
-    //Define unk
-    unsigned int ourUNKid = lm.encode_map.find("<unk>")->second;
+    unsigned int ourUNKid = unk_id;
     YAML::Node vocab = YAML::Load(ifs);
     for (auto&& pair : vocab) {
         auto str = pair.first.as<std::string>();
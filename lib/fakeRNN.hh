@@ -1,5 +1,6 @@
 #include "gpu_LM_utils_v2.hh"
 #include "lm_impl.hh"
+#include "beam_scorer_impl.hh"
 
 class fakeRNN {
     private:
@@ -9,6 +10,12 @@ class fakeRNN {
         std::vector<unsigned int> softmax_layer;
 
         std::unordered_map<size_t, unsigned int> marian2glmIDs;
+        bool make_exp;
+        unsigned int unk_id;
+        std::unique_ptr<BeamScorer> beam_scorer;
+        std::unique_ptr<WorkStealingPool> decode_pool;
+        unsigned int toGLM(size_t theirID);
+        void scoreStates(const std::vector<LMState>& states, float * results);
         void makeSents(std::vector<size_t>& input, unsigned int batch_size, std::vector<std::vector<unsigned int> >& proper_sents);
         void vocabIDsent2queries(std::vector<unsigned int>& vocabIDs, std::vector<unsigned int>& ret);
     public:
@@ -19,5 +26,12 @@ class fakeRNN {
         fakeRNN(std::string, std::string, int, int, int, bool = true);
         void batchRNNQuery(std::vector<size_t>& input, unsigned int batch_size, float * gpuMemory);
         void decodeRNNQuery(std::vector<std::vector<int> >& input, unsigned int batch_size, float * gpuMemory);
+        /*Incremental beam search scoring on the CPU. decodeStart gives the states of fresh hypotheses. Every step, new hypothesis i
+          extends states[prev_hypotheses[i]] with Marian token tokens[i] and gets its next token scores, softmax_size of them,
+          written to results in host memory. Returns the new states to pass to the next step.*/
+        std::vector<LMState> decodeStart(size_t num_hypotheses);
+        std::vector<LMState> decodeStep(const std::vector<LMState>& states, const std::vector<size_t>& prev_hypotheses,
+         const std::vector<size_t>& tokens, float * results);
+        void setDecodeThreads(unsigned int num_threads); //0 or 1 scores in the calling thread
         void loadVocab(const std::string& vocabPath);
 };
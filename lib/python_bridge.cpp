@@ -59,8 +59,11 @@ BOOST_PYTHON_MODULE(libngrams_nematus)
     import_array();
     class_<NematusLM>("NematusLM", init<char *, char *, unsigned int, int>())
         .def("processBatch", &NematusLM::processBatchNDARRAY)
+        .def("processBatchSparse", &NematusLM::processBatchSparseNDARRAY)
+        .def("getUnigramRow", &NematusLM::getUnigramRowNDARRAY)
         .def("getLastNumQueries", &NematusLM::getLastNumQueries)
         .def("freeResultsMemory", &NematusLM::freeResultsMemory)
+        .def_readwrite("groupContexts", &NematusLM::groupContexts)
         .def("testNDARRAY", &testNDARRAY)
         .staticmethod("testNDARRAY")
         .def("testNDARRAY2", &ndARRAYTest)
@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+/*Batches of fixed width queries (max_ngram_order vocabIDs each) are full of duplicates: padded unigrams, repeated contexts,
+  the same word under the same history. We sort them with an LSD radix sort, keep one copy of each and remember for every
+  original query which unique one it maps to, so that only the unique set needs to be scored.*/
+struct DedupedBatch {
+    std::vector<unsigned int> unique_queries; //Sorted lexicographically, width vocabIDs each
+    std::vector<size_t> positions; //For every original query, the index of its unique query
+
+    size_t numUnique(unsigned short width) const {
+        return unique_queries.size()/width;
+    }
+};
+
+#define RADIX_DIGIT_BITS 11
+
+/*Returns the permutation that sorts the queries lexicographically, first word being the most significant. The sort is stable.
+  Only the first key_width words of every query take part in the sort, by default all of them.*/
+inline std::vector<size_t> radixSortQueries(const unsigned int * queries, size_t num_queries, unsigned short width, unsigned short key_width = 0) {
+    if (key_width == 0 || key_width > width) {
+        key_width = width;
+    }
+    std::vector<size_t> order(num_queries);
+    for (size_t i = 0; i < num_queries; i++) {
+        order[i] = i;
+    }
+    if (num_queries < 2) {
+        return order;
+    }
+
+    //Only sort as many bits as the largest vocabID needs.
+    unsigned int max_id = 0;
+    for (size_t i = 0; i < num_queries; i++) {
+        for (unsigned short word = 0; word < key_width; word++) {
+            if (queries[i*width + word] > max_id) {
+                max_id = queries[i*width + word];
+            }
+        }
+    }
+    unsigned int bits = 0;
+    while (bits < 32 && (max_id >> bits) != 0) {
+        bits++;
+    }
+
+    const size_t num_buckets = 1 << RADIX_DIGIT_BITS;
+    const unsigned int digit_mask = num_buckets - 1;
+    std::vector<size_t> tmp(num_queries);
+    std::vector<size_t> histogram(num_buckets);
+
+    //Least significant word first
+    for (int word = key_width - 1; word >= 0; word--) {
+        for (unsigned int shift = 0; shift < bits; shift += RADIX_DIGIT_BITS) {
+            std::fill(histogram.begin(), histogram.end(), 0);
+            for (size_t i = 0; i < num_queries; i++) {
+                histogram[(queries[order[i]*width + word] >> shift) & digit_mask]++;
+            }
+            //Skip passes where every query has the same digit. Very common with zero padding.
+            if (histogram[(queries[order[0]*width + word] >> shift) & digit_mask] == num_queries) {
+                continue;
+            }
+            size_t sum = 0;
+            for (size_t b = 0; b < num_buckets; b++) {
+                size_t count = histogram[b];
+                histogram[b] = sum;
+                sum += count;
+            }
+            for (size_t i = 0; i < num_queries; i++) {
+                size_t digit = (queries[order[i]*width + word] >> shift) & digit_mask;
+                tmp[histogram[digit]++] = order[i];
+            }
+            order.swap(tmp);
+        }
+    }
+    return order;
+}
+
+inline void dedupQueries(const unsigned int * queries, size_t num_queries, unsigned short width, DedupedBatch& batch) {
+    std::vector<size_t> order = radixSortQueries(queries, num_queries, width);
+
+    batch.unique_queries.clear();
+    batch.positions.resize(num_queries);
+    size_t num_unique = 0;
+    for (size_t i = 0; i < num_queries; i++) {
+        const unsigned int * query = &queries[order[i]*width];
+        if (num_unique == 0 || std::memcmp(&batch.unique_queries[(num_unique - 1)*width], query, width*sizeof(unsigned int)) != 0) {
+            batch.unique_queries.insert(batch.unique_queries.end(), query, query + width);
+            num_unique++;
+        }
+        batch.positions[order[i]] = num_unique - 1;
+    }
+}
+
+//Writes the result of every unique query back to all the original positions it came from.
+template<class T>
+void scatterResults(const T * unique_results, const DedupedBatch& batch, T * results) {
+    for (size_t i = 0; i < batch.positions.size(); i++) {
+        results[i] = unique_results[batch.positions[i]];
+    }
+}
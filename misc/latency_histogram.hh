@@ -0,0 +1,236 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+/*Log bucketed histogram of latencies in nanoseconds, in the style of HdrHistogram: values below 128 get a bucket each, above that
+  every power of two is split in 64 linear sub-buckets, so a recorded value is known within 1/64 (1.6%) of itself over the whole
+  uint64 range, in 3776 buckets. Recording is a few shifts and one increment. Counts are atomics written only by their owning thread
+  with relaxed loads and stores, so recording costs no more than a plain increment and a report can read them while threads record.*/
+class LatencyHistogram {
+    private:
+        static const unsigned int SUB_BUCKET_BITS = 6;
+        static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const unsigned int LINEAR_VALUES = 2*SUB_BUCKETS;
+
+        std::vector<std::atomic<uint64_t> > counts;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max_value;
+
+        static void add(std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+    public:
+        static const unsigned int NUM_BUCKETS = LINEAR_VALUES + (64 - SUB_BUCKET_BITS - 1)*SUB_BUCKETS;
+
+        LatencyHistogram() : counts(NUM_BUCKETS), total(0), sum(0), max_value(0) {
+            for (std::atomic<uint64_t>& count : counts) {
+                count.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        static unsigned int bucketOf(uint64_t value) {
+            if (value < LINEAR_VALUES) {
+                return value;
+            }
+            unsigned int magnitude = 63 - __builtin_clzll(value); //At least SUB_BUCKET_BITS + 1
+            unsigned int shift = magnitude - SUB_BUCKET_BITS;
+            return LINEAR_VALUES + (magnitude - SUB_BUCKET_BITS - 1)*SUB_BUCKETS + (unsigned int)((value >> shift) - SUB_BUCKETS);
+        }
+
+        //The largest value that falls in the bucket
+        static uint64_t bucketUpperBound(unsigned int bucket) {
+            if (bucket < LINEAR_VALUES) {
+                return bucket;
+            }
+            unsigned int shift = (bucket - LINEAR_VALUES)/SUB_BUCKETS + 1;
+            uint64_t sub_bucket = (bucket - LINEAR_VALUES) % SUB_BUCKETS + SUB_BUCKETS;
+            return ((sub_bucket + 1) << shift) - 1;
+        }
+
+        //Not thread safe with other writers: every thread records into its own histogram, see LatencyRecorder.
+        void record(uint64_t nanoseconds) {
+            add(counts[bucketOf(nanoseconds)], 1);
+            add(total, 1);
+            add(sum, nanoseconds);
+            if (nanoseconds > max_value.load(std::memory_order_relaxed)) {
+                max_value.store(nanoseconds, std::memory_order_relaxed);
+            }
+        }
+
+        void merge(const LatencyHistogram& other) {
+            for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
+                add(counts[i], other.counts[i].load(std::memory_order_relaxed));
+            }
+            add(total, other.total.load(std::memory_order_relaxed));
+            add(sum, other.sum.load(std::memory_order_relaxed));
+            uint64_t other_max = other.max_value.load(std::memory_order_relaxed);
+            if (other_max > max_value.load(std::memory_order_relaxed)) {
+                max_value.store(other_max, std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t count() const {
+            return total.load(std::memory_order_relaxed);
+        }
+        uint64_t max() const {
+            return max_value.load(std::memory_order_relaxed);
+        }
+        double mean() const {
+            uint64_t recorded = count();
+            return recorded ? (double)sum.load(std::memory_order_relaxed)/recorded : 0;
+        }
+
+        //The smallest bucket bound that at least percentile % of the values are at or below, capped by the largest value.
+        uint64_t percentile(double percentile) const {
+            uint64_t recorded = count();
+            if (recorded == 0) {
+                return 0;
+            }
+            uint64_t rank = std::max<uint64_t>((uint64_t)std::ceil(percentile/100*recorded), 1);
+            uint64_t seen = 0;
+            for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
+                seen += counts[i].load(std::memory_order_relaxed);
+                if (seen >= rank) {
+                    return std::min(bucketUpperBound(i), max());
+                }
+            }
+            return max();
+        }
+};
+
+struct LatencySummary {
+    std::string name;
+    uint64_t count;
+    double seconds; //Wall time the requests were recorded over
+    double mean_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+
+    double throughput() const {
+        return seconds > 0 ? count/seconds : 0;
+    }
+
+    void print(std::ostream& out) const {
+        out << name << ": " << count << " requests, " << throughput() << " per second, latency (us) mean " << mean_ns/1000
+        << " p50 " << p50_ns/1000.0 << " p90 " << p90_ns/1000.0 << " p99 " << p99_ns/1000.0 << " p99.9 " << p999_ns/1000.0
+        << " max " << max_ns/1000.0 << std::endl;
+    }
+
+    void writeJSON(std::ostream& out) const {
+        out << "{\"name\": \"" << name << "\", \"count\": " << count << ", \"seconds\": " << seconds << ", \"throughput\": "
+        << throughput() << ", \"latency_ns\": {\"mean\": " << mean_ns << ", \"p50\": " << p50_ns << ", \"p90\": " << p90_ns
+        << ", \"p99\": " << p99_ns << ", \"p99.9\": " << p999_ns << ", \"max\": " << max_ns << "}}";
+    }
+};
+
+/*Latencies of one kind of request, recorded from any number of threads. Every thread records into a histogram of its own, found
+  through a thread local cache, and a summary merges them. Recorders get an ID that is never reused, so a cache entry of a destroyed
+  recorder can't be mistaken for a new one. Throughput is over the wall time since construction or the last reset.*/
+class LatencyRecorder {
+    private:
+        std::mutex lock; //Guards the list of per thread histograms
+        std::vector<std::unique_ptr<LatencyHistogram> > histograms;
+        uint64_t id;
+        std::chrono::time_point<std::chrono::steady_clock> start;
+
+        static uint64_t nextID() {
+            static std::atomic<uint64_t> next(1);
+            return next++;
+        }
+
+        LatencyHistogram& local() {
+            thread_local std::vector<std::pair<uint64_t, LatencyHistogram *> > cache;
+            for (std::pair<uint64_t, LatencyHistogram *>& entry : cache) {
+                if (entry.first == id) {
+                    return *entry.second;
+                }
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            histograms.push_back(std::unique_ptr<LatencyHistogram>(new LatencyHistogram()));
+            cache.push_back(std::make_pair(id, histograms.back().get()));
+            return *histograms.back();
+        }
+
+    public:
+        std::string name;
+
+        explicit LatencyRecorder(const std::string& name_) : id(nextID()), start(std::chrono::steady_clock::now()), name(name_) {}
+        LatencyRecorder(const LatencyRecorder&) = delete;
+        LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+        void record(uint64_t nanoseconds) {
+            local().record(nanoseconds);
+        }
+
+        //Drops what was recorded. Threads may not be recording while this runs.
+        void reset() {
+            std::lock_guard<std::mutex> guard(lock);
+            histograms.clear();
+            id = nextID();
+            start = std::chrono::steady_clock::now();
+        }
+
+        void merged(LatencyHistogram& all) {
+            std::lock_guard<std::mutex> guard(lock);
+            for (std::unique_ptr<LatencyHistogram>& histogram : histograms) {
+                all.merge(*histogram);
+            }
+        }
+
+        LatencySummary summary() {
+            LatencyHistogram all;
+            merged(all);
+            LatencySummary result = {name, all.count(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                all.mean(), all.percentile(50), all.percentile(90), all.percentile(99), all.percentile(99.9), all.max()};
+            return result;
+        }
+};
+
+//Records the time from construction to destruction, if there is a recorder.
+class ScopedLatency {
+    private:
+        LatencyRecorder * recorder;
+        std::chrono::time_point<std::chrono::steady_clock> start;
+
+    public:
+        explicit ScopedLatency(LatencyRecorder * recorder_) : recorder(recorder_) {
+            if (recorder) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~ScopedLatency() {
+            if (recorder) {
+                recorder->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+};
+
+//Summaries as a JSON array, to a file.
+inline void writeLatencyJSON(const std::vector<LatencySummary>& summaries, const std::string& path) {
+    std::ofstream out(path);
+    if (out.fail()) {
+        std::cerr << "Failed to open file " << path << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    out << "{\"latencies\": [";
+    for (size_t i = 0; i < summaries.size(); i++) {
+        out << (i ? ",\n  " : "\n  ");
+        summaries[i].writeJSON(out);
+    }
+    out << "\n]}\n";
+}
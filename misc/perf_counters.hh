@@ -0,0 +1,252 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+/*Hardware performance counters around the phases of a tool (binarize, load, query preparation, search), normalized per query, so
+  that a slowdown can be told apart as cache, TLB or branch bound. Counters come from perf_event_open, for user space only, this
+  thread and the threads it creates afterwards. Every event is opened on its own, so an event the CPU or the hypervisor doesn't
+  have only drops that column; without perf_event_open at all (other OSes, containers, perf_event_paranoid > 2) the phases are
+  still timed. The tools turn this on when the environment variable GLM_PERF_COUNTERS is set.*/
+
+enum PerfEvent {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES, PERF_NUM_EVENTS};
+
+inline const char * perfEventName(int event) {
+    static const char * names[PERF_NUM_EVENTS] = {"cycles", "instructions", "LLC-misses", "dTLB-misses", "branch-misses"};
+    return names[event];
+}
+
+inline bool perfCountersRequested() {
+    const char * env = std::getenv("GLM_PERF_COUNTERS");
+    return env && std::strcmp(env, "0") != 0;
+}
+
+struct PerfSample {
+    uint64_t values[PERF_NUM_EVENTS] = {0};
+    bool valid[PERF_NUM_EVENTS] = {false};
+    double seconds = 0;
+};
+
+class PerfCounters {
+    private:
+        int fds[PERF_NUM_EVENTS];
+        uint64_t start_values[PERF_NUM_EVENTS];
+        uint64_t start_enabled[PERF_NUM_EVENTS];
+        uint64_t start_running[PERF_NUM_EVENTS];
+        std::chrono::time_point<std::chrono::steady_clock> start_time;
+
+#ifdef __linux__
+        static int openEvent(int event) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            switch (event) {
+                case PERF_CYCLES:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                    break;
+                case PERF_INSTRUCTIONS:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                    break;
+                case PERF_LLC_MISSES:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                    break;
+                case PERF_DTLB_MISSES:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                    break;
+                default:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            }
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1; //Worker threads started after this
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+        //Value, time enabled and time running of the event
+        bool readEvent(int event, uint64_t (&data)[3]) const {
+            return fds[event] >= 0 && read(fds[event], data, sizeof(data)) == sizeof(data);
+        }
+#endif
+
+    public:
+        PerfCounters(bool enabled = true) {
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                fds[event] = -1;
+#ifdef __linux__
+                if (enabled) {
+                    fds[event] = openEvent(event);
+                }
+#endif
+            }
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters() {
+#ifdef __linux__
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                if (fds[event] >= 0) {
+                    close(fds[event]);
+                }
+            }
+#endif
+        }
+
+        bool available(int event) const {
+            return fds[event] >= 0;
+        }
+
+        bool anyAvailable() const {
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                if (available(event)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //The counters keep running, start and stop only take readings.
+        void start() {
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                start_values[event] = start_enabled[event] = start_running[event] = 0;
+#ifdef __linux__
+                uint64_t data[3];
+                if (readEvent(event, data)) {
+                    start_values[event] = data[0];
+                    start_enabled[event] = data[1];
+                    start_running[event] = data[2];
+                }
+#endif
+            }
+            start_time = std::chrono::steady_clock::now();
+        }
+
+        /*Counts since start(). When there are more events than hardware counters the kernel time multiplexes them, then the count is
+          scaled by the time the event was enabled over the time it was counting.*/
+        PerfSample stop() {
+            PerfSample sample;
+            sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+#ifdef __linux__
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                uint64_t data[3];
+                if (!readEvent(event, data)) {
+                    continue;
+                }
+                uint64_t value = data[0] - start_values[event];
+                uint64_t enabled = data[1] - start_enabled[event];
+                uint64_t running = data[2] - start_running[event];
+                if (running == 0) {
+                    //Never scheduled on a counter, no reading rather than a zero one
+                    continue;
+                }
+                sample.values[event] = (running < enabled) ? (uint64_t)((double)value*enabled/running) : value;
+                sample.valid[event] = true;
+            }
+#endif
+            return sample;
+        }
+};
+
+struct PhaseSample {
+    std::string name;
+    size_t num_queries;
+    PerfSample sample;
+};
+
+/*The phases of one run, in order. begin() and end() bracket a phase, which is timed always and counted when counters were asked for.
+  Counters opened in the constructor also follow the threads started later, like the search workers, but a thread's counts only
+  reach its parent once the thread exits, so a phase with worker threads should end after they are joined.*/
+class PerfProfile {
+    private:
+        PerfCounters counters;
+        bool enabled;
+        std::string current;
+
+    public:
+        std::vector<PhaseSample> phases;
+
+        explicit PerfProfile(bool enabled_ = perfCountersRequested()) : counters(enabled_), enabled(enabled_) {
+            if (enabled && !counters.anyAvailable()) {
+                std::cerr << "Hardware performance counters are unavailable (see /proc/sys/kernel/perf_event_paranoid), "
+                << "only timing the phases." << std::endl;
+            }
+        }
+
+        bool countersEnabled() const {
+            return enabled;
+        }
+
+        void begin(const std::string& phase) {
+            current = phase;
+            counters.start();
+        }
+
+        //num_queries is what the per query figures are divided by, 0 for phases that aren't about queries.
+        const PhaseSample& end(size_t num_queries = 0) {
+            PhaseSample phase = {current, num_queries, counters.stop()};
+            phases.push_back(phase);
+            return phases.back();
+        }
+
+        //A table of the phases: totals, IPC, and per query counts where the phase has queries. n/a marks an unavailable event.
+        void report(std::ostream& out) const {
+            if (!enabled) {
+                return;
+            }
+            std::ios::fmtflags flags = out.flags();
+            out << std::left << std::setw(14) << "phase" << std::right << std::setw(12) << "seconds" << std::setw(12) << "queries";
+            for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                out << std::setw(16) << perfEventName(event);
+            }
+            out << std::setw(8) << "IPC" << std::endl;
+            for (const PhaseSample& phase : phases) {
+                const PerfSample& sample = phase.sample;
+                out << std::left << std::setw(14) << phase.name << std::right << std::fixed << std::setprecision(4) << std::setw(12)
+                << sample.seconds << std::setw(12) << phase.num_queries;
+                for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                    if (sample.valid[event]) {
+                        out << std::setw(16) << sample.values[event];
+                    } else {
+                        out << std::setw(16) << "n/a";
+                    }
+                }
+                if (sample.valid[PERF_CYCLES] && sample.valid[PERF_INSTRUCTIONS] && sample.values[PERF_CYCLES]) {
+                    out << std::setw(8) << std::setprecision(2) << (double)sample.values[PERF_INSTRUCTIONS]/sample.values[PERF_CYCLES];
+                } else {
+                    out << std::setw(8) << "n/a";
+                }
+                out << std::endl;
+                if (phase.num_queries) {
+                    out << std::left << std::setw(14) << "  per query" << std::right << std::setprecision(1) << std::setw(12)
+                    << sample.seconds*1e9/phase.num_queries << std::setw(12) << "ns";
+                    for (int event = 0; event < PERF_NUM_EVENTS; event++) {
+                        if (sample.valid[event]) {
+                            out << std::setw(16) << (double)sample.values[event]/phase.num_queries;
+                        } else {
+                            out << std::setw(16) << "n/a";
+                        }
+                    }
+                    out << std::endl;
+                }
+            }
+            out.flags(flags);
+        }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+/*Scoped spans written as Chrome trace JSON (chrome://tracing, ui.perfetto.dev), one timeline row per thread. Tracing is compiled in
+  only with GLM_TRACING defined (cmake -DTRACING=1). Without it the macros expand to nothing, so instrumented code costs nothing.
+    GLM_TRACE_SPAN("name");                  //Spans the rest of the enclosing scope
+    GLM_TRACE_SPAN_ARG("name", "order", n);  //Same, with an integer argument shown on the span
+    GLM_TRACE_WRITE();                       //Writes every span so far to $GLM_TRACE_FILE, or glm_trace.json
+  Names and argument names must be string literals, spans keep the pointers. Every thread appends to a buffer of its own, so spans
+  only contend when the trace is written.*/
+
+#ifdef GLM_TRACING
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+
+struct TraceEvent {
+    const char * name;
+    const char * arg_name; //nullptr if the span has no argument
+    int64_t arg_value;
+    double start_us;
+    double duration_us;
+};
+
+class TraceCollector {
+    private:
+        struct ThreadBuffer {
+            std::mutex lock; //Only contended while writing the trace
+            unsigned int tid;
+            std::vector<TraceEvent> events;
+        };
+        std::mutex lock; //Guards the list of buffers
+        std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+        std::chrono::time_point<std::chrono::steady_clock> start;
+
+        TraceCollector() : start(std::chrono::steady_clock::now()) {}
+
+        ThreadBuffer& local() {
+            thread_local ThreadBuffer * buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard<std::mutex> guard(lock);
+                buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+                buffers.back()->tid = buffers.size();
+                buffer = buffers.back().get();
+            }
+            return *buffer;
+        }
+
+    public:
+        static TraceCollector& instance() {
+            static TraceCollector collector;
+            return collector;
+        }
+
+        double now() const {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void add(const TraceEvent& event) {
+            ThreadBuffer& buffer = local();
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            buffer.events.push_back(event);
+        }
+
+        void write(std::ostream& out) {
+            std::lock_guard<std::mutex> guard(lock);
+            out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+            bool first = true;
+            for (std::unique_ptr<ThreadBuffer>& buffer : buffers) {
+                std::lock_guard<std::mutex> buffer_guard(buffer->lock);
+                out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+                << ", \"args\": {\"name\": \"thread " << buffer->tid << "\"}}";
+                first = false;
+                for (const TraceEvent& event : buffer->events) {
+                    out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": "
+                    << event.start_us << ", \"dur\": " << event.duration_us;
+                    if (event.arg_name) {
+                        out << ", \"args\": {\"" << event.arg_name << "\": " << event.arg_value << "}";
+                    }
+                    out << "}";
+                }
+            }
+            out << "\n]}\n";
+        }
+
+        void write() {
+            const char * path = std::getenv("GLM_TRACE_FILE");
+            std::string file = path ? path : "glm_trace.json";
+            std::ofstream out(file);
+            if (out.fail()) {
+                std::cerr << "Failed to open file " << file << std::endl;
+                return;
+            }
+            write(out);
+            std::cerr << "Wrote the trace to " << file << std::endl;
+        }
+};
+
+class ScopedTraceSpan {
+    private:
+        TraceEvent event;
+
+    public:
+        explicit ScopedTraceSpan(const char * name, const char * arg_name = nullptr, int64_t arg_value = 0) {
+            event.name = name;
+            event.arg_name = arg_name;
+            event.arg_value = arg_value;
+            event.start_us = TraceCollector::instance().now();
+        }
+        ~ScopedTraceSpan() {
+            event.duration_us = TraceCollector::instance().now() - event.start_us;
+            TraceCollector::instance().add(event);
+        }
+};
+
+#define GLM_TRACE_CONCAT_(a, b) a##b
+#define GLM_TRACE_CONCAT(a, b) GLM_TRACE_CONCAT_(a, b)
+#define GLM_TRACE_SPAN(name) ScopedTraceSpan GLM_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define GLM_TRACE_SPAN_ARG(name, arg_name, arg_value) ScopedTraceSpan GLM_TRACE_CONCAT(trace_span_, __LINE__)(name, arg_name, arg_value)
+#define GLM_TRACE_WRITE() TraceCollector::instance().write()
+
+#else
+
+#define GLM_TRACE_SPAN(name)
+#define GLM_TRACE_SPAN_ARG(name, arg_name, arg_value)
+#define GLM_TRACE_WRITE()
+
+#endif